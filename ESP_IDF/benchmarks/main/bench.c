@@ -0,0 +1,126 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#else
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_app_desc.h"
+#endif
+
+static bench_case_t current;
+
+// Cycles are 32 bits, past this an iteration is timed with esp_timer alone
+#define BENCH_CYCLES_MAX_US 10000000
+
+void bench_csv_begin(void)
+{
+    printf("BENCH_CSV_BEGIN\n");
+    printf("target,app,group,case,n,min_us,p50_us,mean_us,max_us,p50_cycles,bytes,error\n");
+}
+
+void bench_csv_end(void)
+{
+    printf("BENCH_CSV_END\n");
+}
+
+bench_case_t *bench_begin(const char *group, const char *name)
+{
+    bench_case_t *c = &current;
+    c->group = group;
+    c->name = name;
+    c->n = 0;
+    c->bytes = -1;
+    c->error = ESP_OK;
+    return c;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+// No cycle counter on the host, the monotonic clock has ns resolution
+static int64_t host_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_start(bench_case_t *c)
+{
+    c->start_us = host_ns();
+}
+
+void bench_stop(bench_case_t *c)
+{
+    int64_t ns = host_ns() - c->start_us;
+    if (c->n < BENCH_ITERATIONS_MAX)
+        c->ns[c->n++] = ns;
+}
+#else
+void bench_start(bench_case_t *c)
+{
+    c->start_us = esp_timer_get_time();
+    c->start_cycles = esp_cpu_get_cycle_count();
+}
+
+void bench_stop(bench_case_t *c)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count() - c->start_cycles;
+    int64_t us = esp_timer_get_time() - c->start_us;
+    if (c->n == BENCH_ITERATIONS_MAX)
+        return;
+    // The bench task is pinned, so both stamps come from the same core's counter
+    c->ns[c->n++] = us < BENCH_CYCLES_MAX_US ? (int64_t)cycles * 1000 / esp_rom_get_cpu_ticks_per_us() : us * 1000;
+}
+#endif
+
+void bench_set_bytes(bench_case_t *c, int bytes)
+{
+    c->bytes = bytes;
+}
+
+void bench_fail(bench_case_t *c, esp_err_t err)
+{
+    c->error = err;
+    c->n = 0;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void bench_end(bench_case_t *c)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    const char *app = "host";
+#else
+    const char *app = esp_app_get_description()->version;
+#endif
+    printf("%s,%s,%s,%s,%d,", CONFIG_IDF_TARGET, app, c->group, c->name, c->n);
+    if (c->n == 0)
+    {
+        printf(",,,,,,%s\n", c->error != ESP_OK ? esp_err_to_name(c->error) : "no iterations");
+        return;
+    }
+
+    qsort(c->ns, c->n, sizeof(c->ns[0]), compare_ns);
+    int64_t sum = 0;
+    for (int i = 0; i < c->n; i++)
+        sum += c->ns[i];
+    int64_t p50 = c->ns[c->n / 2];
+    printf("%.3f,%.3f,%.3f,%.3f,", c->ns[0] / 1000.0, p50 / 1000.0, (double)sum / c->n / 1000.0,
+           c->ns[c->n - 1] / 1000.0);
+#if CONFIG_IDF_TARGET_LINUX
+    printf(",");
+#else
+    printf("%lld,", (long long)(p50 * esp_rom_get_cpu_ticks_per_us() / 1000));
+#endif
+    if (c->bytes >= 0)
+        printf("%d", c->bytes);
+    printf(",\n");
+}
@@ -0,0 +1,60 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Microbenchmarks of the firmware hot paths. Each case times every
+// iteration on its own and is summarised as one CSV row, between
+// BENCH_CSV_BEGIN and BENCH_CSV_END lines on the console:
+//
+//   target,app,group,case,n,min_us,p50_us,mean_us,max_us,p50_cycles,bytes,error
+//
+// p50_cycles is empty on the linux target, bytes is the payload or response
+// size where there is one. A case that failed has n = 0 and the error name.
+// tools/bench_compare.py checks a run against a baseline.
+//
+//   bench_case_t *c = bench_begin("json", "telemetry_encode_fixed");
+//   for (int i = 0; i < 200; i++) {
+//       bench_start(c);
+//       len = telemetry_json_encode(...);
+//       bench_stop(c);
+//   }
+//   bench_set_bytes(c, len);
+//   bench_end(c);
+
+#define BENCH_ITERATIONS_MAX 512
+#define BENCH_TASK_STACK 8192
+#define BENCH_TASK_PRIO 5
+
+typedef struct {
+    const char *group;
+    const char *name;
+    int n;
+    int bytes;                  // -1 = none
+    esp_err_t error;
+    int64_t start_us;           // ns on the linux target
+    uint32_t start_cycles;
+    int64_t ns[BENCH_ITERATIONS_MAX];
+} bench_case_t;
+
+void bench_csv_begin(void);
+void bench_csv_end(void);
+
+/* The one case being measured, cases don't nest */
+bench_case_t *bench_begin(const char *group, const char *name);
+void bench_start(bench_case_t *c);
+void bench_stop(bench_case_t *c);
+void bench_set_bytes(bench_case_t *c, int bytes);
+/* Drop what was measured, the row reports the error instead */
+void bench_fail(bench_case_t *c, esp_err_t err);
+/* Print the row */
+void bench_end(bench_case_t *c);
+
+// Suites, each prints its rows
+void bench_json_run(void);
+void bench_net_run(void);
+void bench_io_run(void);
+
+#endif // BENCH_H
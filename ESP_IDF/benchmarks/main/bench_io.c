@@ -0,0 +1,129 @@
+#include "bench.h"
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "dht.h"
+#include "bh1750.h"
+#include "shadow.h"
+
+// Wired as for the firmware, see its main.c
+#define I2C_SDA GPIO_NUM_21
+#define I2C_SCK GPIO_NUM_22
+#define DHT_TYPE DHT_TYPE_AM2301
+#define DHT_GPIO GPIO_NUM_4
+#define OUTPUT_GPIO GPIO_NUM_2          // button1
+
+// The AM2301 needs 2 s between reads
+#define DHT_ITERATIONS 5
+#define DHT_PERIOD_MS 2500
+#define BH1750_ITERATIONS 50
+#define BH1750_MEASURE_MS 180           // first continuous high resolution result
+#define GPIO_ITERATIONS 200
+#define GPIO_SPINS_MAX 1000            // readbacks before the level counts as not applied
+
+/* Read in tenths, as dht_task does */
+static void bench_dht(void)
+{
+    bench_case_t *c = bench_begin("sensor", "dht_read");
+    for (int i = 0; i < DHT_ITERATIONS; i++)
+    {
+        int16_t humidity, temp;
+        vTaskDelay(pdMS_TO_TICKS(DHT_PERIOD_MS));
+        bench_start(c);
+        esp_err_t err = dht_read_data(DHT_TYPE, DHT_GPIO, &humidity, &temp);
+        bench_stop(c);
+        if (err != ESP_OK)
+        {
+            bench_fail(c, err);
+            break;
+        }
+    }
+    bench_end(c);
+}
+
+static void bench_bh1750(void)
+{
+    bench_case_t *c = bench_begin("sensor", "bh1750_read");
+    i2c_dev_t dev = { 0 };
+    esp_err_t err = i2cdev_init();
+    if (err == ESP_OK)
+        err = bh1750_init_desc(&dev, BH1750_ADDR_LO, 0, I2C_SDA, I2C_SCK);
+    if (err == ESP_OK)
+        err = bh1750_setup(&dev, BH1750_MODE_CONTINUOUS, BH1750_RES_HIGH);
+    if (err != ESP_OK)
+    {
+        bench_fail(c, err);
+        bench_end(c);
+        return;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(BH1750_MEASURE_MS));
+    for (int i = 0; i < BH1750_ITERATIONS; i++)
+    {
+        uint16_t lux;
+        bench_start(c);
+        err = bh1750_read(&dev, &lux);
+        bench_stop(c);
+        if (err != ESP_OK)
+        {
+            bench_fail(c, err);
+            break;
+        }
+        vTaskDelay(1);
+    }
+    bench_end(c);
+    bh1750_free_desc(&dev);
+}
+
+static void bench_gpio(void)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << OUTPUT_GPIO,
+        .mode = GPIO_MODE_INPUT_OUTPUT,
+    };
+    esp_err_t err = gpio_config(&io_conf);
+
+    bench_case_t *c = bench_begin("gpio", "set_level");
+    for (int i = 0; err == ESP_OK && i < GPIO_ITERATIONS; i++)
+    {
+        bench_start(c);
+        gpio_set_level(OUTPUT_GPIO, i & 1);
+        bench_stop(c);
+    }
+    if (err != ESP_OK)
+        bench_fail(c, err);
+    bench_end(c);
+
+    // A desired document to the pin reading back its new level, the
+    // firmware's path for a streamed command minus the network. Versions
+    // start past the JSON suite's so every document applies.
+    c = bench_begin("gpio", "apply_command");
+    char doc[96];
+    int64_t version = shadow_field(0)->version;
+    for (int i = 0; err == ESP_OK && i < GPIO_ITERATIONS; i++)
+    {
+        int value = !(i & 1);
+        snprintf(doc, sizeof(doc), "{\"button1\":{\"value\":%d,\"version\":%lld}}", value,
+                 (long long)(version + 1 + i));
+        bench_start(c);
+        if (shadow_merge_desired(doc) & 1)
+            gpio_set_level(OUTPUT_GPIO, shadow_field(0)->value);
+        int spins = 0;
+        while (gpio_get_level(OUTPUT_GPIO) != value && ++spins < GPIO_SPINS_MAX)
+            ;
+        bench_stop(c);
+        if (spins == GPIO_SPINS_MAX)
+            err = ESP_ERR_TIMEOUT;
+    }
+    if (err != ESP_OK)
+        bench_fail(c, err);
+    bench_end(c);
+}
+
+void bench_io_run(void)
+{
+    bench_gpio();
+    bench_bh1750();
+    bench_dht();
+}
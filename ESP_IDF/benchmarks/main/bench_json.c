@@ -0,0 +1,175 @@
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include "cJSON.h"
+#include "telemetry_cbor.h"
+#include "telemetry_fixed.h"
+#include "shadow.h"
+
+#define JSON_ITERATIONS 200
+
+// The DHT sample as the firmware sends it, in the channels' fixed point
+static const telemetry_reading_t dht_sample[] = {
+    { TELEMETRY_CH_TEMPERATURE, 2340 },
+    { TELEMETRY_CH_HUMIDITY, 510 },
+};
+#define DHT_SAMPLE_COUNT (int)(sizeof(dht_sample) / sizeof(dht_sample[0]))
+
+// A command_queue/<id> batch as the board takes it, four pushes
+static const char command_batch[] =
+    "{\"-NqA1\":{\"field\":\"button1\",\"value\":1,\"version\":1718000000001,\"seq\":11,\"sent_at\":1718000000000},"
+    "\"-NqA2\":{\"field\":\"button2\",\"value\":0,\"version\":1718000000002,\"seq\":12,\"sent_at\":1718000000001},"
+    "\"-NqA3\":{\"field\":\"button3\",\"value\":1,\"version\":1718000000003,\"seq\":13,\"sent_at\":1718000000002},"
+    "\"-NqA4\":{\"field\":\"button1\",\"value\":0,\"version\":1718000000004,\"seq\":14,\"sent_at\":1718000000003}}";
+
+/* The path samples took before they were fixed point: doubles into cJSON */
+static void bench_telemetry_cjson(void)
+{
+    bench_case_t *c = bench_begin("json", "telemetry_encode_cjson");
+    int len = 0;
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        bench_start(c);
+        cJSON *json = cJSON_CreateObject();
+        for (int r = 0; r < DHT_SAMPLE_COUNT; r++)
+            cJSON_AddNumberToObject(json, telemetry_channel_name(dht_sample[r].channel),
+                                    telemetry_fixed_to_double(dht_sample[r].value,
+                                                              telemetry_channel_decimals(dht_sample[r].channel)));
+        char *data = cJSON_PrintUnformatted(json);
+        bench_stop(c);
+        len = data ? (int)strlen(data) : -1;
+        cJSON_free(data);
+        cJSON_Delete(json);
+        if (len < 0)
+        {
+            bench_fail(c, ESP_ERR_NO_MEM);
+            break;
+        }
+    }
+    bench_set_bytes(c, len);
+    bench_end(c);
+}
+
+static void bench_telemetry_fixed(void)
+{
+    bench_case_t *c = bench_begin("json", "telemetry_encode_fixed");
+    char buf[TELEMETRY_JSON_MAX];
+    int len = 0;
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        bench_start(c);
+        len = telemetry_json_encode(buf, sizeof(buf), dht_sample, DHT_SAMPLE_COUNT);
+        bench_stop(c);
+    }
+    bench_set_bytes(c, len);
+    bench_end(c);
+}
+
+static void bench_telemetry_cbor(void)
+{
+    uint8_t buf[TELEMETRY_CBOR_MAX];
+    int len = 0;
+    bench_case_t *c = bench_begin("json", "telemetry_encode_cbor");
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        bench_start(c);
+        len = telemetry_cbor_encode(buf, sizeof(buf), -1, dht_sample, DHT_SAMPLE_COUNT);
+        bench_stop(c);
+    }
+    bench_set_bytes(c, len);
+    bench_end(c);
+
+    // What the gateway does with it
+    c = bench_begin("json", "telemetry_decode_cbor");
+    telemetry_reading_t readings[TELEMETRY_READINGS_MAX];
+    int64_t ts_ms;
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        bench_start(c);
+        int count = telemetry_cbor_decode(buf, len, &ts_ms, readings, TELEMETRY_READINGS_MAX);
+        bench_stop(c);
+        if (count != DHT_SAMPLE_COUNT)
+        {
+            bench_fail(c, ESP_ERR_INVALID_RESPONSE);
+            break;
+        }
+    }
+    bench_set_bytes(c, len);
+    bench_end(c);
+}
+
+/* A desired state document through the firmware's own shadow merge, each
+ * one newer so every field applies */
+static void bench_shadow_decode(void)
+{
+    bench_case_t *c = bench_begin("json", "shadow_decode");
+    char doc[256];
+    int len = 0;
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        long long version = 1718000000000LL + i;
+        len = snprintf(doc, sizeof(doc),
+                       "{\"button1\":{\"value\":%d,\"version\":%lld,\"seq\":%d,\"sent_at\":%lld},"
+                       "\"button2\":{\"value\":%d,\"version\":%lld},\"button3\":{\"value\":%d,\"version\":%lld}}",
+                       i & 1, version, i + 1, version - 5, (i >> 1) & 1, version, (i >> 2) & 1, version);
+        bench_start(c);
+        int changed = shadow_merge_desired(doc);
+        bench_stop(c);
+        if (changed != (1 << SHADOW_FIELD_COUNT) - 1)
+        {
+            bench_fail(c, ESP_ERR_INVALID_RESPONSE);
+            break;
+        }
+    }
+    bench_set_bytes(c, len);
+    bench_end(c);
+
+    c = bench_begin("json", "shadow_reported_encode");
+    char buf[64];
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        bench_start(c);
+        len = shadow_reported_json(i % SHADOW_FIELD_COUNT, buf, sizeof(buf));
+        bench_stop(c);
+    }
+    bench_set_bytes(c, len);
+    bench_end(c);
+}
+
+/* Parse and walk a command queue batch, as command_queue_take() does */
+static void bench_command_batch(void)
+{
+    bench_case_t *c = bench_begin("json", "command_batch_decode");
+    for (int i = 0; i < JSON_ITERATIONS; i++)
+    {
+        bench_start(c);
+        cJSON *json = cJSON_Parse(command_batch);
+        int count = 0;
+        cJSON *entry;
+        cJSON_ArrayForEach(entry, json)
+        {
+            const cJSON *field = cJSON_GetObjectItem(entry, "field");
+            const cJSON *value = cJSON_GetObjectItem(entry, "value");
+            if (cJSON_IsString(field) && shadow_field_index(field->valuestring) >= 0 && cJSON_IsNumber(value))
+                count++;
+        }
+        cJSON_Delete(json);
+        bench_stop(c);
+        if (count != 4)
+        {
+            bench_fail(c, json ? ESP_ERR_INVALID_RESPONSE : ESP_ERR_NO_MEM);
+            break;
+        }
+    }
+    bench_set_bytes(c, sizeof(command_batch) - 1);
+    bench_end(c);
+}
+
+void bench_json_run(void)
+{
+    bench_telemetry_cjson();
+    bench_telemetry_fixed();
+    bench_telemetry_cbor();
+    bench_shadow_decode();
+    bench_command_batch();
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "bench.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "nvs_flash.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "protocol_examples_common.h"
+#endif
+
+static const char *TAG = "BENCH";
+
+static void run_suites(bool online)
+{
+    bench_csv_begin();
+    bench_json_run();
+#if !CONFIG_IDF_TARGET_LINUX
+    bench_io_run();
+    if (online)
+        bench_net_run();
+#endif
+    bench_csv_end();
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+void app_main(void)
+{
+    // Host run, the encoders only, then the process ends for the caller
+    run_suites(false);
+    fflush(stdout);
+    exit(0);
+}
+#else
+static void bench_task(void *arg)
+{
+    run_suites((bool)(intptr_t)arg);
+    ESP_LOGI(TAG, "Done.");
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    // Without a network the TLS and HTTP rows are left out, the others still run
+    bool online = example_connect() == ESP_OK;
+    if (!online)
+        ESP_LOGW(TAG, "No network, skipping the TLS and HTTP benchmarks.");
+
+    // Pinned, the cycle counter of one core times each iteration
+    if (xTaskCreatePinnedToCore(bench_task, "Bench Task", BENCH_TASK_STACK, (void *)(intptr_t)online,
+                                BENCH_TASK_PRIO, NULL, xPortGetCoreID()) != pdPASS)
+        ESP_LOGE(TAG, "Failed to start the bench task.");
+}
+#endif
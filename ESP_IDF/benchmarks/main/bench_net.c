@@ -0,0 +1,159 @@
+#include "bench.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_tls.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+
+static const char *TAG_NET = "BENCH_NET";
+
+// The firmware's database, see FIREBASE_BASE_URL in the firmware's main.c.
+// Any status is a full round trip, the path needn't be readable.
+#define BENCH_HOST "https-start-617d7-default-rtdb.firebaseio.com"
+#define BENCH_URL "https://" BENCH_HOST "/bench.json"
+#define BENCH_TLS_PORT 443
+#define BENCH_TIMEOUT_MS 10000
+
+#define TLS_ITERATIONS 10
+#define HTTP_ITERATIONS 20
+
+/* TCP connect and handshake, with a saved session or without. The session
+ * the server hands out is kept for the next resumed one. */
+static esp_err_t tls_connect(esp_tls_client_session_t **session, bench_case_t *c)
+{
+    esp_tls_cfg_t cfg = {
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = BENCH_TIMEOUT_MS,
+        .client_session = *session,
+    };
+    esp_tls_t *tls = esp_tls_init();
+    if (tls == NULL)
+        return ESP_ERR_NO_MEM;
+
+    bench_start(c);
+    int ret = esp_tls_conn_new_sync(BENCH_HOST, strlen(BENCH_HOST), BENCH_TLS_PORT, &cfg, tls);
+    bench_stop(c);
+
+    if (ret == 1)
+    {
+        esp_tls_client_session_t *next = esp_tls_get_client_session(tls);
+        if (next)
+        {
+            if (*session)
+                esp_tls_free_client_session(*session);
+            *session = next;
+        }
+    }
+    esp_tls_conn_destroy(tls);
+    return ret == 1 ? ESP_OK : ESP_FAIL;
+}
+
+static void bench_tls(void)
+{
+    esp_tls_client_session_t *session = NULL;
+
+    bench_case_t *c = bench_begin("tls", "handshake_full");
+    for (int i = 0; i < TLS_ITERATIONS; i++)
+    {
+        // Each one starts without a session, the one it gets is thrown away
+        if (session)
+            esp_tls_free_client_session(session);
+        session = NULL;
+        esp_err_t err = tls_connect(&session, c);
+        if (err != ESP_OK)
+        {
+            bench_fail(c, err);
+            break;
+        }
+    }
+    bench_end(c);
+
+    c = bench_begin("tls", "handshake_resumed");
+    if (session == NULL)
+        bench_fail(c, ESP_ERR_NOT_SUPPORTED); // no ticket from the server, or tickets are off
+    for (int i = 0; session && i < TLS_ITERATIONS; i++)
+    {
+        esp_err_t err = tls_connect(&session, c);
+        if (err != ESP_OK)
+        {
+            bench_fail(c, err);
+            break;
+        }
+    }
+    bench_end(c);
+    if (session)
+        esp_tls_free_client_session(session);
+}
+
+static int response_len;
+
+static esp_err_t http_event(esp_http_client_event_t *evt)
+{
+    if (evt->event_id == HTTP_EVENT_ON_DATA)
+        response_len += evt->data_len;
+    return ESP_OK;
+}
+
+static esp_http_client_handle_t http_client(void)
+{
+    esp_http_client_config_t config = {
+        .url = BENCH_URL,
+        .event_handler = http_event,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = BENCH_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    return esp_http_client_init(&config);
+}
+
+/* One GET, the response is counted and dropped */
+static esp_err_t http_get(esp_http_client_handle_t client, bench_case_t *c)
+{
+    response_len = 0;
+    if (c)
+        bench_start(c);
+    esp_err_t err = esp_http_client_perform(client);
+    if (c)
+        bench_stop(c);
+    if (err == ESP_OK && c)
+        bench_set_bytes(c, response_len);
+    return err;
+}
+
+static void bench_http(void)
+{
+    // A client per request, DNS, TCP and a full handshake every time
+    bench_case_t *c = bench_begin("http", "request_cold");
+    for (int i = 0; i < HTTP_ITERATIONS; i++)
+    {
+        esp_http_client_handle_t client = http_client();
+        esp_err_t err = client ? http_get(client, c) : ESP_ERR_NO_MEM;
+        if (client)
+            esp_http_client_cleanup(client);
+        if (err != ESP_OK)
+        {
+            bench_fail(c, err);
+            break;
+        }
+    }
+    bench_end(c);
+
+    // One client, the connection set up by an untimed first request
+    c = bench_begin("http", "request_keepalive");
+    esp_http_client_handle_t client = http_client();
+    esp_err_t err = client ? http_get(client, NULL) : ESP_ERR_NO_MEM;
+    for (int i = 0; err == ESP_OK && i < HTTP_ITERATIONS; i++)
+        err = http_get(client, c);
+    if (err != ESP_OK)
+        bench_fail(c, err);
+    if (client)
+        esp_http_client_cleanup(client);
+    bench_end(c);
+}
+
+void bench_net_run(void)
+{
+    ESP_LOGI(TAG_NET, "Against %s", BENCH_HOST);
+    bench_tls();
+    bench_http();
+}
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Compare a benchmark run against a baseline.
+
+Both files are either the CSV the app prints or a whole console log with the
+CSV between its BENCH_CSV_BEGIN and BENCH_CSV_END lines. A case regresses when
+its p50 is more than the tolerance above the baseline's. A case that failed in
+the run, or that the run is missing, fails the comparison too.
+
+    tools/bench_compare.py baseline.csv run.log --tolerance 15
+    tools/bench_compare.py run.log --extract > baseline.csv
+
+Exits 0 when nothing regressed, 1 otherwise.
+"""
+
+import argparse
+import csv
+import io
+import sys
+
+BEGIN = "BENCH_CSV_BEGIN"
+END = "BENCH_CSV_END"
+
+
+def extract(text):
+    """The CSV lines of a log, or the text itself when it is already a CSV"""
+    lines = text.splitlines()
+    starts = [i for i, line in enumerate(lines) if line.strip().endswith(BEGIN)]
+    if not starts:
+        return [line for line in lines if line.strip()]
+    # The last run in the log, a board may have reset in between
+    out = []
+    for line in lines[starts[-1] + 1:]:
+        line = line.strip()
+        if line.endswith(END):
+            break
+        if line:
+            out.append(line)
+    return out
+
+
+def load(path):
+    with open(path, encoding="utf-8", errors="replace") as f:
+        lines = extract(f.read())
+    rows = {}
+    for row in csv.DictReader(io.StringIO("\n".join(lines))):
+        if row.get("group") and row.get("case"):
+            rows[(row["group"], row["case"])] = row
+    return lines, rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline", help="baseline CSV or log, or the run with --extract")
+    parser.add_argument("run", nargs="?", help="run CSV or log")
+    parser.add_argument("--tolerance", type=float, default=10.0,
+                        help="allowed p50 increase in percent (default 10)")
+    parser.add_argument("--min-us", type=float, default=1.0,
+                        help="absolute slack in us, for cases too fast for a percentage (default 1)")
+    parser.add_argument("--extract", action="store_true", help="print the CSV of a log and exit")
+    args = parser.parse_args()
+
+    if args.extract:
+        lines, _ = load(args.baseline)
+        print("\n".join(lines))
+        return 0
+    if args.run is None:
+        parser.error("the run to compare is missing")
+
+    _, base = load(args.baseline)
+    _, run = load(args.run)
+    if not run:
+        print(f"no benchmark rows in {args.run}", file=sys.stderr)
+        return 1
+
+    failed = 0
+    print(f"{'case':40} {'base p50':>10} {'run p50':>10} {'change':>8}")
+    for key in sorted(set(base) | set(run)):
+        name = "/".join(key)
+        b, r = base.get(key), run.get(key)
+        if r is None:
+            print(f"{name:40} {'':>10} {'':>10} {'MISSING':>8}")
+            failed += 1
+            continue
+        if r["error"] or int(r["n"] or 0) == 0:
+            print(f"{name:40} {'':>10} {'':>10} {'FAILED':>8} {r['error']}")
+            failed += 1
+            continue
+        run_p50 = float(r["p50_us"])
+        if b is None or b["error"] or int(b["n"] or 0) == 0:
+            print(f"{name:40} {'':>10} {run_p50:>10.2f} {'NEW':>8}")
+            continue
+        base_p50 = float(b["p50_us"])
+        change = (run_p50 - base_p50) / base_p50 * 100 if base_p50 else 0.0
+        limit = max(base_p50 * (1 + args.tolerance / 100), base_p50 + args.min_us)
+        verdict = "REGRESS" if run_p50 > limit else ""
+        if verdict:
+            failed += 1
+        print(f"{name:40} {base_p50:>10.2f} {run_p50:>10.2f} {change:>+7.1f}% {verdict}")
+
+    if failed:
+        print(f"{failed} case(s) regressed, failed or missing", file=sys.stderr)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,48 @@
+#ifndef GATEWAY_FRAME_H
+#define GATEWAY_FRAME_H
+
+#include <stdint.h>
+#include <string.h>
+
+// LAN protocol between boards and the edge gateway (Gateway/ in the repo root).
+// Every frame is a fixed header followed by a payload. Over UDP one datagram
+// holds one frame, over TCP each frame is preceded by its length (u16, big-endian).
+
+#define GATEWAY_PORT 7878
+#define GATEWAY_FRAME_VERSION 1
+#define GATEWAY_DEVICE_ID_LEN 6     // station MAC
+#define GATEWAY_HEADER_LEN (2 + GATEWAY_DEVICE_ID_LEN)
+#define GATEWAY_FRAME_MAX 512       // header and payload
+#define GATEWAY_HISTORY_HEADER_LEN 3
+
+typedef enum {
+    GATEWAY_MSG_TELEMETRY = 1,      // board -> gateway, CBOR sample (telemetry_cbor.h)
+    GATEWAY_MSG_HELLO = 2,          // board -> gateway, asks for commands, optional shadow
+                                    // version (i64, big-endian) to resync from
+    GATEWAY_MSG_COMMAND = 3,        // gateway -> board, JSON desired state (shadow.h)
+    GATEWAY_MSG_HISTORY = 4,        // board -> gateway, channel (u8), count (u16, big-endian),
+                                    // Gorilla block of that many samples (telemetry_gorilla.h)
+    GATEWAY_MSG_ACK = 5,            // board -> gateway, JSON command ack (command_ack_t)
+    GATEWAY_MSG_REPORTED = 6,       // board -> gateway, JSON {"<field>": reported child}
+    GATEWAY_MSG_HISTORY_FIXED = 7,  // board -> gateway, as HISTORY with the channel's
+                                    // fixed-point values (gorilla_encode_fixed())
+} gateway_msg_t;
+
+/* Write the header, returns its length */
+static inline int gateway_frame_header(uint8_t *buf, gateway_msg_t type, const uint8_t *device_id)
+{
+    buf[0] = GATEWAY_FRAME_VERSION;
+    buf[1] = (uint8_t)type;
+    memcpy(buf + 2, device_id, GATEWAY_DEVICE_ID_LEN);
+    return GATEWAY_HEADER_LEN;
+}
+
+/* Check a received frame, returns the type or -1 if it is not ours */
+static inline int gateway_frame_type(const uint8_t *buf, int len)
+{
+    if (len < GATEWAY_HEADER_LEN || len > GATEWAY_FRAME_MAX || buf[0] != GATEWAY_FRAME_VERSION)
+        return -1;
+    return buf[1];
+}
+
+#endif // GATEWAY_FRAME_H
@@ -0,0 +1,59 @@
+#ifndef TELEMETRY_CBOR_H
+#define TELEMETRY_CBOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "telemetry_schema.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One channel value of a sample, fixed point: value / 10^decimals of the
+// channel (telemetry_channel_decimals()), 2345 is 23.45 C
+typedef struct {
+    uint8_t channel;
+    int32_t value;
+} telemetry_reading_t;
+
+// Most channels one sample carries
+#define TELEMETRY_READINGS_MAX 8
+
+// Largest encoded live sample: map head, then per reading the key, tag 4,
+// the array head, the exponent and an int32 mantissa
+#define TELEMETRY_CBOR_MAX (1 + TELEMETRY_READINGS_MAX * 9)
+
+// Append-only CBOR writer over a caller buffer, overflow is sticky
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} cbor_writer_t;
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size);
+void cbor_put_uint(cbor_writer_t *w, uint64_t value);
+void cbor_put_int(cbor_writer_t *w, int64_t value);
+void cbor_put_array(cbor_writer_t *w, size_t count);
+void cbor_put_map(cbor_writer_t *w, size_t count);
+/* value / 10^decimals, as an integer when whole and a decimal fraction
+ * (tag 4, [exponent, mantissa]) otherwise, trailing zeros dropped */
+void cbor_put_fixed(cbor_writer_t *w, int32_t value, int decimals);
+
+/* Encode a sample as {0: ts_ms, channel: value, ...}, ts_ms < 0 leaves the
+ * time out. Integer arithmetic only. Returns the length or -1 if buf is too
+ * small. */
+int telemetry_cbor_encode(uint8_t *buf, size_t size, int64_t ts_ms, const telemetry_reading_t *readings, int count);
+
+/* Decode a sample written by telemetry_cbor_encode(), or with float values
+ * by schema 1 boards, into the channels' fixed point. Unknown keys are
+ * skipped, *ts_ms is -1 without a time. Returns the number of readings
+ * or -1 if the data is malformed. */
+int telemetry_cbor_decode(const uint8_t *buf, size_t len, int64_t *ts_ms, telemetry_reading_t *readings, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_CBOR_H
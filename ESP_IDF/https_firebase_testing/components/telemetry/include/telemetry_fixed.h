@@ -0,0 +1,41 @@
+#ifndef TELEMETRY_FIXED_H
+#define TELEMETRY_FIXED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telemetry_cbor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Samples stay fixed point from the sensor read to the wire, each channel
+// scaled by its decimals (telemetry_schema.h). On the ESP32 the first float
+// instruction a task runs pins it to its core and makes the scheduler save
+// and restore the FPU registers for it, so the sensor tasks and the
+// encoders never touch one. Formatting here is integer arithmetic only,
+// the double conversions are for parsing config and for host tools.
+
+// Longest formatted value, "-214748364.7" and the NUL
+#define TELEMETRY_FIXED_TEXT_MAX 13
+
+// Room for a JSON sample of all the channels in the schema
+#define TELEMETRY_JSON_MAX 128
+
+/* value / 10^decimals as a JSON number, "23.45", "-0.5", "51" (trailing
+ * zeros dropped). Returns the length, -1 if it does not fit with its NUL. */
+int telemetry_fixed_format(char *buf, size_t size, int32_t value, int decimals);
+
+/* {"temperature":23.4,"humidity":51}, field names as in the schema. Returns
+ * the length, -1 if it does not fit with its NUL. */
+int telemetry_json_encode(char *buf, size_t size, const telemetry_reading_t *readings, int count);
+
+/* Rounded to the nearest step and clamped to the int32 range */
+int32_t telemetry_fixed_from_double(double value, int decimals);
+double telemetry_fixed_to_double(int32_t value, int decimals);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_FIXED_H
@@ -0,0 +1,76 @@
+#ifndef TELEMETRY_GORILLA_H
+#define TELEMETRY_GORILLA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Gorilla-style compression of one channel's (ts_ms, value) series:
+// timestamps as delta-of-delta, values as the XOR with the previous float,
+// or with the previous fixed-point value (telemetry_fixed.h). Small steps
+// between scaled integers XOR to a few low bits, as float steps do to a
+// few mantissa bits.
+// A block starts with the first sample raw (64-bit time, 32-bit value), the
+// sample count travels next to the block since the last byte is padded.
+
+// Delta-of-delta buckets, prefix bits then the offset value (ms)
+//   0                 dod == 0
+//   10   + 7 bits     -63..64
+//   110  + 9 bits     -255..256
+//   1110 + 12 bits    -2047..2048
+//   1111 + 64 bits    anything else
+// Values
+//   0                                 same as the previous value
+//   10 + meaningful bits              XOR fits the previous leading/trailing window
+//   11 + 5 bits leading + 5 bits (length - 1) + meaningful bits
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t bits;            // bits written so far
+    uint16_t count;         // samples in the block
+    int64_t prev_ts;
+    int64_t prev_delta;
+    uint32_t prev_value;    // float or fixed-point bits
+    uint8_t leading;        // window of the last XOR written with a header
+    uint8_t trailing;
+} gorilla_encoder_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;             // bytes
+    size_t bits;            // bits read so far
+    uint16_t remaining;
+    uint16_t count;         // samples decoded so far
+    int64_t prev_ts;
+    int64_t prev_delta;
+    uint32_t prev_value;
+    uint8_t leading;
+    uint8_t trailing;
+} gorilla_decoder_t;
+
+void gorilla_encoder_init(gorilla_encoder_t *enc, uint8_t *buf, size_t size);
+
+/* Append a sample. Returns false and leaves the block as it was if it does
+ * not fit, the caller sends the block and starts a new one. */
+bool gorilla_encode(gorilla_encoder_t *enc, int64_t ts_ms, float value);
+bool gorilla_encode_fixed(gorilla_encoder_t *enc, int64_t ts_ms, int32_t value);
+
+/* Bytes used by the block so far */
+size_t gorilla_encoder_len(const gorilla_encoder_t *enc);
+
+void gorilla_decoder_init(gorilla_decoder_t *dec, const uint8_t *buf, size_t len, uint16_t count);
+
+/* Next sample of the block, false at the end or if the block is truncated */
+bool gorilla_decode(gorilla_decoder_t *dec, int64_t *ts_ms, float *value);
+bool gorilla_decode_fixed(gorilla_decoder_t *dec, int64_t *ts_ms, int32_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_GORILLA_H
@@ -0,0 +1,95 @@
+#ifndef TELEMETRY_METRICS_H
+#define TELEMETRY_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Metrics registry rendered in the Prometheus text format, for scraping
+// boards (and host builds) without reading logs. Metrics are static
+// objects: a counter bump is one relaxed atomic add, nothing is allocated
+// or looked up on the hot path. Values are 32 bits so the add stays a
+// single instruction on the ESP32, counters wrap like a restart would.
+//
+//   metric_t requests = METRIC_COUNTER("http_requests_total", "Requests", "outcome=\"ok\"");
+//   METRIC_HISTOGRAM_DEFINE(latency, "http_request_ms", "Request time", NULL, 50, 100, 500);
+//   metrics_register(&requests);      // once, at boot
+//   metric_inc(&requests);            // hot path
+//
+// Series of the same name (different labels) must be registered one after
+// the other, the family's HELP and TYPE lines are written once before them.
+
+#define METRICS_MAX 64
+
+typedef enum {
+    METRIC_TYPE_COUNTER = 0,
+    METRIC_TYPE_GAUGE,
+    METRIC_TYPE_HISTOGRAM,
+} metric_type_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+    const char *labels;         // label pairs without braces, e.g. event="error", NULL for none
+    uint8_t type;               // metric_type_t
+    uint8_t bucket_count;       // histograms: finite buckets, +Inf comes on top
+    uint32_t value;             // counters, gauges (int32 bits)
+    uint32_t sum;               // histograms: sum of the observations
+    const uint32_t *bounds;     // histograms: inclusive upper bounds, ascending
+    uint32_t *buckets;          // histograms: bucket_count + 1 counts, not cumulative
+    int32_t (*read)(void);      // gauges: read at scrape time instead of value, may be NULL
+} metric_t;
+
+#define METRIC_COUNTER(name_, help_, labels_) \
+    { .name = (name_), .help = (help_), .labels = (labels_), .type = METRIC_TYPE_COUNTER }
+#define METRIC_GAUGE(name_, help_, labels_) \
+    { .name = (name_), .help = (help_), .labels = (labels_), .type = METRIC_TYPE_GAUGE }
+#define METRIC_GAUGE_FN(name_, help_, labels_, read_) \
+    { .name = (name_), .help = (help_), .labels = (labels_), .type = METRIC_TYPE_GAUGE, .read = (read_) }
+
+// Defines var and its bucket storage, the bounds are the remaining arguments
+#define METRIC_HISTOGRAM_DEFINE(var, name_, help_, labels_, ...)                                      \
+    static const uint32_t var##_bounds[] = { __VA_ARGS__ };                                           \
+    static uint32_t var##_buckets[sizeof(var##_bounds) / sizeof(var##_bounds[0]) + 1];                \
+    metric_t var = { .name = (name_), .help = (help_), .labels = (labels_),                           \
+                     .type = METRIC_TYPE_HISTOGRAM,                                                   \
+                     .bucket_count = (uint8_t)(sizeof(var##_bounds) / sizeof(var##_bounds[0])),       \
+                     .bounds = var##_bounds, .buckets = var##_buckets }
+
+static inline void metric_inc(metric_t *m)
+{
+    __atomic_fetch_add(&m->value, 1, __ATOMIC_RELAXED);
+}
+
+static inline void metric_add(metric_t *m, uint32_t n)
+{
+    __atomic_fetch_add(&m->value, n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_set(metric_t *m, int32_t v)
+{
+    __atomic_store_n(&m->value, (uint32_t)v, __ATOMIC_RELAXED);
+}
+
+/* Count one observation into its bucket, a scan over at most bucket_count bounds */
+void metric_observe(metric_t *m, uint32_t v);
+
+/* Add to the registry, returns -1 when it is full. Not thread safe, call
+ * before the tasks that scrape start. */
+int metrics_register(metric_t *m);
+
+/* Write callback for metrics_render(), returns 0 on success */
+typedef int (*metrics_write_fn)(void *ctx, const char *text, size_t len);
+
+/* Render every registered metric as Prometheus text (format 0.0.4), a line
+ * at a time. Returns 0, or the first non-zero write() result. */
+int metrics_render(metrics_write_fn write, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_METRICS_H
@@ -0,0 +1,42 @@
+#ifndef TELEMETRY_SCHEMA_H
+#define TELEMETRY_SCHEMA_H
+
+// Shared by the firmware and the gateway.
+// Channel IDs are the keys on the wire: never renumber, only append.
+
+// 2: values are fixed point, decimal fractions in CBOR (telemetry_fixed.h)
+#define TELEMETRY_SCHEMA_VERSION 2
+
+// Map key of the sample time, ms since the epoch, left out for live samples
+#define TELEMETRY_KEY_TS 0
+
+typedef enum {
+    TELEMETRY_CH_TEMPERATURE = 1,   // degrees C
+    TELEMETRY_CH_HUMIDITY = 2,      // % RH
+    TELEMETRY_CH_LIGHT = 3,         // lux
+    TELEMETRY_CH_MAX
+} telemetry_channel_t;
+
+// JSON field names, as the REST backend and the database use them
+#define TELEMETRY_CHANNEL_NAMES { "ts", "temperature", "humidity", "light_intensity" }
+
+// Database node each channel is written under
+#define TELEMETRY_CHANNEL_NODES { NULL, "sensor_data", "sensor_data", "Light_data" }
+
+// Decimal digits of each channel's fixed-point value: centi-degrees, tenths
+// of % RH (per mille), whole lux
+#define TELEMETRY_CHANNEL_DECIMALS { 0, 2, 1, 0 }
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *telemetry_channel_name(int channel);
+const char *telemetry_channel_node(int channel);
+int telemetry_channel_decimals(int channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_SCHEMA_H
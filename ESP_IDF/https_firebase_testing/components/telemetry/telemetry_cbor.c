@@ -0,0 +1,309 @@
+#include "telemetry_cbor.h"
+#include <string.h>
+#include <math.h>
+
+// CBOR major types (RFC 8949)
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+static const char *channel_names[TELEMETRY_CH_MAX] = TELEMETRY_CHANNEL_NAMES;
+static const char *channel_nodes[TELEMETRY_CH_MAX] = TELEMETRY_CHANNEL_NODES;
+static const uint8_t channel_decimals[TELEMETRY_CH_MAX] = TELEMETRY_CHANNEL_DECIMALS;
+
+const char *telemetry_channel_name(int channel)
+{
+    return channel >= 0 && channel < TELEMETRY_CH_MAX ? channel_names[channel] : "unknown";
+}
+
+const char *telemetry_channel_node(int channel)
+{
+    return channel > TELEMETRY_KEY_TS && channel < TELEMETRY_CH_MAX ? channel_nodes[channel] : NULL;
+}
+
+int telemetry_channel_decimals(int channel)
+{
+    return channel >= 0 && channel < TELEMETRY_CH_MAX ? channel_decimals[channel] : 0;
+}
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = false;
+}
+
+static void put_bytes(cbor_writer_t *w, const uint8_t *data, size_t len)
+{
+    if (w->overflow || w->size - w->len < len)
+    {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/* Initial byte plus the shortest argument encoding */
+static void put_head(cbor_writer_t *w, int major, uint64_t arg)
+{
+    uint8_t head[9];
+    size_t n;
+
+    if (arg < 24)
+    {
+        head[0] = major << 5 | arg;
+        n = 1;
+    }
+    else if (arg <= UINT8_MAX)
+    {
+        head[0] = major << 5 | 24;
+        n = 2;
+    }
+    else if (arg <= UINT16_MAX)
+    {
+        head[0] = major << 5 | 25;
+        n = 3;
+    }
+    else if (arg <= UINT32_MAX)
+    {
+        head[0] = major << 5 | 26;
+        n = 5;
+    }
+    else
+    {
+        head[0] = major << 5 | 27;
+        n = 9;
+    }
+    for (size_t i = 1; i < n; i++)
+        head[i] = arg >> (8 * (n - 1 - i));
+    put_bytes(w, head, n);
+}
+
+void cbor_put_uint(cbor_writer_t *w, uint64_t value)
+{
+    put_head(w, CBOR_UINT, value);
+}
+
+void cbor_put_int(cbor_writer_t *w, int64_t value)
+{
+    if (value >= 0)
+        put_head(w, CBOR_UINT, value);
+    else
+        put_head(w, CBOR_NINT, (uint64_t)(-1 - value));
+}
+
+void cbor_put_array(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_ARRAY, count);
+}
+
+void cbor_put_map(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_MAP, count);
+}
+
+void cbor_put_fixed(cbor_writer_t *w, int32_t value, int decimals)
+{
+    // 51.0 % RH goes out as 51, lux and other counts are always whole
+    while (decimals > 0 && value % 10 == 0)
+    {
+        value /= 10;
+        decimals--;
+    }
+    if (decimals == 0)
+    {
+        cbor_put_int(w, value);
+        return;
+    }
+    put_head(w, CBOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+    cbor_put_array(w, 2);
+    cbor_put_int(w, -decimals);
+    cbor_put_int(w, value);
+}
+
+int telemetry_cbor_encode(uint8_t *buf, size_t size, int64_t ts_ms, const telemetry_reading_t *readings, int count)
+{
+    cbor_writer_t w;
+    cbor_writer_init(&w, buf, size);
+
+    cbor_put_map(&w, count + (ts_ms >= 0 ? 1 : 0));
+    if (ts_ms >= 0)
+    {
+        cbor_put_uint(&w, TELEMETRY_KEY_TS);
+        cbor_put_uint(&w, (uint64_t)ts_ms);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        cbor_put_uint(&w, readings[i].channel);
+        cbor_put_fixed(&w, readings[i].value, telemetry_channel_decimals(readings[i].channel));
+    }
+    return w.overflow ? -1 : (int)w.len;
+}
+
+// Reader side, just enough CBOR for telemetry maps
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+} cbor_reader_t;
+
+static bool get_head(cbor_reader_t *r, int *major, int *info, uint64_t *arg)
+{
+    if (r->pos >= r->len)
+        return false;
+    uint8_t b = r->buf[r->pos++];
+    *major = b >> 5;
+    *info = b & 0x1f;
+
+    size_t n = *info < 24 ? 0 : *info == 24 ? 1 : *info == 25 ? 2 : *info == 26 ? 4 : *info == 27 ? 8 : SIZE_MAX;
+    if (n == SIZE_MAX || r->len - r->pos < n)
+        return false; // indefinite lengths are never written
+    *arg = n == 0 ? (uint64_t)*info : 0;
+    for (size_t i = 0; i < n; i++)
+        *arg = *arg << 8 | r->buf[r->pos++];
+    return true;
+}
+
+static float half_to_float(uint16_t h)
+{
+    int exp = (h >> 10) & 0x1f;
+    int mant = h & 0x3ff;
+    float value = exp == 0 ? ldexpf(mant, -24) : exp != 31 ? ldexpf(mant + 1024, exp - 25) : mant ? NAN : INFINITY;
+    return h & 0x8000 ? -value : value;
+}
+
+// A number item as written: mantissa * 10^exp, or a float from a schema 1 board
+typedef struct {
+    bool is_float;
+    double f;
+    int64_t mantissa;
+    int exp;
+} cbor_number_t;
+
+static bool get_int(cbor_reader_t *r, int64_t *value)
+{
+    int major, info;
+    uint64_t arg;
+    if (!get_head(r, &major, &info, &arg) || (major != CBOR_UINT && major != CBOR_NINT) || arg > INT64_MAX)
+        return false;
+    *value = major == CBOR_UINT ? (int64_t)arg : -1 - (int64_t)arg;
+    return true;
+}
+
+/* Read a number item, any width the spec allows */
+static bool get_number(cbor_reader_t *r, cbor_number_t *value)
+{
+    size_t start = r->pos;
+    int major, info;
+    uint64_t arg;
+    if (!get_head(r, &major, &info, &arg))
+        return false;
+
+    memset(value, 0, sizeof(*value));
+    switch (major)
+    {
+    case CBOR_UINT:
+    case CBOR_NINT:
+        r->pos = start;
+        return get_int(r, &value->mantissa);
+    case CBOR_TAG:
+    {
+        int64_t exp;
+        if (arg != CBOR_TAG_DECIMAL_FRACTION || !get_head(r, &major, &info, &arg) || major != CBOR_ARRAY ||
+            arg != 2 || !get_int(r, &exp) || exp < -18 || exp > 18 || !get_int(r, &value->mantissa))
+            return false;
+        value->exp = (int)exp;
+        return true;
+    }
+    case CBOR_SIMPLE:
+        value->is_float = true;
+        if (info == 25)
+        {
+            value->f = half_to_float((uint16_t)arg);
+            return true;
+        }
+        if (info == 26)
+        {
+            uint32_t bits = (uint32_t)arg;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            value->f = f;
+            return true;
+        }
+        if (info == 27)
+        {
+            memcpy(&value->f, &arg, sizeof(value->f));
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+/* The number times 10^decimals, rounded half away from zero and clamped */
+static int64_t number_scaled(const cbor_number_t *n, int decimals, int64_t min, int64_t max)
+{
+    if (n->is_float)
+    {
+        double v = round(n->f * pow(10, decimals));
+        return isnan(v) ? 0 : v < (double)min ? min : v > (double)max ? max : (int64_t)v;
+    }
+
+    int64_t v = n->mantissa;
+    int shift = n->exp + decimals;
+    for (; shift > 0; shift--)
+    {
+        if (v > max / 10 || v < min / 10)
+            return v > 0 ? max : min;
+        v *= 10;
+    }
+    if (shift < 0)
+    {
+        int64_t div = 1;
+        for (; shift < 0 && div <= INT64_MAX / 10; shift++)
+            div *= 10;
+        int64_t q = v / div, rem = v % div;
+        v = rem * 2 >= div ? q + 1 : rem * 2 <= -div ? q - 1 : q;
+    }
+    return v < min ? min : v > max ? max : v;
+}
+
+int telemetry_cbor_decode(const uint8_t *buf, size_t len, int64_t *ts_ms, telemetry_reading_t *readings, int max)
+{
+    cbor_reader_t r = { .buf = buf, .len = len };
+    int major, info;
+    uint64_t pairs;
+    int count = 0;
+
+    *ts_ms = -1;
+    if (!get_head(&r, &major, &info, &pairs) || major != CBOR_MAP)
+        return -1;
+
+    for (uint64_t i = 0; i < pairs; i++)
+    {
+        uint64_t key;
+        cbor_number_t value;
+        if (!get_head(&r, &major, &info, &key) || major != CBOR_UINT || !get_number(&r, &value))
+            return -1;
+
+        if (key == TELEMETRY_KEY_TS)
+            *ts_ms = number_scaled(&value, 0, 0, INT64_MAX);
+        else if (key < TELEMETRY_CH_MAX && count < max)
+        {
+            readings[count].channel = key;
+            readings[count].value = (int32_t)number_scaled(&value, telemetry_channel_decimals(key), INT32_MIN, INT32_MAX);
+            count++;
+        }
+        // Channels from a newer schema are skipped
+    }
+    return count;
+}
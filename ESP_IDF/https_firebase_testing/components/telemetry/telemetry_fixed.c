@@ -0,0 +1,83 @@
+#include "telemetry_fixed.h"
+#include <string.h>
+#include <math.h>
+
+int telemetry_fixed_format(char *buf, size_t size, int32_t value, int decimals)
+{
+    // Digits least significant first, at least one before the point
+    char digits[12];
+    uint32_t mag = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + mag % 10;
+        mag /= 10;
+    } while (mag);
+    while (n <= decimals)
+        digits[n++] = '0';
+
+    int skip = 0;
+    while (skip < decimals && digits[skip] == '0')
+        skip++;
+
+    int len = (value < 0) + (n - decimals) + (skip < decimals ? 1 + decimals - skip : 0);
+    if ((size_t)len >= size)
+        return -1;
+    char *out = buf;
+    if (value < 0)
+        *out++ = '-';
+    for (int i = n - 1; i >= decimals; i--)
+        *out++ = digits[i];
+    if (skip < decimals)
+    {
+        *out++ = '.';
+        for (int i = decimals - 1; i >= skip; i--)
+            *out++ = digits[i];
+    }
+    *out = '\0';
+    return len;
+}
+
+static bool append(char *buf, size_t size, int *len, const char *text, int n)
+{
+    if ((size_t)(*len + n) >= size)
+        return false;
+    memcpy(buf + *len, text, n);
+    *len += n;
+    return true;
+}
+
+int telemetry_json_encode(char *buf, size_t size, const telemetry_reading_t *readings, int count)
+{
+    int len = 0;
+    if (!append(buf, size, &len, "{", 1))
+        return -1;
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = telemetry_channel_name(readings[i].channel);
+        char number[TELEMETRY_FIXED_TEXT_MAX];
+        int n = telemetry_fixed_format(number, sizeof(number), readings[i].value,
+                                       telemetry_channel_decimals(readings[i].channel));
+        if ((i > 0 && !append(buf, size, &len, ",", 1)) || !append(buf, size, &len, "\"", 1) ||
+            !append(buf, size, &len, name, strlen(name)) || !append(buf, size, &len, "\":", 2) ||
+            !append(buf, size, &len, number, n))
+            return -1;
+    }
+    if (!append(buf, size, &len, "}", 1))
+        return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+int32_t telemetry_fixed_from_double(double value, int decimals)
+{
+    double v = round(value * pow(10, decimals));
+    if (isnan(v))
+        return 0;
+    return v < INT32_MIN ? INT32_MIN : v > INT32_MAX ? INT32_MAX : (int32_t)v;
+}
+
+double telemetry_fixed_to_double(int32_t value, int decimals)
+{
+    return value / pow(10, decimals);
+}
@@ -0,0 +1,253 @@
+#include "telemetry_gorilla.h"
+#include <string.h>
+
+// No XOR window written yet, larger than any leading zero count
+#define WINDOW_NONE 0xff
+
+// Delta-of-delta buckets by number of leading 1 bits in the prefix
+static const int dod_widths[5] = { 0, 7, 9, 12, 64 };
+static const int64_t dod_bias[5] = { 0, 63, 255, 2047, 0 };
+
+void gorilla_encoder_init(gorilla_encoder_t *enc, uint8_t *buf, size_t size)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->buf = buf;
+    enc->size = size;
+    enc->leading = WINDOW_NONE;
+}
+
+size_t gorilla_encoder_len(const gorilla_encoder_t *enc)
+{
+    return (enc->bits + 7) / 8;
+}
+
+/* Append the low n bits of value, most significant first */
+static bool put_bits(gorilla_encoder_t *enc, uint64_t value, int n)
+{
+    if (enc->bits + n > enc->size * 8)
+        return false;
+    while (n > 0)
+    {
+        size_t byte = enc->bits >> 3;
+        int used = enc->bits & 7;
+        int room = 8 - used;
+        int take = n < room ? n : room;
+        uint8_t chunk = (value >> (n - take)) & ((1u << take) - 1);
+        if (used == 0)
+            enc->buf[byte] = 0;
+        enc->buf[byte] |= chunk << (room - take);
+        enc->bits += take;
+        n -= take;
+    }
+    return true;
+}
+
+static bool put_dod(gorilla_encoder_t *enc, int64_t dod)
+{
+    if (dod == 0)
+        return put_bits(enc, 0, 1);
+    for (int ones = 1; ones < 4; ones++)
+    {
+        int64_t max = dod_bias[ones] + 1;
+        if (dod >= -dod_bias[ones] && dod <= max)
+            return put_bits(enc, ((1u << ones) - 1) << 1, ones + 1) &&
+                   put_bits(enc, (uint64_t)(dod + dod_bias[ones]), dod_widths[ones]);
+    }
+    return put_bits(enc, 0xf, 4) && put_bits(enc, (uint64_t)dod, 64);
+}
+
+static bool put_xor(gorilla_encoder_t *enc, uint32_t x)
+{
+    if (x == 0)
+        return put_bits(enc, 0, 1);
+
+    int leading = __builtin_clz(x);
+    int trailing = __builtin_ctz(x);
+    if (leading >= enc->leading && trailing >= enc->trailing)
+    {
+        // Fits the previous window, only the meaningful bits
+        return put_bits(enc, 0x2, 2) &&
+               put_bits(enc, x >> enc->trailing, 32 - enc->leading - enc->trailing);
+    }
+
+    int len = 32 - leading - trailing;
+    enc->leading = leading;
+    enc->trailing = trailing;
+    return put_bits(enc, 0x3, 2) && put_bits(enc, leading, 5) && put_bits(enc, len - 1, 5) &&
+           put_bits(enc, x >> trailing, len);
+}
+
+static bool encode_bits(gorilla_encoder_t *enc, int64_t ts_ms, uint32_t v)
+{
+    gorilla_encoder_t saved = *enc;
+
+    bool ok;
+    if (enc->count == 0)
+    {
+        ok = put_bits(enc, (uint64_t)ts_ms, 64) && put_bits(enc, v, 32);
+    }
+    else
+    {
+        int64_t delta = ts_ms - enc->prev_ts;
+        ok = put_dod(enc, delta - enc->prev_delta) && put_xor(enc, v ^ enc->prev_value);
+        enc->prev_delta = delta;
+    }
+
+    if (!ok || enc->count == UINT16_MAX)
+    {
+        // Roll back, including bits a partial write left in the last byte
+        *enc = saved;
+        if (enc->bits & 7)
+            enc->buf[enc->bits >> 3] &= 0xff << (8 - (enc->bits & 7));
+        return false;
+    }
+    enc->prev_ts = ts_ms;
+    enc->prev_value = v;
+    enc->count++;
+    return true;
+}
+
+bool gorilla_encode(gorilla_encoder_t *enc, int64_t ts_ms, float value)
+{
+    uint32_t v;
+    memcpy(&v, &value, sizeof(v));
+    return encode_bits(enc, ts_ms, v);
+}
+
+bool gorilla_encode_fixed(gorilla_encoder_t *enc, int64_t ts_ms, int32_t value)
+{
+    return encode_bits(enc, ts_ms, (uint32_t)value);
+}
+
+void gorilla_decoder_init(gorilla_decoder_t *dec, const uint8_t *buf, size_t len, uint16_t count)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->buf = buf;
+    dec->len = len;
+    dec->remaining = count;
+    dec->leading = WINDOW_NONE;
+}
+
+static bool get_bits(gorilla_decoder_t *dec, int n, uint64_t *out)
+{
+    if (dec->bits + n > dec->len * 8)
+        return false;
+    uint64_t value = 0;
+    while (n > 0)
+    {
+        uint8_t byte = dec->buf[dec->bits >> 3];
+        int room = 8 - (dec->bits & 7);
+        int take = n < room ? n : room;
+        value = value << take | ((byte >> (room - take)) & ((1u << take) - 1));
+        dec->bits += take;
+        n -= take;
+    }
+    *out = value;
+    return true;
+}
+
+static bool get_dod(gorilla_decoder_t *dec, int64_t *dod)
+{
+    uint64_t bit;
+    int ones = 0;
+    while (ones < 4)
+    {
+        if (!get_bits(dec, 1, &bit))
+            return false;
+        if (bit == 0)
+            break;
+        ones++;
+    }
+    if (ones == 0)
+    {
+        *dod = 0;
+        return true;
+    }
+
+    uint64_t offset;
+    if (!get_bits(dec, dod_widths[ones], &offset))
+        return false;
+    *dod = (int64_t)offset - dod_bias[ones];
+    return true;
+}
+
+static bool get_xor(gorilla_decoder_t *dec, uint32_t *x)
+{
+    uint64_t bit, bits;
+    if (!get_bits(dec, 1, &bit))
+        return false;
+    if (bit == 0)
+    {
+        *x = 0;
+        return true;
+    }
+
+    if (!get_bits(dec, 1, &bit))
+        return false;
+    if (bit == 1)
+    {
+        uint64_t leading, len;
+        if (!get_bits(dec, 5, &leading) || !get_bits(dec, 5, &len) || leading + len + 1 > 32)
+            return false;
+        dec->leading = leading;
+        dec->trailing = 32 - leading - (len + 1);
+    }
+    else if (dec->leading == WINDOW_NONE)
+    {
+        return false;
+    }
+
+    if (!get_bits(dec, 32 - dec->leading - dec->trailing, &bits))
+        return false;
+    *x = (uint32_t)(bits << dec->trailing);
+    return true;
+}
+
+static bool decode_bits(gorilla_decoder_t *dec, int64_t *ts_ms, uint32_t *value)
+{
+    if (dec->remaining == 0)
+        return false;
+
+    if (dec->count == 0)
+    {
+        uint64_t ts, v;
+        if (!get_bits(dec, 64, &ts) || !get_bits(dec, 32, &v))
+            return false;
+        dec->prev_ts = (int64_t)ts;
+        dec->prev_value = (uint32_t)v;
+    }
+    else
+    {
+        int64_t dod;
+        uint32_t x;
+        if (!get_dod(dec, &dod) || !get_xor(dec, &x))
+            return false;
+        dec->prev_delta += dod;
+        dec->prev_ts += dec->prev_delta;
+        dec->prev_value ^= x;
+    }
+
+    dec->count++;
+    dec->remaining--;
+    *ts_ms = dec->prev_ts;
+    *value = dec->prev_value;
+    return true;
+}
+
+bool gorilla_decode(gorilla_decoder_t *dec, int64_t *ts_ms, float *value)
+{
+    uint32_t v;
+    if (!decode_bits(dec, ts_ms, &v))
+        return false;
+    memcpy(value, &v, sizeof(*value));
+    return true;
+}
+
+bool gorilla_decode_fixed(gorilla_decoder_t *dec, int64_t *ts_ms, int32_t *value)
+{
+    uint32_t v;
+    if (!decode_bits(dec, ts_ms, &v))
+        return false;
+    *value = (int32_t)v;
+    return true;
+}
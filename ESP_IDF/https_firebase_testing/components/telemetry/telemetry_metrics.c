@@ -0,0 +1,120 @@
+#include "telemetry_metrics.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static metric_t *registry[METRICS_MAX];
+static int registered;
+
+static const char *type_names[] = { "counter", "gauge", "histogram" };
+
+// Longest line written, names, labels and help texts must fit
+#define METRICS_LINE_MAX 192
+
+void metric_observe(metric_t *m, uint32_t v)
+{
+    int i = 0;
+    while (i < m->bucket_count && v > m->bounds[i])
+        i++;
+    __atomic_fetch_add(&m->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m->sum, v, __ATOMIC_RELAXED);
+}
+
+int metrics_register(metric_t *m)
+{
+    if (registered == METRICS_MAX)
+        return -1;
+    registry[registered++] = m;
+    return 0;
+}
+
+/* {labels} with an extra pair appended, "" when there are none at all */
+static void label_set(char *buf, size_t size, const char *labels, const char *extra)
+{
+    bool has = labels != NULL && labels[0] != '\0';
+    if (!has && extra == NULL)
+        buf[0] = '\0';
+    else
+        snprintf(buf, size, "{%s%s%s}", has ? labels : "", has && extra ? "," : "", extra ? extra : "");
+}
+
+static int write_line(metrics_write_fn write, void *ctx, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static int write_line(metrics_write_fn write, void *ctx, const char *fmt, ...)
+{
+    char line[METRICS_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n < 0)
+        return -1;
+    if (n >= (int)sizeof(line))
+        n = sizeof(line) - 1;
+    return write(ctx, line, n);
+}
+
+static int render_histogram(const metric_t *m, metrics_write_fn write, void *ctx)
+{
+    char labels[METRICS_LINE_MAX / 2];
+    char le[24];
+    int err;
+
+    // Buckets are read one by one while tasks observe, so the count is the
+    // sum of what was read and +Inf always matches it
+    uint32_t cumulative = 0;
+    for (int i = 0; i <= m->bucket_count; i++)
+    {
+        cumulative += __atomic_load_n(&m->buckets[i], __ATOMIC_RELAXED);
+        if (i < m->bucket_count)
+            snprintf(le, sizeof(le), "le=\"%lu\"", (unsigned long)m->bounds[i]);
+        else
+            snprintf(le, sizeof(le), "le=\"+Inf\"");
+        label_set(labels, sizeof(labels), m->labels, le);
+        if ((err = write_line(write, ctx, "%s_bucket%s %lu\n", m->name, labels, (unsigned long)cumulative)) != 0)
+            return err;
+    }
+    label_set(labels, sizeof(labels), m->labels, NULL);
+    if ((err = write_line(write, ctx, "%s_sum%s %lu\n", m->name, labels,
+                          (unsigned long)__atomic_load_n(&m->sum, __ATOMIC_RELAXED))) != 0)
+        return err;
+    return write_line(write, ctx, "%s_count%s %lu\n", m->name, labels, (unsigned long)cumulative);
+}
+
+int metrics_render(metrics_write_fn write, void *ctx)
+{
+    const char *family = NULL;
+    char labels[METRICS_LINE_MAX / 2];
+    int err;
+
+    for (int i = 0; i < registered; i++)
+    {
+        const metric_t *m = registry[i];
+        if (family == NULL || strcmp(family, m->name) != 0)
+        {
+            family = m->name;
+            if ((err = write_line(write, ctx, "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help, m->name,
+                                  type_names[m->type])) != 0)
+                return err;
+        }
+
+        if (m->type == METRIC_TYPE_HISTOGRAM)
+        {
+            err = render_histogram(m, write, ctx);
+        }
+        else
+        {
+            label_set(labels, sizeof(labels), m->labels, NULL);
+            uint32_t v = __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+            if (m->type == METRIC_TYPE_COUNTER)
+                err = write_line(write, ctx, "%s%s %lu\n", m->name, labels, (unsigned long)v);
+            else
+                err = write_line(write, ctx, "%s%s %ld\n", m->name, labels, (long)(m->read ? m->read() : (int32_t)v));
+        }
+        if (err != 0)
+            return err;
+    }
+    return 0;
+}
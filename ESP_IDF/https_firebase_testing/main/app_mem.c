@@ -0,0 +1,193 @@
+#include "app_mem.h"
+#include "board_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "multi_heap.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+
+static const char *TAG_MEM = "APP_MEM";
+
+static uint8_t payload_storage[APP_MEM_PAYLOAD_BYTES] __attribute__((aligned(8)));
+static uint8_t tls_storage[APP_MEM_TLS_BYTES] __attribute__((aligned(8)));
+
+typedef struct {
+    const char *name;
+    uint8_t *start;
+    size_t size;
+    multi_heap_handle_t heap;
+    portMUX_TYPE lock;
+} arena_t;
+
+static arena_t arenas[APP_ARENA_MAX] = {
+    [APP_ARENA_PAYLOAD] = { "payload", payload_storage, sizeof(payload_storage), NULL, portMUX_INITIALIZER_UNLOCKED },
+    [APP_ARENA_TLS] = { "tls", tls_storage, sizeof(tls_storage), NULL, portMUX_INITIALIZER_UNLOCKED },
+};
+
+// Tasks whose allocations are counted by name
+typedef struct {
+    TaskHandle_t handle;
+    const char *name;
+    bool strict;
+    uint32_t allocs;            // since the seal
+    uint32_t last_size;
+} counted_task_t;
+
+static counted_task_t tasks[APP_MEM_TASKS];
+static int task_count;
+static volatile bool sealed;
+static uint32_t system_allocs;
+static uint32_t payload_failures;
+
+static bool in_arena(const arena_t *a, const void *ptr)
+{
+    return (const uint8_t *)ptr >= a->start && (const uint8_t *)ptr < a->start + a->size;
+}
+
+esp_err_t app_mem_init(void)
+{
+    for (int i = 0; i < APP_ARENA_MAX; i++)
+    {
+        arenas[i].heap = multi_heap_register(arenas[i].start, arenas[i].size);
+        if (arenas[i].heap == NULL)
+            return ESP_ERR_NO_MEM;
+        multi_heap_set_lock(arenas[i].heap, &arenas[i].lock);
+    }
+    cJSON_Hooks hooks = { .malloc_fn = app_malloc, .free_fn = app_free };
+    cJSON_InitHooks(&hooks);
+    return ESP_OK;
+}
+
+void *app_malloc(size_t size)
+{
+    void *ptr = multi_heap_malloc(arenas[APP_ARENA_PAYLOAD].heap, size);
+    if (ptr == NULL)
+        __atomic_fetch_add(&payload_failures, 1, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+void app_free(void *ptr)
+{
+    if (ptr)
+        multi_heap_free(arenas[APP_ARENA_PAYLOAD].heap, ptr);
+}
+
+char *app_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = app_malloc(len);
+    if (copy)
+        memcpy(copy, s, len);
+    return copy;
+}
+
+// mbedTLS allocator, CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC
+void *esp_mbedtls_mem_calloc(size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size)
+        return NULL;
+    void *ptr = multi_heap_malloc(arenas[APP_ARENA_TLS].heap, n * size);
+    if (ptr == NULL)
+    {
+        // A third session (pipeline, MQTT) can still connect, the fallbacks show how often
+        metric_inc(&metric_tls_fallbacks);
+        return heap_caps_calloc(n, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    memset(ptr, 0, n * size);
+    return ptr;
+}
+
+void esp_mbedtls_mem_free(void *ptr)
+{
+    if (in_arena(&arenas[APP_ARENA_TLS], ptr))
+        multi_heap_free(arenas[APP_ARENA_TLS].heap, ptr);
+    else
+        heap_caps_free(ptr);
+}
+
+esp_err_t app_task_start(TaskFunction_t fn, const char *name, StackType_t *stack, uint32_t stack_bytes,
+                         StaticTask_t *tcb, UBaseType_t prio, bool strict)
+{
+    if (task_count == APP_MEM_TASKS)
+        return ESP_ERR_NO_MEM;
+    counted_task_t *t = &tasks[task_count];
+    t->name = name;
+    t->strict = strict;
+    t->handle = xTaskCreateStatic(fn, name, stack_bytes, NULL, prio, stack, tcb);
+    if (t->handle == NULL)
+        return ESP_FAIL;
+    __atomic_store_n(&task_count, task_count + 1, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void app_mem_seal(void)
+{
+    sealed = true;
+    ESP_LOGI(TAG_MEM, "Boot done, counting heap allocations from here on.");
+}
+
+// Heap hooks, CONFIG_HEAP_USE_HOOKS. Called inside every system heap
+// allocation, so IRAM and nothing that allocates or blocks.
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (!sealed)
+        return;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    int count = __atomic_load_n(&task_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        if (tasks[i].handle != self)
+            continue;
+        __atomic_fetch_add(&tasks[i].allocs, 1, __ATOMIC_RELAXED);
+        tasks[i].last_size = size;
+        metric_inc(&metric_heap_allocs[tasks[i].strict ? BOARD_HEAP_STRICT_TASKS : BOARD_HEAP_COUNTED_TASKS]);
+#if CONFIG_APP_MEM_STRICT
+        if (tasks[i].strict)
+            abort();
+#endif
+        return;
+    }
+    __atomic_fetch_add(&system_allocs, 1, __ATOMIC_RELAXED);
+    metric_inc(&metric_heap_allocs[BOARD_HEAP_SYSTEM]);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+}
+
+int32_t app_arena_free(app_arena_t arena)
+{
+    return (int32_t)multi_heap_free_size(arenas[arena].heap);
+}
+
+int32_t app_arena_min_free(app_arena_t arena)
+{
+    return (int32_t)multi_heap_minimum_free_size(arenas[arena].heap);
+}
+
+void app_mem_dump(void)
+{
+    ESP_LOGI(TAG_MEM, "Heap allocations since boot was done%s", sealed ? "" : " (not done yet)");
+    printf("  %-16s %-7s %10s %10s\n", "task", "strict", "allocs", "last size");
+    int count = __atomic_load_n(&task_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+        printf("  %-16s %-7s %10lu %10lu\n", tasks[i].name, tasks[i].strict ? "yes" : "no",
+               (unsigned long)tasks[i].allocs, (unsigned long)tasks[i].last_size);
+    printf("  %-16s %-7s %10lu\n", "(system)", "no", (unsigned long)system_allocs);
+
+    printf("  %-8s %8s %8s %8s %8s\n", "arena", "size", "free", "min free", "largest");
+    for (int i = 0; i < APP_ARENA_MAX; i++)
+    {
+        multi_heap_info_t info;
+        multi_heap_get_info(arenas[i].heap, &info);
+        printf("  %-8s %8u %8u %8u %8u\n", arenas[i].name, (unsigned)arenas[i].size,
+               (unsigned)info.total_free_bytes, (unsigned)info.minimum_free_bytes, (unsigned)info.largest_free_block);
+    }
+    printf("  payload allocations refused %lu, TLS allocations on the system heap %lu\n",
+           (unsigned long)payload_failures, (unsigned long)metric_tls_fallbacks.value);
+    printf("  system heap largest free block %u\n", (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
@@ -0,0 +1,73 @@
+#ifndef APP_MEM_H
+#define APP_MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Memory the firmware runs on once booted. A board that allocates in every
+// loop fragments the heap over days until a TLS handshake can't find its
+// 16 KB. So steady state runs on storage reserved at boot:
+//  - tasks, queues and semaphores are created static, in .bss;
+//  - request bodies, WebSocket frames and cJSON trees come from the payload
+//    arena, a private heap on a static buffer (cJSON is hooked to it);
+//  - mbedTLS allocates from the TLS arena (CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC),
+//    and the scheduler lanes keep one HTTP client and TLS session each.
+// Neither arena touches the system heap, so what happens in them can't
+// fragment it. The TLS arena falls back to the system heap when full, the
+// payload arena returns NULL.
+//
+// With CONFIG_HEAP_USE_HOOKS every system heap allocation made after
+// app_mem_seal() is counted against the task making it, tasks started with
+// app_task_start() by name and everything else as "system" (Wi-Fi, lwIP,
+// httpd, ...). A strict task must not allocate at all: CONFIG_APP_MEM_STRICT
+// turns its first allocation into an abort, with the backtrace pointing at
+// the caller. Soak builds set it (see the README).
+
+#define APP_MEM_PAYLOAD_BYTES (16 * 1024)
+#define APP_MEM_TLS_BYTES (64 * 1024)
+#define APP_MEM_TASKS 16            // tasks counted by name
+
+typedef enum {
+    APP_ARENA_PAYLOAD = 0,
+    APP_ARENA_TLS,
+    APP_ARENA_MAX
+} app_arena_t;
+
+// Storage of a static task, at file scope
+#define APP_TASK_DEFINE(var, stack_bytes) \
+    static StackType_t var##_stack[stack_bytes]; \
+    static StaticTask_t var##_tcb
+
+#define APP_TASK_START(var, fn, name, prio, strict) \
+    app_task_start((fn), (name), var##_stack, sizeof(var##_stack), &var##_tcb, (prio), (strict))
+
+/* Set up the arenas and hook cJSON to the payload arena. First thing in
+ * app_main, before anything parses or prints JSON. */
+esp_err_t app_mem_init(void);
+
+/* Payload arena, NULL when it is full */
+void *app_malloc(size_t size);
+void app_free(void *ptr);
+char *app_strdup(const char *s);
+
+/* xTaskCreateStatic() on APP_TASK_DEFINE storage, counted from now on.
+ * Stack sizes are in bytes, as everywhere in ESP-IDF. */
+esp_err_t app_task_start(TaskFunction_t fn, const char *name, StackType_t *stack, uint32_t stack_bytes,
+                         StaticTask_t *tcb, UBaseType_t prio, bool strict);
+
+/* Boot is over, count system heap allocations from now on. Called once
+ * every task has been through its first cycle. */
+void app_mem_seal(void);
+
+/* Arena use, for /metrics */
+int32_t app_arena_free(app_arena_t arena);
+int32_t app_arena_min_free(app_arena_t arena);
+
+/* Allocations since the seal per task, arena use and TLS fallbacks */
+void app_mem_dump(void);
+
+#endif // APP_MEM_H
@@ -0,0 +1,144 @@
+#include "board_metrics.h"
+#include "local_server.h"
+#include "net_sched.h"
+#include "http_backoff.h"
+#include "sample_store.h"
+#include "app_mem.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+// Hot path metrics, bumped where they happen
+metric_t metric_http_events[BOARD_METRICS_HTTP_EVENTS] = {
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"error\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"connected\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"headers_sent\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"header\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"data\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"finish\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"disconnected\""),
+    METRIC_COUNTER("esp_http_client_events_total", "esp_http_client events by type", "event=\"redirect\""),
+};
+
+metric_t metric_http_requests[BOARD_HTTP_OUTCOME_MAX] = {
+    METRIC_COUNTER("http_requests_total", "Database requests by outcome", "outcome=\"ok\""),
+    METRIC_COUNTER("http_requests_total", "Database requests by outcome", "outcome=\"client_error\""),
+    METRIC_COUNTER("http_requests_total", "Database requests by outcome", "outcome=\"server_error\""),
+    METRIC_COUNTER("http_requests_total", "Database requests by outcome", "outcome=\"transport_error\""),
+};
+
+METRIC_HISTOGRAM_DEFINE(metric_http_request_ms, "http_request_duration_milliseconds",
+                        "Database request time, connect to last body byte", NULL,
+                        50, 100, 200, 500, 1000, 2000, 5000);
+
+metric_t metric_sensor_reads[BOARD_SENSOR_MAX] = {
+    METRIC_COUNTER("sensor_reads_total", "Sensor reads attempted", "sensor=\"dht\""),
+    METRIC_COUNTER("sensor_reads_total", "Sensor reads attempted", "sensor=\"bh1750\""),
+};
+
+metric_t metric_sensor_failures[BOARD_SENSOR_MAX] = {
+    METRIC_COUNTER("sensor_read_failures_total", "Sensor reads that failed", "sensor=\"dht\""),
+    METRIC_COUNTER("sensor_read_failures_total", "Sensor reads that failed", "sensor=\"bh1750\""),
+};
+
+metric_t metric_log_lost[BOARD_LOG_LOST_MAX] = {
+    METRIC_COUNTER("log_records_dropped_total", "Deferred log records not printed", "reason=\"ring_full\""),
+    METRIC_COUNTER("log_records_dropped_total", "Deferred log records not printed", "reason=\"rate_limited\""),
+};
+
+metric_t metric_heap_allocs[BOARD_HEAP_MAX] = {
+    METRIC_COUNTER("heap_allocs_after_boot_total", "System heap allocations once booted", "tasks=\"strict\""),
+    METRIC_COUNTER("heap_allocs_after_boot_total", "System heap allocations once booted", "tasks=\"counted\""),
+    METRIC_COUNTER("heap_allocs_after_boot_total", "System heap allocations once booted", "tasks=\"system\""),
+};
+
+metric_t metric_tls_fallbacks =
+    METRIC_COUNTER("tls_arena_fallbacks_total", "mbedTLS allocations that didn't fit the TLS arena", NULL);
+
+static metric_t wifi_disconnects =
+    METRIC_COUNTER("wifi_disconnects_total", "Station disconnects, each followed by a reconnect attempt", NULL);
+
+// Read when scraped
+static int32_t command_depth(void) { return net_sched_depth(NET_CLASS_COMMAND); }
+static int32_t telemetry_depth(void) { return net_sched_depth(NET_CLASS_TELEMETRY); }
+static int32_t backlog_depth(void) { return net_sched_depth(NET_CLASS_BACKLOG); }
+static int32_t stored_samples(void) { return sample_store_count(); }
+static int32_t free_heap(void) { return (int32_t)esp_get_free_heap_size(); }
+static int32_t min_free_heap(void) { return (int32_t)esp_get_minimum_free_heap_size(); }
+static int32_t breaker_state(void) { return http_backoff_state(); }
+static int32_t largest_free_block(void) { return (int32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT); }
+static int32_t payload_free(void) { return app_arena_free(APP_ARENA_PAYLOAD); }
+static int32_t payload_min_free(void) { return app_arena_min_free(APP_ARENA_PAYLOAD); }
+static int32_t tls_free(void) { return app_arena_free(APP_ARENA_TLS); }
+static int32_t tls_min_free(void) { return app_arena_min_free(APP_ARENA_TLS); }
+static int32_t uptime_s(void) { return (int32_t)(esp_timer_get_time() / 1000000); }
+
+static int32_t wifi_rssi(void)
+{
+    wifi_ap_record_t ap;
+    return esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+}
+
+static metric_t gauges[] = {
+    METRIC_GAUGE_FN("net_sched_queue_depth", "Requests waiting per scheduler class", "class=\"command\"", command_depth),
+    METRIC_GAUGE_FN("net_sched_queue_depth", "Requests waiting per scheduler class", "class=\"telemetry\"", telemetry_depth),
+    METRIC_GAUGE_FN("net_sched_queue_depth", "Requests waiting per scheduler class", "class=\"backlog\"", backlog_depth),
+    METRIC_GAUGE_FN("sample_store_samples", "Samples waiting for the history upload", NULL, stored_samples),
+    METRIC_GAUGE_FN("http_breaker_state", "Circuit breaker, 0 closed, 1 open, 2 half open", NULL, breaker_state),
+    METRIC_GAUGE_FN("heap_free_bytes", "Free heap", NULL, free_heap),
+    METRIC_GAUGE_FN("heap_min_free_bytes", "Lowest free heap since boot", NULL, min_free_heap),
+    METRIC_GAUGE_FN("heap_largest_free_block_bytes", "Largest system heap block, fragmentation shows here first", NULL, largest_free_block),
+    METRIC_GAUGE_FN("arena_free_bytes", "Free bytes in the static arenas", "arena=\"payload\"", payload_free),
+    METRIC_GAUGE_FN("arena_free_bytes", "Free bytes in the static arenas", "arena=\"tls\"", tls_free),
+    METRIC_GAUGE_FN("arena_min_free_bytes", "Lowest free bytes in the static arenas since boot", "arena=\"payload\"", payload_min_free),
+    METRIC_GAUGE_FN("arena_min_free_bytes", "Lowest free bytes in the static arenas since boot", "arena=\"tls\"", tls_min_free),
+    METRIC_GAUGE_FN("wifi_rssi_dbm", "Signal of the access point, 0 when not associated", NULL, wifi_rssi),
+    METRIC_GAUGE_FN("uptime_seconds", "Time since boot", NULL, uptime_s),
+};
+
+static void on_wifi_disconnected(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    metric_inc(&wifi_disconnects);
+}
+
+static int write_chunk(void *ctx, const char *text, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, text, len) == ESP_OK ? 0 : -1;
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    if (metrics_render(write_chunk, req) != 0)
+        return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void register_all(metric_t *metrics, int count)
+{
+    for (int i = 0; i < count; i++)
+        metrics_register(&metrics[i]);
+}
+
+esp_err_t board_metrics_init(void)
+{
+    register_all(metric_http_events, BOARD_METRICS_HTTP_EVENTS);
+    register_all(metric_http_requests, BOARD_HTTP_OUTCOME_MAX);
+    register_all(&metric_http_request_ms, 1);
+    register_all(metric_sensor_reads, BOARD_SENSOR_MAX);
+    register_all(metric_sensor_failures, BOARD_SENSOR_MAX);
+    register_all(metric_log_lost, BOARD_LOG_LOST_MAX);
+    register_all(metric_heap_allocs, BOARD_HEAP_MAX);
+    register_all(&metric_tls_fallbacks, 1);
+    register_all(&wifi_disconnects, 1);
+    register_all(gauges, sizeof(gauges) / sizeof(gauges[0]));
+    return esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, on_wifi_disconnected, NULL);
+}
+
+esp_err_t board_metrics_serve(void)
+{
+    static const httpd_uri_t uri = { .uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler };
+    return local_server_add_handler(&uri);
+}
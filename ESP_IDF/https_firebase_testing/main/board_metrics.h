@@ -0,0 +1,57 @@
+#ifndef BOARD_METRICS_H
+#define BOARD_METRICS_H
+
+#include <esp_err.h>
+#include "esp_http_client.h"
+#include "telemetry_metrics.h"
+
+// The firmware's metrics, scraped from http://<board>/metrics (see
+// local_server.h). Hot paths bump them directly, queue depths, heap and
+// Wi-Fi are read when scraped.
+
+#define BOARD_METRICS_HTTP_EVENTS (HTTP_EVENT_REDIRECT + 1)
+
+typedef enum {
+    BOARD_SENSOR_DHT = 0,
+    BOARD_SENSOR_BH1750,
+    BOARD_SENSOR_MAX
+} board_sensor_t;
+
+typedef enum {
+    BOARD_HTTP_OK = 0,
+    BOARD_HTTP_CLIENT_ERROR,        // 4xx
+    BOARD_HTTP_SERVER_ERROR,        // 5xx
+    BOARD_HTTP_TRANSPORT_ERROR,     // no response at all
+    BOARD_HTTP_OUTCOME_MAX
+} board_http_outcome_t;
+
+typedef enum {
+    BOARD_LOG_RING_FULL = 0,        // the log task fell a whole ring behind
+    BOARD_LOG_RATE_LIMITED,         // over the tag's records per second
+    BOARD_LOG_LOST_MAX
+} board_log_lost_t;
+
+typedef enum {
+    BOARD_HEAP_STRICT_TASKS = 0,    // tasks that must not allocate, see app_mem.h
+    BOARD_HEAP_COUNTED_TASKS,       // our other tasks
+    BOARD_HEAP_SYSTEM,              // everything else
+    BOARD_HEAP_MAX
+} board_heap_tasks_t;
+
+extern metric_t metric_http_events[BOARD_METRICS_HTTP_EVENTS];
+extern metric_t metric_http_requests[BOARD_HTTP_OUTCOME_MAX];
+extern metric_t metric_http_request_ms;
+extern metric_t metric_sensor_reads[BOARD_SENSOR_MAX];
+extern metric_t metric_sensor_failures[BOARD_SENSOR_MAX];
+extern metric_t metric_log_lost[BOARD_LOG_LOST_MAX];
+extern metric_t metric_heap_allocs[BOARD_HEAP_MAX];
+extern metric_t metric_tls_fallbacks;
+
+/* Register everything and count Wi-Fi disconnects. Call before the tasks
+ * start, serving /metrics waits for local_server_start(). */
+esp_err_t board_metrics_init(void);
+
+/* Add /metrics to the LAN server */
+esp_err_t board_metrics_serve(void);
+
+#endif // BOARD_METRICS_H
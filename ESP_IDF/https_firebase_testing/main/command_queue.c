@@ -0,0 +1,171 @@
+#include "command_queue.h"
+#include "net_sched.h"
+#include "shadow.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dlog.h"
+#include "cJSON.h"
+
+static const char *TAG_QUEUE = "COMMAND_QUEUE";
+
+static const char *queue_url;
+// Push IDs sort by time, so the oldest batch is the first keys
+static char take_url[HTTP_URL_MAX];
+
+// Only the button task reads the queue, a batch is too big for its stack
+static char take_buf[COMMAND_QUEUE_BATCH * COMMAND_QUEUE_ENTRY_MAX + 2];
+
+// Longest key the database allows, and the trim body of one, escaped
+#define DB_KEY_MAX 768
+static char bad_key_body[2 * DB_KEY_MAX + 16];
+
+// Body of the trim PATCH, {"<key>":null,...}
+typedef struct {
+    const char *body;
+    int len;
+    int pos;
+} trim_body_t;
+
+void command_queue_init(const char *url)
+{
+    queue_url = url;
+    snprintf(take_url, sizeof(take_url), "%s?orderBy=%%22%%24key%%22&limitToFirst=%d", url, COMMAND_QUEUE_BATCH);
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    return strcmp(((const queued_command_t *)a)->key, ((const queued_command_t *)b)->key);
+}
+
+static void trim_reset(void *ctx)
+{
+    ((trim_body_t *)ctx)->pos = 0;
+}
+
+static int trim_next(void *ctx, char *buf, int size)
+{
+    trim_body_t *trim = ctx;
+    int n = trim->len - trim->pos < size ? trim->len - trim->pos : size;
+    memcpy(buf, trim->body + trim->pos, n);
+    trim->pos += n;
+    return n;
+}
+
+static esp_err_t trim_stream(trim_body_t *trim)
+{
+    http_body_source_t source = { .reset = trim_reset, .next = trim_next, .ctx = trim };
+    return net_sched_stream(NET_CLASS_COMMAND, queue_url, HTTP_METHOD_PATCH, &source, HTTP_STREAM_CONTENT_LENGTH);
+}
+
+/* Append "<key>":null to a trim body at len, the first key_max characters of
+ * the key, escaped. Needs room for 2 * key_max + 8, returns the new length. */
+static int trim_entry(char *body, int len, const char *key, int key_max)
+{
+    body[len++] = '"';
+    for (const char *c = key; *c && c - key < key_max; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            body[len++] = '\\';
+        body[len++] = *c;
+    }
+    return len + sprintf(body + len, "\":null");
+}
+
+/* Delete an entry whose key doesn't fit a queued_command_t. Left in place it
+ * would sit at the head of the queue and come back in every read. */
+static void trim_bad_key(const char *key)
+{
+    trim_body_t trim = { .body = bad_key_body };
+    bad_key_body[trim.len++] = '{';
+    trim.len = trim_entry(bad_key_body, trim.len, key, DB_KEY_MAX);
+    bad_key_body[trim.len++] = '}';
+    if (trim_stream(&trim) != ESP_OK)
+        DLOGE(TAG_QUEUE, "Failed to trim a %d byte key.", (int)strlen(key));
+}
+
+int64_t command_queue_marker(const char *desired)
+{
+    cJSON *json = cJSON_Parse(desired);
+    cJSON *version = cJSON_GetObjectItem(cJSON_GetObjectItem(json, COMMAND_QUEUE_MARKER), "version");
+    int64_t marker = cJSON_IsNumber(version) ? (int64_t)version->valuedouble : 0;
+    cJSON_Delete(json);
+    return marker;
+}
+
+esp_err_t command_queue_take(queued_command_t *out, int *count, bool *more)
+{
+    *count = 0;
+    *more = false;
+    esp_err_t err = net_sched_get_sized(NET_CLASS_COMMAND, take_url, take_buf, sizeof(take_buf));
+    if (err != ESP_OK)
+        return err;
+
+    cJSON *json = cJSON_Parse(take_buf);
+    if (json == NULL)
+    {
+        // No keys to go on, the next read gets the batch again
+        DLOGE(TAG_QUEUE, "Failed to parse queue: %s", take_buf);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    int read = 0;
+    cJSON *entry;
+    cJSON_ArrayForEach(entry, json)
+    {
+        if (read++ == COMMAND_QUEUE_BATCH || entry->string == NULL)
+            continue;
+        if (strlen(entry->string) > COMMAND_QUEUE_KEY_LEN)
+        {
+            trim_bad_key(entry->string);
+            continue;
+        }
+        queued_command_t *cmd = &out[(*count)++];
+        memset(cmd, 0, sizeof(*cmd));
+        strcpy(cmd->key, entry->string);
+
+        cJSON *field = cJSON_GetObjectItem(entry, "field");
+        cJSON *value = cJSON_GetObjectItem(entry, "value");
+        cJSON *version = cJSON_GetObjectItem(entry, "version");
+        cJSON *seq = cJSON_GetObjectItem(entry, "seq");
+        cJSON *sent_at = cJSON_GetObjectItem(entry, "sent_at");
+        cmd->field = cJSON_IsString(field) ? shadow_field_index(field->valuestring) : -1;
+        if (!cJSON_IsNumber(value))
+            cmd->field = -1;
+        cmd->value = cJSON_IsNumber(value) ? value->valueint : 0;
+        cmd->version = cJSON_IsNumber(version) ? (int64_t)version->valuedouble : 0;
+        if (cJSON_IsNumber(seq) && cJSON_IsNumber(sent_at))
+        {
+            cmd->seq = (uint32_t)seq->valuedouble;
+            cmd->sent_at_ms = (int64_t)sent_at->valuedouble;
+        }
+    }
+    cJSON_Delete(json);
+    *more = read >= COMMAND_QUEUE_BATCH;
+
+    // REST doesn't keep the order of a filtered result
+    qsort(out, *count, sizeof(*out), compare_keys);
+    return ESP_OK;
+}
+
+esp_err_t command_queue_trim(const queued_command_t *taken, int count)
+{
+    if (count == 0)
+        return ESP_OK;
+
+    char body[COMMAND_QUEUE_BATCH * (2 * COMMAND_QUEUE_KEY_LEN + 9) + 2];
+    trim_body_t trim = { .body = body };
+    body[trim.len++] = '{';
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0)
+            body[trim.len++] = ',';
+        trim.len = trim_entry(body, trim.len, taken[i].key, COMMAND_QUEUE_KEY_LEN);
+    }
+    body[trim.len++] = '}';
+
+    esp_err_t err = trim_stream(&trim);
+    if (err != ESP_OK)
+        DLOGE(TAG_QUEUE, "Failed to trim %d commands.", count);
+    return err;
+}
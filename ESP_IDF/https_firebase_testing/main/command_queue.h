@@ -0,0 +1,54 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+// Ordered command channel next to the shadow. Dashboards push one child per
+// click to command_queue/<id>, push IDs sort in the order they were written:
+//   "<push id>": {"field": "button1", "value": 1, "version": <server ms>, "seq": .., "sent_at": ..}
+// The board takes the oldest batch, applies it in order and deletes it with
+// one multi-path PATCH, so quick toggles are never folded into one state.
+// Whoever pushes also writes the marker commands/<id>/command_queue,
+//   {"version": <server ms>}
+// next to the desired fields, so the version poll the board already makes
+// sees the queue change and the queue is only read then.
+// Only the REST transport reads the queue, on a push transport it would be
+// the one poll left. Dashboards write the desired state for those boards.
+
+// Commands per read
+#define COMMAND_QUEUE_BATCH 8
+#define COMMAND_QUEUE_KEY_LEN 20
+// Room for one entry of the response, the key, its five members and slack
+#define COMMAND_QUEUE_ENTRY_MAX 192
+// Desired child bumped with every push
+#define COMMAND_QUEUE_MARKER "command_queue"
+
+typedef struct {
+    char key[COMMAND_QUEUE_KEY_LEN + 1];
+    int field;              // shadow field index
+    int value;
+    int64_t version;
+    uint32_t seq;           // latency stamp, 0 = none
+    int64_t sent_at_ms;
+} queued_command_t;
+
+/* url: <db>/command_queue/<id>.json, must stay valid */
+void command_queue_init(const char *url);
+
+/* Version of the marker in a desired document, 0 if it has none. A newer
+ * one than last time means commands were pushed since. */
+int64_t command_queue_marker(const char *desired);
+
+/* The oldest commands into out, at most COMMAND_QUEUE_BATCH, in push order,
+ * and their number into count (0 for an empty queue). Entries that aren't
+ * commands come back with field -1, they are trimmed all the same. Keys too
+ * long to keep are deleted right away. more is set when the read was a full
+ * batch, so more may be waiting. */
+esp_err_t command_queue_take(queued_command_t *out, int *count, bool *more);
+
+/* Delete the commands take() returned, one PATCH for the whole batch */
+esp_err_t command_queue_trim(const queued_command_t *taken, int count);
+
+#endif // COMMAND_QUEUE_H
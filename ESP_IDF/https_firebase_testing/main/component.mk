@@ -1 +1 @@
-COMPONENT_EMBED_TXTFILES := certificate.pem
\ No newline at end of file
+COMPONENT_EMBED_TXTFILES := certificate.pem local_dashboard.html
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "device.h"
+#include "http.h"
+#include <stdio.h>
+#include "esp_mac.h"
+
+static char id[DEVICE_ID_LEN + 1];
+static char db[HTTP_URL_MAX];
+static char base_url[HTTP_URL_MAX];
+
+esp_err_t device_init(const char *db_url)
+{
+    uint8_t mac[6];
+    esp_err_t err = esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    if (err != ESP_OK)
+        return err;
+
+    snprintf(id, sizeof(id), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    if (snprintf(db, sizeof(db), "%s", db_url) >= (int)sizeof(db) ||
+        snprintf(base_url, sizeof(base_url), "%s/devices/%s", db_url, id) >= (int)sizeof(base_url))
+        return ESP_ERR_INVALID_SIZE;
+    return ESP_OK;
+}
+
+const char *device_id(void)
+{
+    return id;
+}
+
+const char *device_base_url(void)
+{
+    return base_url;
+}
+
+int device_url(char *buf, size_t size, const char *node)
+{
+    return snprintf(buf, size, "%s/%s.json", base_url, node);
+}
+
+int device_tree_url(char *buf, size_t size, const char *tree, const char *child)
+{
+    if (child == NULL)
+        return snprintf(buf, size, "%s/%s/%s.json", db, tree, id);
+    return snprintf(buf, size, "%s/%s/%s/%s.json", db, tree, id, child);
+}
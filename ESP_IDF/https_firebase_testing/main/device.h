@@ -0,0 +1,25 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stddef.h>
+#include <esp_err.h>
+
+// Station MAC in lowercase hex, the key of this board everywhere in the database
+#define DEVICE_ID_LEN 12
+
+/* Read the MAC and remember the database root, call once at boot */
+esp_err_t device_init(const char *db_url);
+
+const char *device_id(void);
+
+/* <db>/devices/<id>, the subtree only this board writes */
+const char *device_base_url(void);
+
+/* <db>/devices/<id>/<node>.json */
+int device_url(char *buf, size_t size, const char *node);
+
+/* <db>/<tree>/<id>[/<child>].json, for fleet-wide trees keyed by board
+ * (fleet, commands, history), child may be NULL */
+int device_tree_url(char *buf, size_t size, const char *tree, const char *child);
+
+#endif // DEVICE_H
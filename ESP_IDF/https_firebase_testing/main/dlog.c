@@ -0,0 +1,356 @@
+#include "dlog.h"
+#include "board_metrics.h"
+#include "app_mem.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG_DLOG = "DLOG";
+
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void *p;
+    struct {
+        uint16_t off;           // into strings
+        uint8_t cut;            // the source was longer
+    } s;
+} dlog_value_t;
+
+typedef struct {
+    // Bounded MPMC queue sequence (Vyukov), stored minus the slot index so
+    // the zeroed ring is a valid empty one before dlog_start()
+    uint32_t seq;
+    uint32_t ts_ms;
+    const char *tag;
+    const char *fmt;
+    uint8_t level;
+    uint8_t nargs;
+    uint8_t types[DLOG_ARGS_MAX];
+    dlog_value_t values[DLOG_ARGS_MAX];
+    char strings[DLOG_STR_BYTES];
+} dlog_record_t;
+
+#define DLOG_MASK (DLOG_RING_SLOTS - 1)
+
+static dlog_record_t ring[DLOG_RING_SLOTS];
+static uint32_t head;           // next position to claim, producers
+static uint32_t tail;           // next position to print, the log task only
+
+// Records per tag in the current second, claimed slot by slot
+typedef struct {
+    const char *tag;
+    uint32_t window;            // second of the count
+    uint32_t count;
+    uint32_t limited;           // since the last report
+} dlog_tag_t;
+
+static dlog_tag_t tags[DLOG_TAGS];
+
+static const char level_letters[] = "NEWIDV";
+
+static dlog_tag_t *tag_entry(const char *tag)
+{
+    for (int i = 0; i < DLOG_TAGS; i++)
+    {
+        const char *t = __atomic_load_n(&tags[i].tag, __ATOMIC_ACQUIRE);
+        if (t == NULL)
+        {
+            const char *expected = NULL;
+            if (__atomic_compare_exchange_n(&tags[i].tag, &expected, tag, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return &tags[i];
+            t = expected;
+        }
+        if (t == tag)
+            return &tags[i];
+    }
+    return NULL;
+}
+
+/* Whether the tag is within its budget. The window reset races with other
+ * tasks counting, which can let a couple of extra records through. */
+static bool tag_allowed(const char *tag, uint32_t now_ms)
+{
+    dlog_tag_t *t = tag_entry(tag);
+    if (t == NULL)
+        return true;
+    uint32_t window = now_ms / 1000;
+    if (__atomic_load_n(&t->window, __ATOMIC_RELAXED) != window)
+    {
+        __atomic_store_n(&t->window, window, __ATOMIC_RELAXED);
+        __atomic_store_n(&t->count, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_fetch_add(&t->count, 1, __ATOMIC_RELAXED) < DLOG_TAG_RATE)
+        return true;
+    __atomic_fetch_add(&t->limited, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+/* Copy a string argument into the record, returns the bytes used */
+static size_t copy_string(dlog_record_t *rec, dlog_value_t *value, size_t used, const char *s, size_t len)
+{
+    size_t room = DLOG_STR_BYTES - used;
+    size_t n = len < room - 1 ? len : room - 1;
+    memcpy(rec->strings + used, s, n);
+    rec->strings[used + n] = '\0';
+    value->s.off = used;
+    value->s.cut = n < len;
+    return n + 1;
+}
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *fmt, const dlog_arg_t *args, int nargs)
+{
+    uint32_t now_ms = esp_log_timestamp();
+    if (!tag_allowed(tag, now_ms))
+    {
+        metric_inc(&metric_log_lost[BOARD_LOG_RATE_LIMITED]);
+        return;
+    }
+
+    uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    dlog_record_t *rec;
+    for (;;)
+    {
+        rec = &ring[pos & DLOG_MASK];
+        int32_t diff = (int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) + (pos & DLOG_MASK) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // The log task is a whole ring behind
+            metric_inc(&metric_log_lost[BOARD_LOG_RING_FULL]);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->ts_ms = now_ms;
+    rec->tag = tag;
+    rec->fmt = fmt;
+    rec->level = level;
+    rec->nargs = nargs < DLOG_ARGS_MAX ? nargs : DLOG_ARGS_MAX;
+    size_t used = 0;
+    for (int i = 0; i < rec->nargs; i++)
+    {
+        dlog_value_t *value = &rec->values[i];
+        rec->types[i] = args[i].type;
+        switch (args[i].type)
+        {
+        case DLOG_ARG_STR: {
+            const char *s = args[i].p ? args[i].p : "(null)";
+            // Only as far as fits, s may be longer than the whole ring
+            size_t room = DLOG_STR_BYTES - used;
+            used += copy_string(rec, value, used, s, strnlen(s, room));
+            break;
+        }
+        case DLOG_ARG_BYTES:
+            used += copy_string(rec, value, used, args[i].b.data, args[i].b.len > 0 ? args[i].b.len : 0);
+            break;
+        case DLOG_ARG_DOUBLE:
+            value->d = args[i].d;
+            break;
+        case DLOG_ARG_PTR:
+            value->p = args[i].p;
+            break;
+        default:
+            value->i = args[i].i;
+            break;
+        }
+        // No room left for even an empty string, the rest print as ""
+        if (used >= DLOG_STR_BYTES)
+            used = DLOG_STR_BYTES - 1;
+    }
+    __atomic_store_n(&rec->seq, pos + 1 - (pos & DLOG_MASK), __ATOMIC_RELEASE);
+}
+
+/* Take the oldest complete record, false when there is none yet */
+static bool take(dlog_record_t *out)
+{
+    dlog_record_t *rec = &ring[tail & DLOG_MASK];
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) + (tail & DLOG_MASK) != tail + 1)
+        return false;
+    memcpy(out, rec, sizeof(*out));
+    __atomic_store_n(&rec->seq, tail + DLOG_RING_SLOTS - (tail & DLOG_MASK), __ATOMIC_RELEASE);
+    tail++;
+    return true;
+}
+
+static int append(char *line, int pos, int n)
+{
+    if (n < 0)
+        return pos;
+    return pos + n < DLOG_LINE_MAX ? pos + n : DLOG_LINE_MAX - 1;
+}
+
+/* Format with the record's values. The conversion of each spec is replaced
+ * by the one matching the recorded type, so a wrong specifier prints the
+ * value instead of reading garbage. */
+static void format_record(const dlog_record_t *rec, char *line)
+{
+    const char *f = rec->fmt;
+    int pos = 0, arg = 0;
+    line[0] = '\0';
+    while (*f && pos < DLOG_LINE_MAX - 1)
+    {
+        if (*f != '%' || f[1] == '%')
+        {
+            line[pos++] = *f;
+            f += *f == '%' ? 2 : 1;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion, * taken from the args
+        const char *start = f++;
+        char spec[40];
+        int len = 0;
+        spec[len++] = '%';
+        for (; *f && strchr("-+ #0", *f); f++)
+            if (len < 6)
+                spec[len++] = *f;
+        for (int part = 0; part < 2; part++)
+        {
+            if (part == 1)
+            {
+                if (*f != '.')
+                    break;
+                spec[len++] = *f++;
+            }
+            if (*f == '*')
+            {
+                f++;
+                int star = arg < rec->nargs && rec->types[arg] <= DLOG_ARG_UINT ? (int)rec->values[arg].i : 0;
+                arg++;
+                len += snprintf(spec + len, 12, "%d", star);
+            }
+            for (int digits = 0; *f >= '0' && *f <= '9'; f++)
+                if (digits++ < 4)
+                    spec[len++] = *f;
+        }
+        while (*f && strchr("hlLqjzt", *f))
+            f++;
+        char conv = *f ? *f++ : 's';
+
+        if (arg >= rec->nargs)
+        {
+            // More specs than arguments, keep the spec as written
+            pos = append(line, pos, snprintf(line + pos, DLOG_LINE_MAX - pos, "%.*s", (int)(f - start), start));
+            continue;
+        }
+
+        const dlog_value_t *v = &rec->values[arg];
+        int n;
+        switch (rec->types[arg++])
+        {
+        case DLOG_ARG_INT:
+        case DLOG_ARG_UINT:
+            if (conv == 'c')
+            {
+                spec[len++] = 'c';
+                spec[len] = '\0';
+                n = snprintf(line + pos, DLOG_LINE_MAX - pos, spec, (int)v->i);
+                break;
+            }
+            if (strchr("fFeEgGaA", conv))
+            {
+                spec[len++] = conv;
+                spec[len] = '\0';
+                n = snprintf(line + pos, DLOG_LINE_MAX - pos, spec,
+                             rec->types[arg - 1] == DLOG_ARG_INT ? (double)v->i : (double)v->u);
+                break;
+            }
+            spec[len++] = 'l';
+            spec[len++] = 'l';
+            if (strchr("diuxXo", conv))
+                spec[len++] = conv;
+            else
+                spec[len++] = rec->types[arg - 1] == DLOG_ARG_INT ? 'd' : 'u';
+            spec[len] = '\0';
+            n = snprintf(line + pos, DLOG_LINE_MAX - pos, spec, v->i);
+            break;
+        case DLOG_ARG_DOUBLE:
+            spec[len++] = strchr("fFeEgGaA", conv) ? conv : 'f';
+            spec[len] = '\0';
+            n = snprintf(line + pos, DLOG_LINE_MAX - pos, spec, v->d);
+            break;
+        case DLOG_ARG_PTR:
+            spec[len++] = 'p';
+            spec[len] = '\0';
+            n = snprintf(line + pos, DLOG_LINE_MAX - pos, spec, v->p);
+            break;
+        default:
+            spec[len++] = 's';
+            spec[len] = '\0';
+            n = snprintf(line + pos, DLOG_LINE_MAX - pos, spec, rec->strings + v->s.off);
+            if (v->s.cut && n >= 0)
+            {
+                pos = append(line, pos, n);
+                n = snprintf(line + pos, DLOG_LINE_MAX - pos, "...");
+            }
+            break;
+        }
+        pos = append(line, pos, n);
+    }
+    line[pos] = '\0';
+}
+
+static void emit(const dlog_record_t *rec)
+{
+    static const char *colors[] = { "", LOG_COLOR_E, LOG_COLOR_W, LOG_COLOR_I, LOG_COLOR_D, LOG_COLOR_V };
+    char line[DLOG_LINE_MAX];
+    format_record(rec, line);
+    int level = rec->level <= ESP_LOG_VERBOSE ? rec->level : ESP_LOG_VERBOSE;
+    esp_log_write(level, rec->tag, "%s%c (%lu) %s: %s%s\n", colors[level], level_letters[level],
+                  (unsigned long)rec->ts_ms, rec->tag, line, colors[level][0] ? LOG_RESET_COLOR : "");
+}
+
+/* What was lost since the last report, per tag for rate limiting */
+static void report_lost(uint32_t *last_full)
+{
+    for (int i = 0; i < DLOG_TAGS; i++)
+    {
+        const char *tag = __atomic_load_n(&tags[i].tag, __ATOMIC_ACQUIRE);
+        if (tag == NULL)
+            break;
+        uint32_t limited = __atomic_exchange_n(&tags[i].limited, 0, __ATOMIC_RELAXED);
+        if (limited)
+            ESP_LOGW(TAG_DLOG, "%lu records from %s over %d/s dropped.", (unsigned long)limited, tag, DLOG_TAG_RATE);
+    }
+    uint32_t full = __atomic_load_n(&metric_log_lost[BOARD_LOG_RING_FULL].value, __ATOMIC_RELAXED);
+    if (full != *last_full)
+        ESP_LOGW(TAG_DLOG, "%lu records dropped, ring full.", (unsigned long)(full - *last_full));
+    *last_full = full;
+}
+
+static void dlog_task(void *pvParameters)
+{
+    dlog_record_t rec;
+    uint32_t last_full = 0;
+    TickType_t last_report = xTaskGetTickCount();
+    for (;;)
+    {
+        while (take(&rec))
+            emit(&rec);
+        if (xTaskGetTickCount() - last_report >= pdMS_TO_TICKS(DLOG_REPORT_PERIOD_MS))
+        {
+            report_lost(&last_full);
+            last_report = xTaskGetTickCount();
+        }
+        vTaskDelay(pdMS_TO_TICKS(DLOG_POLL_MS));
+    }
+}
+
+APP_TASK_DEFINE(log, DLOG_TASK_STACK);
+
+esp_err_t dlog_start(void)
+{
+    return APP_TASK_START(log, dlog_task, "Log Task", DLOG_TASK_PRIO, true);
+}
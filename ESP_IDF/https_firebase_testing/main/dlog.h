@@ -0,0 +1,124 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "esp_log.h"
+
+// Deferred logging for the hot paths. ESP_LOGx formats and prints in the
+// calling task, at 115200 baud that blocks it for a few ms per line. DLOGx
+// takes the same arguments but only records the format pointer and the
+// arguments, typed, into a lock-free ring. A low priority task formats and
+// prints them later with esp_log_write(), timestamped when recorded.
+//
+//   DLOGI(TAG, "HTTP GET status: %d (%d ms)", status, elapsed_ms);
+//   DLOGI(TAG, "data=%s", dlog_bytes(evt->data, evt->data_len));
+//
+// - fmt and tag must be string literals or otherwise outlive the record.
+// - Strings are copied, DLOG_STR_BYTES per record shared by all of them,
+//   longer ones are cut and end in "...". dlog_bytes() logs a buffer that
+//   isn't NUL terminated.
+// - At most DLOG_ARGS_MAX arguments, %n is not supported.
+// - Each tag gets DLOG_TAG_RATE records per second. A full ring drops the
+//   record. Both are counted in log_records_dropped_total (board_metrics.h)
+//   and reported by the log task every DLOG_REPORT_PERIOD_MS.
+
+#define DLOG_RING_SLOTS 32          // power of two
+#define DLOG_ARGS_MAX 8
+#define DLOG_STR_BYTES 48
+#define DLOG_TAG_RATE 20            // records per tag and second
+#define DLOG_TAGS 16                // tags rate limited, the ones after that aren't
+#define DLOG_LINE_MAX 160           // formatted message, longer is cut
+#define DLOG_TASK_PRIO 1
+#define DLOG_TASK_STACK 3072
+#define DLOG_POLL_MS 20             // log task sleep while the ring is empty
+#define DLOG_REPORT_PERIOD_MS 10000 // how often drops and rate limiting are reported
+
+typedef enum {
+    DLOG_ARG_INT = 0,
+    DLOG_ARG_UINT,
+    DLOG_ARG_DOUBLE,
+    DLOG_ARG_PTR,
+    DLOG_ARG_STR,
+    DLOG_ARG_BYTES,
+} dlog_arg_type_t;
+
+// A buffer of len bytes, logged with %s
+typedef struct {
+    const void *data;
+    int len;
+} dlog_bytes_t;
+
+typedef struct {
+    uint8_t type;               // dlog_arg_type_t
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const void *p;
+        dlog_bytes_t b;
+    };
+} dlog_arg_t;
+
+static inline dlog_bytes_t dlog_bytes(const void *data, int len)
+{
+    return (dlog_bytes_t){ .data = data, .len = len };
+}
+
+static inline dlog_arg_t dlog_arg_int(long long v) { return (dlog_arg_t){ .type = DLOG_ARG_INT, .i = v }; }
+static inline dlog_arg_t dlog_arg_uint(unsigned long long v) { return (dlog_arg_t){ .type = DLOG_ARG_UINT, .u = v }; }
+static inline dlog_arg_t dlog_arg_double(double v) { return (dlog_arg_t){ .type = DLOG_ARG_DOUBLE, .d = v }; }
+static inline dlog_arg_t dlog_arg_ptr(const volatile void *v) { return (dlog_arg_t){ .type = DLOG_ARG_PTR, .p = (const void *)v }; }
+static inline dlog_arg_t dlog_arg_str(const char *v) { return (dlog_arg_t){ .type = DLOG_ARG_STR, .p = v }; }
+static inline dlog_arg_t dlog_arg_bytes(dlog_bytes_t v) { return (dlog_arg_t){ .type = DLOG_ARG_BYTES, .b = v }; }
+
+// The argument's type picks the constructor, nothing is converted by format
+#define DLOG_ARG(x) _Generic((x),                                                   \
+    char: dlog_arg_int, signed char: dlog_arg_int, short: dlog_arg_int,             \
+    int: dlog_arg_int, long: dlog_arg_int, long long: dlog_arg_int,                 \
+    _Bool: dlog_arg_uint, unsigned char: dlog_arg_uint, unsigned short: dlog_arg_uint, \
+    unsigned int: dlog_arg_uint, unsigned long: dlog_arg_uint,                      \
+    unsigned long long: dlog_arg_uint,                                              \
+    float: dlog_arg_double, double: dlog_arg_double,                                \
+    char *: dlog_arg_str, const char *: dlog_arg_str,                               \
+    dlog_bytes_t: dlog_arg_bytes,                                                   \
+    default: dlog_arg_ptr)(x)
+
+#define DLOG_COUNT(...) DLOG_COUNT_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_COUNT_(_, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_ARGS(...) DLOG_CAT(DLOG_ARGS_, DLOG_COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define DLOG_ARGS_0()
+#define DLOG_ARGS_1(a) DLOG_ARG(a)
+#define DLOG_ARGS_2(a, ...) DLOG_ARG(a), DLOG_ARGS_1(__VA_ARGS__)
+#define DLOG_ARGS_3(a, ...) DLOG_ARG(a), DLOG_ARGS_2(__VA_ARGS__)
+#define DLOG_ARGS_4(a, ...) DLOG_ARG(a), DLOG_ARGS_3(__VA_ARGS__)
+#define DLOG_ARGS_5(a, ...) DLOG_ARG(a), DLOG_ARGS_4(__VA_ARGS__)
+#define DLOG_ARGS_6(a, ...) DLOG_ARG(a), DLOG_ARGS_5(__VA_ARGS__)
+#define DLOG_ARGS_7(a, ...) DLOG_ARG(a), DLOG_ARGS_6(__VA_ARGS__)
+#define DLOG_ARGS_8(a, ...) DLOG_ARG(a), DLOG_ARGS_7(__VA_ARGS__)
+
+// Levels above LOG_LOCAL_LEVEL compile away, as with ESP_LOGx
+#define DLOG_LEVEL(level, tag, fmt, ...)                                                    \
+    do {                                                                                    \
+        if ((level) <= LOG_LOCAL_LEVEL) {                                                   \
+            const dlog_arg_t dlog_args_[] = { { 0 }, DLOG_ARGS(__VA_ARGS__) };              \
+            dlog_write((level), (tag), (fmt), dlog_args_ + 1,                               \
+                       (int)(sizeof(dlog_args_) / sizeof(dlog_args_[0])) - 1);              \
+        }                                                                                   \
+    } while (0)
+
+#define DLOGE(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+/* Record one line, from any task. Never blocks, lock-free. */
+void dlog_write(esp_log_level_t level, const char *tag, const char *fmt, const dlog_arg_t *args, int nargs);
+
+/* Start the log task. Records made before are kept until the ring fills. */
+esp_err_t dlog_start(void);
+
+#endif // DLOG_H
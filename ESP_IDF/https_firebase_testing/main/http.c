@@ -0,0 +1,388 @@
+#include "http.h"
+#include "http_trace.h"
+#include "http_backoff.h"
+#include "board_metrics.h"
+#include "dlog.h"
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// External Certificates
+extern const uint8_t certificate_pem_start[] asm("_binary_certificate_pem_start");
+extern const uint8_t certificate_pem_end[] asm("_binary_certificate_pem_end");
+
+static const char *TAG = "HTTP_CLIENT";
+
+// State of one request, handed to the event handler as user_data
+typedef struct {
+    char *data;             // response buffer of data_size bytes, or NULL
+    int data_size;
+    int data_len;
+    int rx_len;             // response body bytes, whether kept or not
+    bool streaming;         // body written by the caller, SEND is marked after it
+    http_trace_t trace;
+} http_req_ctx_t;
+
+// A client kept by a task that called http_session_bind(), with its buffers
+// and TLS session, connected while the server keeps the connection open
+typedef struct {
+    TaskHandle_t owner;
+    esp_http_client_handle_t client;
+} http_session_t;
+
+static http_session_t sessions[HTTP_SESSIONS];
+static int session_count;
+
+/* Callback or event handler */
+esp_err_t http_event_handler(esp_http_client_event_t* evt)
+{
+    http_req_ctx_t *ctx = (http_req_ctx_t *)evt->user_data;
+    if (evt->event_id >= 0 && evt->event_id < BOARD_METRICS_HTTP_EVENTS)
+        metric_inc(&metric_http_events[evt->event_id]);
+
+    switch (evt->event_id)
+    {
+    case HTTP_EVENT_ERROR:
+        DLOGI(TAG, "HTTP_EVENT_ERROR");
+        break;
+
+    case HTTP_EVENT_ON_CONNECTED:
+        DLOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
+        if (ctx)
+            http_trace_mark(&ctx->trace, HTTP_PHASE_CONNECT);
+        break;
+
+    case HTTP_EVENT_HEADERS_SENT:
+        // Our bodies are small enough to go out in the same flight as the headers
+        if (ctx && !ctx->streaming)
+            http_trace_mark(&ctx->trace, HTTP_PHASE_SEND);
+        break;
+
+    case HTTP_EVENT_ON_HEADER:
+        // First parsed header means the first response bytes have arrived
+        if (ctx)
+            http_trace_mark(&ctx->trace, HTTP_PHASE_TTFB);
+        break;
+
+    case HTTP_EVENT_ON_DATA:
+        DLOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d, data=%s", evt->data_len, dlog_bytes(evt->data, evt->data_len));
+        if (ctx)
+            ctx->rx_len += evt->data_len;
+
+        if (ctx && ctx->data)
+        {
+            if (ctx->data_len + evt->data_len >= ctx->data_size)
+                return ESP_FAIL;
+
+            memcpy(ctx->data + ctx->data_len, evt->data, evt->data_len);
+            ctx->data_len += evt->data_len;
+            ctx->data[ctx->data_len] = '\0'; // Ensure null termination
+        }
+        break;
+
+    case HTTP_EVENT_ON_FINISH:
+        if (ctx)
+            http_trace_mark(&ctx->trace, HTTP_PHASE_BODY);
+        break;
+
+    case HTTP_EVENT_DISCONNECTED:
+        DLOGD(TAG, "HTTP_EVENT_DISCONNECTED");
+        break;
+
+    default:
+        break;
+    }
+    return ESP_OK;
+}
+
+void http_session_bind(void)
+{
+    int i = __atomic_fetch_add(&session_count, 1, __ATOMIC_RELAXED);
+    if (i < HTTP_SESSIONS)
+        sessions[i].owner = xTaskGetCurrentTaskHandle();
+}
+
+static http_session_t *current_session(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < HTTP_SESSIONS; i++)
+    {
+        if (sessions[i].owner == self)
+            return &sessions[i];
+    }
+    return NULL;
+}
+
+/* The calling task's kept client pointed at url, or one for this request only */
+static esp_http_client_handle_t request_begin(const char *url, esp_http_client_method_t method, http_req_ctx_t *ctx,
+                                              http_session_t **session)
+{
+    *session = current_session();
+    if (*session && (*session)->client)
+    {
+        // Same host keeps the connection, another one reconnects
+        esp_http_client_handle_t client = (*session)->client;
+        esp_http_client_set_url(client, url);
+        esp_http_client_set_method(client, method);
+        esp_http_client_set_user_data(client, ctx);
+        esp_http_client_set_post_field(client, NULL, 0);
+        esp_http_client_delete_header(client, "Transfer-Encoding");
+        return client;
+    }
+
+    // HTTP client configuration
+    esp_http_client_config_t config = {
+        .event_handler = http_event_handler,
+        .method = method,
+        .url = url,
+        .user_data = ctx,
+        .cert_pem = (const char *)certificate_pem_start,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client)
+        esp_http_client_set_header(client, "Content-Type", "application/json");
+    if (client && *session)
+        (*session)->client = client;
+    return client;
+}
+
+/* A kept connection may have been closed by the server while idle, a
+ * request failing on it gets one more try on a fresh one. One that failed
+ * on a connection of its own (CONNECT seen) isn't tried again. */
+static esp_err_t request_perform(esp_http_client_handle_t client, http_session_t *session, http_req_ctx_t *ctx)
+{
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK && session && ctx->trace.mark[HTTP_PHASE_CONNECT] == 0)
+    {
+        esp_http_client_close(client);
+        ctx->data_len = 0;
+        ctx->rx_len = 0;
+        if (ctx->data)
+            ctx->data[0] = '\0';
+        err = esp_http_client_perform(client);
+    }
+    return err;
+}
+
+/* Keep the session's connection for the next request if asked to */
+static void request_end(esp_http_client_handle_t client, http_session_t *session, bool keep)
+{
+    if (session == NULL)
+        esp_http_client_cleanup(client);
+    else if (!keep)
+        esp_http_client_close(client);
+}
+
+/* Functions GET method */
+esp_err_t http_client_get_req(char* data, const char* url)
+{
+    return http_client_get_sized(data, MAX_BUFFER_SIZE, url);
+}
+
+esp_err_t http_client_get_sized(char *data, int size, const char *url)
+{
+    esp_err_t ret_code = ESP_FAIL;
+    http_req_ctx_t ctx = { .data = data, .data_size = size };
+    data[0] = '\0';
+    http_trace_begin(&ctx.trace, url);
+    http_trace_resolve(&ctx.trace, url);
+
+    http_session_t *session;
+    esp_http_client_handle_t client = request_begin(url, HTTP_METHOD_GET, &ctx, &session);
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+    esp_err_t err = request_perform(client, session, &ctx);
+    http_trace_end(&ctx.trace);
+    int elapsed_ms = (int)((ctx.trace.mark[HTTP_PHASE_TOTAL] - ctx.trace.start) / 1000);
+    int status = (err == ESP_OK) ? esp_http_client_get_status_code(client) : 0;
+    http_backoff_report(err, status);
+    if (err == ESP_OK)
+    {
+        if (status == 200)
+        {
+            DLOGI(TAG, "HTTP GET status: %d (%d ms)", status, elapsed_ms);
+            ret_code = ESP_OK;
+        }
+        else
+        {
+            DLOGE(TAG, "HTTP GET status: %d (%d ms)", status, elapsed_ms);
+        }
+    }
+    else
+    {
+        DLOGE(TAG, "Failed to send GET request after %d ms", elapsed_ms);
+    }
+    request_end(client, session, err == ESP_OK);
+
+    return ret_code;
+}
+
+/* Silent writes ask Firebase for a bodyless 204 instead of echoing the data */
+static esp_err_t silent_url(char *buf, size_t size, const char *url)
+{
+    int n = snprintf(buf, size, "%s%cprint=silent", url, strchr(url, '?') ? '&' : '?');
+    return n < (int)size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/* HTTP POST function, kept for callers that want the full echo */
+esp_err_t http_client_post_req(const char* data_post, const char* post_url)
+{
+    return http_client_write_req(data_post, post_url, HTTP_ACK_FULL);
+}
+
+/* HTTP PUT with acknowledgement level */
+esp_err_t http_client_write_req(const char* data_post, const char* post_url, http_ack_mode_t ack)
+{
+    esp_err_t ret_code = ESP_FAIL;
+    http_req_ctx_t ctx = { 0 };
+    char url[HTTP_URL_MAX];
+
+    if (ack != HTTP_ACK_FULL)
+    {
+        if (silent_url(url, sizeof(url), post_url) != ESP_OK)
+            return ESP_ERR_INVALID_SIZE;
+        post_url = url;
+        ack = HTTP_ACK_SILENT;
+    }
+    http_trace_begin(&ctx.trace, post_url);
+    http_trace_resolve(&ctx.trace, post_url);
+
+    http_session_t *session;
+    esp_http_client_handle_t client = request_begin(post_url, HTTP_METHOD_PUT, &ctx, &session);
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+    esp_http_client_set_post_field(client, data_post, strlen(data_post));
+
+    esp_err_t err = request_perform(client, session, &ctx);
+    http_trace_end(&ctx.trace);
+    int elapsed_ms = (int)((ctx.trace.mark[HTTP_PHASE_TOTAL] - ctx.trace.start) / 1000);
+    int status = (err == ESP_OK) ? esp_http_client_get_status_code(client) : 0;
+    http_backoff_report(err, status);
+    if (err == ESP_OK)
+    {
+        if (status == 200 || status == 204)
+        {
+            DLOGI(TAG, "HTTP PUT status: %d (%d ms)", status, elapsed_ms);
+            http_write_record(post_url, ack, strlen(data_post), ctx.rx_len, 0);
+            ret_code = ESP_OK;
+        }
+        else
+        {
+            DLOGE(TAG, "HTTP PUT status: %d (%d ms)", status, elapsed_ms);
+        }
+    }
+    else
+    {
+        DLOGE(TAG, "Failed to send PUT request after %d ms", elapsed_ms);
+    }
+    request_end(client, session, err == ESP_OK);
+    return ret_code;
+}
+
+/* Streamed upload, the body never exists in one piece */
+esp_err_t http_client_stream_req(const char* stream_url, esp_http_client_method_t method, http_ack_mode_t ack,
+                                 http_stream_mode_t mode, http_body_source_t* source)
+{
+    esp_err_t ret_code = ESP_FAIL;
+    http_req_ctx_t ctx = { .streaming = true };
+    char url[HTTP_URL_MAX];
+    // Room in front of the data for the chunk size line and behind it for CRLF
+    char buf[8 + HTTP_STREAM_BUF_SIZE + 2];
+    char *data = buf + 8;
+    int n;
+
+    if (ack != HTTP_ACK_FULL)
+    {
+        if (silent_url(url, sizeof(url), stream_url) != ESP_OK)
+            return ESP_ERR_INVALID_SIZE;
+        stream_url = url;
+        ack = HTTP_ACK_SILENT;
+    }
+
+    // Counting pass, nothing is kept
+    int content_length = -1;
+    if (mode == HTTP_STREAM_CONTENT_LENGTH)
+    {
+        content_length = 0;
+        source->reset(source->ctx);
+        while ((n = source->next(source->ctx, data, HTTP_STREAM_BUF_SIZE)) > 0)
+            content_length += n;
+    }
+    source->reset(source->ctx);
+
+    http_trace_begin(&ctx.trace, stream_url);
+    http_trace_resolve(&ctx.trace, stream_url);
+
+    http_session_t *session;
+    esp_http_client_handle_t client = request_begin(stream_url, method, &ctx, &session);
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+    if (content_length < 0)
+        esp_http_client_delete_header(client, "Content-Length");
+
+    // A negative length makes the client send Transfer-Encoding: chunked,
+    // the chunk framing itself is ours to write
+    esp_err_t err = esp_http_client_open(client, content_length);
+    if (err != ESP_OK && session)
+    {
+        esp_http_client_close(client);
+        err = esp_http_client_open(client, content_length);
+    }
+    int body_len = 0;
+    while (err == ESP_OK)
+    {
+        n = source->next(source->ctx, data, HTTP_STREAM_BUF_SIZE);
+        char *out = data;
+        int out_len = n;
+        if (content_length < 0)
+        {
+            char size_line[8];
+            int hdr = snprintf(size_line, sizeof(size_line), "%x\r\n", n);
+            out -= hdr;
+            memcpy(out, size_line, hdr);
+            memcpy(data + n, "\r\n", 2);
+            out_len += hdr + 2;
+        }
+        if (out_len > 0 && esp_http_client_write(client, out, out_len) != out_len)
+            err = ESP_FAIL;
+        body_len += n;
+        if (n == 0)
+            break;
+    }
+    http_trace_mark(&ctx.trace, HTTP_PHASE_SEND);
+
+    int status = 0;
+    if (err == ESP_OK && esp_http_client_fetch_headers(client) >= 0)
+    {
+        status = esp_http_client_get_status_code(client);
+        esp_http_client_flush_response(client, NULL);
+        http_trace_mark(&ctx.trace, HTTP_PHASE_BODY);
+    }
+    else
+    {
+        err = ESP_FAIL;
+    }
+    http_trace_end(&ctx.trace);
+    int elapsed_ms = (int)((ctx.trace.mark[HTTP_PHASE_TOTAL] - ctx.trace.start) / 1000);
+    http_backoff_report(err, status);
+
+    if (err == ESP_OK && (status == 200 || status == 204))
+    {
+        DLOGI(TAG, "HTTP stream status: %d, %d bytes (%d ms)", status, body_len, elapsed_ms);
+        http_write_record(stream_url, ack, body_len, ctx.rx_len, 0);
+        ret_code = ESP_OK;
+    }
+    else if (err == ESP_OK)
+    {
+        DLOGE(TAG, "HTTP stream status: %d (%d ms)", status, elapsed_ms);
+    }
+    else
+    {
+        DLOGE(TAG, "Failed to stream request after %d ms, %d bytes sent", elapsed_ms, body_len);
+    }
+    // Only perform() leaves the client ready for another request on the same
+    // connection, the client itself is kept
+    request_end(client, session, false);
+    return ret_code;
+}
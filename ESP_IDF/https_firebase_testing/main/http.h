@@ -0,0 +1,77 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <esp_err.h>
+#include "esp_http_client.h"
+
+// Define maximum buffer size
+#define MAX_BUFFER_SIZE 1024    // a full desired state
+#define HTTP_URL_MAX 256
+
+// Write acknowledgement levels
+typedef enum {
+    HTTP_ACK_FULL = 0,      // 200, Firebase echoes the written JSON back
+    HTTP_ACK_SILENT,        // ?print=silent, 204 and no body
+    HTTP_ACK_PIPELINED,     // silent, sent back-to-back with other writes on one connection
+    HTTP_ACK_MAX
+} http_ack_mode_t;
+
+// One write of a pipelined batch, all urls must be on the same host
+typedef struct {
+    const char *url;
+    const char *data;
+    esp_err_t result;
+} http_write_t;
+
+#define HTTP_PIPELINE_MAX 4
+
+// Body producer for streamed uploads: next() fills buf with at most size bytes
+// and returns how many, 0 at the end; reset() rewinds to the start.
+// For HTTP_STREAM_CONTENT_LENGTH both passes must produce the same bytes.
+typedef struct {
+    void (*reset)(void *ctx);
+    int (*next)(void *ctx, char *buf, int size);
+    void *ctx;
+} http_body_source_t;
+
+typedef enum {
+    HTTP_STREAM_CHUNKED = 0,        // Transfer-Encoding: chunked, one pass
+    HTTP_STREAM_CONTENT_LENGTH      // counting pass first, then the upload
+} http_stream_mode_t;
+
+// Size of the one buffer a streamed upload goes through
+#define HTTP_STREAM_BUF_SIZE 256
+
+// Tasks keeping an HTTP client across requests, the scheduler lanes
+#define HTTP_SESSIONS 2
+
+// Callback function declaration
+esp_err_t http_event_handler(esp_http_client_event_t *evt);
+
+// Keep one client, its buffers and its TLS session for the calling task's
+// requests instead of setting them up for each one. Call once from the task,
+// at its start. Other tasks still get a client per request.
+void http_session_bind(void);
+
+// HTTP GET and PUT function declarations
+esp_err_t http_client_get_req(char *data, const char *url);
+// GET into a buffer of size bytes, fails if the body doesn't fit
+esp_err_t http_client_get_sized(char *data, int size, const char *url);
+esp_err_t http_client_post_req(const char *data, const char *url);
+
+// PUT with a chosen acknowledgement level (FULL or SILENT)
+esp_err_t http_client_write_req(const char *data, const char *url, http_ack_mode_t ack);
+
+// Pipelined silent PUTs, per-write outcome in writes[i].result
+esp_err_t http_client_pipeline_req(http_write_t *writes, int count);
+
+// Upload a body from a source through a fixed buffer, memory use does not
+// depend on the body size
+esp_err_t http_client_stream_req(const char *url, esp_http_client_method_t method, http_ack_mode_t ack,
+                                 http_stream_mode_t mode, http_body_source_t *source);
+
+// Per-path accounting of what each acknowledgement mode cost and saved
+void http_write_record(const char *url, http_ack_mode_t ack, int body_len, int rx_len, int round_trips_saved);
+void http_write_dump(void);
+
+#endif // HTTP_H
@@ -0,0 +1,192 @@
+#include "http_backoff.h"
+#include "board_metrics.h"
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_log.h"
+#include "dlog.h"
+
+static const char *TAG_BACKOFF = "HTTP_BACKOFF";
+
+static const char *state_names[] = { "closed", "open", "half-open" };
+
+// Breaker state
+static http_breaker_state_t state = HTTP_BREAKER_CLOSED;
+static uint32_t consecutive_failures;
+static uint32_t sleep_ms = HTTP_BACKOFF_BASE_MS;
+static int64_t next_probe_us;
+
+// Token bucket, in thousandths of a token
+static int64_t tokens_milli = HTTP_RATE_BURST * 1000;
+static int64_t last_refill_us;
+
+// Counters
+static uint32_t admitted;
+static uint32_t shed_open;
+static uint32_t shed_rate;
+static uint32_t trips;
+static uint32_t probes;
+
+static portMUX_TYPE backoff_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Decorrelated jitter, boards that failed together spread out on retry */
+static uint32_t next_sleep_ms(uint32_t prev)
+{
+    uint32_t upper = prev * 3;
+    if (upper > HTTP_BACKOFF_CAP_MS || upper < prev)
+        upper = HTTP_BACKOFF_CAP_MS;
+    uint32_t next = HTTP_BACKOFF_BASE_MS + esp_random() % (upper - HTTP_BACKOFF_BASE_MS + 1);
+    return next < HTTP_BACKOFF_CAP_MS ? next : HTTP_BACKOFF_CAP_MS;
+}
+
+static void trip(int64_t now)
+{
+    sleep_ms = next_sleep_ms(sleep_ms);
+    next_probe_us = now + (int64_t)sleep_ms * 1000;
+    state = HTTP_BREAKER_OPEN;
+    trips++;
+}
+
+static void refill(int64_t now)
+{
+    if (last_refill_us == 0)
+        last_refill_us = now;
+    tokens_milli += (now - last_refill_us) * HTTP_RATE_PER_SEC / 1000;
+    if (tokens_milli > HTTP_RATE_BURST * 1000)
+        tokens_milli = HTTP_RATE_BURST * 1000;
+    last_refill_us = now;
+}
+
+esp_err_t http_backoff_acquire(void)
+{
+    esp_err_t ret = ESP_OK;
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&backoff_lock);
+    if (state == HTTP_BREAKER_OPEN && now >= next_probe_us)
+    {
+        // Let exactly one request through to see if the service is back
+        state = HTTP_BREAKER_HALF_OPEN;
+        probes++;
+    }
+    else if (state != HTTP_BREAKER_CLOSED)
+    {
+        shed_open++;
+        ret = ESP_ERR_INVALID_STATE;
+    }
+
+    if (ret == ESP_OK)
+    {
+        refill(now);
+        if (tokens_milli >= 1000)
+        {
+            tokens_milli -= 1000;
+            admitted++;
+        }
+        else
+        {
+            if (state == HTTP_BREAKER_HALF_OPEN)
+            {
+                // Give the probe slot back for the next caller
+                state = HTTP_BREAKER_OPEN;
+                probes--;
+            }
+            shed_rate++;
+            ret = ESP_ERR_TIMEOUT;
+        }
+    }
+    taskEXIT_CRITICAL(&backoff_lock);
+    return ret;
+}
+
+esp_err_t http_backoff_wait_token(void)
+{
+    esp_err_t err;
+    while ((err = http_backoff_acquire()) == ESP_ERR_TIMEOUT)
+    {
+        vTaskDelay(pdMS_TO_TICKS(1000 / HTTP_RATE_PER_SEC));
+    }
+    return err;
+}
+
+void http_backoff_report(esp_err_t err, int status)
+{
+    // Client errors other than 429 mean the service is up, so they don't count
+    bool ok = (err == ESP_OK && status < 500 && status != 429);
+    metric_inc(&metric_http_requests[err != ESP_OK ? BOARD_HTTP_TRANSPORT_ERROR
+                                     : status >= 500 ? BOARD_HTTP_SERVER_ERROR
+                                     : status >= 400 ? BOARD_HTTP_CLIENT_ERROR
+                                     : BOARD_HTTP_OK]);
+    int64_t now = esp_timer_get_time();
+    http_breaker_state_t old_state;
+
+    taskENTER_CRITICAL(&backoff_lock);
+    old_state = state;
+    switch (state)
+    {
+    case HTTP_BREAKER_CLOSED:
+        consecutive_failures = ok ? 0 : consecutive_failures + 1;
+        if (consecutive_failures >= HTTP_BACKOFF_FAIL_THRESHOLD)
+            trip(now);
+        break;
+
+    case HTTP_BREAKER_HALF_OPEN:
+        if (ok)
+        {
+            state = HTTP_BREAKER_CLOSED;
+            consecutive_failures = 0;
+            sleep_ms = HTTP_BACKOFF_BASE_MS;
+        }
+        else
+        {
+            trip(now);
+        }
+        break;
+
+    case HTTP_BREAKER_OPEN:
+        // Late result of a request admitted before the trip, the probe decides
+        break;
+    }
+    http_breaker_state_t new_state = state;
+    uint32_t wait_ms = sleep_ms;
+    taskEXIT_CRITICAL(&backoff_lock);
+
+    if (new_state != old_state)
+    {
+        if (new_state == HTTP_BREAKER_OPEN)
+            DLOGW(TAG_BACKOFF, "Circuit %s -> open, next probe in %lu ms", state_names[old_state], (unsigned long)wait_ms);
+        else
+            DLOGI(TAG_BACKOFF, "Circuit %s -> %s", state_names[old_state], state_names[new_state]);
+    }
+}
+
+uint32_t http_backoff_retry_in_ms(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t ms = 0;
+
+    taskENTER_CRITICAL(&backoff_lock);
+    if (state == HTTP_BREAKER_OPEN && next_probe_us > now)
+        ms = (uint32_t)((next_probe_us - now) / 1000);
+    taskEXIT_CRITICAL(&backoff_lock);
+    return ms;
+}
+
+http_breaker_state_t http_backoff_state(void)
+{
+    return state;
+}
+
+void http_backoff_dump(void)
+{
+    taskENTER_CRITICAL(&backoff_lock);
+    http_breaker_state_t s = state;
+    uint32_t a = admitted, so = shed_open, sr = shed_rate, t = trips, p = probes;
+    taskEXIT_CRITICAL(&backoff_lock);
+
+    ESP_LOGI(TAG_BACKOFF, "Circuit %s, retry in %lu ms", state_names[s], (unsigned long)http_backoff_retry_in_ms());
+    printf("admitted %lu, shed (open) %lu, shed (rate) %lu, trips %lu, probes %lu\n", (unsigned long)a,
+           (unsigned long)so, (unsigned long)sr, (unsigned long)t, (unsigned long)p);
+}
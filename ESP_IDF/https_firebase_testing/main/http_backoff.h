@@ -0,0 +1,49 @@
+#ifndef HTTP_BACKOFF_H
+#define HTTP_BACKOFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Circuit breaker: open after this many failures in a row
+#define HTTP_BACKOFF_FAIL_THRESHOLD 3
+
+// Decorrelated jitter between probes: sleep = min(cap, random(base, 3 * sleep))
+#define HTTP_BACKOFF_BASE_MS 1000
+#define HTTP_BACKOFF_CAP_MS (5 * 60 * 1000)
+
+// Token bucket on the total request rate of the board. Over REST the steady
+// state is about 3 requests a second: the version poll, one DHT and one
+// BH1750 sample. The backlog (last_seen and traces every minute, history
+// every minute, rules every 30 s) adds under 0.1. A command adds a burst of
+// four, the queue read, report, ack and trim, so the rate keeps as much again
+// in headroom and the burst takes two commands at once.
+#define HTTP_RATE_STEADY_PER_SEC 3
+#define HTTP_RATE_PER_SEC (2 * HTTP_RATE_STEADY_PER_SEC)
+#define HTTP_RATE_BURST 8
+
+typedef enum {
+    HTTP_BREAKER_CLOSED = 0,    // normal operation
+    HTTP_BREAKER_OPEN,          // failing, everything is shed until the next probe
+    HTTP_BREAKER_HALF_OPEN      // one probe request is in flight
+} http_breaker_state_t;
+
+/* Ask to send one request.
+ * ESP_OK: go ahead, report the outcome with http_backoff_report().
+ * ESP_ERR_INVALID_STATE: breaker is open, don't send.
+ * ESP_ERR_TIMEOUT: out of tokens, don't send (see http_backoff_wait_token()). */
+esp_err_t http_backoff_acquire(void);
+
+/* Block until a token is free or the breaker opens */
+esp_err_t http_backoff_wait_token(void);
+
+/* Outcome of an admitted request: transport error or HTTP status */
+void http_backoff_report(esp_err_t err, int status);
+
+/* How long pollers should wait before trying again, 0 when healthy */
+uint32_t http_backoff_retry_in_ms(void);
+
+http_breaker_state_t http_backoff_state(void);
+void http_backoff_dump(void);
+
+#endif // HTTP_BACKOFF_H
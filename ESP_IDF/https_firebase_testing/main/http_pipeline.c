@@ -0,0 +1,318 @@
+#include "http.h"
+#include "http_trace.h"
+#include "http_backoff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_tls.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "dlog.h"
+
+// External Certificates
+extern const uint8_t certificate_pem_start[] asm("_binary_certificate_pem_start");
+extern const uint8_t certificate_pem_end[] asm("_binary_certificate_pem_end");
+
+static const char *TAG_WRITE = "HTTP_WRITE";
+
+#define HTTP_PIPELINE_TIMEOUT_MS 5000
+
+static const char *ack_names[HTTP_ACK_MAX] = { "full", "silent", "pipelined" };
+
+// What each path's writes cost on the downlink and what the ack mode saved
+typedef struct {
+    int last_mode;
+    uint32_t writes[HTTP_ACK_MAX];
+    uint32_t tx_bytes;          // request bodies
+    uint32_t rx_bytes;          // response bodies
+    uint32_t echo_saved;        // echo bytes not sent back, estimated as the body size
+    uint32_t round_trips_saved; // request/response round trips folded into a pipeline
+} write_stats_t;
+
+// One slot per traced endpoint plus one for everything else
+static write_stats_t write_stats[HTTP_EP_MAX + 1];
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Buffered reader over the TLS connection for parsing responses
+typedef struct {
+    esp_tls_t *tls;
+    char buf[256];
+    int len;
+    int pos;
+} tls_reader_t;
+
+void http_write_record(const char *url, http_ack_mode_t ack, int body_len, int rx_len, int round_trips_saved)
+{
+    int ep = http_trace_endpoint(url);
+    write_stats_t *s = &write_stats[ep == HTTP_EP_NONE ? HTTP_EP_MAX : ep];
+
+    taskENTER_CRITICAL(&write_lock);
+    s->last_mode = ack;
+    s->writes[ack]++;
+    s->tx_bytes += body_len;
+    s->rx_bytes += rx_len;
+    if (ack != HTTP_ACK_FULL)
+        s->echo_saved += body_len;
+    s->round_trips_saved += round_trips_saved;
+    taskEXIT_CRITICAL(&write_lock);
+}
+
+void http_write_dump(void)
+{
+    ESP_LOGI(TAG_WRITE, "Write acknowledgement modes per path");
+    printf("%-8s %-9s %6s %6s %6s %8s %8s %8s %6s\n", "path", "mode", "full", "silent", "pipe",
+           "tx", "rx", "saved", "rtt");
+    for (int ep = 0; ep <= HTTP_EP_MAX; ep++)
+    {
+        taskENTER_CRITICAL(&write_lock);
+        write_stats_t s = write_stats[ep];
+        taskEXIT_CRITICAL(&write_lock);
+        if (s.writes[HTTP_ACK_FULL] + s.writes[HTTP_ACK_SILENT] + s.writes[HTTP_ACK_PIPELINED] == 0)
+            continue;
+        printf("%-8s %-9s %6lu %6lu %6lu %8lu %8lu %8lu %6lu\n", http_trace_endpoint_name(ep < HTTP_EP_MAX ? ep : HTTP_EP_NONE),
+               ack_names[s.last_mode], (unsigned long)s.writes[HTTP_ACK_FULL], (unsigned long)s.writes[HTTP_ACK_SILENT],
+               (unsigned long)s.writes[HTTP_ACK_PIPELINED], (unsigned long)s.tx_bytes, (unsigned long)s.rx_bytes,
+               (unsigned long)s.echo_saved, (unsigned long)s.round_trips_saved);
+    }
+}
+
+static bool tls_write_all(esp_tls_t *tls, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = esp_tls_conn_write(tls, data, len);
+        if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_WANT_WRITE)
+            continue;
+        if (n < 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int tls_read_byte(tls_reader_t *r)
+{
+    while (r->pos == r->len)
+    {
+        ssize_t n = esp_tls_conn_read(r->tls, r->buf, sizeof(r->buf));
+        if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_WANT_WRITE)
+            continue;
+        if (n <= 0)
+            return -1;
+        r->len = n;
+        r->pos = 0;
+    }
+    return (unsigned char)r->buf[r->pos++];
+}
+
+static int tls_read_line(tls_reader_t *r, char *line, int size)
+{
+    int len = 0;
+    int c;
+    while ((c = tls_read_byte(r)) >= 0 && c != '\n')
+    {
+        if (c != '\r' && len < size - 1)
+            line[len++] = c;
+    }
+    line[len] = '\0';
+    return c < 0 ? -1 : len;
+}
+
+/* Read one response, returns the status code or -1 if it can't be framed.
+ * keep is cleared when the server is closing the connection after it. */
+static int read_response(tls_reader_t *r, http_trace_t *trace, int *body_len, bool *keep)
+{
+    char line[128];
+    int status = -1;
+    int content_length = 0;
+
+    if (tls_read_line(r, line, sizeof(line)) < 0 || sscanf(line, "HTTP/%*s %d", &status) != 1)
+        return -1;
+    http_trace_mark(trace, HTTP_PHASE_TTFB);
+
+    int len;
+    while ((len = tls_read_line(r, line, sizeof(line))) > 0)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            content_length = atoi(line + 15);
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            return -1; // chunked error bodies would need a decoder, give up on the rest
+        else if (strncasecmp(line, "Connection:", 11) == 0 &&
+                 strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0)
+            *keep = false;
+    }
+    if (len < 0)
+        return -1;
+
+    // Silent writes answer 204 with no body, anything else (errors) is skipped
+    for (int i = 0; i < content_length; i++)
+    {
+        if (tls_read_byte(r) < 0)
+            return -1;
+    }
+    http_trace_mark(trace, HTTP_PHASE_BODY);
+    *body_len = content_length;
+    return status;
+}
+
+// The pipeline connection, kept open between batches like the lanes' HTTP
+// sessions. Only the net worker pipelines, so it needs no lock.
+static esp_tls_t *pipe_tls;
+static char pipe_host[64];
+
+static void pipe_close(void)
+{
+    if (pipe_tls)
+        esp_tls_conn_destroy(pipe_tls);
+    pipe_tls = NULL;
+}
+
+static esp_err_t pipe_connect(const char *url, const char *host)
+{
+    esp_tls_cfg_t cfg = {
+        .cacert_buf = certificate_pem_start,
+        .cacert_bytes = certificate_pem_end - certificate_pem_start,
+        .timeout_ms = HTTP_PIPELINE_TIMEOUT_MS,
+    };
+    esp_tls_t *tls = esp_tls_init();
+    if (tls == NULL)
+        return ESP_ERR_NO_MEM;
+
+    if (esp_tls_conn_http_new_sync(url, &cfg, tls) != 1)
+    {
+        esp_tls_conn_destroy(tls);
+        return ESP_FAIL;
+    }
+    pipe_tls = tls;
+    strcpy(pipe_host, host);
+    return ESP_OK;
+}
+
+/* Send every request before reading any response, returns how many were
+ * answered; responses come back in request order */
+static int pipe_exchange(http_write_t *writes, http_trace_t *traces, int count, const char *host, int *statuses,
+                         int *rx_lens, bool *keep)
+{
+    char header[HTTP_URL_MAX + 160];
+    int sent = 0;
+    for (; sent < count; sent++)
+    {
+        const char *path = strstr(writes[sent].url, "://");
+        path = strchr(path ? path + 3 : writes[sent].url, '/');
+        int body_len = strlen(writes[sent].data);
+        int n = snprintf(header, sizeof(header),
+                         "PUT %s%cprint=silent HTTP/1.1\r\n"
+                         "Host: %s\r\n"
+                         "Content-Type: application/json\r\n"
+                         "Content-Length: %d\r\n"
+                         "\r\n",
+                         path ? path : "/", (path && strchr(path, '?')) ? '&' : '?', host, body_len);
+        if (n >= (int)sizeof(header) || !tls_write_all(pipe_tls, header, n) ||
+            !tls_write_all(pipe_tls, writes[sent].data, body_len))
+            break;
+        http_trace_mark(&traces[sent], HTTP_PHASE_SEND);
+    }
+
+    tls_reader_t reader = { .tls = pipe_tls };
+    int answered = 0;
+    for (; answered < sent; answered++)
+    {
+        statuses[answered] = read_response(&reader, &traces[answered], &rx_lens[answered], keep);
+        if (statuses[answered] < 0)
+            break;
+    }
+    if (answered < count)
+        *keep = false;
+    return answered;
+}
+
+/* Pipelined silent PUTs: every request goes out back-to-back on the kept
+ * TLS connection, then the statuses are collected in request order */
+esp_err_t http_client_pipeline_req(http_write_t *writes, int count)
+{
+    char host[64];
+    http_trace_t traces[HTTP_PIPELINE_MAX];
+    int statuses[HTTP_PIPELINE_MAX];
+    int rx_lens[HTTP_PIPELINE_MAX] = { 0 };
+    int64_t start = esp_timer_get_time();
+
+    if (count > HTTP_PIPELINE_MAX)
+        return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < count; i++)
+    {
+        writes[i].result = ESP_FAIL;
+        http_trace_begin(&traces[i], writes[i].url);
+    }
+
+    const char *p = strstr(writes[0].url, "://");
+    p = p ? p + 3 : writes[0].url;
+    size_t host_len = strcspn(p, ":/?");
+    if (host_len == 0 || host_len >= sizeof(host))
+        return ESP_ERR_INVALID_ARG;
+    memcpy(host, p, host_len);
+    host[host_len] = '\0';
+
+    // A kept connection may have been closed by the server while idle, a
+    // batch nothing came back for gets one more try on a fresh one
+    bool reused = pipe_tls && strcmp(pipe_host, host) == 0;
+    bool keep = true;
+    int answered;
+    while (1)
+    {
+        if (!reused)
+        {
+            pipe_close();
+            http_trace_resolve(&traces[0], writes[0].url);
+            for (int i = 1; i < count; i++)
+                traces[i].mark[HTTP_PHASE_DNS] = traces[0].mark[HTTP_PHASE_DNS];
+            esp_err_t err = pipe_connect(writes[0].url, host);
+            if (err != ESP_OK)
+            {
+                DLOGE(TAG_WRITE, "Failed to connect pipeline to %s", host);
+                http_backoff_report(ESP_FAIL, 0);
+                for (int i = 0; i < count; i++)
+                    http_trace_end(&traces[i]);
+                return err;
+            }
+            for (int i = 0; i < count; i++)
+                http_trace_mark(&traces[i], HTTP_PHASE_CONNECT);
+        }
+
+        answered = pipe_exchange(writes, traces, count, host, statuses, rx_lens, &keep);
+        if (answered > 0 || !reused)
+            break;
+        reused = false;
+        keep = true;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        http_trace_end(&traces[i]);
+        if (i >= answered)
+            continue;
+
+        http_backoff_report(ESP_OK, statuses[i]);
+        if (statuses[i] == 200 || statuses[i] == 204)
+        {
+            // Every write after the first skipped waiting out a round trip
+            writes[i].result = ESP_OK;
+            http_write_record(writes[i].url, HTTP_ACK_PIPELINED, strlen(writes[i].data), rx_lens[i], i > 0 ? 1 : 0);
+        }
+        else
+        {
+            DLOGE(TAG_WRITE, "Pipelined PUT %s status: %d", writes[i].url, statuses[i]);
+        }
+    }
+    if (answered < count)
+        http_backoff_report(ESP_FAIL, 0);
+
+    // A batch that lost its framing leaves the connection out of step
+    if (!keep)
+        pipe_close();
+    DLOGI(TAG_WRITE, "Pipelined %d/%d writes in %d ms", answered, count,
+             (int)((esp_timer_get_time() - start) / 1000));
+    return answered == count ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,197 @@
+#include "http_trace.h"
+#include "board_metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/netdb.h"
+
+static const char *TAG_TRACE = "HTTP_TRACE";
+
+// URL path fragments and short names for each traced endpoint
+static const char *endpoint_paths[HTTP_EP_MAX] = { "sensor_data.json", "Light_data.json", "button_state.json" };
+static const char *endpoint_names[HTTP_EP_MAX] = { "sensor", "light", "button" };
+static const char *phase_names[HTTP_PHASE_MAX] = { "dns", "connect", "send", "ttfb", "body", "total" };
+static const uint32_t bucket_bounds_ms[HTTP_TRACE_NUM_BUCKETS - 1] = HTTP_TRACE_BUCKETS;
+
+// One histogram per endpoint and phase, shared by all tasks
+static http_hist_t histograms[HTTP_EP_MAX][HTTP_PHASE_MAX];
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+http_endpoint_t http_trace_endpoint(const char *url)
+{
+    for (int i = 0; i < HTTP_EP_MAX; i++)
+    {
+        if (strstr(url, endpoint_paths[i]))
+            return i;
+    }
+    return HTTP_EP_NONE;
+}
+
+void http_hist_add(http_hist_t *h, uint32_t ms)
+{
+    int b = 0;
+    while (b < HTTP_TRACE_NUM_BUCKETS - 1 && ms > bucket_bounds_ms[b])
+        b++;
+    h->count[b]++;
+    h->n++;
+    if (ms > h->max_ms)
+        h->max_ms = ms;
+}
+
+void http_trace_begin(http_trace_t *trace, const char *url)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->endpoint = http_trace_endpoint(url);
+    trace->start = esp_timer_get_time();
+}
+
+void http_trace_mark(http_trace_t *trace, http_phase_t phase)
+{
+    // Keep the first mark, later events of the same kind don't move the phase
+    if (trace->mark[phase] == 0)
+        trace->mark[phase] = esp_timer_get_time();
+}
+
+void http_trace_resolve(http_trace_t *trace, const char *url)
+{
+    char host[64];
+    const char *p = strstr(url, "://");
+    p = p ? p + 3 : url;
+    size_t len = strcspn(p, ":/?");
+    if (len == 0 || len >= sizeof(host))
+        return;
+    memcpy(host, p, len);
+    host[len] = '\0';
+
+    // The result lands in the lwIP DNS cache, so the client's own lookup is a hit
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, NULL, &hints, &res) == 0)
+    {
+        freeaddrinfo(res);
+        http_trace_mark(trace, HTTP_PHASE_DNS);
+    }
+}
+
+void http_trace_end(http_trace_t *trace)
+{
+    trace->mark[HTTP_PHASE_TOTAL] = esp_timer_get_time();
+    metric_observe(&metric_http_request_ms, (uint32_t)((trace->mark[HTTP_PHASE_TOTAL] - trace->start) / 1000));
+    if (trace->endpoint == HTTP_EP_NONE)
+        return;
+
+    // Each phase runs from the previous mark we saw, so a skipped phase
+    // (reused connection, failed request) folds into the next one
+    uint32_t ms[HTTP_PHASE_MAX];
+    int64_t prev = trace->start;
+    for (int p = 0; p < HTTP_PHASE_MAX; p++)
+    {
+        if (trace->mark[p] == 0)
+        {
+            ms[p] = UINT32_MAX;
+            continue;
+        }
+        ms[p] = (uint32_t)((trace->mark[p] - prev) / 1000);
+        prev = trace->mark[p];
+    }
+    ms[HTTP_PHASE_TOTAL] = (uint32_t)((trace->mark[HTTP_PHASE_TOTAL] - trace->start) / 1000);
+
+    taskENTER_CRITICAL(&trace_lock);
+    for (int p = 0; p < HTTP_PHASE_MAX; p++)
+    {
+        if (ms[p] != UINT32_MAX)
+            http_hist_add(&histograms[trace->endpoint][p], ms[p]);
+    }
+    taskEXIT_CRITICAL(&trace_lock);
+}
+
+int http_hist_percentile(const http_hist_t *h, int pct)
+{
+    if (h->n == 0)
+        return -1;
+
+    // Report the upper bound of the bucket holding the rank, capped at the max seen
+    uint32_t rank = (h->n * pct + 99) / 100;
+    uint32_t seen = 0;
+    int b = 0;
+    for (; b < HTTP_TRACE_NUM_BUCKETS - 1; b++)
+    {
+        seen += h->count[b];
+        if (seen >= rank)
+            break;
+    }
+    uint32_t bound = (b < HTTP_TRACE_NUM_BUCKETS - 1) ? bucket_bounds_ms[b] : h->max_ms;
+    return (int)(bound < h->max_ms ? bound : h->max_ms);
+}
+
+int http_trace_percentile_ms(http_endpoint_t ep, http_phase_t phase, int pct)
+{
+    taskENTER_CRITICAL(&trace_lock);
+    int result = http_hist_percentile(&histograms[ep][phase], pct);
+    taskEXIT_CRITICAL(&trace_lock);
+    return result;
+}
+
+const char *http_trace_endpoint_name(http_endpoint_t ep)
+{
+    return (ep >= 0 && ep < HTTP_EP_MAX) ? endpoint_names[ep] : "other";
+}
+
+void http_trace_dump(void)
+{
+    ESP_LOGI(TAG_TRACE, "Per-phase latency (ms), p50/p99/max");
+    printf("%-8s %-8s %6s %6s %6s %6s\n", "endpoint", "phase", "n", "p50", "p99", "max");
+    for (int ep = 0; ep < HTTP_EP_MAX; ep++)
+    {
+        for (int p = 0; p < HTTP_PHASE_MAX; p++)
+        {
+            taskENTER_CRITICAL(&trace_lock);
+            uint32_t n = histograms[ep][p].n;
+            uint32_t max_ms = histograms[ep][p].max_ms;
+            taskEXIT_CRITICAL(&trace_lock);
+            if (n == 0)
+                continue;
+            printf("%-8s %-8s %6lu %6d %6d %6lu\n", endpoint_names[ep], phase_names[p], (unsigned long)n,
+                   http_trace_percentile_ms(ep, p, 50), http_trace_percentile_ms(ep, p, 99), (unsigned long)max_ms);
+        }
+    }
+}
+
+/* Compact form for upload: {"sensor":{"n":12,"dns":[3,40],...},...}, one [p50,p99] pair per phase */
+int http_trace_to_json(char *buf, size_t size)
+{
+    int len = snprintf(buf, size, "{");
+    int first_ep = 1;
+    for (int ep = 0; ep < HTTP_EP_MAX && len < (int)size; ep++)
+    {
+        taskENTER_CRITICAL(&trace_lock);
+        uint32_t n = histograms[ep][HTTP_PHASE_TOTAL].n;
+        taskEXIT_CRITICAL(&trace_lock);
+        if (n == 0)
+            continue;
+
+        len += snprintf(buf + len, size - len, "%s\"%s\":{\"n\":%lu", first_ep ? "" : ",",
+                        endpoint_names[ep], (unsigned long)n);
+        for (int p = 0; p < HTTP_PHASE_MAX && len < (int)size; p++)
+        {
+            len += snprintf(buf + len, size - len, ",\"%s\":[%d,%d]", phase_names[p],
+                            http_trace_percentile_ms(ep, p, 50), http_trace_percentile_ms(ep, p, 99));
+        }
+        if (len < (int)size)
+            len += snprintf(buf + len, size - len, "}");
+        first_ep = 0;
+    }
+    if (len < (int)size)
+        len += snprintf(buf + len, size - len, "}");
+
+    return len < (int)size ? len : -1;
+}
+
+void http_trace_reset(void)
+{
+    taskENTER_CRITICAL(&trace_lock);
+    memset(histograms, 0, sizeof(histograms));
+    taskEXIT_CRITICAL(&trace_lock);
+}
@@ -0,0 +1,67 @@
+#ifndef HTTP_TRACE_H
+#define HTTP_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Phases of one request, in the order they complete
+typedef enum {
+    HTTP_PHASE_DNS = 0,     // host name lookup
+    HTTP_PHASE_CONNECT,     // TCP connect + TLS handshake
+    HTTP_PHASE_SEND,        // request line, headers and body written
+    HTTP_PHASE_TTFB,        // waiting for the first response byte
+    HTTP_PHASE_BODY,        // rest of the response
+    HTTP_PHASE_TOTAL,       // whole request, start to finish
+    HTTP_PHASE_MAX
+} http_phase_t;
+
+// Endpoints we keep histograms for, matched on the URL path
+typedef enum {
+    HTTP_EP_SENSOR = 0,     // sensor_data.json
+    HTTP_EP_LIGHT,          // Light_data.json
+    HTTP_EP_BUTTON,         // button_state.json
+    HTTP_EP_MAX,
+    HTTP_EP_NONE = -1       // not traced
+} http_endpoint_t;
+
+// Histogram bucket upper bounds in ms, the last bucket catches everything above
+#define HTTP_TRACE_BUCKETS { 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 }
+#define HTTP_TRACE_NUM_BUCKETS 12
+
+// How often main dumps and uploads the histograms
+#define HTTP_TRACE_REPORT_PERIOD_MS (60 * 1000)
+
+// Fixed-bucket latency histogram, callers provide their own locking
+typedef struct {
+    uint32_t count[HTTP_TRACE_NUM_BUCKETS];
+    uint32_t n;
+    uint32_t max_ms;
+} http_hist_t;
+
+void http_hist_add(http_hist_t *h, uint32_t ms);
+int http_hist_percentile(const http_hist_t *h, int pct);
+
+// Timestamps of one request in flight (esp_timer us, 0 = phase not seen)
+typedef struct {
+    int endpoint;
+    int64_t start;
+    int64_t mark[HTTP_PHASE_MAX];
+} http_trace_t;
+
+// Per-request API, called from the HTTP layer
+http_endpoint_t http_trace_endpoint(const char *url);
+void http_trace_begin(http_trace_t *trace, const char *url);
+void http_trace_mark(http_trace_t *trace, http_phase_t phase);
+void http_trace_end(http_trace_t *trace);
+
+// Resolve the URL host up front so DNS shows up as its own phase
+void http_trace_resolve(http_trace_t *trace, const char *url);
+
+// Reporting
+int http_trace_percentile_ms(http_endpoint_t ep, http_phase_t phase, int pct);
+const char *http_trace_endpoint_name(http_endpoint_t ep);
+void http_trace_dump(void);
+int http_trace_to_json(char *buf, size_t size);
+void http_trace_reset(void);
+
+#endif // HTTP_TRACE_H
@@ -0,0 +1,257 @@
+#include "local_server.h"
+#include "shadow.h"
+#include "app_mem.h"
+#include "telemetry_fixed.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "dlog.h"
+#include "esp_http_server.h"
+#include "mdns.h"
+#include "cJSON.h"
+
+static const char *TAG_LOCAL = "LOCAL_SERVER";
+
+// The dashboard page, embedded from local_dashboard.html
+extern const char dashboard_html_start[] asm("_binary_local_dashboard_html_start");
+extern const char dashboard_html_end[] asm("_binary_local_dashboard_html_end");
+
+// Sockets looked at per broadcast, the server never holds more
+#define LOCAL_SERVER_MAX_SOCKETS 7
+
+static const local_server_config_t *config;
+static httpd_handle_t server;
+
+// Open WebSockets as of the last broadcast, samples are skipped while 0
+static volatile int ws_clients;
+
+// Last value of each output, -1 until one is known
+static int8_t states[SHADOW_FIELD_COUNT] = { -1, -1, -1 };
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// A frame to send from the server task, to one socket or to every WebSocket (fd -1)
+typedef struct {
+    int fd;
+    int len;
+    char text[LOCAL_SERVER_WS_FRAME_MAX];
+} ws_message_t;
+
+static void send_work(void *arg)
+{
+    ws_message_t *msg = arg;
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)msg->text,
+        .len = msg->len,
+    };
+    if (msg->fd >= 0)
+    {
+        httpd_ws_send_frame_async(server, msg->fd, &frame);
+        app_free(msg);
+        return;
+    }
+
+    size_t count = LOCAL_SERVER_MAX_SOCKETS;
+    int fds[LOCAL_SERVER_MAX_SOCKETS];
+    int sockets = 0;
+    if (httpd_get_client_list(server, &count, fds) == ESP_OK)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (httpd_ws_get_fd_info(server, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET)
+            {
+                httpd_ws_send_frame_async(server, fds[i], &frame);
+                sockets++;
+            }
+        }
+    }
+    ws_clients = sockets;
+    app_free(msg);
+}
+
+/* Hand a frame to the server task, sends must not race its own use of the sockets */
+static void queue_frame(int fd, const char *text, int len)
+{
+    if (server == NULL || len <= 0 || len >= LOCAL_SERVER_WS_FRAME_MAX)
+        return;
+    ws_message_t *msg = app_malloc(sizeof(*msg));
+    if (msg == NULL)
+        return;
+    msg->fd = fd;
+    msg->len = len;
+    memcpy(msg->text, text, len);
+    if (httpd_queue_work(server, send_work, msg) != ESP_OK)
+        app_free(msg);
+}
+
+static int state_frame(int field, int value, char *buf, size_t size)
+{
+    return snprintf(buf, size, "{\"field\":\"%s\",\"value\":%d}", shadow_field_name(field), value);
+}
+
+static esp_err_t root_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/html");
+    // EMBED_TXTFILES adds a terminating NUL
+    return httpd_resp_send(req, dashboard_html_start, dashboard_html_end - dashboard_html_start - 1);
+}
+
+/* The handshake's ?token= matches CONFIG_APP_LOCAL_TOKEN, always true when that is empty */
+static bool token_ok(httpd_req_t *req)
+{
+    static const char expected[] = CONFIG_APP_LOCAL_TOKEN;
+    if (expected[0] == '\0')
+        return true;
+
+    char query[64], token[sizeof(query)];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "token", token, sizeof(token)) != ESP_OK)
+        return false;
+
+    // Same time for every wrong token of the right length
+    size_t len = strlen(token);
+    if (len != sizeof(expected) - 1)
+        return false;
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++)
+        diff |= token[i] ^ expected[i];
+    return diff == 0;
+}
+
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    char text[LOCAL_SERVER_WS_FRAME_MAX];
+    if (req->method == HTTP_GET)
+    {
+        // Handshake done, a page without the token is closed right away
+        if (!token_ok(req))
+        {
+            DLOGW(TAG_LOCAL, "Closed a WebSocket without the token.");
+            return ESP_FAIL;
+        }
+        // The new page gets the outputs as they are
+        int fd = httpd_req_to_sockfd(req);
+        ws_clients++;
+        for (int i = 0; i < SHADOW_FIELD_COUNT; i++)
+        {
+            taskENTER_CRITICAL(&state_lock);
+            int value = states[i];
+            taskEXIT_CRITICAL(&state_lock);
+            if (value >= 0)
+                queue_frame(fd, text, state_frame(i, value, text, sizeof(text)));
+        }
+        return ESP_OK;
+    }
+
+    // Length first, anything longer than a command is dropped
+    uint8_t payload[LOCAL_SERVER_WS_FRAME_MAX + 1];
+    httpd_ws_frame_t frame = { .payload = payload };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK)
+        return err;
+    if (frame.len > LOCAL_SERVER_WS_FRAME_MAX)
+    {
+        DLOGW(TAG_LOCAL, "Dropped a %d byte frame.", (int)frame.len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    err = httpd_ws_recv_frame(req, &frame, LOCAL_SERVER_WS_FRAME_MAX);
+    if (err != ESP_OK || frame.type != HTTPD_WS_TYPE_TEXT)
+        return err;
+    payload[frame.len] = '\0';
+
+    cJSON *json = cJSON_Parse((const char *)payload);
+    cJSON *field = cJSON_GetObjectItem(json, "field");
+    cJSON *value = cJSON_GetObjectItem(json, "value");
+    cJSON *seq = cJSON_GetObjectItem(json, "seq");
+    int f = cJSON_IsString(field) ? shadow_field_index(field->valuestring) : -1;
+    if (f < 0 || !cJSON_IsNumber(value))
+    {
+        DLOGW(TAG_LOCAL, "Not a command: %s", (const char *)payload);
+        cJSON_Delete(json);
+        return ESP_OK;
+    }
+    int v = value->valueint ? 1 : 0;
+    long s = cJSON_IsNumber(seq) ? (long)seq->valuedouble : 0;
+    cJSON_Delete(json);
+
+    // Pin first, then the ack to the page that sent it, then the state to every page, that one included
+    config->on_command(f, v);
+    httpd_ws_frame_t ack = { .final = true, .type = HTTPD_WS_TYPE_TEXT, .payload = (uint8_t *)text };
+    ack.len = snprintf(text, sizeof(text), "{\"ack\":%ld,\"field\":\"%s\",\"value\":%d}", s, shadow_field_name(f), v);
+    httpd_ws_send_frame(req, &ack);
+    local_server_publish_state(f, v);
+    return ESP_OK;
+}
+
+esp_err_t local_server_start(const local_server_config_t *cfg)
+{
+    config = cfg;
+    httpd_config_t http_cfg = HTTPD_DEFAULT_CONFIG();
+    http_cfg.server_port = LOCAL_SERVER_PORT;
+    http_cfg.max_open_sockets = LOCAL_SERVER_MAX_SOCKETS;
+    // A phone coming back takes the oldest socket instead of being refused
+    http_cfg.lru_purge_enable = true;
+    httpd_handle_t handle;
+    esp_err_t err = httpd_start(&handle, &http_cfg);
+    if (err != ESP_OK)
+        return err;
+
+    static const httpd_uri_t root = { .uri = "/", .method = HTTP_GET, .handler = root_handler };
+    static const httpd_uri_t ws = { .uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .is_websocket = true };
+    httpd_register_uri_handler(handle, &root);
+    httpd_register_uri_handler(handle, &ws);
+    server = handle;
+
+    // esp-<id>.local, the server is still reachable by IP without it
+    char hostname[32];
+    snprintf(hostname, sizeof(hostname), "%s%s", LOCAL_SERVER_HOSTNAME_PREFIX, cfg->device_id);
+    mdns_txt_item_t txt[] = {
+        { "id", cfg->device_id },
+        { "ws", "/ws" },
+    };
+    if (mdns_init() != ESP_OK || mdns_hostname_set(hostname) != ESP_OK ||
+        mdns_instance_name_set("Firebase sensor board") != ESP_OK ||
+        mdns_service_add(NULL, "_http", "_tcp", LOCAL_SERVER_PORT, txt, 2) != ESP_OK)
+    {
+        ESP_LOGW(TAG_LOCAL, "Failed to announce %s.local over mDNS.", hostname);
+    }
+    ESP_LOGI(TAG_LOCAL, "Serving http://%s.local/", hostname);
+    if (CONFIG_APP_LOCAL_TOKEN[0] == '\0')
+        ESP_LOGW(TAG_LOCAL, "No CONFIG_APP_LOCAL_TOKEN, anyone on the network can set the outputs.");
+    return ESP_OK;
+}
+
+esp_err_t local_server_add_handler(const httpd_uri_t *uri)
+{
+    return server ? httpd_register_uri_handler(server, uri) : ESP_ERR_INVALID_STATE;
+}
+
+void local_server_publish_sample(sample_channel_t channel, int32_t value)
+{
+    if (server == NULL || ws_clients == 0)
+        return;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    char text[LOCAL_SERVER_WS_FRAME_MAX], number[TELEMETRY_FIXED_TEXT_MAX];
+    telemetry_fixed_format(number, sizeof(number), value, telemetry_channel_decimals(channel));
+    int len = snprintf(text, sizeof(text), "{\"ch\":\"%s\",\"v\":%s,\"t\":%lld}", sample_channel_name(channel),
+                       number, (long long)now.tv_sec * 1000 + now.tv_usec / 1000);
+    queue_frame(-1, text, len);
+}
+
+void local_server_publish_state(int field, int value)
+{
+    taskENTER_CRITICAL(&state_lock);
+    states[field] = value;
+    taskEXIT_CRITICAL(&state_lock);
+    if (server == NULL || ws_clients == 0)
+        return;
+    char text[LOCAL_SERVER_WS_FRAME_MAX];
+    queue_frame(-1, text, state_frame(field, value, text, sizeof(text)));
+}
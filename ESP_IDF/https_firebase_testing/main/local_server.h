@@ -0,0 +1,45 @@
+#ifndef LOCAL_SERVER_H
+#define LOCAL_SERVER_H
+
+#include <stdint.h>
+#include <esp_err.h>
+#include "esp_http_server.h"
+#include "sample_store.h"
+
+// LAN control without the cloud. The board serves a small dashboard at
+// http://<hostname>.local/ and a WebSocket at /ws, found over mDNS as
+// _http._tcp. Text frames, board to page:
+//   {"ch": "temperature", "v": 21.5, "t": <ms>}   a sample as it is read
+//   {"field": "button1", "value": 1}              an output changed, by anyone
+//   {"ack": 7, "field": "button1", "value": 1}    a command of this page applied
+// and page to board:
+//   {"field": "button1", "value": 1, "seq": 7}
+// A command sets the pin in the server task. The button task then moves the
+// shadow to it and reports it through the transport. With CONFIG_APP_LOCAL_TOKEN
+// set, /ws needs ?token=<it>, other sockets are closed after the handshake.
+#define LOCAL_SERVER_PORT 80
+#define LOCAL_SERVER_WS_FRAME_MAX 128
+#define LOCAL_SERVER_HOSTNAME_PREFIX "esp-"
+
+typedef struct {
+    const char *device_id;
+    /* Apply a command from the LAN, from the server task. Sets the pin and
+     * queues the cloud report, must not block. */
+    void (*on_command)(int field, int value);
+} local_server_config_t;
+
+/* Start the server and announce it over mDNS, once the network is up.
+ * cfg must stay valid. */
+esp_err_t local_server_start(const local_server_config_t *cfg);
+
+/* Serve one more URI, after local_server_start(). uri must stay valid. */
+esp_err_t local_server_add_handler(const httpd_uri_t *uri);
+
+/* Push a sample, in the channel's fixed point, to the open WebSockets, from
+ * the sensor tasks. Cheap when no page is connected. */
+void local_server_publish_sample(sample_channel_t channel, int32_t value);
+
+/* An output changed, whoever changed it. New pages get the last values. */
+void local_server_publish_state(int field, int value);
+
+#endif // LOCAL_SERVER_H
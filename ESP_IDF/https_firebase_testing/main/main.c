@@ -1,16 +1,37 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "esp_log.h"
+#include "dlog.h"
 #include "nvs_flash.h"
+#include "esp_netif_sntp.h"
 //#include "esp_netif.h"
-#include "esp_http_client.h"
 #include "cJSON.h"
 #include "dht.h"
 #include "bh1750.h"
+#if CONFIG_APP_QEMU
+#include "sim_sensors.h"
+#endif
 #include "protocol_examples_common.h"
+#include "http.h"
+#include "http_trace.h"
+#include "net_sched.h"
+#include "http_backoff.h"
+#include "sample_store.h"
+#include "transport.h"
+#include "telemetry_fixed.h"
+#include "telemetry_bench.h"
+#include "device.h"
+#include "shadow.h"
+#include "command_queue.h"
+#include "rules.h"
+#include "local_server.h"
+#include "board_metrics.h"
+#include "app_mem.h"
 
 // --- Constants and Definitions ---
 #define I2C_SDA GPIO_NUM_21
@@ -21,14 +42,27 @@
 #define BUTTON1_GPIO GPIO_NUM_2
 #define BUTTON2_GPIO GPIO_NUM_19
 #define BUTTON3_GPIO GPIO_NUM_23
-// Firebase URLs
-#define FIREBASE_DHT_URL "https://https-start-617d7-default-rtdb.firebaseio.com/sensor_data.json"
-#define FIREBASE_LIGHT_URL "https://https-start-617d7-default-rtdb.firebaseio.com/Light_data.json"
-#define FIREBASE_BUTTON_URL "https://https-start-617d7-default-rtdb.firebaseio.com/button_state.json"
-#define MAX_BUFFER_SIZE 256
-// External Certificates
-extern const uint8_t certificate_pem_start[] asm("_binary_certificate_pem_start");
-extern const uint8_t certificate_pem_end[] asm("_binary_certificate_pem_end");
+// Firebase URLs, under QEMU the harness's mock database (see "QEMU performance runs" in the README)
+#if CONFIG_APP_QEMU
+#define FIREBASE_BASE_URL CONFIG_APP_QEMU_MOCK_URL
+#else
+#define FIREBASE_BASE_URL "https://https-start-617d7-default-rtdb.firebaseio.com"
+#endif
+// Backlog replay
+// Samples are appended to history/<device>/<yyyymmddhh> once a minute, one PATCH per bucket
+#define HISTORY_UPLOAD_BATCH 256
+#define HISTORY_UPLOAD_PERIOD_MS 60000
+
+#if CONFIG_APP_QEMU
+#define SNTP_SERVER CONFIG_APP_QEMU_SNTP_SERVER
+#else
+#define SNTP_SERVER "pool.ntp.org"
+#endif
+#define SNTP_SYNC_WAIT_MS 10000
+// Run the telemetry encoding benchmark once before starting the tasks
+#define TELEMETRY_BENCH_AT_BOOT 0
+// How often rules/<id> is read again
+#define RULES_SYNC_PERIOD_MS 30000
 
 // Event Groups and Tags
 static const char *TAG_WIFI = "WiFi";
@@ -36,220 +70,316 @@ static const char *TAG = "HTTP_CLIENT";
 static const char *TAG_DHT = "DHT_SENSOR";
 static const char *TAG_BH1750 = "BH1750_SENSOR";
 static const char *TAG_BUTTON = "BUTTON";
+static const char *TAG_TRACE = "HTTP_TRACE";
+static const char *TAG_HISTORY = "HISTORY";
+static const char *TAG_RULES = "RULES";
+
+// Telemetry and command backend, sensor_data/Light_data/button_state go through it
+static const transport_t *transport = &TRANSPORT_BACKEND;
+
+// This board's paths, built at boot from its MAC: devices/<id>/..., fleet/<id>, commands/<id>
+// (the desired half of the shadow, the reported half is devices/<id>/reported), command_queue/<id>, rules/<id>
+static char trace_url[HTTP_URL_MAX];
+static char fleet_url[HTTP_URL_MAX];
+static char last_seen_url[HTTP_URL_MAX];
+static char command_url[HTTP_URL_MAX];
+static char ack_url[HTTP_URL_MAX];
+static char queue_url[HTTP_URL_MAX];
+static char reported_urls[SHADOW_FIELD_COUNT][HTTP_URL_MAX];
+static char rules_url[HTTP_URL_MAX];
+static char rule_fired_url[HTTP_URL_MAX];
+static char topic_prefix[64];
 
 // --- Function Prototypes ---
 void dht_task(void *params);
 void bh1750_task(void *params);
 void button_task(void *params);
 void firebase_task(void *pvParameters);
-
-/* Callback or event handler */
-esp_err_t http_event_handler(esp_http_client_event_t* evt)
+void trace_task(void *params);
+void history_task(void *params);
+void rules_task(void *params);
+
+// Task storage, reserved at boot (see app_mem.h)
+APP_TASK_DEFINE(dht_task, 4096);
+APP_TASK_DEFINE(bh1750_task, 4096);
+APP_TASK_DEFINE(button_task, 6144);
+APP_TASK_DEFINE(trace_task, 4096);
+APP_TASK_DEFINE(history_task, 4096);
+APP_TASK_DEFINE(rules_task, 6144);
+
+/* Tell the dashboard a command reached the pins, for its latency histogram */
+static void ack_command(const command_ack_t *ack)
 {
-    switch (evt->event_id)
+    esp_err_t err;
+    if (transport->ack_command != NULL)
+    {
+        err = transport->ack_command(ack);
+    }
+    else
+    {
+        char body[128];
+        command_ack_to_json(ack, transport->name, body, sizeof(body));
+        err = net_sched_put(NET_CLASS_TELEMETRY, ack_url, app_strdup(body), 0, HTTP_ACK_SILENT);
+    }
+    if (err != ESP_OK)
     {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
-        break;
+        DLOGW(TAG_BUTTON, "Failed to acknowledge command %lu.", (unsigned long)ack->seq);
+    }
+}
 
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
+/* Report one shadow field the pins now follow, only that field is written */
+static void report_field(int field)
+{
+    char body[64];
+    shadow_reported_json(field, body, sizeof(body));
+    esp_err_t err = transport->report_state != NULL
+                        ? transport->report_state(shadow_field_name(field), body)
+                        : net_sched_put(NET_CLASS_TELEMETRY, reported_urls[field], app_strdup(body), 0, HTTP_ACK_SILENT);
+    if (err != ESP_OK)
+    {
+        DLOGW(TAG_BUTTON, "Failed to report %s.", shadow_field_name(field));
+    }
+}
 
-    case HTTP_EVENT_ON_DATA:
-        ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d, data=%.*s", evt->data_len, evt->data_len, (char*)evt->data);
+static const gpio_num_t field_gpios[SHADOW_FIELD_COUNT] = { BUTTON1_GPIO, BUTTON2_GPIO, BUTTON3_GPIO };
 
-        if (evt->data_len > MAX_BUFFER_SIZE)
-            return ESP_FAIL;
+/* Set a field's pin, then ack the command that asked for it if it was stamped */
+static void apply_field(int field, int value, uint32_t seq, int64_t sent_at_ms)
+{
+    gpio_set_level(field_gpios[field], value);
+    DLOGI(TAG_BUTTON, "%s: %d", shadow_field_name(field), value);
+    if (seq != 0)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        command_ack_t ack = {
+            .seq = seq,
+            .sent_at_ms = sent_at_ms,
+            .applied_at_ms = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000,
+        };
+        ack_command(&ack);
+    }
+    local_server_publish_state(field, value);
+}
 
-        if (evt->user_data)
-        {
-            memcpy(evt->user_data, evt->data, evt->data_len);
-        }
-        break;
+// Output changes made on the board, by a page on the LAN or a rule, waiting
+// for the button task, which owns the shadow
+typedef struct {
+    int field;
+    int value;
+} local_command_t;
 
-    case HTTP_EVENT_DISCONNECTED:
-        ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
-        break;
+#define LOCAL_COMMAND_QUEUE_LEN 8
+static QueueHandle_t local_commands;
+static StaticQueue_t local_commands_struct;
+static uint8_t local_commands_storage[LOCAL_COMMAND_QUEUE_LEN * sizeof(local_command_t)];
 
-    default:
-        break;
+/* Hand a pin already set to the button task, for the shadow and the cloud */
+static void queue_local_command(int field, int value)
+{
+    local_command_t cmd = { .field = field, .value = value };
+    if (xQueueSend(local_commands, &cmd, 0) != pdTRUE)
+    {
+        DLOGW(TAG_BUTTON, "Failed to queue %s for the shadow.", shadow_field_name(field));
     }
-    return ESP_OK;
 }
-/* Functions GET method */
-esp_err_t http_client_get_req(char* data, const char* url)
+
+/* A command from a page on the LAN: the pin now, the shadow and the cloud
+ * from the button task */
+static void local_command(int field, int value)
 {
-    esp_err_t ret_code = ESP_FAIL;
-    // HTTP client configuration
-    esp_http_client_config_t config = {
-        .event_handler = http_event_handler,
-        .method = HTTP_METHOD_GET,
-        .port = 80,
-        .url = url,
-        .user_data = data,
-        .cert_pem = (const char *)certificate_pem_start,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t err = esp_http_client_perform(client);
-    if (err == ESP_OK)
-    {
-        int status = esp_http_client_get_status_code(client);
+    gpio_set_level(field_gpios[field], value);
+    DLOGI(TAG_BUTTON, "%s: %d (LAN)", shadow_field_name(field), value);
+    queue_local_command(field, value);
+}
 
-        if (status == 200)
-        {
-            ESP_LOGI(TAG, "HTTP GET status: %d", status);
-            ret_code = ESP_OK;
-        }
-        else
-        {
-            ESP_LOGE(TAG, "HTTP GET status: %d", status);
-        }
+/* Fold the LAN commands and rule firings into the shadow, versioned past the
+ * desired writes seen so far (shadow_set_local()). Each field touched is
+ * reported once, through the transport. */
+static void apply_local_commands(void)
+{
+    local_command_t cmd;
+    int changed = 0;
+    while (xQueueReceive(local_commands, &cmd, 0) == pdTRUE)
+    {
+        shadow_set_local(cmd.field, cmd.value);
+        changed |= 1 << cmd.field;
     }
-    else
+    for (int i = 0; i < SHADOW_FIELD_COUNT; i++)
     {
-        ESP_LOGE(TAG, "Failed to send GET request");
+        if (changed & (1 << i))
+            report_field(i);
     }
-    esp_http_client_cleanup(client);
-
-    return ret_code;
 }
 
-/* HTTP POST function */
-esp_err_t http_client_post_req(const char* data_post, const char* post_url) 
+/* Apply the queued commands a batch at a time, in push order. A full batch
+ * means more may be waiting, so the next one is read right away. Returns
+ * true while the queue needs another read on the next wakeup: the breaker
+ * cut a drain short, a read failed, or a trim did and the batch is to be
+ * applied again. */
+static bool drain_command_queue(void)
 {
-    esp_err_t ret_code = ESP_FAIL;
-    // HTTP client configuration
-    esp_http_client_config_t config = {
-        .event_handler = http_event_handler,
-        .method = HTTP_METHOD_PUT,
-        .port = 80,
-        .url = post_url,
-        .cert_pem = (const char *)certificate_pem_start, // Use your certificate
-        
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, data_post, strlen(data_post));
-    
-    esp_err_t err = esp_http_client_perform(client);
-    if (err == ESP_OK) 
+    queued_command_t batch[COMMAND_QUEUE_BATCH];
+    int count;
+    bool more = true;
+    while (more)
     {
-        int status = esp_http_client_get_status_code(client);
-        if (status == 200)
+        if (http_backoff_state() != HTTP_BREAKER_CLOSED || command_queue_take(batch, &count, &more) != ESP_OK)
+            return true;
+        if (count == 0)
+            return more;
+
+        int changed = 0;
+        for (int i = 0; i < count; i++)
         {
-            ESP_LOGI(TAG, "HTTP POST status: %d", status);
-            ret_code = ESP_OK;
+            if (batch[i].field < 0)
+                continue;
+            apply_field(batch[i].field, batch[i].value, batch[i].seq, batch[i].sent_at_ms);
+            shadow_set(batch[i].field, batch[i].value, batch[i].version);
+            changed |= 1 << batch[i].field;
         }
-        else
+        // The reported state is where the batch left each field
+        for (int i = 0; i < SHADOW_FIELD_COUNT; i++)
         {
-            ESP_LOGE(TAG, "HTTP POST status: %d", status);
+            if (changed & (1 << i))
+                report_field(i);
         }
+        if (command_queue_trim(batch, count) != ESP_OK)
+            return true;
     }
-    else 
-    {
-        ESP_LOGE(TAG, "Failed to send POST request");
-    }
-    esp_http_client_cleanup(client);
-    return ret_code;
+    return false;
 }
 
 void button_task(void* arg) {
     char data[MAX_BUFFER_SIZE] = {0};
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << BUTTON1_GPIO) | (1ULL << BUTTON2_GPIO) | (1ULL << BUTTON3_GPIO),
-        .mode = GPIO_MODE_OUTPUT,  
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE
-    };
-    gpio_config(&io_conf);
-    gpio_set_level(BUTTON1_GPIO, 0);
-    gpio_set_level(BUTTON2_GPIO, 0);
-    gpio_set_level(BUTTON3_GPIO, 0);
+    // Queue marker version of the last read, 0 reads it once at boot
+    int64_t queue_seen = 0;
+    bool queue_pending = false;
 while (1)
     {
-        // Send HTTP GET request to Firebase to retrieve button states
-        if (http_client_get_req(data, FIREBASE_BUTTON_URL) == ESP_OK)
+        // Fetch the desired fields changed since our version, or wait for the broker to push a change
+        esp_err_t err = transport->wait_commands(data, shadow_version(), 1000);
+        // Changes made on the board first, a desired write older than one of them is skipped
+        apply_local_commands();
+        if (err == ESP_OK)
         {
-            ESP_LOGI(TAG_BUTTON, "Received button states: %s", data);
-
-            // Parse the JSON response
-            cJSON* json = cJSON_Parse(data);
-            if (json == NULL)
+            int changed = shadow_merge_desired(data);
+            if (changed < 0)
             {
-                ESP_LOGE(TAG_BUTTON, "Failed to parse JSON response.");
+                DLOGE(TAG_BUTTON, "Failed to parse desired state: %s", data);
             }
-            else
+            for (int i = 0; changed > 0 && i < SHADOW_FIELD_COUNT; i++)
             {
-                // Extract button states from the JSON
-                cJSON* button1 = cJSON_GetObjectItem(json, "button1");
-                cJSON* button2 = cJSON_GetObjectItem(json, "button2");
-                cJSON* button3 = cJSON_GetObjectItem(json, "button3");
-
-                if (button1 && button2 && button3)
+                // Only the fields that changed touch the pins
+                if (changed & (1 << i))
                 {
-                    int button1_state = button1->valueint;
-                    int button2_state = button2->valueint;
-                    int button3_state = button3->valueint;
-
-                    ESP_LOGI(TAG_BUTTON, "Button1: %d, Button2: %d, Button3: %d", button1_state, button2_state, button3_state);
-
-                    // Control LEDs based on Firebase button states
-                    gpio_set_level(BUTTON1_GPIO, button1_state);
-                    gpio_set_level(BUTTON2_GPIO, button2_state);
-                    gpio_set_level(BUTTON3_GPIO, button3_state);
-                }
-                else
-                {
-                    ESP_LOGE(TAG_BUTTON, "Failed to extract button states from JSON.");
+                    const shadow_field_t *field = shadow_field(i);
+                    apply_field(i, field->value, field->seq, field->sent_at_ms);
+                    report_field(i);
                 }
+            }
 
-                cJSON_Delete(json); // Free the JSON object
+            int64_t marker = command_queue_marker(data);
+            if (marker > queue_seen)
+            {
+                queue_seen = marker;
+                queue_pending = true;
             }
         }
-        else
+        else if (err != ESP_ERR_TIMEOUT)
         {
-            ESP_LOGE(TAG_BUTTON, "Failed to retrieve button states from Firebase.");
+            DLOGE(TAG_BUTTON, "Failed to retrieve button states from %s.", transport->name);
         }
 
-        vTaskDelay(pdMS_TO_TICKS(1000)); 
+        // Then the queue, only once the poll saw its marker move or a drain
+        // left work behind; a push transport gets its commands as desired
+        // state only (command_queue.h)
+        if (!transport->pushes_commands && queue_pending)
+            queue_pending = drain_command_queue();
+
+        // Poll every second, or less often while the circuit breaker is open
+        if (!transport->pushes_commands)
+        {
+            uint32_t delay_ms = http_backoff_retry_in_ms();
+            vTaskDelay(pdMS_TO_TICKS(delay_ms > 1000 ? delay_ms : 1000));
+        }
     }
     vTaskDelete(NULL);
 }
+// --- Sensor reads, simulated under QEMU where there is no bus ---
+static esp_err_t dht_read(int16_t *humidity_x10, int16_t *temp_x10)
+{
+#if CONFIG_APP_QEMU
+    return sim_dht_read(humidity_x10, temp_x10);
+#else
+    return dht_read_data(SENSOR_TYPE, CONFIG_DATA_GPIO, humidity_x10, temp_x10);
+#endif
+}
+
+static esp_err_t light_init(i2c_dev_t *dev)
+{
+#if CONFIG_APP_QEMU
+    return ESP_OK;
+#else
+    esp_err_t err = bh1750_init_desc(dev, BH1750_ADDR_LO, 0, I2C_SDA, I2C_SCK);
+    return err == ESP_OK ? bh1750_setup(dev, BH1750_MODE_CONTINUOUS, BH1750_RES_HIGH) : err;
+#endif
+}
+
+static esp_err_t light_read(i2c_dev_t *dev, uint16_t *lux)
+{
+#if CONFIG_APP_QEMU
+    return sim_bh1750_read(lux);
+#else
+    return bh1750_read(dev, lux);
+#endif
+}
+
 // --- DHT Sensor Task ---
 void dht_task(void* arg)
 {
-    float temp, humidity;
+    // Tenths as the sensor reports them, no float anywhere in this task
+    int16_t temp_x10, humidity_x10;
 
     while (1)
     {
-        if (dht_read_float_data(SENSOR_TYPE, CONFIG_DATA_GPIO, &humidity, &temp) == ESP_OK)
+        metric_inc(&metric_sensor_reads[BOARD_SENSOR_DHT]);
+        if (dht_read(&humidity_x10, &temp_x10) == ESP_OK)
         {
-            ESP_LOGI(TAG_DHT, "Humidity: %.1f%%, Temp: %.1fC", humidity, temp);
-
-            // Create JSON payload
-            cJSON* json = cJSON_CreateObject();
-            cJSON_AddNumberToObject(json, "temperature", temp);
-            cJSON_AddNumberToObject(json, "humidity", humidity);
-            char* data = cJSON_Print(json);
-
-            // Send data to Firebase
-            if (http_client_post_req(data, FIREBASE_DHT_URL) == ESP_OK)
-            {
-                ESP_LOGI(TAG, "DHT data uploaded successfully.");
-            }
-            else
+            int32_t temp = temp_x10 * 10;           // centi-degrees
+            int32_t humidity = humidity_x10;        // per mille RH
+
+            // Local rules first, they drive the pins without waiting on the network
+            rules_on_sample(SAMPLE_CH_TEMPERATURE, temp);
+            rules_on_sample(SAMPLE_CH_HUMIDITY, humidity);
+            local_server_publish_sample(SAMPLE_CH_TEMPERATURE, temp);
+            local_server_publish_sample(SAMPLE_CH_HUMIDITY, humidity);
+            char temp_text[TELEMETRY_FIXED_TEXT_MAX], humidity_text[TELEMETRY_FIXED_TEXT_MAX];
+            telemetry_fixed_format(temp_text, sizeof(temp_text), temp, telemetry_channel_decimals(SAMPLE_CH_TEMPERATURE));
+            telemetry_fixed_format(humidity_text, sizeof(humidity_text), humidity,
+                                   telemetry_channel_decimals(SAMPLE_CH_HUMIDITY));
+            DLOGI(TAG_DHT, "Humidity: %s%%, Temp: %sC", humidity_text, temp_text);
+
+            // Every sample goes to the history, the transport only updates the latest value
+            sample_store_push(SAMPLE_CH_TEMPERATURE, temp);
+            sample_store_push(SAMPLE_CH_HUMIDITY, humidity);
+            if (transport->online())
             {
-                ESP_LOGE(TAG, "Failed to upload DHT data.");
+                // The transport encodes the sample for its wire format
+                telemetry_reading_t readings[] = {
+                    { TELEMETRY_CH_TEMPERATURE, temp },
+                    { TELEMETRY_CH_HUMIDITY, humidity },
+                };
+                if (transport->publish(TRANSPORT_NODE_SENSOR, readings, 2) != ESP_OK)
+                {
+                    DLOGE(TAG, "Failed to queue DHT data.");
+                }
             }
-
-            cJSON_Delete(json);
-            free(data);
         }
         else
         {
-            ESP_LOGE(TAG_DHT, "Failed to read DHT sensor.");
+            metric_inc(&metric_sensor_failures[BOARD_SENSOR_DHT]);
+            DLOGE(TAG_DHT, "Failed to read DHT sensor.");
         }
 
         vTaskDelay(pdMS_TO_TICKS(1000)); 
@@ -260,53 +390,210 @@ void dht_task(void* arg)
 void bh1750_task(void* arg)
 {
     i2c_dev_t dev = { 0 };
-    if (bh1750_init_desc(&dev, BH1750_ADDR_LO, 0, I2C_SDA, I2C_SCK) != ESP_OK || 
-        bh1750_setup(&dev, BH1750_MODE_CONTINUOUS, BH1750_RES_HIGH) != ESP_OK)
+    if (light_init(&dev) != ESP_OK)
     {
-        ESP_LOGE(TAG_BH1750, "Failed to initialize BH1750.");
+        DLOGE(TAG_BH1750, "Failed to initialize BH1750.");
         vTaskDelete(NULL);
     }
 
     while (1)
     {
         uint16_t lux;
-        if (bh1750_read(&dev, &lux) == ESP_OK)
+        metric_inc(&metric_sensor_reads[BOARD_SENSOR_BH1750]);
+        if (light_read(&dev, &lux) == ESP_OK)
+        {
+            rules_on_sample(SAMPLE_CH_LIGHT, lux);
+            local_server_publish_sample(SAMPLE_CH_LIGHT, lux);
+            DLOGI(TAG_BH1750, "Light Intensity: %d lux", lux);
+
+            // Every sample goes to the history, the transport only updates the latest value
+            sample_store_push(SAMPLE_CH_LIGHT, lux);
+            if (transport->online())
+            {
+                // The transport encodes the sample for its wire format
+                telemetry_reading_t reading = { TELEMETRY_CH_LIGHT, lux };
+                if (transport->publish(TRANSPORT_NODE_LIGHT, &reading, 1) != ESP_OK)
+                {
+                    DLOGE(TAG, "Failed to queue BH1750 data.");
+                }
+            }
+        }
+        else
+        {
+            metric_inc(&metric_sensor_failures[BOARD_SENSOR_BH1750]);
+            DLOGE(TAG_BH1750, "Failed to read BH1750.");
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(1000)); // Delay for 1 second
+    }
+    vTaskDelete(NULL);
+}
+
+// --- HTTP Trace Report Task ---
+void trace_task(void* arg)
+{
+    char data[640];
+    bool sealed = false;
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(HTTP_TRACE_REPORT_PERIOD_MS));
+
+        // Print the histograms on the console, then upload the p50/p99 summary
+        http_trace_dump();
+        net_sched_dump();
+        http_backoff_dump();
+        http_write_dump();
+        transport->dump();
+        rules_dump();
+        app_mem_dump();
+        // Keep this board's fleet entry fresh
+        net_sched_put(NET_CLASS_BACKLOG, last_seen_url, app_strdup("{\".sv\":\"timestamp\"}"), 0, HTTP_ACK_SILENT);
+        if (http_trace_to_json(data, sizeof(data)) > 0)
+        {
+            if (net_sched_put(NET_CLASS_BACKLOG, trace_url, app_strdup(data), 0, HTTP_ACK_SILENT) != ESP_OK)
+            {
+                DLOGE(TAG_TRACE, "Failed to queue HTTP trace.");
+            }
+        }
+        else
+        {
+            DLOGE(TAG_TRACE, "HTTP trace summary does not fit in %d bytes.", (int)sizeof(data));
+        }
+        // Every task has been through a cycle by now, the slowest is this one
+        if (!sealed)
         {
-            ESP_LOGI(TAG_BH1750, "Light Intensity: %d lux", lux);
+            app_mem_seal();
+            sealed = true;
+        }
+    }
+    vTaskDelete(NULL);
+}
 
-            // Create JSON payload
-            cJSON* json = cJSON_CreateObject();
-            cJSON_AddNumberToObject(json, "light_intensity", lux);
-            char* data = cJSON_Print(json);
+// --- History Upload Task ---
+void history_task(void* arg)
+{
+    sample_replay_t replay;
+    http_body_source_t source;
+    char url[HTTP_URL_MAX];
+    char bucket[SAMPLE_BUCKET_KEY_LEN + 1];
 
-            // Send data to Firebase
-            if (http_client_post_req(data, FIREBASE_LIGHT_URL) == ESP_OK)
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(HISTORY_UPLOAD_PERIOD_MS));
+
+        // Drain the store one bucket at a time, stop at the first failure
+        while (sample_store_count() > 0)
+        {
+            // Stream the oldest batch straight out of the store, then let it go
+            int count = sample_store_replay(&replay, &source, HISTORY_UPLOAD_BATCH);
+            if (replay.bucket_ms < 0)
             {
-                ESP_LOGI(TAG, "BH1750 data uploaded successfully.");
+                DLOGW(TAG_HISTORY, "Dropped %d samples taken before the clock was set.", count);
+                sample_store_release(replay.end_seq);
+                continue;
+            }
+            sample_bucket_key(replay.bucket_ms, bucket);
+            esp_err_t err;
+            if (transport->append_history != NULL)
+            {
+                err = transport->online() ? transport->append_history(&replay) : ESP_ERR_INVALID_STATE;
             }
             else
             {
-                ESP_LOGE(TAG, "Failed to upload BH1750 data.");
+                if (http_backoff_state() != HTTP_BREAKER_CLOSED)
+                    break;
+                device_tree_url(url, sizeof(url), "history", bucket);
+                err = net_sched_stream(NET_CLASS_BACKLOG, url, HTTP_METHOD_PATCH, &source, HTTP_STREAM_CHUNKED);
             }
-
-            cJSON_Delete(json);
-            free(data);
+            if (err != ESP_OK)
+            {
+                DLOGE(TAG_HISTORY, "Failed to append %d samples to bucket %s.", count, bucket);
+                break;
+            }
+            sample_store_release(replay.end_seq);
+            DLOGI(TAG_HISTORY, "Appended %d samples to bucket %s, %d left, %lu lost to overflow.", count,
+                     bucket, sample_store_count(), (unsigned long)sample_store_overwritten());
         }
-        else
+    }
+    vTaskDelete(NULL);
+}
+
+// --- Rules Sync and Report Task ---
+// Only the rules task reads the document, too big for its stack
+static char rules_doc[RULES_DOC_MAX];
+
+void rules_task(void* arg)
+{
+    char body[160];
+    rule_firing_t firing;
+    TickType_t next_sync = xTaskGetTickCount();
+
+    while (1)
+    {
+        // Rules are read again every period, the table in NVS covers the time offline
+        TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(now - next_sync) >= 0)
         {
-            ESP_LOGE(TAG_BH1750, "Failed to read BH1750.");
+            next_sync = now + pdMS_TO_TICKS(RULES_SYNC_PERIOD_MS);
+            if (http_backoff_state() == HTTP_BREAKER_CLOSED &&
+                net_sched_get_sized(NET_CLASS_BACKLOG, rules_url, rules_doc, sizeof(rules_doc)) == ESP_OK &&
+                rules_sync(rules_doc) != ESP_OK)
+            {
+                DLOGE(TAG_RULES, "Failed to apply rules: %s", rules_doc);
+            }
+            continue;
         }
 
-        vTaskDelay(pdMS_TO_TICKS(1000)); // Delay for 1 second
+        // Firings already set the pins, the button task folds them into the
+        // shadow and reports them through the transport like any command
+        if (!rules_wait_firing(&firing, pdTICKS_TO_MS(next_sync - now)))
+            continue;
+        DLOGI(TAG_RULES, "%s set %s to %d in %lu us", firing.name, shadow_field_name(firing.field), firing.value,
+                 (unsigned long)firing.eval_us);
+        local_server_publish_state(firing.field, firing.value);
+        queue_local_command(firing.field, firing.value);
+        rules_firing_to_json(&firing, body, sizeof(body));
+        if (net_sched_put(NET_CLASS_TELEMETRY, rule_fired_url, app_strdup(body), 0, HTTP_ACK_SILENT) != ESP_OK)
+        {
+            DLOGW(TAG_RULES, "Failed to report %s firing.", firing.name);
+        }
     }
     vTaskDelete(NULL);
 }
 
 void app_main(void) {
 
+    // Before anything allocates a payload or parses JSON
+    ESP_ERROR_CHECK(app_mem_init());
+    // Then the log, the tasks below log through it
+    if (dlog_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the log task, deferred logs won't print.");
+    }
     ESP_ERROR_CHECK(nvs_flash_init());
+
+    // Outputs and the rules driving them come up before the network, rules run offline
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << BUTTON1_GPIO) | (1ULL << BUTTON2_GPIO) | (1ULL << BUTTON3_GPIO),
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE
+    };
+    gpio_config(&io_conf);
+    gpio_set_level(BUTTON1_GPIO, 0);
+    gpio_set_level(BUTTON2_GPIO, 0);
+    gpio_set_level(BUTTON3_GPIO, 0);
+    if (rules_init(field_gpios) != ESP_OK) {
+        ESP_LOGE(TAG_RULES, "Failed to start the rule engine.");
+    }
+
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+    // Before connecting, so the first disconnect is counted too
+    if (board_metrics_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Wi-Fi disconnects won't be counted.");
+    }
 
     esp_err_t err = ESP_FAIL;
     while (err != ESP_OK)
@@ -318,13 +605,87 @@ void app_main(void) {
             vTaskDelay(pdMS_TO_TICKS(10000));
         }
     }
+    // History buckets are keyed by UTC hour, sample timestamps need real time
+    esp_sntp_config_t sntp_cfg = ESP_NETIF_SNTP_DEFAULT_CONFIG(SNTP_SERVER);
+    esp_netif_sntp_init(&sntp_cfg);
+    if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(SNTP_SYNC_WAIT_MS)) != ESP_OK) {
+        ESP_LOGW(TAG, "Clock not synced yet, samples taken before it is won't reach the history.");
+    }
+#if !CONFIG_APP_QEMU
     if (i2cdev_init() != ESP_OK) {
         ESP_LOGE(TAG_WIFI, "Failed to initialize I2C.");
         return;
     }
+#endif
+    if (TELEMETRY_BENCH_AT_BOOT)
+        telemetry_bench_run();
+    sample_store_init();
+    if (net_sched_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start network scheduler.");
+        return;
+    }
+    if (device_init(FIREBASE_BASE_URL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read the device ID.");
+        return;
+    }
+    device_url(trace_url, sizeof(trace_url), "http_trace");
+    device_tree_url(fleet_url, sizeof(fleet_url), "fleet", NULL);
+    device_tree_url(command_url, sizeof(command_url), "commands", NULL);
+    device_url(ack_url, sizeof(ack_url), "command_ack");
+    device_tree_url(queue_url, sizeof(queue_url), "command_queue", NULL);
+    command_queue_init(queue_url);
+    device_tree_url(rules_url, sizeof(rules_url), "rules", NULL);
+    device_url(rule_fired_url, sizeof(rule_fired_url), "rule_fired");
+    for (int i = 0; i < SHADOW_FIELD_COUNT; i++) {
+        char node[40];
+        snprintf(node, sizeof(node), "reported/%s", shadow_field_name(i));
+        device_url(reported_urls[i], sizeof(reported_urls[i]), node);
+    }
+    device_tree_url(last_seen_url, sizeof(last_seen_url), "fleet", "last_seen");
+    snprintf(topic_prefix, sizeof(topic_prefix), "%s/%s", MQTT_TOPIC_ROOT, device_id());
+    ESP_LOGI(TAG, "Device %s", device_id());
+
+    // Same-network control and live samples, whatever happens to the cloud
+    local_commands = xQueueCreateStatic(LOCAL_COMMAND_QUEUE_LEN, sizeof(local_command_t), local_commands_storage,
+                                        &local_commands_struct);
+    static local_server_config_t local_cfg = { .on_command = local_command };
+    local_cfg.device_id = device_id();
+    if (local_server_start(&local_cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the LAN server.");
+    } else if (board_metrics_serve() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to serve /metrics.");
+    }
+
+    transport_config_t transport_cfg = {
+        .base_url = device_base_url(),
+        .command_url = command_url,
+        .broker_uri = MQTT_BROKER_URI,
+        .gateway_host = GATEWAY_HOST,
+        .topic_prefix = topic_prefix,
+    };
+    if (transport->init(&transport_cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start %s transport.", transport->name);
+        return;
+    }
+
+    // Register in the fleet index dashboards list boards from
+    char fleet_entry[128];
+    snprintf(fleet_entry, sizeof(fleet_entry),
+             "{\"last_boot\":{\".sv\":\"timestamp\"},\"last_seen\":{\".sv\":\"timestamp\"},\"transport\":\"%s\"}",
+             transport->name);
+    if (net_sched_put(NET_CLASS_BACKLOG, fleet_url, app_strdup(fleet_entry), 0, HTTP_ACK_SILENT) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to queue fleet entry.");
+    }
     // Start sensor tasks
-    xTaskCreate(dht_task, "DHT Task", 4096, NULL, 2, NULL);
-    xTaskCreate(bh1750_task, "BH1750 Task", 4096, NULL, 2, NULL);
-    xTaskCreate(button_task, "Button Task", 4096, NULL, 2, NULL);
+    // The esp-idf-lib I2C driver allocates a command link per transaction, so
+    // the BH1750 task is the one sensor task allowed to allocate
+    if (APP_TASK_START(dht_task, dht_task, "DHT Task", 2, true) != ESP_OK ||
+        APP_TASK_START(bh1750_task, bh1750_task, "BH1750 Task", 2, false) != ESP_OK ||
+        APP_TASK_START(button_task, button_task, "Button Task", 2, true) != ESP_OK ||
+        APP_TASK_START(trace_task, trace_task, "Trace Task", 1, true) != ESP_OK ||
+        APP_TASK_START(history_task, history_task, "History Task", 1, true) != ESP_OK ||
+        APP_TASK_START(rules_task, rules_task, "Rules Task", 1, true) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the tasks.");
+    }
     vTaskDelete(NULL);
 }
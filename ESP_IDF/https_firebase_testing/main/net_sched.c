@@ -0,0 +1,392 @@
+#include "net_sched.h"
+#include "http.h"
+#include "http_trace.h"
+#include "http_backoff.h"
+#include "app_mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "dlog.h"
+
+static const char *TAG_SCHED = "NET_SCHED";
+
+static const char *class_names[NET_CLASS_MAX] = { "command", "telemetry", "backlog" };
+static const int queue_len[NET_CLASS_MAX] = NET_SCHED_QUEUE_LEN;
+
+typedef enum { NET_REQ_GET, NET_REQ_PUT, NET_REQ_STREAM } net_method_t;
+
+// One queued request, copied by value into the class queue
+typedef struct {
+    net_class_t cls;
+    net_method_t method;
+    const char *url;
+    char *body;             // PUT payload, freed when the job finishes
+    char *response;         // GET buffer
+    int response_size;
+    http_ack_mode_t ack;    // PUT acknowledgement level
+    http_body_source_t *source;     // streamed body
+    http_stream_mode_t stream_mode;
+    esp_http_client_method_t stream_method;
+    int64_t enqueued_us;
+    int64_t deadline_us;    // 0 = no deadline
+    TaskHandle_t waiter;    // notified on completion for blocking calls
+    esp_err_t *result;
+} net_job_t;
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t failed;
+    uint32_t dropped_full;
+    uint32_t dropped_stale;
+    uint32_t shed;          // refused by the circuit breaker or rate limit
+    http_hist_t wait;       // time spent queued
+    http_hist_t service;    // time spent on the wire
+} class_stats_t;
+
+static QueueHandle_t queues[NET_CLASS_MAX];
+static SemaphoreHandle_t work_sem;
+static uint8_t queue_storage[NET_SCHED_QUEUE_SLOTS * sizeof(net_job_t)];
+static StaticQueue_t queue_structs[NET_CLASS_MAX];
+static StaticSemaphore_t work_sem_struct;
+APP_TASK_DEFINE(worker, NET_SCHED_WORKER_STACK);
+APP_TASK_DEFINE(command_lane, NET_SCHED_WORKER_STACK);
+static class_stats_t stats[NET_CLASS_MAX];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void job_finish(net_job_t *job, esp_err_t err)
+{
+    app_free(job->body);
+    if (job->waiter)
+    {
+        *job->result = err;
+        xTaskNotifyGive(job->waiter);
+    }
+}
+
+/* Drop stale jobs and ask the breaker/rate limit for a slot, false if the job is done */
+static bool job_admit(net_job_t *job)
+{
+    if (job->deadline_us && esp_timer_get_time() > job->deadline_us)
+    {
+        DLOGW(TAG_SCHED, "Dropping stale %s request to %s", class_names[job->cls], job->url);
+        taskENTER_CRITICAL(&stats_lock);
+        stats[job->cls].dropped_stale++;
+        taskEXIT_CRITICAL(&stats_lock);
+        job_finish(job, ESP_ERR_TIMEOUT);
+        return false;
+    }
+
+    // Commands wait for a token, everything else is shed while rate limited;
+    // nothing goes out while the breaker is open
+    esp_err_t admit = (job->cls == NET_CLASS_COMMAND) ? http_backoff_wait_token() : http_backoff_acquire();
+    if (admit != ESP_OK)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats[job->cls].shed++;
+        taskEXIT_CRITICAL(&stats_lock);
+        job_finish(job, admit);
+        return false;
+    }
+    return true;
+}
+
+static void job_complete(net_job_t *job, int64_t start, int64_t done, esp_err_t err)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    http_hist_add(&stats[job->cls].wait, (uint32_t)((start - job->enqueued_us) / 1000));
+    http_hist_add(&stats[job->cls].service, (uint32_t)((done - start) / 1000));
+    if (err != ESP_OK)
+        stats[job->cls].failed++;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    // Blocking callers log their own failures
+    if (err != ESP_OK && !job->waiter)
+        DLOGE(TAG_SCHED, "Failed %s request to %s", class_names[job->cls], job->url);
+
+    job_finish(job, err);
+}
+
+static void job_run(net_job_t *job)
+{
+    if (!job_admit(job))
+        return;
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err;
+    switch (job->method)
+    {
+    case NET_REQ_GET:
+        err = http_client_get_sized(job->response, job->response_size, job->url);
+        break;
+    case NET_REQ_PUT:
+        err = http_client_write_req(job->body, job->url, job->ack);
+        break;
+    default:
+        err = http_client_stream_req(job->url, job->stream_method, job->ack, job->stream_mode, job->source);
+        break;
+    }
+    job_complete(job, start, esp_timer_get_time(), err);
+}
+
+static void batch_run(net_job_t *jobs, int count)
+{
+    http_write_t writes[HTTP_PIPELINE_MAX];
+    net_job_t *admitted[HTTP_PIPELINE_MAX];
+    int n = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!job_admit(&jobs[i]))
+            continue;
+        writes[n] = (http_write_t){ .url = jobs[i].url, .data = jobs[i].body };
+        admitted[n++] = &jobs[i];
+    }
+    if (n == 0)
+        return;
+
+    int64_t start = esp_timer_get_time();
+    if (n == 1)
+    {
+        // Nothing to pipeline with, the lane's own client does a plain silent write
+        writes[0].result = http_client_write_req(writes[0].data, writes[0].url, HTTP_ACK_SILENT);
+    }
+    else
+    {
+        http_client_pipeline_req(writes, n);
+    }
+    int64_t done = esp_timer_get_time();
+
+    for (int i = 0; i < n; i++)
+        job_complete(admitted[i], start, done, writes[i].result);
+}
+
+static bool same_host(const char *a, const char *b)
+{
+    const char *pa = strstr(a, "://");
+    const char *pb = strstr(b, "://");
+    pa = pa ? pa + 3 : a;
+    pb = pb ? pb + 3 : b;
+    size_t la = strcspn(pa, "/?");
+    return la == strcspn(pb, "/?") && (pa - a) == (pb - b) && strncmp(a, b, (pa - a) + la) == 0;
+}
+
+static bool take_next(net_job_t *job)
+{
+    for (int c = 0; c < NET_CLASS_MAX; c++)
+    {
+        if (xQueueReceive(queues[c], job, 0) == pdTRUE)
+            return true;
+    }
+    return false;
+}
+
+static void net_worker_task(void *arg)
+{
+    net_job_t batch[HTTP_PIPELINE_MAX];
+    net_job_t carry;
+    bool carried = false;
+    http_session_bind();
+    while (1)
+    {
+        // One count per submitted job; the command lane may have taken it already,
+        // in which case we just go back to sleep
+        xSemaphoreTake(work_sem, portMAX_DELAY);
+        while (carried || take_next(&batch[0]))
+        {
+            if (carried)
+            {
+                batch[0] = carry;
+                carried = false;
+            }
+            if (batch[0].ack != HTTP_ACK_PIPELINED || batch[0].cls == NET_CLASS_COMMAND)
+            {
+                job_run(&batch[0]);
+                continue;
+            }
+
+            // Pipelined writes queued right behind this one on the same host ride
+            // along. submit() drops the oldest telemetry from producer tasks, so
+            // a peek could be stale by the time we receive; take the job outright
+            // and carry it into the next round if it can't join this batch.
+            QueueHandle_t q = queues[batch[0].cls];
+            int n = 1;
+            while (n < HTTP_PIPELINE_MAX && xQueueReceive(q, &batch[n], 0) == pdTRUE)
+            {
+                if (batch[n].ack != HTTP_ACK_PIPELINED || !same_host(batch[0].url, batch[n].url))
+                {
+                    carry = batch[n];
+                    carried = true;
+                    break;
+                }
+                n++;
+            }
+            batch_run(batch, n);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+static void net_command_lane_task(void *arg)
+{
+    net_job_t job;
+    http_session_bind();
+    while (1)
+    {
+        if (xQueueReceive(queues[NET_CLASS_COMMAND], &job, portMAX_DELAY) == pdTRUE)
+            job_run(&job);
+    }
+    vTaskDelete(NULL);
+}
+
+static esp_err_t submit(net_job_t *job)
+{
+    QueueHandle_t q = queues[job->cls];
+    job->enqueued_us = esp_timer_get_time();
+
+    if (xQueueSend(q, job, 0) != pdTRUE)
+    {
+        // A full telemetry queue makes room by dropping its oldest sample,
+        // the other classes push back on the caller
+        net_job_t oldest;
+        if (job->cls != NET_CLASS_TELEMETRY || xQueueReceive(q, &oldest, 0) != pdTRUE)
+        {
+            taskENTER_CRITICAL(&stats_lock);
+            stats[job->cls].dropped_full++;
+            taskEXIT_CRITICAL(&stats_lock);
+            return ESP_ERR_NO_MEM;
+        }
+        taskENTER_CRITICAL(&stats_lock);
+        stats[job->cls].dropped_full++;
+        taskEXIT_CRITICAL(&stats_lock);
+        job_finish(&oldest, ESP_ERR_TIMEOUT);
+
+        if (xQueueSend(q, job, 0) != pdTRUE)
+            return ESP_ERR_NO_MEM;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats[job->cls].submitted++;
+    taskEXIT_CRITICAL(&stats_lock);
+    xSemaphoreGive(work_sem);
+    return ESP_OK;
+}
+
+esp_err_t net_sched_init(void)
+{
+    uint8_t *storage = queue_storage;
+    for (int c = 0; c < NET_CLASS_MAX; c++)
+    {
+        if (storage + queue_len[c] * sizeof(net_job_t) > queue_storage + sizeof(queue_storage))
+            return ESP_ERR_INVALID_SIZE;
+        queues[c] = xQueueCreateStatic(queue_len[c], sizeof(net_job_t), storage, &queue_structs[c]);
+        storage += queue_len[c] * sizeof(net_job_t);
+    }
+    work_sem = xSemaphoreCreateCountingStatic(queue_len[0] + queue_len[1] + queue_len[2], 0, &work_sem_struct);
+
+    // The lanes keep an HTTP client and its TLS session, which allocate in
+    // esp_http_client and lwIP on every request, so they aren't strict
+    if (APP_TASK_START(worker, net_worker_task, "Net Worker", NET_SCHED_WORKER_PRIO, false) != ESP_OK ||
+        APP_TASK_START(command_lane, net_command_lane_task, "Net Command", NET_SCHED_COMMAND_LANE_PRIO, false) != ESP_OK)
+        return ESP_ERR_NO_MEM;
+
+    return ESP_OK;
+}
+
+esp_err_t net_sched_get(net_class_t cls, const char *url, char *data)
+{
+    return net_sched_get_sized(cls, url, data, MAX_BUFFER_SIZE);
+}
+
+esp_err_t net_sched_get_sized(net_class_t cls, const char *url, char *data, int size)
+{
+    esp_err_t result = ESP_FAIL;
+    net_job_t job = {
+        .cls = cls,
+        .method = NET_REQ_GET,
+        .url = url,
+        .response = data,
+        .response_size = size,
+        .waiter = xTaskGetCurrentTaskHandle(),
+        .result = &result,
+    };
+
+    esp_err_t err = submit(&job);
+    if (err != ESP_OK)
+        return err;
+
+    // Every job is finished exactly once, so this can't hang
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return result;
+}
+
+esp_err_t net_sched_put(net_class_t cls, const char *url, char *body, uint32_t max_age_ms, http_ack_mode_t ack)
+{
+    // What an app_strdup() from a full payload arena gives
+    if (body == NULL)
+        return ESP_ERR_NO_MEM;
+    net_job_t job = {
+        .cls = cls,
+        .method = NET_REQ_PUT,
+        .url = url,
+        .body = body,
+        .ack = ack,
+        .deadline_us = max_age_ms ? esp_timer_get_time() + (int64_t)max_age_ms * 1000 : 0,
+    };
+
+    esp_err_t err = submit(&job);
+    if (err != ESP_OK)
+        app_free(body);
+    return err;
+}
+
+esp_err_t net_sched_stream(net_class_t cls, const char *url, esp_http_client_method_t method,
+                           http_body_source_t *source, http_stream_mode_t mode)
+{
+    esp_err_t result = ESP_FAIL;
+    net_job_t job = {
+        .cls = cls,
+        .method = NET_REQ_STREAM,
+        .url = url,
+        .ack = HTTP_ACK_SILENT,
+        .source = source,
+        .stream_mode = mode,
+        .stream_method = method,
+        .waiter = xTaskGetCurrentTaskHandle(),
+        .result = &result,
+    };
+
+    esp_err_t err = submit(&job);
+    if (err != ESP_OK)
+        return err;
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return result;
+}
+
+int net_sched_depth(net_class_t cls)
+{
+    return queues[cls] ? (int)uxQueueMessagesWaiting(queues[cls]) : 0;
+}
+
+void net_sched_dump(void)
+{
+    ESP_LOGI(TAG_SCHED, "Per-class queue wait / service time (ms)");
+    printf("%-10s %6s %6s %6s %6s %6s %8s %8s %8s %8s\n", "class", "sent", "failed", "full", "stale", "shed",
+           "wait50", "wait99", "svc50", "svc99");
+    for (int c = 0; c < NET_CLASS_MAX; c++)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        class_stats_t s = stats[c];
+        taskEXIT_CRITICAL(&stats_lock);
+        printf("%-10s %6lu %6lu %6lu %6lu %6lu %8d %8d %8d %8d\n", class_names[c], (unsigned long)s.submitted,
+               (unsigned long)s.failed, (unsigned long)s.dropped_full, (unsigned long)s.dropped_stale, (unsigned long)s.shed,
+               http_hist_percentile(&s.wait, 50), http_hist_percentile(&s.wait, 99),
+               http_hist_percentile(&s.service, 50), http_hist_percentile(&s.service, 99));
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef NET_SCHED_H
+#define NET_SCHED_H
+
+#include <stdint.h>
+#include <esp_err.h>
+#include "http.h"
+
+// QoS classes, lower value is served first
+typedef enum {
+    NET_CLASS_COMMAND = 0,  // actuation, e.g. the button_state read driving the LEDs
+    NET_CLASS_TELEMETRY,    // live sensor uploads
+    NET_CLASS_BACKLOG,      // replay of stored samples, reports
+    NET_CLASS_MAX
+} net_class_t;
+
+// Queue depth per class
+#define NET_SCHED_QUEUE_LEN { 4, 8, 16 }
+#define NET_SCHED_QUEUE_SLOTS (4 + 8 + 16)     // static storage for all of them
+
+// Live telemetry older than this is dropped instead of sent
+#define NET_SCHED_TELEMETRY_MAX_AGE_MS 3000
+
+// Worker tasks: one general worker serving all classes in priority order,
+// plus one lane that only serves commands so a slow upload can't hold them up
+#define NET_SCHED_WORKER_STACK 6144
+#define NET_SCHED_WORKER_PRIO 3
+#define NET_SCHED_COMMAND_LANE_PRIO 4
+
+esp_err_t net_sched_init(void);
+
+/* Blocking GET, data must hold MAX_BUFFER_SIZE bytes */
+esp_err_t net_sched_get(net_class_t cls, const char *url, char *data);
+
+/* Blocking GET into size bytes of data, for bodies that outgrow MAX_BUFFER_SIZE */
+esp_err_t net_sched_get_sized(net_class_t cls, const char *url, char *data, int size);
+
+/* Queued PUT. The scheduler owns body (app_strdup() or app_malloc(), freed
+ * with app_free()) from here on, NULL is refused with ESP_ERR_NO_MEM, and
+ * url must stay valid until the request is done. max_age_ms = 0 never expires.
+ * HTTP_ACK_PIPELINED writes waiting in the same class are sent as one batch. */
+esp_err_t net_sched_put(net_class_t cls, const char *url, char *body, uint32_t max_age_ms, http_ack_mode_t ack);
+
+/* Blocking streamed upload (POST, PUT or PATCH), see http_client_stream_req() */
+esp_err_t net_sched_stream(net_class_t cls, const char *url, esp_http_client_method_t method,
+                           http_body_source_t *source, http_stream_mode_t mode);
+
+/* Jobs waiting in a class's queue */
+int net_sched_depth(net_class_t cls);
+
+void net_sched_dump(void);
+
+#endif // NET_SCHED_H
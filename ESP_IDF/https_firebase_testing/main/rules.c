@@ -0,0 +1,309 @@
+#include "rules.h"
+#include "telemetry_fixed.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "cJSON.h"
+
+static const char *TAG_RULES = "RULES";
+
+static const char *op_names[] = { "<", "<=", ">", ">=" };
+
+// The running table and what it has seen, shared by the sensor tasks
+static rule_table_t table;
+static int8_t active[RULES_MAX];            // -1 = not evaluated yet
+static int32_t latest[SAMPLE_CH_MAX];
+static uint32_t seen_channels;
+static portMUX_TYPE rules_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Only rules_sync() writes it, so it compares against table unlocked
+static rule_table_t staged;
+
+static const gpio_num_t *field_gpios;
+static QueueHandle_t firings;
+static StaticQueue_t firings_struct;
+static uint8_t firings_storage[RULES_FIRING_QUEUE_LEN * sizeof(rule_firing_t)];
+
+static uint32_t evaluations, fired, unreported, eval_max_us;
+
+static esp_err_t save_table(const rule_table_t *t)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open("rules", NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_blob(nvs, "table", t, sizeof(*t));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+    return err;
+}
+
+esp_err_t rules_init(const gpio_num_t *gpios)
+{
+    field_gpios = gpios;
+    memset(active, -1, sizeof(active));
+    firings = xQueueCreateStatic(RULES_FIRING_QUEUE_LEN, sizeof(rule_firing_t), firings_storage, &firings_struct);
+    if (firings == NULL)
+        return ESP_ERR_NO_MEM;
+
+    // Nothing saved yet is an empty table
+    nvs_handle_t nvs;
+    if (nvs_open("rules", NVS_READONLY, &nvs) != ESP_OK)
+        return ESP_OK;
+    size_t len = sizeof(staged);
+    esp_err_t err = nvs_get_blob(nvs, "table", &staged, &len);
+    nvs_close(nvs);
+    if (err == ESP_OK && len == sizeof(staged) && staged.format == RULES_TABLE_FORMAT && staged.count <= RULES_MAX)
+    {
+        table = staged;
+        ESP_LOGI(TAG_RULES, "Loaded %d rules from NVS.", table.count);
+    }
+    return ESP_OK;
+}
+
+static int channel_index(const char *name)
+{
+    for (int ch = 0; ch < SAMPLE_CH_MAX; ch++)
+    {
+        if (ch != 0 && strcmp(sample_channel_name(ch), name) == 0)
+            return ch;
+    }
+    return -1;
+}
+
+static int op_index(const char *name)
+{
+    for (int op = 0; op < (int)(sizeof(op_names) / sizeof(op_names[0])); op++)
+    {
+        if (strcmp(op_names[op], name) == 0)
+            return op;
+    }
+    return -1;
+}
+
+static bool compile_rule(const cJSON *json, rule_t *rule, uint32_t *channels)
+{
+    if (json->string == NULL || strlen(json->string) > RULES_NAME_LEN)
+        return false;
+    strcpy(rule->name, json->string);
+
+    const cJSON *conds = cJSON_GetObjectItem(json, "if");
+    int count = cJSON_GetArraySize(conds);
+    if (!cJSON_IsArray(conds) || count < 1 || count > RULES_MAX_CONDS)
+        return false;
+    const cJSON *cond;
+    cJSON_ArrayForEach(cond, conds)
+    {
+        const cJSON *channel = cJSON_GetObjectItem(cond, "channel");
+        const cJSON *op = cJSON_GetObjectItem(cond, "op");
+        const cJSON *value = cJSON_GetObjectItem(cond, "value");
+        int ch = cJSON_IsString(channel) ? channel_index(channel->valuestring) : -1;
+        int o = cJSON_IsString(op) ? op_index(op->valuestring) : -1;
+        if (ch < 0 || o < 0 || !cJSON_IsNumber(value))
+            return false;
+        // Member by member, padding stays zero for the table compare
+        rule_cond_t *c = &rule->conds[rule->cond_count++];
+        c->channel = ch;
+        c->op = o;
+        c->threshold = telemetry_fixed_from_double(value->valuedouble, telemetry_channel_decimals(ch));
+        *channels |= 1u << ch;
+    }
+
+    const cJSON *then = cJSON_GetObjectItem(json, "then");
+    const cJSON *field = cJSON_GetObjectItem(then, "field");
+    const cJSON *value = cJSON_GetObjectItem(then, "value");
+    int f = cJSON_IsString(field) ? shadow_field_index(field->valuestring) : -1;
+    if (f < 0 || !cJSON_IsNumber(value))
+        return false;
+    rule->field = f;
+    rule->then_value = value->valueint ? 1 : 0;
+
+    const cJSON *otherwise = cJSON_GetObjectItem(json, "else");
+    rule->else_value = cJSON_IsNumber(otherwise) ? (otherwise->valueint ? 1 : 0) : -1;
+    // Scaled per condition, so evaluating a sample stays integer only
+    const cJSON *hysteresis = cJSON_GetObjectItem(json, "hysteresis");
+    double slack = cJSON_IsNumber(hysteresis) && hysteresis->valuedouble > 0 ? hysteresis->valuedouble : 0;
+    for (int i = 0; i < rule->cond_count; i++)
+        rule->conds[i].hysteresis = telemetry_fixed_from_double(slack, telemetry_channel_decimals(rule->conds[i].channel));
+    return true;
+}
+
+esp_err_t rules_compile(const char *json, rule_table_t *out)
+{
+    // Zeroed as a whole so equal tables compare equal byte for byte
+    memset(out, 0, sizeof(*out));
+    out->format = RULES_TABLE_FORMAT;
+
+    cJSON *doc = cJSON_Parse(json);
+    if (doc == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (!cJSON_IsObject(doc))
+    {
+        esp_err_t err = cJSON_IsNull(doc) ? ESP_OK : ESP_ERR_INVALID_ARG;
+        cJSON_Delete(doc);
+        return err;
+    }
+
+    const cJSON *rule;
+    cJSON_ArrayForEach(rule, doc)
+    {
+        if (out->count == RULES_MAX)
+        {
+            ESP_LOGW(TAG_RULES, "Only %d rules are kept, %s dropped.", RULES_MAX, rule->string);
+            continue;
+        }
+        rule_t *r = &out->rules[out->count];
+        uint32_t *channels = &out->channels[out->count];
+        if (compile_rule(rule, r, channels))
+        {
+            out->count++;
+        }
+        else
+        {
+            ESP_LOGW(TAG_RULES, "Rule %s doesn't compile, skipped.", rule->string ? rule->string : "?");
+            memset(r, 0, sizeof(*r));
+            *channels = 0;
+        }
+    }
+    cJSON_Delete(doc);
+    return ESP_OK;
+}
+
+esp_err_t rules_sync(const char *json)
+{
+    esp_err_t err = rules_compile(json, &staged);
+    if (err != ESP_OK || memcmp(&staged, &table, sizeof(table)) == 0)
+        return err;
+
+    // New rules start over, each fires once its channels have a reading
+    taskENTER_CRITICAL(&rules_lock);
+    table = staged;
+    memset(active, -1, sizeof(active));
+    taskEXIT_CRITICAL(&rules_lock);
+
+    ESP_LOGI(TAG_RULES, "Running %d rules.", staged.count);
+    err = save_table(&staged);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG_RULES, "Failed to save rules to NVS: %s", esp_err_to_name(err));
+    return err;
+}
+
+/* All conditions true, with those of a rule already true relaxed by its hysteresis */
+static bool rule_holds(const rule_t *rule, bool was_true)
+{
+    for (int i = 0; i < rule->cond_count; i++)
+    {
+        const rule_cond_t *c = &rule->conds[i];
+        int64_t v = latest[c->channel];
+        int64_t slack = was_true ? c->hysteresis : 0;
+        bool ok;
+        switch (c->op)
+        {
+        case RULE_OP_LT: ok = v < c->threshold + slack; break;
+        case RULE_OP_LE: ok = v <= c->threshold + slack; break;
+        case RULE_OP_GT: ok = v > c->threshold - slack; break;
+        default:         ok = v >= c->threshold - slack; break;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+void rules_on_sample(sample_channel_t channel, int32_t value)
+{
+    int64_t start = esp_timer_get_time();
+    rule_firing_t fire[RULES_MAX];
+    int n = 0;
+
+    taskENTER_CRITICAL(&rules_lock);
+    latest[channel] = value;
+    seen_channels |= 1u << channel;
+    for (int i = 0; i < table.count; i++)
+    {
+        uint32_t reads = table.channels[i];
+        if (!(reads & (1u << channel)) || (reads & seen_channels) != reads)
+            continue;
+        const rule_t *rule = &table.rules[i];
+        int8_t holds = rule_holds(rule, active[i] == 1);
+        if (holds == active[i])
+            continue;
+        active[i] = holds;
+        int8_t out = holds ? rule->then_value : rule->else_value;
+        if (out < 0)
+            continue;
+        // Under the lock, so two sensor tasks' firings reach the pin in the
+        // order they were decided, the last edge's value stays
+        gpio_set_level(field_gpios[rule->field], out);
+        memcpy(fire[n].name, rule->name, sizeof(fire[n].name));
+        fire[n].field = rule->field;
+        fire[n].value = out;
+        n++;
+    }
+    evaluations++;
+    taskEXIT_CRITICAL(&rules_lock);
+
+    if (n == 0)
+        return;
+    uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+
+    // Reporting is someone else's job, a full queue only loses the report
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint32_t dropped = 0;
+    for (int i = 0; i < n; i++)
+    {
+        fire[i].at_ms = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+        fire[i].eval_us = took;
+        if (xQueueSend(firings, &fire[i], 0) != pdTRUE)
+            dropped++;
+    }
+
+    taskENTER_CRITICAL(&rules_lock);
+    fired += n;
+    unreported += dropped;
+    if (took > eval_max_us)
+        eval_max_us = took;
+    taskEXIT_CRITICAL(&rules_lock);
+}
+
+bool rules_wait_firing(rule_firing_t *out, uint32_t timeout_ms)
+{
+    return xQueueReceive(firings, out, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
+int rules_firing_to_json(const rule_firing_t *firing, char *buf, size_t size)
+{
+    // Names are database keys, which may hold quotes and backslashes
+    char name[2 * RULES_NAME_LEN + 1];
+    int len = 0;
+    for (const char *c = firing->name; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            name[len++] = '\\';
+        name[len++] = *c;
+    }
+    name[len] = '\0';
+
+    return snprintf(buf, size, "{\"rule\":\"%s\",\"field\":\"%s\",\"value\":%d,\"at\":%lld,\"eval_us\":%lu}",
+                    name, shadow_field_name(firing->field), firing->value, (long long)firing->at_ms,
+                    (unsigned long)firing->eval_us);
+}
+
+void rules_dump(void)
+{
+    taskENTER_CRITICAL(&rules_lock);
+    int count = table.count;
+    uint32_t e = evaluations, f = fired, u = unreported, m = eval_max_us;
+    taskEXIT_CRITICAL(&rules_lock);
+
+    ESP_LOGI(TAG_RULES, "%d rules", count);
+    printf("evaluations %lu, firings %lu, not reported %lu, sample to GPIO max %lu us\n", (unsigned long)e,
+           (unsigned long)f, (unsigned long)u, (unsigned long)m);
+}
@@ -0,0 +1,98 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "driver/gpio.h"
+#include "sample_store.h"
+#include "shadow.h"
+
+// Local automation, so reacting to a reading needs no cloud round trip and
+// keeps working offline. Rules live in rules/<id>, one child per rule:
+//   "dark": {"if": [{"channel": "light_intensity", "op": "<", "value": 50}],
+//            "then": {"field": "button1", "value": 1}, "else": 0, "hysteresis": 5}
+// Conditions are ANDed, op is one of < <= > >=. A rule fires "then" when its
+// conditions turn true and, if it has an "else", that value when they turn
+// false. Firing is edge triggered, so a dashboard command still wins until
+// the next edge. Once true, a condition holds until the reading is
+// "hysteresis" past its threshold.
+// Rules are compiled to a fixed table, kept in NVS so they run from boot.
+#define RULES_MAX 8
+#define RULES_MAX_CONDS 3
+#define RULES_NAME_LEN 15
+// GET buffer for a rules/<id> document of RULES_MAX full rules, a rule with
+// three conditions is about 250 bytes of JSON
+#define RULES_DOC_MAX (RULES_MAX * 384)
+
+// Firings waiting to be reported upstream, later ones are dropped when full
+#define RULES_FIRING_QUEUE_LEN 16
+
+// Bump when rule_table_t changes, older NVS copies are then ignored
+#define RULES_TABLE_FORMAT 2
+
+typedef enum {
+    RULE_OP_LT = 0,
+    RULE_OP_LE,
+    RULE_OP_GT,
+    RULE_OP_GE,
+} rule_op_t;
+
+typedef struct {
+    uint8_t channel;        // sample_channel_t
+    uint8_t op;             // rule_op_t
+    int32_t threshold;      // in the channel's fixed point, as the samples
+    int32_t hysteresis;     // the rule's, scaled the same
+} rule_cond_t;
+
+typedef struct {
+    char name[RULES_NAME_LEN + 1];
+    uint8_t field;          // shadow field it drives
+    int8_t then_value;
+    int8_t else_value;      // -1 = none
+    uint8_t cond_count;
+    rule_cond_t conds[RULES_MAX_CONDS];
+} rule_t;
+
+typedef struct {
+    uint16_t format;
+    uint16_t count;
+    uint32_t channels[RULES_MAX];  // per rule, bit per channel it reads
+    rule_t rules[RULES_MAX];
+} rule_table_t;
+
+// One output change made by a rule
+typedef struct {
+    char name[RULES_NAME_LEN + 1];
+    uint8_t field;
+    int8_t value;
+    int64_t at_ms;          // wall clock
+    uint32_t eval_us;       // from the sample to the GPIO write
+} rule_firing_t;
+
+/* Load the table saved in NVS, nvs_flash_init() must have run. gpios maps
+ * shadow fields to their output pins and must stay valid. */
+esp_err_t rules_init(const gpio_num_t *gpios);
+
+/* Compile a rules/<id> document, null for none. Rules that don't parse are
+ * skipped with a warning, past RULES_MAX they are dropped. */
+esp_err_t rules_compile(const char *json, rule_table_t *out);
+
+/* Compile and run a synced document. NVS is only written when the table
+ * changed. */
+esp_err_t rules_sync(const char *json);
+
+/* Feed a reading in the channel's fixed point, from the sensor tasks. Rules
+ * reading the channel are evaluated and the pins of those firing set before
+ * it returns. */
+void rules_on_sample(sample_channel_t channel, int32_t value);
+
+/* Next firing to report, false if none came within timeout_ms */
+bool rules_wait_firing(rule_firing_t *out, uint32_t timeout_ms);
+
+/* {"rule":..,"field":..,"value":..,"at":..,"eval_us":..}, returns the length snprintf() would write */
+int rules_firing_to_json(const rule_firing_t *firing, char *buf, size_t size);
+
+void rules_dump(void);
+
+#endif // RULES_H
@@ -0,0 +1,171 @@
+#include "sample_store.h"
+#include "telemetry_fixed.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+
+// Ring of samples, seq of slot i is any value with seq % capacity == i
+static sample_t samples[SAMPLE_STORE_CAPACITY];
+static uint32_t head_seq;       // oldest sample still held
+static uint32_t tail_seq;       // next sample to be written
+static uint32_t overwritten;
+static portMUX_TYPE store_lock = portMUX_INITIALIZER_UNLOCKED;
+
+enum { REPLAY_OPEN = 0, REPLAY_RECORDS, REPLAY_DONE };
+
+esp_err_t sample_store_init(void)
+{
+    taskENTER_CRITICAL(&store_lock);
+    head_seq = tail_seq = 0;
+    overwritten = 0;
+    taskEXIT_CRITICAL(&store_lock);
+    return ESP_OK;
+}
+
+void sample_store_push(sample_channel_t channel, int32_t value)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    taskENTER_CRITICAL(&store_lock);
+    if (tail_seq - head_seq == SAMPLE_STORE_CAPACITY)
+    {
+        head_seq++;
+        overwritten++;
+    }
+    sample_t *s = &samples[tail_seq % SAMPLE_STORE_CAPACITY];
+    s->ts_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    s->seq = tail_seq++;
+    s->channel = channel;
+    s->value = value;
+    taskEXIT_CRITICAL(&store_lock);
+}
+
+int sample_store_count(void)
+{
+    taskENTER_CRITICAL(&store_lock);
+    int count = (int)(tail_seq - head_seq);
+    taskEXIT_CRITICAL(&store_lock);
+    return count;
+}
+
+uint32_t sample_store_overwritten(void)
+{
+    return overwritten;
+}
+
+const char *sample_channel_name(sample_channel_t channel)
+{
+    return telemetry_channel_name(channel);
+}
+
+bool sample_store_get(uint32_t seq, sample_t *out)
+{
+    bool found = false;
+    taskENTER_CRITICAL(&store_lock);
+    if ((int32_t)(seq - head_seq) >= 0 && (int32_t)(tail_seq - seq) > 0)
+    {
+        *out = samples[seq % SAMPLE_STORE_CAPACITY];
+        found = true;
+    }
+    taskEXIT_CRITICAL(&store_lock);
+    return found;
+}
+
+static void replay_reset(void *ctx)
+{
+    sample_replay_t *replay = ctx;
+    replay->next_seq = replay->first_seq;
+    replay->emitted = 0;
+    replay->state = REPLAY_OPEN;
+}
+
+static int replay_next(void *ctx, char *buf, int size)
+{
+    sample_replay_t *replay = ctx;
+    int len = 0;
+
+    if (replay->state == REPLAY_OPEN && size > 0)
+    {
+        buf[len++] = '{';
+        replay->state = REPLAY_RECORDS;
+    }
+
+    // Whole records only, one that doesn't fit waits for the next buffer
+    while (replay->state == REPLAY_RECORDS && replay->next_seq != replay->end_seq)
+    {
+        sample_t s;
+        if (!sample_store_get(replay->next_seq, &s) || s.ts_ms < SAMPLE_TS_MIN_MS)
+        {
+            replay->next_seq++;
+            continue;
+        }
+        char record[48], value[TELEMETRY_FIXED_TEXT_MAX];
+        telemetry_fixed_format(value, sizeof(value), s.value, telemetry_channel_decimals(s.channel));
+        int n = snprintf(record, sizeof(record), "%s\"%lld/%s\":%s", replay->emitted ? "," : "",
+                         (long long)(s.ts_ms - replay->bucket_ms), sample_channel_name(s.channel), value);
+        if (len + n > size)
+            return len;
+        memcpy(buf + len, record, n);
+        len += n;
+        replay->next_seq++;
+        replay->emitted++;
+    }
+
+    if (replay->state == REPLAY_RECORDS && len < size)
+    {
+        buf[len++] = '}';
+        replay->state = REPLAY_DONE;
+    }
+    return len;
+}
+
+int sample_store_replay(sample_replay_t *replay, http_body_source_t *source, int max_samples)
+{
+    taskENTER_CRITICAL(&store_lock);
+    uint32_t count = tail_seq - head_seq;
+    replay->first_seq = head_seq;
+    taskEXIT_CRITICAL(&store_lock);
+
+    if (count > (uint32_t)max_samples)
+        count = max_samples;
+
+    // The bucket is set by the first sample with a valid time, the range ends before the next bucket
+    replay->bucket_ms = -1;
+    uint32_t seq = replay->first_seq;
+    for (; seq != replay->first_seq + count; seq++)
+    {
+        sample_t s;
+        if (!sample_store_get(seq, &s) || s.ts_ms < SAMPLE_TS_MIN_MS)
+            continue;
+        if (replay->bucket_ms < 0)
+            replay->bucket_ms = s.ts_ms - s.ts_ms % SAMPLE_BUCKET_MS;
+        else if (s.ts_ms < replay->bucket_ms || s.ts_ms >= replay->bucket_ms + SAMPLE_BUCKET_MS)
+            break;
+    }
+    replay->end_seq = seq;
+    replay_reset(replay);
+
+    source->reset = replay_reset;
+    source->next = replay_next;
+    source->ctx = replay;
+    return (int)(replay->end_seq - replay->first_seq);
+}
+
+void sample_bucket_key(int64_t bucket_ms, char *buf)
+{
+    time_t t = (time_t)(bucket_ms / 1000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, SAMPLE_BUCKET_KEY_LEN + 1, "%Y%m%d%H", &tm);
+}
+
+void sample_store_release(uint32_t end_seq)
+{
+    taskENTER_CRITICAL(&store_lock);
+    if ((int32_t)(end_seq - head_seq) > 0)
+        head_seq = end_seq;
+    taskEXIT_CRITICAL(&store_lock);
+}
@@ -0,0 +1,67 @@
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "http.h"
+#include "telemetry_schema.h"
+
+// Sensor channels, numbered as in the shared telemetry schema
+typedef enum {
+    SAMPLE_CH_TEMPERATURE = TELEMETRY_CH_TEMPERATURE,
+    SAMPLE_CH_HUMIDITY = TELEMETRY_CH_HUMIDITY,
+    SAMPLE_CH_LIGHT = TELEMETRY_CH_LIGHT,
+    SAMPLE_CH_MAX = TELEMETRY_CH_MAX
+} sample_channel_t;
+
+typedef struct {
+    int64_t ts_ms;          // wall clock, ms since the epoch
+    uint32_t seq;           // position in the store, never reused
+    uint8_t channel;
+    int32_t value;          // fixed point, telemetry_fixed.h
+} sample_t;
+
+// Samples waiting for the history upload, oldest are overwritten when full
+#define SAMPLE_STORE_CAPACITY 1024
+
+// History buckets are one UTC hour, history/<device>/<yyyymmddhh>/<ms into the hour>
+#define SAMPLE_BUCKET_MS 3600000LL
+#define SAMPLE_BUCKET_KEY_LEN 10
+
+// Samples taken before SNTP set the clock (before 2020) are not uploaded
+#define SAMPLE_TS_MIN_MS 1577836800000LL
+
+// Range of the store being replayed, also the state of its body source
+typedef struct {
+    int64_t bucket_ms;      // start of the hour every sample in the range falls in
+    uint32_t first_seq;
+    uint32_t end_seq;
+    uint32_t next_seq;
+    uint32_t emitted;
+    int state;
+} sample_replay_t;
+
+esp_err_t sample_store_init(void);
+void sample_store_push(sample_channel_t channel, int32_t value);
+int sample_store_count(void);
+uint32_t sample_store_overwritten(void);
+const char *sample_channel_name(sample_channel_t channel);
+
+/* Set up a replay of at most max_samples of the oldest samples, stopping at
+ * the end of the first sample's bucket. The source serializes them straight
+ * from the store as a PATCH body for the bucket node,
+ * {"<ms into the hour>/<channel>": value, ...}. Returns the number of samples
+ * in the range, including ones without a valid time that are skipped. */
+int sample_store_replay(sample_replay_t *replay, http_body_source_t *source, int max_samples);
+
+/* Copy out one sample, false if it was overwritten or not written yet */
+bool sample_store_get(uint32_t seq, sample_t *out);
+
+/* yyyymmddhh of a bucket, buf holds SAMPLE_BUCKET_KEY_LEN + 1 bytes */
+void sample_bucket_key(int64_t bucket_ms, char *buf);
+
+/* Drop everything before end_seq once it is safely uploaded */
+void sample_store_release(uint32_t end_seq);
+
+#endif // SAMPLE_STORE_H
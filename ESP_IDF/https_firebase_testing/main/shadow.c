@@ -0,0 +1,108 @@
+#include "shadow.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "cJSON.h"
+
+static const char *field_names[SHADOW_FIELD_COUNT] = SHADOW_FIELD_NAMES;
+
+// Only button_task touches the shadow
+static shadow_field_t fields[SHADOW_FIELD_COUNT];
+// Newest version the server handed us, local changes never move it
+static int64_t server_version;
+
+int shadow_merge_desired(const char *data)
+{
+    cJSON *json = cJSON_Parse(data);
+    if (json == NULL)
+        return -1;
+    if (!cJSON_IsObject(json))
+    {
+        // null: nothing desired, or nothing changed since the version asked for
+        int ret = cJSON_IsNull(json) ? 0 : -1;
+        cJSON_Delete(json);
+        return ret;
+    }
+
+    // Every child counts towards the cursor, applied or not, so a field
+    // behind a local change isn't asked for again
+    cJSON *child;
+    cJSON_ArrayForEach(child, json)
+    {
+        cJSON *version = cJSON_GetObjectItem(child, "version");
+        if (cJSON_IsNumber(version) && (int64_t)version->valuedouble > server_version)
+            server_version = (int64_t)version->valuedouble;
+    }
+
+    int changed = 0;
+    for (int i = 0; i < SHADOW_FIELD_COUNT; i++)
+    {
+        cJSON *field = cJSON_GetObjectItem(json, field_names[i]);
+        cJSON *value = cJSON_GetObjectItem(field, "value");
+        cJSON *version = cJSON_GetObjectItem(field, "version");
+        if (!cJSON_IsNumber(value) || !cJSON_IsNumber(version) || (int64_t)version->valuedouble <= fields[i].version)
+            continue;
+
+        cJSON *seq = cJSON_GetObjectItem(field, "seq");
+        cJSON *sent_at = cJSON_GetObjectItem(field, "sent_at");
+        bool stamped = cJSON_IsNumber(seq) && cJSON_IsNumber(sent_at);
+        fields[i] = (shadow_field_t){
+            .value = value->valueint,
+            .version = (int64_t)version->valuedouble,
+            .seq = stamped ? (uint32_t)seq->valuedouble : 0,
+            .sent_at_ms = stamped ? (int64_t)sent_at->valuedouble : 0,
+        };
+        changed |= 1 << i;
+    }
+    cJSON_Delete(json);
+    return changed;
+}
+
+const shadow_field_t *shadow_field(int field)
+{
+    return &fields[field];
+}
+
+const char *shadow_field_name(int field)
+{
+    return field_names[field];
+}
+
+int shadow_field_index(const char *name)
+{
+    for (int i = 0; i < SHADOW_FIELD_COUNT; i++)
+    {
+        if (strcmp(field_names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void shadow_set(int field, int value, int64_t version)
+{
+    fields[field].value = value;
+    fields[field].seq = 0;
+    if (version > fields[field].version)
+        fields[field].version = version;
+    if (version > server_version)
+        server_version = version;
+}
+
+void shadow_set_local(int field, int value)
+{
+    fields[field].value = value;
+    fields[field].seq = 0;
+    if (server_version + 1 > fields[field].version)
+        fields[field].version = server_version + 1;
+}
+
+int64_t shadow_version(void)
+{
+    return server_version;
+}
+
+int shadow_reported_json(int field, char *buf, size_t size)
+{
+    return snprintf(buf, size, "{\"value\":%d,\"version\":%lld}", fields[field].value,
+                    (long long)fields[field].version);
+}
@@ -0,0 +1,53 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Device shadow. The desired half is commands/<id>, the reported half is
+// devices/<id>/reported, one child per field in both:
+//   "button1": {"value": 1, "version": <server ms>, "seq": .., "sent_at": ..}
+// Dashboards write a desired field with the server time as its version (and
+// the latency stamp, see command_ack_t). The board applies a field only when
+// its version is newer than the one applied, then reports that field alone.
+#define SHADOW_FIELD_COUNT 3
+#define SHADOW_FIELD_NAMES { "button1", "button2", "button3" }
+
+typedef struct {
+    int value;
+    int64_t version;        // desired version the value came from, 0 = never set
+    uint32_t seq;           // latency stamp of the write, 0 = none
+    int64_t sent_at_ms;
+} shadow_field_t;
+
+/* Fold a desired document, all of commands/<id> or any part of it, into the
+ * shadow. Returns a bitmask of the fields that were newer, now in
+ * shadow_field(), or -1 if data is not a JSON object or null. */
+int shadow_merge_desired(const char *data);
+
+const shadow_field_t *shadow_field(int field);
+const char *shadow_field_name(int field);
+
+/* Index of a field by name, -1 if there is none */
+int shadow_field_index(const char *name);
+
+/* A queued command took effect, see command_queue.h. It always applies, the
+ * version only moves forward so older desired writes stay behind it. */
+void shadow_set(int field, int value, int64_t version);
+
+/* An output changed on the board, from the LAN or a rule. It always applies,
+ * versioned one past the newest server version: desired writes the board has
+ * seen stay behind it, the next one from a dashboard wins. The board's clock
+ * plays no part, it can run ahead of the server's. */
+void shadow_set_local(int field, int value);
+
+/* Newest version the server has handed the board, from desired fields and
+ * queued commands, never from local changes. Every desired field written
+ * since has a version at or after it, which is what a resync asks for. */
+int64_t shadow_version(void);
+
+/* {"value":..,"version":..} of a field, the reported child. Returns the length
+ * snprintf() would write. */
+int shadow_reported_json(int field, char *buf, size_t size);
+
+#endif // SHADOW_H
@@ -0,0 +1,31 @@
+#include "sim_sensors.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+
+/* min at the start of the period, max halfway, back to min at the end */
+static int32_t triangle(int64_t now_ms, int32_t min, int32_t max)
+{
+    int32_t phase = (int32_t)(now_ms % SIM_SENSOR_PERIOD_MS);
+    int32_t half = SIM_SENSOR_PERIOD_MS / 2;
+    int32_t rise = phase < half ? phase : SIM_SENSOR_PERIOD_MS - phase;
+    return min + (int32_t)((int64_t)(max - min) * rise / half);
+}
+
+esp_err_t sim_dht_read(int16_t *humidity_x10, int16_t *temp_x10)
+{
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    esp_rom_delay_us(SIM_DHT_READ_US);
+    *temp_x10 = (int16_t)triangle(now_ms, SIM_TEMP_X10_MIN, SIM_TEMP_X10_MAX);
+    // Humidity falls as the temperature rises
+    *humidity_x10 = (int16_t)(SIM_HUMIDITY_X10_MAX + SIM_HUMIDITY_X10_MIN -
+                              triangle(now_ms, SIM_HUMIDITY_X10_MIN, SIM_HUMIDITY_X10_MAX));
+    return ESP_OK;
+}
+
+esp_err_t sim_bh1750_read(uint16_t *lux)
+{
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    esp_rom_delay_us(SIM_BH1750_READ_US);
+    *lux = (uint16_t)triangle(now_ms, 0, SIM_LUX_MAX);
+    return ESP_OK;
+}
@@ -0,0 +1,27 @@
+#ifndef SIM_SENSORS_H
+#define SIM_SENSORS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+// Stand-ins for the DHT and BH1750 under QEMU, which has neither bus. The
+// readings are triangle waves over SIM_SENSOR_PERIOD_MS from boot, so a
+// workload knows when a rule threshold is crossed. Each read busy-waits
+// about as long as the real transfer holds the calling task.
+#define SIM_SENSOR_PERIOD_MS 60000
+
+// DHT: 20.0 to 26.0 C, 40.0 to 60.0 %RH, in tenths as dht_read_data() gives them
+#define SIM_TEMP_X10_MIN 200
+#define SIM_TEMP_X10_MAX 260
+#define SIM_HUMIDITY_X10_MIN 400
+#define SIM_HUMIDITY_X10_MAX 600
+#define SIM_DHT_READ_US 4500        // start pulse and 40 bits
+
+// BH1750: 0 to 1000 lux, darkest at the start of each period
+#define SIM_LUX_MAX 1000
+#define SIM_BH1750_READ_US 400      // two bytes at 100 kHz
+
+esp_err_t sim_dht_read(int16_t *humidity_x10, int16_t *temp_x10);
+esp_err_t sim_bh1750_read(uint16_t *lux);
+
+#endif // SIM_SENSORS_H
@@ -0,0 +1,132 @@
+#include "telemetry_bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "telemetry_cbor.h"
+#include "telemetry_fixed.h"
+
+static const char *TAG_BENCH = "TELEMETRY_BENCH";
+
+typedef enum {
+    ENC_JSON_PRINT = 0,
+    ENC_JSON_UNFORMATTED,
+    ENC_CBOR_FLOAT,
+    ENC_JSON_FIXED,
+    ENC_CBOR,
+    ENC_MAX
+} bench_encoder_t;
+
+static const char *encoder_names[ENC_MAX] = {
+    "cJSON_Print", "cJSON_PrintUnformatted", "cbor float", "json fixed", "cbor fixed",
+};
+
+// A sample as the sensor hands it over: DHT tenths, BH1750 whole lux
+typedef struct {
+    uint8_t channel;
+    bool tenths;            // DHT readings
+    int32_t raw;
+    int32_t scale;          // raw to the channel's fixed point
+} bench_raw_t;
+
+/* The float path the sensor tasks had before samples were fixed point:
+ * tenths to float as dht_read_float_data() does, doubles into cJSON, or
+ * whole floats as CBOR integers and the rest as float32 */
+static int encode_float(bench_encoder_t enc, const bench_raw_t *raw, int count)
+{
+    float values[TELEMETRY_READINGS_MAX];
+    for (int i = 0; i < count; i++)
+        values[i] = raw[i].tenths ? raw[i].raw / 10.0f : raw[i].raw;
+
+    if (enc == ENC_CBOR_FLOAT)
+    {
+        uint8_t buf[TELEMETRY_CBOR_MAX];
+        cbor_writer_t w;
+        cbor_writer_init(&w, buf, sizeof(buf));
+        cbor_put_map(&w, count);
+        for (int i = 0; i < count; i++)
+        {
+            cbor_put_uint(&w, raw[i].channel);
+            if (values[i] == (float)(int32_t)values[i])
+            {
+                cbor_put_int(&w, (int32_t)values[i]);
+                continue;
+            }
+            uint32_t bits;
+            memcpy(&bits, &values[i], sizeof(bits));
+            cbor_put_uint(&w, bits); // same five bytes as a float32 head
+        }
+        return w.overflow ? -1 : (int)w.len;
+    }
+
+    cJSON *json = cJSON_CreateObject();
+    for (int i = 0; i < count; i++)
+        cJSON_AddNumberToObject(json, telemetry_channel_name(raw[i].channel), values[i]);
+    char *data = enc == ENC_JSON_PRINT ? cJSON_Print(json) : cJSON_PrintUnformatted(json);
+    int len = data ? (int)strlen(data) : -1;
+    cJSON_free(data);
+    cJSON_Delete(json);
+    return len;
+}
+
+/* The path the sensor tasks take now, integers from the read to the bytes */
+static int encode_fixed(bench_encoder_t enc, const bench_raw_t *raw, int count)
+{
+    telemetry_reading_t readings[TELEMETRY_READINGS_MAX];
+    for (int i = 0; i < count; i++)
+        readings[i] = (telemetry_reading_t){ raw[i].channel, raw[i].raw * raw[i].scale };
+
+    if (enc == ENC_CBOR)
+    {
+        uint8_t buf[TELEMETRY_CBOR_MAX];
+        return telemetry_cbor_encode(buf, sizeof(buf), -1, readings, count);
+    }
+    char buf[TELEMETRY_JSON_MAX];
+    return telemetry_json_encode(buf, sizeof(buf), readings, count);
+}
+
+static int encode_once(bench_encoder_t enc, const bench_raw_t *raw, int count)
+{
+    return enc < ENC_JSON_FIXED ? encode_float(enc, raw, count) : encode_fixed(enc, raw, count);
+}
+
+static void bench_sample(const char *name, const bench_raw_t *raw, int count)
+{
+    for (int enc = 0; enc < ENC_MAX; enc++)
+    {
+        int len = encode_once(enc, raw, count);
+
+        // The cycle counter is per core, the scheduler stays off so the loop
+        // isn't moved to the other one halfway
+        vTaskSuspendAll();
+        uint32_t start_cycles = esp_cpu_get_cycle_count();
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < TELEMETRY_BENCH_ROUNDS; i++)
+            encode_once(enc, raw, count);
+        int64_t elapsed = esp_timer_get_time() - start;
+        uint32_t cycles = esp_cpu_get_cycle_count() - start_cycles;
+        xTaskResumeAll();
+
+        printf("%-6s %-24s %6d %10lu %10.2f\n", name, encoder_names[enc], len,
+               (unsigned long)(cycles / TELEMETRY_BENCH_ROUNDS), (double)elapsed / TELEMETRY_BENCH_ROUNDS);
+    }
+}
+
+void telemetry_bench_run(void)
+{
+    bench_raw_t dht[] = {
+        { TELEMETRY_CH_TEMPERATURE, true, 234, 10 },
+        { TELEMETRY_CH_HUMIDITY, true, 510, 1 },
+    };
+    bench_raw_t light = { TELEMETRY_CH_LIGHT, false, 1234, 1 };
+
+    ESP_LOGI(TAG_BENCH, "Payload size and encode time per sample, %d rounds", TELEMETRY_BENCH_ROUNDS);
+    printf("%-6s %-24s %6s %10s %10s\n", "sample", "encoder", "bytes", "cycles", "us");
+    bench_sample("dht", dht, 2);
+    bench_sample("bh1750", &light, 1);
+}
@@ -0,0 +1,13 @@
+#ifndef TELEMETRY_BENCH_H
+#define TELEMETRY_BENCH_H
+
+// Iterations per encoder
+#define TELEMETRY_BENCH_ROUNDS 1000
+
+/* Compare payload size and encode cost per DHT and BH1750 sample, from the
+ * sensor's raw reading to the bytes: the float path (cJSON, float32 CBOR)
+ * against the fixed-point one (telemetry_fixed.h), in CPU cycles and us.
+ * Results go to the console. */
+void telemetry_bench_run(void);
+
+#endif // TELEMETRY_BENCH_H
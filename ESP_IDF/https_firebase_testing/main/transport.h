@@ -0,0 +1,100 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "http_trace.h"
+#include "telemetry_cbor.h"
+#include "sample_store.h"
+
+// Data nodes, a database path for REST and a topic for MQTT
+typedef enum {
+    TRANSPORT_NODE_SENSOR = 0,  // sensor_data
+    TRANSPORT_NODE_LIGHT,       // Light_data
+    TRANSPORT_NODE_BUTTON,      // button_state, the command node (desired state)
+    TRANSPORT_NODE_MAX
+} transport_node_t;
+
+#define TRANSPORT_NODE_NAMES { "sensor_data", "Light_data", "button_state" }
+
+typedef struct {
+    const char *base_url;       // REST: this board's subtree, no trailing slash
+    const char *command_url;    // REST: this board's command state (.json)
+    const char *broker_uri;     // MQTT: e.g. mqtt://192.168.1.10:1883
+    const char *topic_prefix;   // MQTT: topics are <prefix>/<node>
+    const char *client_id;      // MQTT: fixed per board so the session persists
+    const char *gateway_host;   // gateway: IPv4 address of the edge gateway
+} transport_config_t;
+
+// A command the board has applied, written back for the dashboard. seq and
+// sent_at come from the command, see button_task.
+typedef struct {
+    uint32_t seq;
+    int64_t sent_at_ms;         // dashboard clock, when the command was written
+    int64_t applied_at_ms;      // board clock (SNTP), when the GPIOs were set
+} command_ack_t;
+
+// Telemetry/command backend
+typedef struct {
+    const char *name;
+    bool pushes_commands;       // commands arrive on their own, no polling needed
+    esp_err_t (*init)(const transport_config_t *cfg);
+    bool (*online)(void);
+    /* Publish one sample, REST sends it as JSON, MQTT as CBOR */
+    esp_err_t (*publish)(transport_node_t node, const telemetry_reading_t *readings, int count);
+    /* Desired state as JSON into data (MAX_BUFFER_SIZE bytes), see shadow.h.
+     * Polling backends fetch the fields with a version at or after
+     * since_version now. Pushing backends wait up to timeout_ms for a change
+     * and return ESP_ERR_TIMEOUT if there was none, since_version is where
+     * they resync from after a reconnect. */
+    esp_err_t (*wait_commands)(char *data, int64_t since_version, uint32_t timeout_ms);
+    /* Optional: upload a range of the sample store to the history. NULL
+     * streams it to Firebase as a JSON PATCH. */
+    esp_err_t (*append_history)(const sample_replay_t *replay);
+    /* Optional: report an applied command. NULL PUTs it to
+     * devices/<id>/command_ack over REST. */
+    esp_err_t (*ack_command)(const command_ack_t *ack);
+    /* Optional: report one shadow field, json is its reported child. NULL
+     * PUTs it to devices/<id>/reported/<field> over REST. */
+    esp_err_t (*report_state)(const char *field, const char *json);
+    void (*dump)(void);
+} transport_t;
+
+extern const transport_t transport_rest;
+extern const transport_t transport_mqtt;
+extern const transport_t transport_gateway;
+
+// Backend used by the firmware
+#define TRANSPORT_BACKEND transport_rest
+
+// MQTT settings
+#define MQTT_BROKER_URI "mqtt://192.168.1.10:1883"
+#define MQTT_TOPIC_ROOT "devices"        // topics are devices/<id>/<node>
+#define MQTT_USE_V5 1                   // 0 = MQTT 3.1.1, no topic aliases
+#define MQTT_TELEMETRY_QOS 0
+#define MQTT_COMMAND_QOS 1
+#define MQTT_SESSION_EXPIRY_S 3600      // v5: broker keeps the session this long
+#define MQTT_PING_PERIOD_MS 10000       // command-path latency probe
+
+// Edge gateway settings, port and framing in gateway_frame.h
+#define GATEWAY_HOST "192.168.1.10"
+#define GATEWAY_RECONNECT_MS 2000
+
+// Per-backend numbers for the REST vs MQTT comparison
+typedef struct {
+    uint32_t samples;
+    uint32_t tx_bytes;          // application bytes on the wire, without TLS/TCP overhead
+    uint32_t commands;
+    http_hist_t cmd_latency;    // REST: GET round trip, MQTT: ping echo via the broker, a proxy
+    http_hist_t puback_latency; // MQTT only: QoS 1 publish to PUBACK
+} transport_stats_t;
+
+void transport_stats_print(const char *name, const transport_stats_t *stats, uint32_t poll_wait_ms);
+
+/* {"seq":..,"sent_at":..,"applied_at":..,"transport":".."}, the command_ack
+ * node. Returns the length snprintf() would write. */
+int command_ack_to_json(const command_ack_t *ack, const char *transport_name, char *buf, size_t size);
+
+#endif // TRANSPORT_H
@@ -0,0 +1,289 @@
+#include "transport.h"
+#include "http.h"
+#include "gateway_frame.h"
+#include "app_mem.h"
+#include "telemetry_gorilla.h"
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "dlog.h"
+#include "esp_mac.h"
+#include "lwip/sockets.h"
+
+static const char *TAG_GATEWAY = "GATEWAY";
+
+static uint8_t device_id[GATEWAY_DEVICE_ID_LEN];
+static struct sockaddr_in gateway_addr;
+static volatile int sock = -1;
+static SemaphoreHandle_t send_lock;
+static StaticSemaphore_t send_lock_struct;
+
+// Latest command payload, a newer one replaces an unread one
+static QueueHandle_t command_queue;
+static StaticQueue_t command_queue_struct;
+static uint8_t command_storage[MAX_BUFFER_SIZE];
+// Shadow version the last wait_commands() had, hello asks for what changed since
+static int64_t resync_version;
+
+APP_TASK_DEFINE(gateway, 4096);
+
+static transport_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Send one length-prefixed frame, closes the socket on error */
+static esp_err_t send_frame(const uint8_t *frame, int len)
+{
+    uint8_t prefix[2] = { len >> 8, len & 0xff };
+    esp_err_t err = ESP_FAIL;
+
+    xSemaphoreTake(send_lock, portMAX_DELAY);
+    if (sock >= 0)
+    {
+        if (send(sock, prefix, sizeof(prefix), 0) == sizeof(prefix) && send(sock, frame, len, 0) == len)
+            err = ESP_OK;
+        else
+            shutdown(sock, SHUT_RDWR); // the receive task notices and reconnects
+    }
+    xSemaphoreGive(send_lock);
+    return err;
+}
+
+static bool recv_all(int fd, uint8_t *buf, int len)
+{
+    while (len > 0)
+    {
+        int n = recv(fd, buf, len, 0);
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Keeps the connection up and turns command frames into button states */
+static void gateway_task(void *arg)
+{
+    uint8_t frame[GATEWAY_FRAME_MAX];
+
+    while (1)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&gateway_addr, sizeof(gateway_addr)) != 0)
+        {
+            DLOGW(TAG_GATEWAY, "Can't reach the gateway, retry in %d ms", GATEWAY_RECONNECT_MS);
+            if (fd >= 0)
+                close(fd);
+            vTaskDelay(pdMS_TO_TICKS(GATEWAY_RECONNECT_MS));
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sock = fd;
+
+        // Hello asks for the desired fields changed since our shadow version
+        int len = gateway_frame_header(frame, GATEWAY_MSG_HELLO, device_id);
+        taskENTER_CRITICAL(&stats_lock);
+        int64_t since = resync_version;
+        taskEXIT_CRITICAL(&stats_lock);
+        for (int i = 0; i < 8; i++)
+            frame[len++] = (uint64_t)since >> (56 - 8 * i);
+        send_frame(frame, len);
+        DLOGI(TAG_GATEWAY, "Connected");
+
+        uint8_t prefix[2];
+        while (recv_all(fd, prefix, sizeof(prefix)))
+        {
+            len = prefix[0] << 8 | prefix[1];
+            if (len > GATEWAY_FRAME_MAX || !recv_all(fd, frame, len))
+                break;
+            if (gateway_frame_type(frame, len) != GATEWAY_MSG_COMMAND)
+                continue;
+
+            char data[MAX_BUFFER_SIZE];
+            int data_len = len - GATEWAY_HEADER_LEN < MAX_BUFFER_SIZE - 1 ? len - GATEWAY_HEADER_LEN : MAX_BUFFER_SIZE - 1;
+            memcpy(data, frame + GATEWAY_HEADER_LEN, data_len);
+            data[data_len] = '\0';
+            xQueueOverwrite(command_queue, data);
+        }
+
+        DLOGW(TAG_GATEWAY, "Disconnected");
+        xSemaphoreTake(send_lock, portMAX_DELAY);
+        sock = -1;
+        xSemaphoreGive(send_lock);
+        close(fd);
+        vTaskDelay(pdMS_TO_TICKS(GATEWAY_RECONNECT_MS));
+    }
+}
+
+static esp_err_t gateway_init(const transport_config_t *cfg)
+{
+    esp_read_mac(device_id, ESP_MAC_WIFI_STA);
+
+    gateway_addr.sin_family = AF_INET;
+    gateway_addr.sin_port = htons(GATEWAY_PORT);
+    if (inet_pton(AF_INET, cfg->gateway_host, &gateway_addr.sin_addr) != 1)
+        return ESP_ERR_INVALID_ARG;
+
+    send_lock = xSemaphoreCreateMutexStatic(&send_lock_struct);
+    command_queue = xQueueCreateStatic(1, MAX_BUFFER_SIZE, command_storage, &command_queue_struct);
+
+    // lwIP allocates pbufs for the socket, so the task is counted, not strict
+    return APP_TASK_START(gateway, gateway_task, "Gateway Task", 3, false);
+}
+
+static bool gateway_online(void)
+{
+    return sock >= 0;
+}
+
+static esp_err_t gateway_publish(transport_node_t node, const telemetry_reading_t *readings, int count)
+{
+    // The gateway knows each channel's node from the schema
+    uint8_t frame[GATEWAY_FRAME_MAX];
+    int len = gateway_frame_header(frame, GATEWAY_MSG_TELEMETRY, device_id);
+    int payload = telemetry_cbor_encode(frame + len, sizeof(frame) - len, -1, readings, count);
+    if (payload < 0)
+        return ESP_ERR_INVALID_SIZE;
+    len += payload;
+
+    esp_err_t err = send_frame(frame, len);
+    if (err == ESP_OK)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.samples++;
+        stats.tx_bytes += 2 + len;
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+    return err;
+}
+
+/* One channel's samples in the range as Gorilla blocks, as many frames as they need */
+static esp_err_t send_history_channel(const sample_replay_t *replay, sample_channel_t channel)
+{
+    uint8_t frame[GATEWAY_FRAME_MAX];
+    uint32_t seq = replay->first_seq;
+
+    while (seq != replay->end_seq)
+    {
+        int len = gateway_frame_header(frame, GATEWAY_MSG_HISTORY_FIXED, device_id);
+        uint8_t *block = frame + len + GATEWAY_HISTORY_HEADER_LEN;
+        gorilla_encoder_t enc;
+        gorilla_encoder_init(&enc, block, sizeof(frame) - (block - frame));
+        for (; seq != replay->end_seq; seq++)
+        {
+            sample_t s;
+            if (!sample_store_get(seq, &s) || s.channel != channel || s.ts_ms < SAMPLE_TS_MIN_MS)
+                continue;
+            if (!gorilla_encode_fixed(&enc, s.ts_ms, s.value))
+                break; // full, the sample starts the next frame
+        }
+        if (enc.count == 0)
+            break;
+
+        frame[len] = channel;
+        frame[len + 1] = enc.count >> 8;
+        frame[len + 2] = enc.count & 0xff;
+        len += GATEWAY_HISTORY_HEADER_LEN + gorilla_encoder_len(&enc);
+        esp_err_t err = send_frame(frame, len);
+        if (err != ESP_OK)
+            return err;
+
+        taskENTER_CRITICAL(&stats_lock);
+        stats.tx_bytes += 2 + len;
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+    return ESP_OK;
+}
+
+/* History goes to the gateway compressed per channel, it writes the same
+ * history/ paths as the REST upload */
+static esp_err_t gateway_append_history(const sample_replay_t *replay)
+{
+    for (int channel = SAMPLE_CH_TEMPERATURE; channel < SAMPLE_CH_MAX; channel++)
+    {
+        esp_err_t err = send_history_channel(replay, channel);
+        if (err != ESP_OK)
+            return err;
+    }
+    return ESP_OK;
+}
+
+/* The gateway writes the ack to devices/<id>/command_ack with its next flush */
+static esp_err_t gateway_ack_command(const command_ack_t *ack)
+{
+    uint8_t frame[GATEWAY_FRAME_MAX];
+    int len = gateway_frame_header(frame, GATEWAY_MSG_ACK, device_id);
+    int payload = command_ack_to_json(ack, "gateway", (char *)frame + len, sizeof(frame) - len);
+    if (payload >= (int)sizeof(frame) - len)
+        return ESP_ERR_INVALID_SIZE;
+    len += payload;
+
+    esp_err_t err = send_frame(frame, len);
+    if (err == ESP_OK)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.tx_bytes += 2 + len;
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+    return err;
+}
+
+/* The gateway writes the field to devices/<id>/reported/<field> */
+static esp_err_t gateway_report_state(const char *field, const char *json)
+{
+    uint8_t frame[GATEWAY_FRAME_MAX];
+    int len = gateway_frame_header(frame, GATEWAY_MSG_REPORTED, device_id);
+    int payload = snprintf((char *)frame + len, sizeof(frame) - len, "{\"%s\":%s}", field, json);
+    if (payload >= (int)sizeof(frame) - len)
+        return ESP_ERR_INVALID_SIZE;
+    len += payload;
+
+    esp_err_t err = send_frame(frame, len);
+    if (err == ESP_OK)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.tx_bytes += 2 + len;
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+    return err;
+}
+
+static esp_err_t gateway_wait_commands(char *data, int64_t since_version, uint32_t timeout_ms)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    resync_version = since_version;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (xQueueReceive(command_queue, data, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.commands++;
+    taskEXIT_CRITICAL(&stats_lock);
+    return ESP_OK;
+}
+
+static void gateway_dump(void)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    transport_stats_t s = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+    transport_stats_print("gateway", &s, 0);
+}
+
+const transport_t transport_gateway = {
+    .name = "gateway",
+    .pushes_commands = true,
+    .init = gateway_init,
+    .online = gateway_online,
+    .publish = gateway_publish,
+    .wait_commands = gateway_wait_commands,
+    .append_history = gateway_append_history,
+    .ack_command = gateway_ack_command,
+    .report_state = gateway_report_state,
+    .dump = gateway_dump,
+};
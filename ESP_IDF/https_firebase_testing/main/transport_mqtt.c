@@ -0,0 +1,270 @@
+#include "transport.h"
+#include "http.h"
+#include "app_mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "dlog.h"
+#include "mqtt_client.h"
+
+static const char *TAG_MQTT = "MQTT";
+
+#define MQTT_TOPIC_MAX 64
+
+static const char *node_names[TRANSPORT_NODE_MAX] = TRANSPORT_NODE_NAMES;
+
+static esp_mqtt_client_handle_t client;
+static char node_topics[TRANSPORT_NODE_MAX][MQTT_TOPIC_MAX];
+static char ping_topic[MQTT_TOPIC_MAX];
+static volatile bool connected;
+
+// Topic aliases live for one connection, the first publish on a node maps it
+static bool alias_sent[TRANSPORT_NODE_MAX];
+static SemaphoreHandle_t publish_lock;
+static StaticSemaphore_t publish_lock_struct;
+
+// Latest command payload, a newer one replaces an unread one
+static QueueHandle_t command_queue;
+static StaticQueue_t command_queue_struct;
+static uint8_t command_storage[MAX_BUFFER_SIZE];
+static int64_t last_ping_us;
+static volatile int ping_msg_id = -1;   // the probe in flight, until its PUBACK
+
+static transport_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int varint_len(int n)
+{
+    int len = 1;
+    while (n >= 128)
+    {
+        n /= 128;
+        len++;
+    }
+    return len;
+}
+
+/* Size of the PUBLISH packet carrying a payload */
+static int publish_bytes(int topic_len, int qos, bool alias, int payload_len)
+{
+    int remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+    if (MQTT_USE_V5)
+    {
+        int props = alias ? 3 : 0;
+        remaining += varint_len(props) + props;
+    }
+    return 1 + varint_len(remaining) + remaining;
+}
+
+static void handle_data(esp_mqtt_event_handle_t event)
+{
+    // Commands and pings are far below the fragment size, anything split is not ours
+    if (event->current_data_offset != 0 || event->data_len != event->total_data_len)
+        return;
+
+    if (event->topic_len == (int)strlen(ping_topic) && strncmp(event->topic, ping_topic, event->topic_len) == 0)
+    {
+        char buf[24];
+        int len = event->data_len < (int)sizeof(buf) - 1 ? event->data_len : (int)sizeof(buf) - 1;
+        memcpy(buf, event->data, len);
+        buf[len] = '\0';
+        int64_t sent_us = strtoll(buf, NULL, 10);
+        taskENTER_CRITICAL(&stats_lock);
+        http_hist_add(&stats.cmd_latency, (uint32_t)((esp_timer_get_time() - sent_us) / 1000));
+        taskEXIT_CRITICAL(&stats_lock);
+        return;
+    }
+
+    const char *topic = node_topics[TRANSPORT_NODE_BUTTON];
+    if (event->topic_len == (int)strlen(topic) && strncmp(event->topic, topic, event->topic_len) == 0)
+    {
+        char data[MAX_BUFFER_SIZE];
+        int len = event->data_len < MAX_BUFFER_SIZE - 1 ? event->data_len : MAX_BUFFER_SIZE - 1;
+        memcpy(data, event->data, len);
+        data[len] = '\0';
+        xQueueOverwrite(command_queue, data);
+    }
+}
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+        DLOGI(TAG_MQTT, "Connected, session %s", event->session_present ? "resumed" : "new");
+        xSemaphoreTake(publish_lock, portMAX_DELAY);
+        memset(alias_sent, 0, sizeof(alias_sent));
+        xSemaphoreGive(publish_lock);
+        // A resumed session still has the subscriptions and any queued QoS 1 commands
+        if (!event->session_present)
+        {
+            esp_mqtt_client_subscribe(client, node_topics[TRANSPORT_NODE_BUTTON], MQTT_COMMAND_QOS);
+            esp_mqtt_client_subscribe(client, ping_topic, 0);
+        }
+        connected = true;
+        break;
+
+    case MQTT_EVENT_DISCONNECTED:
+        DLOGW(TAG_MQTT, "Disconnected");
+        connected = false;
+        break;
+
+    case MQTT_EVENT_DATA:
+        handle_data(event);
+        break;
+
+    case MQTT_EVENT_PUBLISHED:
+        // PUBACK of the QoS 1 probe, the broker's own acknowledgement time
+        if (event->msg_id == ping_msg_id)
+        {
+            taskENTER_CRITICAL(&stats_lock);
+            http_hist_add(&stats.puback_latency, (uint32_t)((esp_timer_get_time() - last_ping_us) / 1000));
+            taskEXIT_CRITICAL(&stats_lock);
+            ping_msg_id = -1;
+        }
+        break;
+
+    case MQTT_EVENT_ERROR:
+        DLOGE(TAG_MQTT, "Error, type %d", event->error_handle->error_type);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static esp_err_t mqtt_init(const transport_config_t *cfg)
+{
+    for (int n = 0; n < TRANSPORT_NODE_MAX; n++)
+    {
+        if (snprintf(node_topics[n], MQTT_TOPIC_MAX, "%s/%s", cfg->topic_prefix, node_names[n]) >= MQTT_TOPIC_MAX)
+            return ESP_ERR_INVALID_SIZE;
+    }
+    snprintf(ping_topic, MQTT_TOPIC_MAX, "%s/ping", cfg->topic_prefix);
+
+    publish_lock = xSemaphoreCreateMutexStatic(&publish_lock_struct);
+    command_queue = xQueueCreateStatic(1, MAX_BUFFER_SIZE, command_storage, &command_queue_struct);
+
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = cfg->broker_uri,
+        .credentials.client_id = cfg->client_id,    // NULL: ESP32_<chip id>, stable per board
+        .session.disable_clean_session = true,
+        .session.keepalive = 30,
+        .session.protocol_ver = MQTT_USE_V5 ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1,
+    };
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    if (client == NULL)
+        return ESP_FAIL;
+
+#if MQTT_USE_V5
+    esp_mqtt5_connection_property_config_t connect_property = {
+        .session_expiry_interval = MQTT_SESSION_EXPIRY_S,
+    };
+    esp_mqtt5_client_set_connect_property(client, &connect_property);
+#endif
+
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    return esp_mqtt_client_start(client);
+}
+
+static bool mqtt_online(void)
+{
+    return connected;
+}
+
+static esp_err_t mqtt_publish(transport_node_t node, const telemetry_reading_t *readings, int count)
+{
+    // Live samples carry no time, the receiver stamps them
+    uint8_t payload[TELEMETRY_CBOR_MAX];
+    int len = telemetry_cbor_encode(payload, sizeof(payload), -1, readings, count);
+    int msg_id = -1;
+    int wire = 0;
+    if (len < 0)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (connected)
+    {
+        xSemaphoreTake(publish_lock, portMAX_DELAY);
+        const char *topic = node_topics[node];
+#if MQTT_USE_V5
+        // Full topic once per connection, then only the two-byte alias
+        esp_mqtt5_publish_property_config_t publish_property = {
+            .topic_alias = node + 1,
+        };
+        esp_mqtt5_client_set_publish_property(client, &publish_property);
+        if (alias_sent[node])
+            topic = "";
+#endif
+        msg_id = esp_mqtt_client_publish(client, topic, (const char *)payload, len, MQTT_TELEMETRY_QOS, 0);
+        if (msg_id >= 0)
+        {
+#if MQTT_USE_V5
+            alias_sent[node] = true;
+#endif
+            wire = publish_bytes(strlen(topic), MQTT_TELEMETRY_QOS, MQTT_USE_V5, len);
+        }
+        xSemaphoreGive(publish_lock);
+    }
+
+    if (msg_id < 0)
+        return ESP_FAIL;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.samples++;
+    stats.tx_bytes += wire;
+    taskEXIT_CRITICAL(&stats_lock);
+    return ESP_OK;
+}
+
+/* The command topic is retained, a reconnect gets the whole desired state
+ * again and the shadow skips the fields it has */
+static esp_err_t mqtt_wait_commands(char *data, int64_t since_version, uint32_t timeout_ms)
+{
+    /* Probe the broker: QoS 1 publish to PUBACK, and publish to the echo on
+     * our own subscription, a stand-in for the path a dashboard command takes */
+    int64_t now = esp_timer_get_time();
+    if (connected && now - last_ping_us >= (int64_t)MQTT_PING_PERIOD_MS * 1000)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lld", (long long)now);
+        // Under the lock so it can't take a telemetry publish's alias property
+        xSemaphoreTake(publish_lock, portMAX_DELAY);
+        last_ping_us = now;
+        ping_msg_id = esp_mqtt_client_publish(client, ping_topic, buf, 0, 1, 0);
+        xSemaphoreGive(publish_lock);
+    }
+
+    if (xQueueReceive(command_queue, data, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.commands++;
+    taskEXIT_CRITICAL(&stats_lock);
+    return ESP_OK;
+}
+
+static void mqtt_dump(void)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    transport_stats_t s = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+    transport_stats_print("mqtt", &s, 0);
+    printf("publish to PUBACK (QoS 1) p50 %d ms p99 %d ms\n", http_hist_percentile(&s.puback_latency, 50),
+           http_hist_percentile(&s.puback_latency, 99));
+}
+
+const transport_t transport_mqtt = {
+    .name = "mqtt",
+    .pushes_commands = true,
+    .init = mqtt_init,
+    .online = mqtt_online,
+    .publish = mqtt_publish,
+    .wait_commands = mqtt_wait_commands,
+    .dump = mqtt_dump,
+};
@@ -0,0 +1,132 @@
+#include "transport.h"
+#include "net_sched.h"
+#include "app_mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "telemetry_fixed.h"
+#include "http_backoff.h"
+
+// button_task polls once a second, a change waits half of that on average
+#define REST_POLL_INTERVAL_MS 1000
+
+static const char *node_names[TRANSPORT_NODE_MAX] = TRANSPORT_NODE_NAMES;
+
+// Built once, the scheduler needs URLs that outlive the request
+static char node_urls[TRANSPORT_NODE_MAX][HTTP_URL_MAX];
+static int host_len;
+static transport_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Request line and headers esp_http_client sends for a silent PUT */
+static int request_bytes(transport_node_t node, int body_len)
+{
+    const char *path = node_urls[node] + strlen("https://") + host_len;
+    return snprintf(NULL, 0,
+                    "PUT %s?print=silent HTTP/1.1\r\nUser-Agent: ESP32 HTTP Client/1.0\r\nHost: %.*s\r\n"
+                    "Content-Type: application/json\r\nContent-Length: %d\r\n\r\n",
+                    path, host_len, node_urls[node] + strlen("https://"), body_len) + body_len;
+}
+
+static esp_err_t rest_init(const transport_config_t *cfg)
+{
+    for (int n = 0; n < TRANSPORT_NODE_MAX; n++)
+    {
+        int len = n == TRANSPORT_NODE_BUTTON
+                      ? snprintf(node_urls[n], HTTP_URL_MAX, "%s", cfg->command_url)
+                      : snprintf(node_urls[n], HTTP_URL_MAX, "%s/%s.json", cfg->base_url, node_names[n]);
+        if (len >= HTTP_URL_MAX)
+            return ESP_ERR_INVALID_SIZE;
+    }
+    const char *host = strstr(cfg->base_url, "://");
+    host = host ? host + 3 : cfg->base_url;
+    host_len = strcspn(host, ":/");
+    return ESP_OK;
+}
+
+static bool rest_online(void)
+{
+    return http_backoff_state() == HTTP_BREAKER_CLOSED;
+}
+
+static esp_err_t rest_publish(transport_node_t node, const telemetry_reading_t *readings, int count)
+{
+    // Integer formatting, this runs in the sensor tasks
+    char json[TELEMETRY_JSON_MAX];
+    if (telemetry_json_encode(json, sizeof(json), readings, count) < 0)
+        return ESP_ERR_INVALID_SIZE;
+    char *payload = app_strdup(json);
+    if (payload == NULL)
+        return ESP_ERR_NO_MEM;
+
+    // The scheduler frees the payload once sent
+    int wire = request_bytes(node, strlen(payload));
+    esp_err_t err = net_sched_put(NET_CLASS_TELEMETRY, node_urls[node], payload, NET_SCHED_TELEMETRY_MAX_AGE_MS,
+                                  HTTP_ACK_PIPELINED);
+    if (err == ESP_OK)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.samples++;
+        stats.tx_bytes += wire;
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+    return err;
+}
+
+/* Only the desired fields written at or after the version the shadow has,
+ * usually one field or none. Served by the version index in the rules. */
+static esp_err_t rest_wait_commands(char *data, int64_t since_version, uint32_t timeout_ms)
+{
+    char url[HTTP_URL_MAX];
+    if (snprintf(url, sizeof(url), "%s?orderBy=%%22version%%22&startAt=%lld", node_urls[TRANSPORT_NODE_BUTTON],
+                 (long long)since_version) >= (int)sizeof(url))
+        return ESP_ERR_INVALID_SIZE;
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = net_sched_get(NET_CLASS_COMMAND, url, data);
+    if (err == ESP_OK)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.commands++;
+        http_hist_add(&stats.cmd_latency, (uint32_t)((esp_timer_get_time() - start) / 1000));
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+    return err;
+}
+
+static void rest_dump(void)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    transport_stats_t s = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+    transport_stats_print("rest", &s, REST_POLL_INTERVAL_MS / 2);
+}
+
+const transport_t transport_rest = {
+    .name = "rest",
+    .pushes_commands = false,
+    .init = rest_init,
+    .online = rest_online,
+    .publish = rest_publish,
+    .wait_commands = rest_wait_commands,
+    .dump = rest_dump,
+};
+
+void transport_stats_print(const char *name, const transport_stats_t *stats, uint32_t poll_wait_ms)
+{
+    ESP_LOGI("TRANSPORT", "Backend %s", name);
+    printf("samples %lu, bytes/sample %lu, commands %lu, command latency p50 %d ms p99 %d ms (+%lu ms avg poll wait)\n",
+           (unsigned long)stats->samples, (unsigned long)(stats->samples ? stats->tx_bytes / stats->samples : 0),
+           (unsigned long)stats->commands, http_hist_percentile(&stats->cmd_latency, 50),
+           http_hist_percentile(&stats->cmd_latency, 99), (unsigned long)poll_wait_ms);
+}
+
+int command_ack_to_json(const command_ack_t *ack, const char *transport_name, char *buf, size_t size)
+{
+    return snprintf(buf, size, "{\"seq\":%lu,\"sent_at\":%lld,\"applied_at\":%lld,\"transport\":\"%s\"}",
+                    (unsigned long)ack->seq, (long long)ack->sent_at_ms, (long long)ack->applied_at_ms,
+                    transport_name);
+}
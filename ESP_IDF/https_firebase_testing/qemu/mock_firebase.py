@@ -0,0 +1,418 @@
+#!/usr/bin/env python3
+"""Mock of the Firebase Realtime Database REST API and an SNTP server.
+
+Enough of the REST API for the firmware: GET with orderBy/startAt/endAt/
+limitToFirst/limitToLast, PUT, PATCH with path keys, POST, DELETE,
+print=silent, {".sv": "timestamp"}, chunked request bodies and pipelined
+requests on a kept connection. Every request is logged with its route, the
+path with the device ID, push keys and history buckets replaced, so counts
+compare across runs.
+
+run_perf.py drives it in-process. On its own it serves until interrupted
+and prints the request counts at exit:
+
+    qemu/mock_firebase.py --port 8443 --sntp-port 123
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import socket
+import ssl
+import struct
+import threading
+import time
+from collections import Counter
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, unquote, urlsplit
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CERT = os.path.join(HERE, "mock_server.pem")
+KEY = os.path.join(HERE, "mock_server.key")
+
+NTP_EPOCH_OFFSET = 2208988800
+PUSH_CHARS = "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz"
+
+# Path segments folded into one route: device IDs (MAC), push keys, hourly
+# history buckets and the ms keys inside them
+ROUTE_PATTERNS = [
+    (re.compile(r"^[0-9a-f]{12}$"), "{id}"),
+    (re.compile(r"^-[0-9A-Za-z_-]{19}$"), "{key}"),
+    (re.compile(r"^\d{10}$"), "{bucket}"),
+    (re.compile(r"^\d+$"), "{n}"),
+]
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+def route_of(path):
+    segments = []
+    for seg in path.strip("/").split("/"):
+        for pattern, name in ROUTE_PATTERNS:
+            if pattern.match(seg):
+                seg = name
+                break
+        segments.append(seg)
+    return "/".join(segments)
+
+
+def split_path(path):
+    return [unquote(s) for s in path.strip("/").split("/") if s]
+
+
+class PushIds:
+    """Time ordered 20 character keys, as the client SDKs make them"""
+
+    def __init__(self):
+        self.last_ms = 0
+        self.last_rand = [0] * 12
+        self.lock = threading.Lock()
+
+    def next(self):
+        with self.lock:
+            ms = now_ms()
+            if ms == self.last_ms:
+                for i in range(11, -1, -1):
+                    if self.last_rand[i] != 63:
+                        self.last_rand[i] += 1
+                        break
+                    self.last_rand[i] = 0
+            else:
+                self.last_rand = [random.randrange(64) for _ in range(12)]
+            self.last_ms = ms
+            stamp = []
+            for _ in range(8):
+                stamp.append(PUSH_CHARS[ms % 64])
+                ms //= 64
+            return "".join(reversed(stamp)) + "".join(PUSH_CHARS[r] for r in self.last_rand)
+
+
+class Database:
+    """The JSON tree, null children are pruned as Firebase does"""
+
+    def __init__(self):
+        self.root = None
+        self.lock = threading.Lock()
+        self.push_ids = PushIds()
+
+    @staticmethod
+    def _resolve(value, ts):
+        if isinstance(value, dict):
+            if value.get(".sv") == "timestamp":
+                return ts
+            return {k: Database._resolve(v, ts) for k, v in value.items()}
+        if isinstance(value, list):
+            return {str(i): Database._resolve(v, ts) for i, v in enumerate(value)}
+        return value
+
+    @staticmethod
+    def _prune(value):
+        if isinstance(value, dict):
+            value = {k: Database._prune(v) for k, v in value.items()}
+            value = {k: v for k, v in value.items() if v is not None}
+            return value or None
+        return value
+
+    @staticmethod
+    def _arrays(value):
+        """Children keyed 0..n-1 read back as an array, as Firebase returns them"""
+        if isinstance(value, dict):
+            value = {k: Database._arrays(v) for k, v in value.items()}
+            if all(k.isdigit() for k in value) and sorted(map(int, value)) == list(range(len(value))):
+                return [value[str(i)] for i in range(len(value))]
+        return value
+
+    def _get(self, keys):
+        node = self.root
+        for k in keys:
+            if not isinstance(node, dict) or k not in node:
+                return None
+            node = node[k]
+        return node
+
+    def _set(self, keys, value):
+        if not keys:
+            self.root = value
+            return
+        if not isinstance(self.root, dict):
+            self.root = {}
+        node = self.root
+        for k in keys[:-1]:
+            if not isinstance(node.get(k), dict):
+                node[k] = {}
+            node = node[k]
+        node[keys[-1]] = value
+        self.root = self._prune(self.root)
+
+    def get(self, path):
+        with self.lock:
+            return self._arrays(json.loads(json.dumps(self._get(split_path(path)))))
+
+    def put(self, path, value):
+        with self.lock:
+            value = self._prune(self._resolve(value, now_ms()))
+            self._set(split_path(path), value)
+            return value
+
+    def patch(self, path, children):
+        ts = now_ms()
+        with self.lock:
+            base = split_path(path)
+            for key, value in children.items():
+                self._set(base + split_path(key), self._prune(self._resolve(value, ts)))
+            return self._get(base)
+
+    def push(self, path, value):
+        key = self.push_ids.next()
+        self.put(path.rstrip("/") + "/" + key, value)
+        return key
+
+
+def _query_value(raw):
+    try:
+        return json.loads(raw)
+    except ValueError:
+        return raw
+
+
+def _order_key(value):
+    """Firebase orders null, false, true, numbers, strings, objects"""
+    if value is None:
+        return (0, 0)
+    if value is False:
+        return (1, 0)
+    if value is True:
+        return (2, 0)
+    if isinstance(value, (int, float)):
+        return (3, value)
+    if isinstance(value, str):
+        return (4, value)
+    return (5, 0)
+
+
+def apply_query(value, query):
+    order_by = query.get("orderBy")
+    if order_by is None or not isinstance(value, dict):
+        return value
+    order_by = _query_value(order_by)
+    if order_by == "$key":
+        items = sorted(value.items(), key=lambda kv: kv[0])
+        key_of = lambda kv: kv[0]
+    else:
+        if order_by == "$value":
+            child = lambda kv: kv[1]
+        else:
+            child = lambda kv: kv[1].get(order_by) if isinstance(kv[1], dict) else None
+        items = sorted(value.items(), key=lambda kv: (_order_key(child(kv)), kv[0]))
+        key_of = child
+    if "startAt" in query:
+        start = _order_key(_query_value(query["startAt"]))
+        items = [kv for kv in items if _order_key(key_of(kv)) >= start]
+    if "endAt" in query:
+        end = _order_key(_query_value(query["endAt"]))
+        items = [kv for kv in items if _order_key(key_of(kv)) <= end]
+    if "limitToFirst" in query:
+        items = items[:int(query["limitToFirst"])]
+    if "limitToLast" in query:
+        items = items[-int(query["limitToLast"]):]
+    return dict(items) or None
+
+
+class MockFirebase:
+    """The REST server, its request log, write watchers and injected faults"""
+
+    def __init__(self, latency_ms=0):
+        self.db = Database()
+        self.latency_ms = latency_ms
+        self.requests = []          # (t, method, route, status, bytes in, bytes out)
+        self.faults = []            # (until, status, route regex or None)
+        self.injected = 0           # requests answered with a fault
+        self.watchers = []          # (route regex, fn(t, method, path, value))
+        self.lock = threading.Lock()
+        self.server = None
+
+    def fault(self, status, duration_s, route=None):
+        with self.lock:
+            self.faults.append((time.time() + duration_s, status, re.compile(route) if route else None))
+
+    def watch(self, route, fn):
+        self.watchers.append((re.compile(route), fn))
+
+    def counts(self):
+        with self.lock:
+            return Counter(f"{m} {r}" for _, m, r, _, _, _ in self.requests)
+
+    def _fault_for(self, route):
+        now = time.time()
+        with self.lock:
+            self.faults = [f for f in self.faults if f[0] > now]
+            for _, status, pattern in self.faults:
+                if pattern is None or pattern.search(route):
+                    self.injected += 1
+                    return status
+        return None
+
+    def handle(self, method, path, query, body):
+        """(status, JSON value or None for no body), nothing here touches the socket"""
+        route = route_of(path)
+        status = self._fault_for(route)
+        if status is not None:
+            return route, status, {"error": "injected fault"}
+        silent = query.get("print") == "silent"
+        try:
+            value = json.loads(body) if body else None
+        except ValueError:
+            return route, 400, {"error": "Invalid data; couldn't parse JSON object."}
+
+        if method == "GET":
+            result = apply_query(self.db.get(path), query)
+        elif method == "PUT":
+            result = self.db.put(path, value)
+        elif method == "PATCH":
+            if not isinstance(value, dict):
+                return route, 400, {"error": "Invalid data; couldn't parse JSON object."}
+            result = self.db.patch(path, value)
+        elif method == "POST":
+            result = {"name": self.db.push(path, value)}
+        elif method == "DELETE":
+            result = self.db.put(path, None)
+        else:
+            return route, 405, {"error": "Method not allowed"}
+
+        if method != "GET":
+            t = time.time()
+            for pattern, fn in self.watchers:
+                if pattern.search(route):
+                    fn(t, method, path, value)
+        if silent:
+            return route, 204, None
+        return route, 200, result
+
+    def log(self, method, route, status, rx, tx):
+        with self.lock:
+            self.requests.append((time.time(), method, route, status, rx, tx))
+
+    def start(self, host="127.0.0.1", port=8443, certfile=CERT, keyfile=KEY):
+        mock = self
+
+        class Handler(BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.1"
+
+            def log_message(self, fmt, *args):
+                pass
+
+            def _body(self):
+                if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+                    chunks = []
+                    while True:
+                        size = int(self.rfile.readline().split(b";")[0].strip() or b"0", 16)
+                        if size == 0:
+                            # Trailers end at an empty line
+                            while self.rfile.readline() not in (b"\r\n", b"\n", b""):
+                                pass
+                            break
+                        chunks.append(self.rfile.read(size))
+                        self.rfile.readline()
+                    return b"".join(chunks)
+                return self.rfile.read(int(self.headers.get("Content-Length") or 0))
+
+            def _serve(self):
+                url = urlsplit(self.path)
+                query = {k: v[-1] for k, v in parse_qs(url.query).items()}
+                path = url.path
+                body = self._body()
+                if not path.endswith(".json"):
+                    route, status, result = route_of(path), 404, {"error": "Not found"}
+                else:
+                    route, status, result = mock.handle(self.command, path[:-len(".json")], query, body)
+                if mock.latency_ms:
+                    time.sleep(mock.latency_ms / 1000)
+                out = json.dumps(result, separators=(",", ":")).encode() if status != 204 else b""
+                # Logged before the reply, a client reading the log after it sees its own request
+                mock.log(self.command, route, status, len(body), len(out))
+                self.send_response(status)
+                if status != 204:
+                    self.send_header("Content-Type", "application/json; charset=utf-8")
+                    self.send_header("Content-Length", str(len(out)))
+                self.end_headers()
+                self.wfile.write(out)
+
+            do_GET = do_PUT = do_PATCH = do_POST = do_DELETE = _serve
+
+        class Server(ThreadingHTTPServer):
+            daemon_threads = True
+
+            def handle_error(self, request, client_address):
+                pass    # the board dropping a connection is not our error
+
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(certfile, keyfile)
+        self.server = Server((host, port), Handler)
+        self.server.socket = context.wrap_socket(self.server.socket, server_side=True)
+        threading.Thread(target=self.server.serve_forever, name="mock-firebase", daemon=True).start()
+        return self
+
+    def stop(self):
+        if self.server:
+            self.server.shutdown()
+            self.server.server_close()
+
+
+class SntpServer:
+    """Answers every request with the host clock, stratum 1"""
+
+    def __init__(self, host="127.0.0.1", port=123):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind((host, port))
+        self.served = 0
+        threading.Thread(target=self._serve, name="mock-sntp", daemon=True).start()
+
+    @staticmethod
+    def _stamp(t):
+        t += NTP_EPOCH_OFFSET
+        return struct.pack("!II", int(t), int((t % 1) * (1 << 32)))
+
+    def _serve(self):
+        while True:
+            try:
+                data, addr = self.sock.recvfrom(512)
+            except OSError:
+                return
+            if len(data) < 48:
+                continue
+            received = time.time()
+            reply = struct.pack("!BBbb", 0x24, 1, data[2], -20) + b"\0" * 8 + b"LOCL"
+            reply += self._stamp(received) + data[40:48] + self._stamp(received) + self._stamp(time.time())
+            self.sock.sendto(reply, addr)
+            self.served += 1
+
+    def stop(self):
+        self.sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--sntp-port", type=int, default=123, help="0 for no SNTP server")
+    parser.add_argument("--latency-ms", type=int, default=0, help="added to every response")
+    args = parser.parse_args()
+
+    mock = MockFirebase(args.latency_ms).start(args.host, args.port)
+    sntp = SntpServer(args.host, args.sntp_port) if args.sntp_port else None
+    print(f"Serving https://{args.host}:{args.port}" + (f", SNTP on {args.sntp_port}" if sntp else ""))
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    for request, n in sorted(mock.counts().items()):
+        print(f"{n:6} {request}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,428 @@
+#!/usr/bin/env python3
+"""Performance regression run of the firmware under Espressif's QEMU.
+
+Boots the CONFIG_APP_QEMU build (open_eth network, simulated sensors) with
+QEMU's user network, serves it the mock database and SNTP server from
+mock_firebase.py, plays a workload against it and records request counts,
+heap and latencies. The run is compared with a baseline from the same host.
+
+    qemu/run_perf.py --build --save-baseline     # once, on a known good commit
+    qemu/run_perf.py --build                     # then on every change
+
+Exits 0 when the run is within the workload's limits of the baseline, 1 on
+a regression or a failed check (crash, reboot, command not acknowledged),
+2 when the run couldn't be set up.
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import threading
+import time
+import urllib.request
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+PROJECT = os.path.dirname(HERE)
+sys.path.insert(0, HERE)
+from mock_firebase import MockFirebase, SntpServer, now_ms  # noqa: E402
+
+FLASH_SIZE = "2MB"
+CRASH_PATTERNS = re.compile(r"Guru Meditation|abort\(\) was called|stack overflow|Backtrace:|assert failed")
+BOOT_PATTERN = re.compile(r"^rst:0x")
+METRIC_LINE = re.compile(r"^([a-zA-Z_:][a-zA-Z0-9_:]*)(\{[^}]*\})?\s+(\S+)$")
+
+
+class SetupError(Exception):
+    pass
+
+
+def run(cmd, cwd):
+    print("$ " + " ".join(cmd), flush=True)
+    if subprocess.call(cmd, cwd=cwd) != 0:
+        raise SetupError(f"{cmd[0]} failed")
+
+
+def build(build_dir):
+    """The firmware's sdkconfig with qemu/sdkconfig.qemu on top, in a build directory of its own"""
+    if shutil.which("idf.py") is None:
+        raise SetupError("idf.py not found, source export.sh from ESP-IDF first")
+    run(["idf.py", "-B", build_dir, "-D", f"SDKCONFIG={os.path.join(build_dir, 'sdkconfig')}",
+         "-D", "SDKCONFIG_DEFAULTS=sdkconfig;qemu/sdkconfig.qemu", "build"], PROJECT)
+
+
+def flash_image(build_dir):
+    """Bootloader, partition table and app merged into one flash sized image"""
+    if not os.path.exists(os.path.join(build_dir, "flash_args")):
+        raise SetupError(f"no build in {build_dir}, run with --build")
+    image = os.path.join(build_dir, "qemu_flash.bin")
+    run([sys.executable, "-m", "esptool", "--chip", "esp32", "merge_bin", "--fill-flash-size", FLASH_SIZE,
+         "-o", image, "@flash_args"], build_dir)
+    return image
+
+
+class Board:
+    """QEMU with the image, its console copied to a log and watched for crashes"""
+
+    def __init__(self, qemu, image, metrics_port, log_path):
+        cmd = [qemu, "-nographic", "-machine", "esp32",
+               "-drive", f"file={image},if=mtd,format=raw",
+               "-nic", f"user,model=open_eth,hostfwd=tcp:127.0.0.1:{metrics_port}-:80"]
+        print("$ " + " ".join(cmd), flush=True)
+        self.proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                                     stderr=subprocess.STDOUT)
+        self.log = open(log_path, "w", encoding="utf-8", errors="replace")
+        self.boots = 0
+        self.crashes = []
+        threading.Thread(target=self._read, name="qemu-console", daemon=True).start()
+
+    def _read(self):
+        for raw in self.proc.stdout:
+            line = raw.decode("utf-8", errors="replace").rstrip("\r\n")
+            self.log.write(line + "\n")
+            if BOOT_PATTERN.match(line):
+                self.boots += 1
+            if CRASH_PATTERNS.search(line):
+                self.crashes.append(line)
+
+    def alive(self):
+        return self.proc.poll() is None
+
+    def stop(self):
+        if self.alive():
+            self.proc.terminate()
+            try:
+                self.proc.wait(5)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+        self.log.close()
+
+
+def scrape(port):
+    """{name or name{labels}: value} from the board's /metrics, {} when it doesn't answer"""
+    try:
+        with urllib.request.urlopen(f"http://127.0.0.1:{port}/metrics", timeout=5) as r:
+            text = r.read().decode()
+    except OSError:
+        return {}
+    samples = {}
+    for line in text.splitlines():
+        m = METRIC_LINE.match(line)
+        if m and not line.startswith("#"):
+            try:
+                samples[m.group(1) + (m.group(2) or "")] = float(m.group(3))
+            except ValueError:
+                pass
+    return samples
+
+
+def histogram_percentile(samples, name, pct):
+    """Upper bound of the bucket holding the rank, as the firmware reports its own"""
+    buckets = []
+    for key, value in samples.items():
+        m = re.match(re.escape(name) + r'_bucket\{.*le="([^"]+)"', key)
+        if m:
+            buckets.append((float("inf") if m.group(1) == "+Inf" else float(m.group(1)), value))
+    buckets.sort()
+    if not buckets or buckets[-1][1] == 0:
+        return None
+    rank = buckets[-1][1] * pct / 100
+    for bound, cumulative in buckets:
+        if cumulative >= rank:
+            return bound if bound != float("inf") else buckets[-2][0] if len(buckets) > 1 else None
+    return None
+
+
+def percentile(values, pct):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def expand_steps(workload):
+    """(at, step) for every action, repeats unrolled"""
+    actions = []
+    for step in workload["steps"]:
+        for i in range(step.get("count", 1)):
+            actions.append((step["at"] + i * step.get("every", 0), i, step))
+    return sorted(actions, key=lambda a: a[0])
+
+
+class Run:
+    def __init__(self, args, workload):
+        self.args = args
+        self.workload = workload
+        self.limits = workload["limits"]
+        self.mock = MockFirebase(workload.get("server", {}).get("latency_ms", 0))
+        self.device = None
+        self.t0 = None
+        self.registered = threading.Event()
+        self.seq = 0
+        self.sent = {}              # seq -> host time written
+        self.acked = {}             # seq -> host time the ack arrived
+        self.firings = []
+        self.heap = []              # (free, largest block) per scrape
+
+    # --- Mock database hooks ---
+    def _on_fleet(self, t, method, path, value):
+        if self.device is None and method in ("PUT", "PATCH"):
+            self.device = path.strip("/").split("/")[1]
+            self.t0 = t
+            self.registered.set()
+
+    def _on_ack(self, t, method, path, value):
+        if isinstance(value, dict) and "seq" in value:
+            self.acked.setdefault(int(value["seq"]), t)
+
+    def _on_firing(self, t, method, path, value):
+        if isinstance(value, dict):
+            self.firings.append(value)
+
+    # --- Workload actions ---
+    def _command(self, field, value):
+        self.seq += 1
+        ms = now_ms()
+        self.sent[self.seq] = time.time()
+        return {"field": field, "value": value, "version": ms, "seq": self.seq, "sent_at": ms}
+
+    def _act(self, i, step):
+        dev = self.device
+        if "put" in step:
+            self.mock.db.put(step["put"].format(id=dev), step["value"])
+        elif "command" in step:
+            c = step["command"]
+            value = i % 2 == 0 if c["value"] == "toggle" else c["value"]
+            cmd = self._command(c["field"], int(value))
+            del cmd["field"]
+            self.mock.db.put(f"commands/{dev}/{c['field']}", cmd)
+        elif "queue" in step:
+            for c in step["queue"]:
+                self.mock.db.push(f"command_queue/{dev}", self._command(c["field"], c["value"]))
+            # The marker is what tells the board's version poll to read the queue
+            self.mock.db.put(f"commands/{dev}/command_queue", {"version": now_ms()})
+        elif "fault" in step:
+            f = step["fault"]
+            self.mock.fault(f["status"], f["for_s"], f.get("route"))
+        else:
+            raise SetupError(f"unknown workload step {step}")
+
+    def execute(self, board):
+        self.mock.watch(r"^fleet/\{id\}$", self._on_fleet)
+        self.mock.watch(r"^devices/\{id\}/command_ack$", self._on_ack)
+        self.mock.watch(r"^devices/\{id\}/rule_fired$", self._on_firing)
+
+        deadline = time.time() + self.limits["register_timeout_s"]
+        while not self.registered.wait(1):
+            if not board.alive() or time.time() > deadline:
+                raise SetupError("the board never registered in fleet/, see the console log")
+        print(f"Device {self.device} registered, running {self.workload['duration_s']} s", flush=True)
+        injected_start = self.mock.injected
+
+        actions = expand_steps(self.workload)
+        next_scrape = 0
+        end = self.t0 + self.workload["duration_s"]
+        while time.time() < end and board.alive():
+            now = time.time()
+            while actions and self.t0 + actions[0][0] <= now:
+                _, i, step = actions.pop(0)
+                self._act(i, step)
+            if now >= next_scrape:
+                s = scrape(self.args.metrics_port)
+                if "heap_free_bytes" in s:
+                    self.heap.append((s["heap_free_bytes"], s.get("heap_largest_free_block_bytes", 0)))
+                next_scrape = now + 10
+            time.sleep(0.2)
+
+        # Commands still in flight get until the deadline
+        grace = time.time() + self.limits["ack_deadline_s"]
+        while len(self.acked) < len(self.sent) and time.time() < grace and board.alive():
+            time.sleep(0.5)
+        return self.results(board, injected_start, scrape(self.args.metrics_port))
+
+    def results(self, board, injected_start, final):
+        requests = {}
+        failed = 0
+        # From the registration on, it is logged just after t0
+        for t, method, route, status, _, _ in self.mock.requests:
+            if t < self.t0:
+                continue
+            key = f"{method} {route}"
+            requests[key] = requests.get(key, 0) + 1
+            failed += status >= 400
+        # Injected faults are the workload's, only the others count as failures
+        failed -= self.mock.injected - injected_start
+        ack_ms = [(self.acked[s] - self.sent[s]) * 1000 for s in self.sent if s in self.acked]
+        late = [s for s in self.sent if s in self.acked and self.acked[s] - self.sent[s] > self.limits["ack_deadline_s"]]
+
+        checks = []
+        if not board.alive():
+            checks.append("QEMU exited before the end of the run")
+        if board.boots > 1:
+            checks.append(f"board rebooted {board.boots - 1} time(s)")
+        checks += [f"crash: {line}" for line in board.crashes[:5]]
+        if len(ack_ms) < len(self.sent):
+            checks.append(f"{len(self.sent) - len(ack_ms)} of {len(self.sent)} commands never acknowledged")
+        if late:
+            checks.append(f"{len(late)} commands acknowledged after {self.limits['ack_deadline_s']} s")
+        if not final:
+            checks.append("/metrics did not answer at the end of the run")
+
+        trace = self.mock.db.get(f"devices/{self.device}/http_trace") or {}
+        trace_ms = {}
+        for ep, phases in trace.items():
+            if isinstance(phases, dict) and isinstance(phases.get("total"), list):
+                trace_ms[f"{ep}_total_p50"], trace_ms[f"{ep}_total_p99"] = phases["total"][:2]
+
+        return {
+            "workload": os.path.basename(self.args.workload),
+            "duration_s": self.workload["duration_s"],
+            "device": self.device,
+            "requests": dict(sorted(requests.items())),
+            "errors": {
+                "http_failed": failed,
+                "sensor_failures": sum(v for k, v in final.items() if k.startswith("sensor_read_failures_total")),
+                "tls_arena_fallbacks": final.get("tls_arena_fallbacks_total"),
+                "strict_allocs": final.get('heap_allocs_after_boot_total{tasks="strict"}'),
+            },
+            "heap": {
+                "free_min": final.get("heap_min_free_bytes"),
+                "free_end": final.get("heap_free_bytes"),
+                "largest_block_min": min((b for _, b in self.heap), default=None),
+            },
+            "latency_ms": {
+                "command_ack_p50": percentile(ack_ms, 50),
+                "command_ack_p90": percentile(ack_ms, 90),
+                "command_ack_max": max(ack_ms, default=None),
+                "request_p50": histogram_percentile(final, "http_request_duration_milliseconds", 50),
+                "request_p99": histogram_percentile(final, "http_request_duration_milliseconds", 99),
+                **trace_ms,
+            },
+            "rules": {
+                "firings": len(self.firings),
+                "eval_us_max": max((f.get("eval_us", 0) for f in self.firings), default=None),
+            },
+            "commands": {"sent": len(self.sent), "acked": len(ack_ms)},
+            "checks": checks,
+        }
+
+
+def compare(results, baseline, limits):
+    """(name, base, run, verdict) rows, verdict is empty when within limits"""
+    rows = []
+
+    def row(name, base, value, worse):
+        verdict = "" if base is None or value is None else worse(base, value)
+        rows.append((name, base, value, verdict))
+
+    pct = limits["requests_pct"] / 100
+    for route in sorted(set(baseline["requests"]) | set(results["requests"])):
+        base, value = baseline["requests"].get(route), results["requests"].get(route, 0)
+        if base is None:
+            rows.append((f"requests {route}", None, value, "new"))
+            continue
+        row(f"requests {route}", base, value,
+            lambda b, v: "more" if v > b * (1 + pct) + 1 else "missing" if v == 0 else "")
+    for name in results["errors"]:
+        row(f"errors {name}", baseline["errors"].get(name), results["errors"][name],
+            lambda b, v: "more" if v > b else "")
+    for name in results["heap"]:
+        row(f"heap {name}", baseline["heap"].get(name), results["heap"][name],
+            lambda b, v: "less" if v < b - limits["heap_bytes"] else "")
+    lat = limits["latency_pct"] / 100
+    for name in sorted(set(baseline["latency_ms"]) | set(results["latency_ms"])):
+        row(f"latency_ms {name}", baseline["latency_ms"].get(name), results["latency_ms"].get(name),
+            lambda b, v: "slower" if v > b * (1 + lat) + limits["latency_slack_ms"] else "")
+    # The rule fires on every light period, none means the rules path broke
+    row("rules firings", baseline["rules"]["firings"], results["rules"]["firings"],
+        lambda b, v: "none" if b > 0 and v == 0 else "")
+    return rows
+
+
+def fmt(v):
+    if v is None:
+        return "-"
+    return f"{v:.0f}" if isinstance(v, float) else str(v)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--build", action="store_true", help="build the QEMU variant first")
+    parser.add_argument("--build-dir", default=os.path.join(PROJECT, "build-qemu"))
+    parser.add_argument("--workload", default=os.path.join(HERE, "workload.json"))
+    parser.add_argument("--baseline", default=os.path.join(HERE, "baseline.json"))
+    parser.add_argument("--save-baseline", action="store_true", help="write this run as the baseline")
+    parser.add_argument("--out", default=None, help="results JSON, default <build dir>/perf_results.json")
+    parser.add_argument("--qemu", default="qemu-system-xtensa")
+    parser.add_argument("--port", type=int, default=8443, help="mock database, must match CONFIG_APP_QEMU_MOCK_URL")
+    parser.add_argument("--sntp-port", type=int, default=123, help="the board asks port 123, 0 to skip")
+    parser.add_argument("--metrics-port", type=int, default=18080, help="host port forwarded to the board's :80")
+    args = parser.parse_args()
+    args.build_dir = os.path.abspath(args.build_dir)
+
+    with open(args.workload, encoding="utf-8") as f:
+        workload = json.load(f)
+    perf = Run(args, workload)
+    board = sntp = None
+    try:
+        if args.build:
+            build(args.build_dir)
+        image = flash_image(args.build_dir)
+        if shutil.which(args.qemu) is None:
+            raise SetupError(f"{args.qemu} not found, install it with idf_tools.py install qemu-xtensa")
+        perf.mock.start("127.0.0.1", args.port)
+        if args.sntp_port:
+            try:
+                sntp = SntpServer("127.0.0.1", args.sntp_port)
+            except PermissionError:
+                raise SetupError(f"can't bind SNTP port {args.sntp_port}, run as root or lower "
+                                 "net.ipv4.ip_unprivileged_port_start")
+        board = Board(args.qemu, image, args.metrics_port, os.path.join(args.build_dir, "qemu_console.log"))
+        results = perf.execute(board)
+    except SetupError as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 2
+    finally:
+        if board:
+            board.stop()
+        if sntp:
+            sntp.stop()
+        perf.mock.stop()
+
+    out = args.out or os.path.join(args.build_dir, "perf_results.json")
+    with open(out, "w", encoding="utf-8") as f:
+        json.dump(results, f, indent=2)
+    print(f"Results in {out}, console in {os.path.join(args.build_dir, 'qemu_console.log')}")
+
+    for check in results["checks"]:
+        print(f"FAILED {check}")
+    if args.save_baseline:
+        if results["checks"]:
+            print("Not saved as the baseline, the run failed its checks", file=sys.stderr)
+            return 1
+        with open(args.baseline, "w", encoding="utf-8") as f:
+            json.dump(results, f, indent=2)
+        print(f"Saved as the baseline in {args.baseline}")
+        return 0
+    if not os.path.exists(args.baseline):
+        print(f"No baseline at {args.baseline}, run with --save-baseline on a known good build", file=sys.stderr)
+        return 1 if results["checks"] else 0
+
+    with open(args.baseline, encoding="utf-8") as f:
+        baseline = json.load(f)
+    rows = compare(results, baseline, workload["limits"])
+    print(f"{'metric':56} {'base':>10} {'run':>10}")
+    regressions = 0
+    for name, base, value, verdict in rows:
+        regressions += verdict not in ("", "new")
+        print(f"{name:56} {fmt(base):>10} {fmt(value):>10} {verdict.upper()}")
+    if regressions:
+        print(f"{regressions} regression(s) against {args.baseline}", file=sys.stderr)
+    return 1 if regressions or results["checks"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,40 @@
+#include "coalescer.h"
+
+void coalescer::put(const std::string &path, std::string json_value)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = pending_.find(path);
+    if (it != pending_.end()) {
+        it->second = std::move(json_value);
+        coalesced_++;
+    } else if (pending_.size() < max_pending_) {
+        pending_.emplace(path, std::move(json_value));
+    } else {
+        dropped_++;
+    }
+}
+
+coalescer::batch coalescer::take()
+{
+    batch out;
+    std::lock_guard<std::mutex> guard(lock_);
+    out.swap(pending_);
+    return out;
+}
+
+void coalescer::restore(batch &&failed)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto &entry : failed) {
+        if (pending_.size() < max_pending_)
+            pending_.try_emplace(entry.first, std::move(entry.second));
+        else if (pending_.find(entry.first) == pending_.end())
+            dropped_++;
+    }
+}
+
+size_t coalescer::pending() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return pending_.size();
+}
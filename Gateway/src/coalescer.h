@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Pending database writes, one value per path. A value that arrives before
+// the next flush replaces the older one, so a PATCH carries only the latest.
+// At most max_pending paths are held, a new path beyond that is dropped, so
+// a long outage costs the newest history instead of all the memory.
+class coalescer {
+public:
+    using batch = std::unordered_map<std::string, std::string>;
+
+    explicit coalescer(size_t max_pending = 500000) : max_pending_(max_pending) {}
+
+    void put(const std::string &path, std::string json_value);
+
+    // Everything pending, the coalescer is empty afterwards
+    batch take();
+
+    // Put back a batch that failed to upload, values written since win
+    void restore(batch &&failed);
+
+    size_t pending() const;
+    uint64_t coalesced() const { return coalesced_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    const size_t max_pending_;
+    mutable std::mutex lock_;
+    batch pending_;
+    std::atomic<uint64_t> coalesced_{0};
+    std::atomic<uint64_t> dropped_{0};     // paths turned away at the cap
+};
@@ -0,0 +1,311 @@
+#include "json.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+std::string json_quote(const std::string &text)
+{
+    std::string out;
+    out.reserve(text.size() + 2);
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+std::string json_number(double value)
+{
+    if (!std::isfinite(value))
+        return std::string();
+
+    char buf[32];
+    // Readings are floats on the board, 9 digits always get them back
+    for (int precision = 6; precision <= 9; precision++) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, value);
+        if (static_cast<float>(strtod(buf, nullptr)) == static_cast<float>(value))
+            break;
+    }
+    return buf;
+}
+
+static size_t skip_ws(const std::string &s, size_t pos)
+{
+    while (pos < s.size() && isspace(static_cast<unsigned char>(s[pos])))
+        pos++;
+    return pos;
+}
+
+/* End of the value starting at pos, npos if it is malformed */
+static size_t scan_value(const std::string &s, size_t pos)
+{
+    if (pos >= s.size())
+        return std::string::npos;
+
+    if (s[pos] == '"') {
+        for (size_t i = pos + 1; i < s.size(); i++) {
+            if (s[i] == '\\')
+                i++;
+            else if (s[i] == '"')
+                return i + 1;
+        }
+        return std::string::npos;
+    }
+
+    if (s[pos] == '{' || s[pos] == '[') {
+        int depth = 0;
+        for (size_t i = pos; i < s.size(); i++) {
+            char c = s[i];
+            if (c == '"') {
+                i = scan_value(s, i);
+                if (i == std::string::npos)
+                    return i;
+                i--;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0)
+                    return i + 1;
+            }
+        }
+        return std::string::npos;
+    }
+
+    // Number or literal
+    size_t end = pos;
+    while (end < s.size() && s[end] != ',' && s[end] != '}' && s[end] != ']' &&
+           !isspace(static_cast<unsigned char>(s[end])))
+        end++;
+    return end > pos ? end : std::string::npos;
+}
+
+// Nesting limit for json_valid(), far above what boards send
+static constexpr int JSON_MAX_DEPTH = 32;
+
+static bool valid_value(const std::string &s, size_t &pos, int depth);
+
+/* Only the four whitespace characters JSON allows */
+static size_t skip_json_ws(const std::string &s, size_t pos)
+{
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+        pos++;
+    return pos;
+}
+
+static bool valid_string(const std::string &s, size_t &pos)
+{
+    for (pos++; pos < s.size(); pos++) {
+        unsigned char c = s[pos];
+        if (c == '"') {
+            pos++;
+            return true;
+        }
+        if (c < 0x20)
+            return false;
+        if (c != '\\')
+            continue;
+        if (++pos >= s.size())
+            return false;
+        c = s[pos];
+        if (c == 'u') {
+            for (int i = 0; i < 4; i++)
+                if (++pos >= s.size() || !isxdigit(static_cast<unsigned char>(s[pos])))
+                    return false;
+        } else if (strchr("\"\\/bfnrt", c) == nullptr || c == '\0') {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool valid_digits(const std::string &s, size_t &pos)
+{
+    size_t start = pos;
+    while (pos < s.size() && isdigit(static_cast<unsigned char>(s[pos])))
+        pos++;
+    return pos > start;
+}
+
+static bool valid_number(const std::string &s, size_t &pos)
+{
+    if (s[pos] == '-')
+        pos++;
+    if (pos < s.size() && s[pos] == '0')
+        pos++;
+    else if (!valid_digits(s, pos))
+        return false;
+    if (pos < s.size() && s[pos] == '.') {
+        pos++;
+        if (!valid_digits(s, pos))
+            return false;
+    }
+    if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+        pos++;
+        if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+            pos++;
+        if (!valid_digits(s, pos))
+            return false;
+    }
+    return true;
+}
+
+static bool valid_container(const std::string &s, size_t &pos, int depth)
+{
+    char close = s[pos] == '{' ? '}' : ']';
+    pos = skip_json_ws(s, pos + 1);
+    if (pos < s.size() && s[pos] == close) {
+        pos++;
+        return true;
+    }
+    while (pos < s.size()) {
+        if (close == '}') {
+            if (s[pos] != '"' || !valid_string(s, pos))
+                return false;
+            pos = skip_json_ws(s, pos);
+            if (pos >= s.size() || s[pos] != ':')
+                return false;
+            pos = skip_json_ws(s, pos + 1);
+        }
+        if (!valid_value(s, pos, depth + 1))
+            return false;
+        pos = skip_json_ws(s, pos);
+        if (pos < s.size() && s[pos] == close) {
+            pos++;
+            return true;
+        }
+        if (pos >= s.size() || s[pos] != ',')
+            return false;
+        pos = skip_json_ws(s, pos + 1);
+    }
+    return false;
+}
+
+static bool valid_value(const std::string &s, size_t &pos, int depth)
+{
+    if (pos >= s.size() || depth > JSON_MAX_DEPTH)
+        return false;
+    switch (s[pos]) {
+    case '{':
+    case '[':
+        return valid_container(s, pos, depth);
+    case '"':
+        return valid_string(s, pos);
+    case 't':
+    case 'f':
+    case 'n':
+        for (const char *literal : { "true", "false", "null" }) {
+            if (s.compare(pos, strlen(literal), literal) == 0) {
+                pos += strlen(literal);
+                return true;
+            }
+        }
+        return false;
+    default:
+        return valid_number(s, pos);
+    }
+}
+
+bool json_valid(const std::string &text)
+{
+    size_t pos = skip_json_ws(text, 0);
+    if (!valid_value(text, pos, 0))
+        return false;
+    return skip_json_ws(text, pos) == text.size();
+}
+
+std::string json_unquote(const std::string &raw)
+{
+    if (raw.size() < 2 || raw.front() != '"')
+        return raw;
+
+    std::string out;
+    for (size_t i = 1; i + 1 < raw.size(); i++) {
+        char c = raw[i];
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        c = raw[++i];
+        switch (c) {
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u':
+            if (i + 4 < raw.size()) {
+                out += static_cast<char>(strtol(raw.substr(i + 1, 4).c_str(), nullptr, 16) & 0x7f);
+                i += 4;
+            }
+            break;
+        default: out += c; break;
+        }
+    }
+    return out;
+}
+
+bool json_members(const std::string &text, std::vector<std::pair<std::string, std::string>> &members)
+{
+    size_t pos = skip_ws(text, 0);
+    if (pos >= text.size() || text[pos] != '{')
+        return false;
+    pos = skip_ws(text, pos + 1);
+    if (pos < text.size() && text[pos] == '}')
+        return true;
+
+    while (pos < text.size()) {
+        size_t key_end = scan_value(text, pos);
+        if (text[pos] != '"' || key_end == std::string::npos)
+            return false;
+        std::string key = json_unquote(text.substr(pos, key_end - pos));
+
+        pos = skip_ws(text, key_end);
+        if (pos >= text.size() || text[pos] != ':')
+            return false;
+        pos = skip_ws(text, pos + 1);
+        size_t value_end = scan_value(text, pos);
+        if (value_end == std::string::npos)
+            return false;
+        members.emplace_back(std::move(key), text.substr(pos, value_end - pos));
+
+        pos = skip_ws(text, value_end);
+        if (pos < text.size() && text[pos] == '}')
+            return true;
+        if (pos >= text.size() || text[pos] != ',')
+            return false;
+        pos = skip_ws(text, pos + 1);
+    }
+    return false;
+}
+
+bool json_member(const std::string &text, const std::string &key, std::string &raw)
+{
+    std::vector<std::pair<std::string, std::string>> members;
+    if (!json_members(text, members))
+        return false;
+    for (auto &member : members) {
+        if (member.first == key) {
+            raw = std::move(member.second);
+            return true;
+        }
+    }
+    return false;
+}
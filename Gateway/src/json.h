@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON for building PATCH bodies and reading stream events
+
+// Quoted and escaped string
+std::string json_quote(const std::string &text);
+
+// Shortest form that round-trips a float reading, empty for NaN and the
+// infinities, which JSON has no form for
+std::string json_number(double value);
+
+// Whole text is one well-formed JSON value, nothing after it but whitespace.
+// json_members() only finds the member boundaries, check untrusted input
+// with this before it goes into a PATCH body.
+bool json_valid(const std::string &text);
+
+// Top-level members of an object as (key, raw value text), false if text is not an object
+bool json_members(const std::string &text, std::vector<std::pair<std::string, std::string>> &members);
+
+// Raw value of one top-level member
+bool json_member(const std::string &text, const std::string &key, std::string &raw);
+
+// Contents of a JSON string value, escapes resolved (\uXXXX only for ASCII)
+std::string json_unquote(const std::string &raw);
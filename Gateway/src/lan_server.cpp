@@ -0,0 +1,498 @@
+#include "lan_server.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gateway_frame.h"
+#include "json.h"
+#include "telemetry_cbor.h"
+#include "telemetry_fixed.h"
+#include "telemetry_gorilla.h"
+
+// Fleet index, one entry per board next to the devices/ tree
+static const std::string FLEET_ROOT = "fleet/";
+
+// Time-bucketed history, history/<device>/<yyyymmddhh>/<ms into the hour>/<channel>,
+// the same layout the boards append to over REST. Only history frames go there,
+// live telemetry is already in the board's own history batches.
+static const std::string HISTORY_ROOT = "history/";
+static constexpr int64_t HISTORY_BUCKET_MS = 3600000;
+
+// Accepted sample times: after SNTP could have set the board's clock (2020,
+// SAMPLE_TS_MIN_MS on the board) and at most an hour of clock skew ahead
+static constexpr int64_t SAMPLE_TS_MIN_MS = 1577836800000LL;
+static constexpr int64_t SAMPLE_TS_SKEW_MS = 3600000;
+
+// Unsent command bytes a slow board may hold up before it is dropped
+static constexpr size_t MAX_OUT_BUFFER = 16 * 1024;
+
+static std::string device_key(const uint8_t *id)
+{
+    char hex[GATEWAY_DEVICE_ID_LEN * 2 + 1];
+    for (int i = 0; i < GATEWAY_DEVICE_ID_LEN; i++)
+        snprintf(hex + 2 * i, 3, "%02x", id[i]);
+    return hex;
+}
+
+/* Empty if the time has no yyyymmddhh bucket */
+static std::string history_path(const std::string &device, int64_t ts_ms)
+{
+    int64_t bucket_ms = ts_ms - ts_ms % HISTORY_BUCKET_MS;
+    time_t t = bucket_ms / 1000;
+    struct tm tm;
+    char bucket[16];
+    if (gmtime_r(&t, &tm) == nullptr || strftime(bucket, sizeof(bucket), "%Y%m%d%H", &tm) != 10)
+        return std::string();
+    return HISTORY_ROOT + device + "/" + bucket + "/" + std::to_string(ts_ms - bucket_ms) + "/";
+}
+
+static bool parse_device_key(const std::string &key, uint8_t *id)
+{
+    if (key.size() != GATEWAY_DEVICE_ID_LEN * 2)
+        return false;
+    for (int i = 0; i < GATEWAY_DEVICE_ID_LEN; i++) {
+        unsigned int byte;
+        if (sscanf(key.c_str() + 2 * i, "%2x", &byte) != 1)
+            return false;
+        id[i] = byte;
+    }
+    return true;
+}
+
+lan_server::lan_server(uint16_t port, std::string root, coalescer &sink, gateway_stats &stats)
+    : port_(port), root_(std::move(root)), sink_(sink), stats_(stats)
+{
+}
+
+lan_server::~lan_server()
+{
+    for (auto &entry : connections_)
+        close(entry.first);
+    for (int fd : { udp_fd_, tcp_fd_, wake_fd_, epoll_fd_ }) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+bool lan_server::open()
+{
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port_);
+    int one = 1;
+
+    udp_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    tcp_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK);
+    epoll_fd_ = epoll_create1(0);
+    if (udp_fd_ < 0 || tcp_fd_ < 0 || wake_fd_ < 0 || epoll_fd_ < 0)
+        return false;
+
+    setsockopt(tcp_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(udp_fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (bind(udp_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        bind(tcp_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(tcp_fd_, 1024) < 0) {
+        perror("lan_server: bind");
+        return false;
+    }
+
+    for (int fd : { udp_fd_, tcp_fd_, wake_fd_ })
+        watch(fd, false);
+    return true;
+}
+
+void lan_server::watch(int fd, bool want_write)
+{
+    epoll_event ev {};
+    ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0)
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void lan_server::run(const std::atomic<bool> &stop)
+{
+    epoll_event events[256];
+
+    while (!stop) {
+        int n = epoll_wait(epoll_fd_, events, 256, 500);
+        if (n < 0 && errno != EINTR) {
+            perror("lan_server: epoll_wait");
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == udp_fd_) {
+                read_udp();
+            } else if (fd == tcp_fd_) {
+                accept_all();
+            } else if (fd == wake_fd_) {
+                uint64_t count;
+                while (read(wake_fd_, &count, sizeof(count)) > 0) {}
+                drain_commands();
+            } else {
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close_tcp(fd);
+                    continue;
+                }
+                if (events[i].events & EPOLLIN)
+                    read_tcp(fd);
+                if ((events[i].events & EPOLLOUT) && connections_.count(fd))
+                    write_tcp(fd);
+            }
+        }
+    }
+}
+
+void lan_server::accept_all()
+{
+    while (true) {
+        int fd = accept4(tcp_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd < 0)
+            return;
+        connections_[fd];
+        stats_.connections++;
+        watch(fd, false);
+    }
+}
+
+void lan_server::close_tcp(int fd)
+{
+    auto it = connections_.find(fd);
+    if (it == connections_.end())
+        return;
+    auto dev = device_fds_.find(it->second.device);
+    if (dev != device_fds_.end() && dev->second == fd)
+        device_fds_.erase(dev);
+    connections_.erase(it);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    stats_.connections--;
+}
+
+void lan_server::read_tcp(int fd)
+{
+    uint8_t buf[4096];
+    connection &conn = connections_[fd];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_tcp(fd);
+            return;
+        }
+        if (n < 0)
+            break;
+        conn.in.insert(conn.in.end(), buf, buf + n);
+    }
+
+    // Frames are u16 length + frame
+    size_t pos = 0;
+    while (conn.in.size() - pos >= 2) {
+        int len = conn.in[pos] << 8 | conn.in[pos + 1];
+        if (len > GATEWAY_FRAME_MAX) {
+            stats_.bad_frames++;
+            close_tcp(fd);
+            return;
+        }
+        if (conn.in.size() - pos - 2 < static_cast<size_t>(len))
+            break;
+        handle_frame(conn.in.data() + pos + 2, len, fd, nullptr);
+        if (connections_.count(fd) == 0)
+            return; // closed while answering
+        pos += 2 + len;
+    }
+    conn.in.erase(conn.in.begin(), conn.in.begin() + pos);
+}
+
+void lan_server::write_tcp(int fd)
+{
+    connection &conn = connections_[fd];
+    while (!conn.out.empty()) {
+        ssize_t n = send(fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                close_tcp(fd);
+            else
+                watch(fd, true);
+            return;
+        }
+        conn.out.erase(0, n);
+    }
+    watch(fd, false);
+}
+
+void lan_server::read_udp()
+{
+    uint8_t buf[GATEWAY_FRAME_MAX + 1];
+    sockaddr_in from {};
+    socklen_t from_len = sizeof(from);
+
+    while (true) {
+        ssize_t n = recvfrom(udp_fd_, buf, sizeof(buf), 0, reinterpret_cast<sockaddr *>(&from), &from_len);
+        if (n < 0)
+            return;
+        handle_frame(buf, static_cast<int>(n), -1, &from);
+        from_len = sizeof(from);
+    }
+}
+
+void lan_server::handle_frame(const uint8_t *frame, int len, int fd, const sockaddr_in *from)
+{
+    int type = gateway_frame_type(frame, len);
+    if (type < 0) {
+        stats_.bad_frames++;
+        return;
+    }
+    stats_.frames++;
+
+    std::string device = device_key(frame + 2);
+    int64_t since = 0; // shadow version a hello resyncs from
+    bool is_new;
+    if (fd >= 0) {
+        is_new = device_fds_[device] != fd;
+        device_fds_[device] = fd;
+        connections_[fd].device = device;
+    } else {
+        is_new = device_addrs_.count(device) == 0;
+        device_addrs_[device] = *from;
+    }
+
+    switch (type) {
+    case GATEWAY_MSG_TELEMETRY:
+        handle_telemetry(device, frame + GATEWAY_HEADER_LEN, len - GATEWAY_HEADER_LEN);
+        break;
+    case GATEWAY_MSG_HISTORY:
+    case GATEWAY_MSG_HISTORY_FIXED:
+        handle_history(device, frame + GATEWAY_HEADER_LEN, len - GATEWAY_HEADER_LEN, type == GATEWAY_MSG_HISTORY_FIXED);
+        break;
+    case GATEWAY_MSG_ACK:
+        handle_ack(device, frame + GATEWAY_HEADER_LEN, len - GATEWAY_HEADER_LEN);
+        break;
+    case GATEWAY_MSG_REPORTED:
+        handle_reported(device, frame + GATEWAY_HEADER_LEN, len - GATEWAY_HEADER_LEN);
+        break;
+    case GATEWAY_MSG_HELLO:
+        // No payload, or exactly the i64 shadow version
+        if (len - GATEWAY_HEADER_LEN != 0 && len - GATEWAY_HEADER_LEN != 8) {
+            stats_.bad_frames++;
+            return;
+        }
+        is_new = true;
+        if (len - GATEWAY_HEADER_LEN == 8) {
+            uint64_t version = 0;
+            for (int i = 0; i < 8; i++)
+                version = version << 8 | frame[GATEWAY_HEADER_LEN + i];
+            since = static_cast<int64_t>(version);
+            if (since < 0) {
+                stats_.bad_frames++;
+                since = 0;
+            }
+        }
+        break;
+    default:
+        stats_.bad_frames++;
+        return;
+    }
+
+    if (is_new)
+        sink_.put(FLEET_ROOT + device + "/transport", R"("gateway")");
+
+    // A board that (re)appears gets the desired fields it doesn't have right away
+    auto cmd = last_command_.find(device);
+    if (is_new && cmd != last_command_.end()) {
+        std::string delta = desired_since(cmd->second, since);
+        if (delta != "{}")
+            send_command(device, delta);
+    }
+}
+
+/* A channel's fixed-point value as the board would write it, exact */
+static std::string fixed_number(int32_t value, int channel)
+{
+    char text[TELEMETRY_FIXED_TEXT_MAX];
+    telemetry_fixed_format(text, sizeof(text), value, telemetry_channel_decimals(channel));
+    return text;
+}
+
+void lan_server::handle_telemetry(const std::string &device, const uint8_t *payload, int len)
+{
+    telemetry_reading_t readings[TELEMETRY_READINGS_MAX];
+    int64_t ts_ms;
+    int count = telemetry_cbor_decode(payload, len, &ts_ms, readings, TELEMETRY_READINGS_MAX);
+    if (count < 0) {
+        stats_.bad_frames++;
+        return;
+    }
+
+    std::string base = root_ + "/" + device + "/";
+    const char *last_node = nullptr;
+    for (int i = 0; i < count; i++) {
+        const char *node = telemetry_channel_node(readings[i].channel);
+        if (node == nullptr)
+            continue;
+        sink_.put(base + node + "/" + telemetry_channel_name(readings[i].channel),
+                  fixed_number(readings[i].value, readings[i].channel));
+        if (ts_ms >= 0 && node != last_node)
+            sink_.put(base + node + "/ts", std::to_string(ts_ms));
+        last_node = node;
+        stats_.values++;
+    }
+    sink_.put(FLEET_ROOT + device + "/last_seen", R"({".sv":"timestamp"})");
+}
+
+void lan_server::handle_history(const std::string &device, const uint8_t *payload, int len, bool fixed)
+{
+    if (len < GATEWAY_HISTORY_HEADER_LEN || telemetry_channel_node(payload[0]) == nullptr) {
+        stats_.bad_frames++;
+        return;
+    }
+    const char *channel = telemetry_channel_name(payload[0]);
+    uint16_t count = payload[1] << 8 | payload[2];
+
+    gorilla_decoder_t dec;
+    gorilla_decoder_init(&dec, payload + GATEWAY_HISTORY_HEADER_LEN, len - GATEWAY_HISTORY_HEADER_LEN, count);
+    int64_t ts_ms;
+    float value;
+    int32_t fixed_value;
+    int64_t ts_max = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()).count() + SAMPLE_TS_SKEW_MS;
+    bool rejected = false;
+    while (fixed ? gorilla_decode_fixed(&dec, &ts_ms, &fixed_value) : gorilla_decode(&dec, &ts_ms, &value)) {
+        // A corrupt batch decodes to garbage times and values, keep those out of the tree
+        if (ts_ms < SAMPLE_TS_MIN_MS || ts_ms > ts_max || (!fixed && !std::isfinite(value))) {
+            rejected = true;
+            continue;
+        }
+        std::string path = history_path(device, ts_ms);
+        if (path.empty()) {
+            rejected = true;
+            continue;
+        }
+        sink_.put(path + channel, fixed ? fixed_number(fixed_value, payload[0]) : json_number(value));
+        stats_.values++;
+    }
+    if (rejected || dec.remaining > 0)
+        stats_.bad_frames++;
+    sink_.put(FLEET_ROOT + device + "/last_seen", R"({".sv":"timestamp"})");
+}
+
+void lan_server::handle_ack(const std::string &device, const uint8_t *payload, int len)
+{
+    // Goes into a PATCH body as is, so it has to be a JSON object and nothing
+    // else, one bad ack would get the whole PATCH refused
+    std::string ack(reinterpret_cast<const char *>(payload), len);
+    std::vector<std::pair<std::string, std::string>> members;
+    if (!json_valid(ack) || !json_members(ack, members)) {
+        stats_.bad_frames++;
+        return;
+    }
+    sink_.put(root_ + "/" + device + "/command_ack", ack);
+}
+
+void lan_server::handle_reported(const std::string &device, const uint8_t *payload, int len)
+{
+    // Members go into a PATCH body as is, so they have to be JSON
+    std::string fields(reinterpret_cast<const char *>(payload), len);
+    std::vector<std::pair<std::string, std::string>> members;
+    if (!json_valid(fields) || !json_members(fields, members)) {
+        stats_.bad_frames++;
+        return;
+    }
+    for (auto &member : members)
+        sink_.put(root_ + "/" + device + "/reported/" + member.first, member.second);
+}
+
+/* The desired fields with a version at or after since, all of them for 0 */
+std::string lan_server::desired_since(const std::string &json, int64_t since)
+{
+    std::vector<std::pair<std::string, std::string>> members;
+    if (since <= 0 || !json_valid(json) || !json_members(json, members))
+        return json;
+
+    std::string out = "{";
+    for (auto &member : members) {
+        // A field without a whole-number version goes along, the board's shadow decides
+        std::string version;
+        char *end = nullptr;
+        if (json_member(member.second, "version", version)) {
+            long long parsed = strtoll(version.c_str(), &end, 10);
+            if (end != version.c_str() && *end == '\0' && parsed < since)
+                continue;
+        }
+        if (out.size() > 1)
+            out += ',';
+        out += json_quote(member.first) + ":" + member.second;
+    }
+    return out + "}";
+}
+
+void lan_server::send_command(const std::string &device, const std::string &json)
+{
+    uint8_t id[GATEWAY_DEVICE_ID_LEN];
+    if (!parse_device_key(device, id) || GATEWAY_HEADER_LEN + json.size() > GATEWAY_FRAME_MAX) {
+        fprintf(stderr, "lan_server: can't frame command for %s\n", device.c_str());
+        return;
+    }
+    uint8_t frame[GATEWAY_FRAME_MAX];
+    int len = gateway_frame_header(frame, GATEWAY_MSG_COMMAND, id);
+    memcpy(frame + len, json.data(), json.size());
+    len += json.size();
+
+    auto tcp = device_fds_.find(device);
+    if (tcp != device_fds_.end()) {
+        connection &conn = connections_[tcp->second];
+        if (conn.out.size() > MAX_OUT_BUFFER) {
+            close_tcp(tcp->second);
+            return;
+        }
+        conn.out += static_cast<char>(len >> 8);
+        conn.out += static_cast<char>(len & 0xff);
+        conn.out.append(reinterpret_cast<const char *>(frame), len);
+        write_tcp(tcp->second);
+        stats_.commands_out++;
+        return;
+    }
+
+    auto udp = device_addrs_.find(device);
+    if (udp != device_addrs_.end()) {
+        sendto(udp_fd_, frame, len, 0, reinterpret_cast<const sockaddr *>(&udp->second), sizeof(udp->second));
+        stats_.commands_out++;
+    }
+}
+
+void lan_server::post_command(const std::string &device, const std::string &json)
+{
+    {
+        std::lock_guard<std::mutex> guard(command_lock_);
+        command_queue_.emplace_back(device, json);
+    }
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+        perror("lan_server: eventfd");
+}
+
+void lan_server::drain_commands()
+{
+    std::vector<std::pair<std::string, std::string>> commands;
+    {
+        std::lock_guard<std::mutex> guard(command_lock_);
+        commands.swap(command_queue_);
+    }
+    for (auto &command : commands) {
+        last_command_[command.first] = command.second;
+        send_command(command.first, command.second);
+    }
+}
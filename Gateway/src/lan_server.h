@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <netinet/in.h>
+
+#include "coalescer.h"
+#include "stats.h"
+
+// Board side of the gateway: one epoll loop serving UDP datagrams and TCP
+// connections on the same port (framing in gateway_frame.h). Telemetry goes
+// into the coalescer under <root>/<device>/<node>/<channel>, the
+// Gorilla-compressed history batches boards upload under
+// history/<device>/<yyyymmddhh>, command acks and the reported shadow fields
+// under <root>/<device>/command_ack and <root>/<device>/reported, liveness
+// under fleet/<device>.
+class lan_server {
+public:
+    lan_server(uint16_t port, std::string root, coalescer &sink, gateway_stats &stats);
+    ~lan_server();
+
+    bool open();
+    void run(const std::atomic<bool> &stop);
+
+    // Send a board its command (desired) state, callable from any thread. The
+    // latest state is also kept for boards that say hello later, they get the
+    // fields changed since the shadow version in their hello.
+    void post_command(const std::string &device, const std::string &json);
+
+private:
+    struct connection {
+        std::vector<uint8_t> in;
+        std::string out;
+        std::string device;
+    };
+
+    void accept_all();
+    void read_tcp(int fd);
+    void write_tcp(int fd);
+    void close_tcp(int fd);
+    void read_udp();
+    void handle_frame(const uint8_t *frame, int len, int fd, const sockaddr_in *from);
+    void handle_telemetry(const std::string &device, const uint8_t *payload, int len);
+    void handle_history(const std::string &device, const uint8_t *payload, int len, bool fixed);
+    void handle_ack(const std::string &device, const uint8_t *payload, int len);
+    void handle_reported(const std::string &device, const uint8_t *payload, int len);
+    static std::string desired_since(const std::string &json, int64_t since);
+    void send_command(const std::string &device, const std::string &json);
+    void drain_commands();
+    void watch(int fd, bool want_write);
+
+    uint16_t port_;
+    std::string root_;
+    coalescer &sink_;
+    gateway_stats &stats_;
+
+    int epoll_fd_ = -1;
+    int udp_fd_ = -1;
+    int tcp_fd_ = -1;
+    int wake_fd_ = -1;
+
+    std::unordered_map<int, connection> connections_;
+    std::unordered_map<std::string, int> device_fds_;           // boards on TCP
+    std::unordered_map<std::string, sockaddr_in> device_addrs_; // boards on UDP
+    std::unordered_map<std::string, std::string> last_command_;
+
+    std::mutex command_lock_;
+    std::vector<std::pair<std::string, std::string>> command_queue_;
+};
@@ -0,0 +1,169 @@
+// Edge gateway: boards on the LAN send telemetry here instead of each holding
+// a TLS session to Firebase. Writes from every board are coalesced and go up
+// as multi-path PATCHes, command changes come down one event stream.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <thread>
+#include <sys/resource.h>
+#include <curl/curl.h>
+
+#include "coalescer.h"
+#include "gateway_frame.h"
+#include "lan_server.h"
+#include "stats.h"
+#include "upstream.h"
+
+static std::atomic<bool> stop_requested{false};
+
+static void on_signal(int)
+{
+    stop_requested = true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --db URL             database root, e.g. https://<project>-default-rtdb.firebaseio.com\n"
+            "                       (leave out for a dry run that builds but does not send PATCHes)\n"
+            "  --auth TOKEN         database secret or ID token\n"
+            "  --root PATH          where board data is written (default devices)\n"
+            "  --commands PATH      command states streamed down to boards (default commands)\n"
+            "  --port N             LAN port for UDP and TCP (default %d)\n"
+            "  --flush-ms N         coalescing window (default 1000)\n"
+            "  --max-paths N        paths per PATCH (default 1000)\n"
+            "  --max-pending N      paths held while the database is unreachable (default 500000)\n"
+            "  --stats-s N          stats period in seconds, 0 = off (default 10)\n",
+            prog, GATEWAY_PORT);
+}
+
+static double cpu_seconds()
+{
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void report_loop(const gateway_stats &stats, const coalescer &pending, int period_s)
+{
+    auto last = std::chrono::steady_clock::now();
+    double last_cpu = cpu_seconds();
+    uint64_t last_frames = 0, last_values = 0;
+
+    while (!stop_requested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        if (elapsed < period_s)
+            continue;
+
+        double cpu = cpu_seconds();
+        uint64_t frames = stats.frames, values = stats.values;
+        printf("frames/s %.0f, values/s %.0f, cpu %.1f%%, tcp %d, pending %zu, coalesced %llu, "
+               "dropped %llu, patches %llu (%llu failed, %llu rejected), paths %llu (%llu rejected), bytes %llu, "
+               "commands %llu in / %llu out, bad %llu\n",
+               (frames - last_frames) / elapsed, (values - last_values) / elapsed,
+               100.0 * (cpu - last_cpu) / elapsed, stats.connections.load(), pending.pending(),
+               (unsigned long long)pending.coalesced(), (unsigned long long)pending.dropped(),
+               (unsigned long long)stats.patches.load(), (unsigned long long)stats.patch_failures.load(),
+               (unsigned long long)stats.patch_rejects.load(), (unsigned long long)stats.paths_out.load(),
+               (unsigned long long)stats.paths_rejected.load(),
+               (unsigned long long)stats.bytes_out.load(), (unsigned long long)stats.command_events.load(),
+               (unsigned long long)stats.commands_out.load(), (unsigned long long)stats.bad_frames.load());
+        fflush(stdout);
+        last = now;
+        last_cpu = cpu;
+        last_frames = frames;
+        last_values = values;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    upstream_config config;
+    config.commands_path = "commands";
+    std::string root = "devices";
+    int port = GATEWAY_PORT;
+    int stats_s = 10;
+    long max_pending = 500000;
+
+    static const option options[] = {
+        { "db", required_argument, nullptr, 'd' },
+        { "auth", required_argument, nullptr, 'a' },
+        { "root", required_argument, nullptr, 'r' },
+        { "commands", required_argument, nullptr, 'c' },
+        { "port", required_argument, nullptr, 'p' },
+        { "flush-ms", required_argument, nullptr, 'f' },
+        { "max-paths", required_argument, nullptr, 'm' },
+        { "max-pending", required_argument, nullptr, 'P' },
+        { "stats-s", required_argument, nullptr, 's' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+        case 'd': config.db_url = optarg; break;
+        case 'a': config.auth = optarg; break;
+        case 'r': root = optarg; break;
+        case 'c': config.commands_path = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'f': config.flush_ms = atoi(optarg); break;
+        case 'm': config.max_paths = static_cast<size_t>(atoi(optarg)); break;
+        case 'P': max_pending = atol(optarg); break;
+        case 's': stats_s = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    while (!config.db_url.empty() && config.db_url.back() == '/')
+        config.db_url.pop_back();
+    if (config.max_paths == 0 || config.flush_ms <= 0 || max_pending <= 0 || port <= 0 || port > 65535) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // One descriptor per board on TCP
+    rlimit files {};
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    gateway_stats stats;
+    coalescer pending(static_cast<size_t>(max_pending));
+    lan_server lan(static_cast<uint16_t>(port), root, pending, stats);
+    if (!lan.open()) {
+        fprintf(stderr, "gateway: can't listen on port %d\n", port);
+        return 1;
+    }
+
+    upstream up(config, pending, stats);
+    up.start([&lan](const std::string &device, const std::string &json) { lan.post_command(device, json); });
+    printf("gateway: port %d, %s, flush every %d ms\n", port,
+           config.db_url.empty() ? "dry run" : config.db_url.c_str(), config.flush_ms);
+
+    std::thread reporter;
+    if (stats_s > 0)
+        reporter = std::thread(report_loop, std::cref(stats), std::cref(pending), stats_s);
+
+    lan.run(stop_requested);
+
+    stop_requested = true;
+    up.stop();
+    if (reporter.joinable())
+        reporter.join();
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,276 @@
+#include "rollup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include <curl/curl.h>
+
+#include "json.h"
+
+static constexpr int64_t MINUTE_MS = 60000;
+static constexpr int64_t HOUR_MS = 3600000;
+
+void aggregate::add(double value)
+{
+    if (!std::isfinite(value))
+        return;
+    if (count == 0 || value < min)
+        min = value;
+    if (count == 0 || value > max)
+        max = value;
+    sum += value;
+    count++;
+}
+
+void aggregate::merge(const aggregate &other)
+{
+    if (other.count == 0)
+        return;
+    if (count == 0 || other.min < min)
+        min = other.min;
+    if (count == 0 || other.max > max)
+        max = other.max;
+    sum += other.sum;
+    count += other.count;
+}
+
+std::string aggregate::to_json() const
+{
+    return "{\"min\":" + json_number(min) + ",\"max\":" + json_number(max) +
+           ",\"mean\":" + json_number(count ? sum / count : 0) + ",\"count\":" + std::to_string(count) + "}";
+}
+
+/* yyyymmddhh or yyyymmddhhmm (UTC) of a time */
+static std::string time_key(int64_t ms, bool minutes)
+{
+    time_t t = ms / 1000;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char key[16];
+    strftime(key, sizeof(key), minutes ? "%Y%m%d%H%M" : "%Y%m%d%H", &tm);
+    return key;
+}
+
+static size_t append_body(char *ptr, size_t size, size_t nmemb, void *user)
+{
+    static_cast<std::string *>(user)->append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+rollup_worker::rollup_worker(rollup_config config)
+    : config_(std::move(config)), curl_(curl_easy_init())
+{
+}
+
+rollup_worker::~rollup_worker()
+{
+    curl_easy_cleanup(static_cast<CURL *>(curl_));
+}
+
+std::string rollup_worker::url(const std::string &path, const std::string &query) const
+{
+    std::vector<std::string> params;
+    if (!query.empty())
+        params.push_back(query);
+    if (!config_.ns.empty())
+        params.push_back("ns=" + config_.ns);
+    if (!config_.auth.empty())
+        params.push_back("auth=" + config_.auth);
+
+    std::string out = config_.db_url + "/" + path + ".json";
+    for (size_t i = 0; i < params.size(); i++)
+        out += (i == 0 ? '?' : '&') + params[i];
+    return out;
+}
+
+bool rollup_worker::get(const std::string &path, const std::string &query, std::string &body)
+{
+    CURL *curl = static_cast<CURL *>(curl_);
+    body.clear();
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url(path, query).c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_body);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 30000L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    long status = 0;
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (res != CURLE_OK || status != 200) {
+        fprintf(stderr, "rollup: GET %s failed, %s, status %ld\n", path.c_str(), curl_easy_strerror(res), status);
+        return false;
+    }
+    return true;
+}
+
+bool rollup_worker::patch(const std::map<std::string, std::string> &writes)
+{
+    CURL *curl = static_cast<CURL *>(curl_);
+    std::vector<const std::pair<const std::string, std::string> *> entries;
+    for (auto &entry : writes)
+        entries.push_back(&entry);
+
+    // Multi-path PATCHes at the root, each one is all-or-nothing
+    for (size_t start = 0; start < entries.size(); start += config_.max_paths) {
+        size_t end = std::min(entries.size(), start + config_.max_paths);
+        std::string body = "{";
+        for (size_t i = start; i < end; i++) {
+            if (i > start)
+                body += ',';
+            body += json_quote(entries[i]->first);
+            body += ':';
+            body += entries[i]->second;
+        }
+        body += '}';
+
+        std::string response;
+        curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+        curl_easy_reset(curl);
+        curl_easy_setopt(curl, CURLOPT_URL, url("", "print=silent").c_str());
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_body);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 30000L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+        long status = 0;
+        CURLcode res = curl_easy_perform(curl);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        curl_slist_free_all(headers);
+        if (res != CURLE_OK || status < 200 || status >= 300) {
+            fprintf(stderr, "rollup: PATCH failed, %s, status %ld\n", curl_easy_strerror(res), status);
+            return false;
+        }
+        paths_written_ += end - start;
+    }
+    return true;
+}
+
+bool rollup_worker::roll_bucket(const std::string &device, int64_t bucket_ms, bucket_state &state,
+                                std::map<std::string, std::string> &writes)
+{
+    // Re-read from the minute holding the newest sample minus the settle time,
+    // late uploads land there. Integer keys sort numerically.
+    int64_t from = 0;
+    if (state.newest_offset >= 0)
+        from = std::max<int64_t>(0, state.newest_offset - config_.settle_s * 1000LL) / MINUTE_MS * MINUTE_MS;
+    std::string bucket = time_key(bucket_ms, false);
+    std::string path = config_.history_path + "/" + device + "/" + bucket;
+    std::string query;
+    if (from > 0)
+        query = "orderBy=%22%24key%22&startAt=%22" + std::to_string(from) + "%22";
+
+    std::string body;
+    if (!get(path, query, body))
+        return false;
+
+    std::vector<std::pair<std::string, std::string>> offsets, channels;
+    if (!json_members(body, offsets))
+        return true; // null, nothing in the bucket yet
+
+    // Minutes from the re-read point on are rebuilt from scratch
+    int first_minute = static_cast<int>(from / MINUTE_MS);
+    auto rebuilt = state.minutes.lower_bound(first_minute);
+    uint64_t count_before = 0, count_after = 0;
+    int64_t newest_before = state.newest_offset;
+    for (auto it = rebuilt; it != state.minutes.end(); ++it)
+        for (auto &channel : it->second)
+            count_before += channel.second.count;
+    state.minutes.erase(rebuilt, state.minutes.end());
+    for (auto &offset : offsets) {
+        int64_t ms = atoll(offset.first.c_str());
+        if (ms < from || ms >= HOUR_MS)
+            continue;
+        channels.clear();
+        if (!json_members(offset.second, channels))
+            continue;
+        auto &minute = state.minutes[static_cast<int>(ms / MINUTE_MS)];
+        for (auto &channel : channels) {
+            minute[channel.first].add(strtod(channel.second.c_str(), nullptr));
+            samples_++;
+            count_after++;
+        }
+        state.newest_offset = std::max(state.newest_offset, ms);
+    }
+
+    if (count_after == count_before && state.newest_offset == newest_before)
+        return true; // nothing new since the last pass
+
+    // The touched minutes, and the hour merged from all of its minutes
+    std::string root = config_.rollup_path + "/" + device + "/";
+    std::map<std::string, aggregate> hour;
+    for (auto &minute : state.minutes) {
+        std::string key = time_key(bucket_ms + minute.first * MINUTE_MS, true);
+        for (auto &channel : minute.second) {
+            if (minute.first >= first_minute)
+                writes[root + "minute/" + key + "/" + channel.first] = channel.second.to_json();
+            hour[channel.first].merge(channel.second);
+        }
+    }
+    for (auto &channel : hour)
+        writes[root + "hour/" + bucket + "/" + channel.first] = channel.second.to_json();
+    return true;
+}
+
+bool rollup_worker::run_once(int64_t now_ms)
+{
+    std::string body;
+    std::vector<std::pair<std::string, std::string>> devices;
+    if (!get(config_.fleet_path, "shallow=true", body))
+        return false;
+    json_members(body, devices);
+
+    int hours = first_pass_ ? std::max(config_.backfill_hours, config_.lookback_hours) : config_.lookback_hours;
+    int64_t current = now_ms / HOUR_MS * HOUR_MS;
+    int64_t oldest = current - (hours - 1) * HOUR_MS;
+    bool ok = true;
+
+    for (auto &device : devices) {
+        auto &buckets = state_[device.first];
+        std::map<std::string, std::string> writes;
+        for (int64_t bucket_ms = oldest; bucket_ms <= current; bucket_ms += HOUR_MS) {
+            if (!roll_bucket(device.first, bucket_ms, buckets[bucket_ms], writes))
+                ok = false;
+        }
+        if (!writes.empty() && !patch(writes)) {
+            // The state already has what the lost writes carried, start the
+            // device over so the next pass reads its buckets whole and rewrites them
+            state_.erase(device.first);
+            ok = false;
+            continue;
+        }
+
+        // Buckets that dropped out of the lookback are final
+        buckets.erase(buckets.begin(), buckets.lower_bound(current - (config_.lookback_hours - 1) * HOUR_MS));
+    }
+    if (ok)
+        first_pass_ = false;
+    return ok;
+}
+
+void rollup_worker::run(const std::atomic<bool> &stop)
+{
+    while (!stop) {
+        auto start = std::chrono::steady_clock::now();
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+        bool ok = run_once(now_ms);
+        double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("rollup: pass %s in %.2f s, %llu samples read, %llu paths written\n", ok ? "done" : "incomplete", took,
+               (unsigned long long)samples_, (unsigned long long)paths_written_);
+        fflush(stdout);
+
+        auto next = start + std::chrono::seconds(config_.interval_s);
+        while (!stop && std::chrono::steady_clock::now() < next)
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+
+struct rollup_config {
+    std::string db_url;             // https://<project>-default-rtdb.firebaseio.com or the emulator
+    std::string auth;               // database secret or ID token, optional
+    std::string ns;                 // emulator namespace (?ns=<project>), optional
+    std::string fleet_path = "fleet";
+    std::string history_path = "history";
+    std::string rollup_path = "rollup";
+    int interval_s = 30;            // time between passes
+    int lookback_hours = 2;         // buckets revisited every pass, the current one included
+    int backfill_hours = 24;        // buckets rolled up on the first pass
+    int settle_s = 300;             // how late samples may land behind the newest one
+    size_t max_paths = 1000;        // paths per PATCH
+};
+
+// min/max/mean/count of one channel over a minute or an hour. Aggregates of
+// minutes merge into the hour's.
+struct aggregate {
+    double min = 0;
+    double max = 0;
+    double sum = 0;
+    uint64_t count = 0;
+
+    void add(double value);
+    void merge(const aggregate &other);
+    std::string to_json() const;
+};
+
+// Rolls the raw history buckets, history/<device>/<yyyymmddhh>/<ms into the
+// hour>/<channel>, up into rollup/<device>/minute/<yyyymmddhhmm>/<channel> and
+// rollup/<device>/hour/<yyyymmddhh>/<channel>. Each pass only reads the tail
+// of a bucket since the last pass and rewrites the minutes it touched.
+class rollup_worker {
+public:
+    explicit rollup_worker(rollup_config config);
+    ~rollup_worker();
+
+    // One pass over every board in the fleet, false if a request failed
+    bool run_once(int64_t now_ms);
+    void run(const std::atomic<bool> &stop);
+
+    uint64_t samples() const { return samples_; }
+    uint64_t paths_written() const { return paths_written_; }
+
+private:
+    // What is known of one history bucket
+    struct bucket_state {
+        int64_t newest_offset = -1;                                 // ms into the hour
+        std::map<int, std::map<std::string, aggregate>> minutes;    // minute of the hour -> channel
+    };
+
+    bool roll_bucket(const std::string &device, int64_t bucket_ms, bucket_state &state,
+                     std::map<std::string, std::string> &writes);
+    bool get(const std::string &path, const std::string &query, std::string &body);
+    bool patch(const std::map<std::string, std::string> &writes);
+    std::string url(const std::string &path, const std::string &query) const;
+
+    rollup_config config_;
+    void *curl_;
+    bool first_pass_ = true;
+    uint64_t samples_ = 0;
+    uint64_t paths_written_ = 0;
+
+    // device -> bucket start (ms) -> state
+    std::map<std::string, std::map<int64_t, bucket_state>> state_;
+};
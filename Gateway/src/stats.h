@@ -0,0 +1,20 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Counters shared by the LAN side and the upstream threads
+struct gateway_stats {
+    std::atomic<uint64_t> frames{0};            // frames received from boards
+    std::atomic<uint64_t> bad_frames{0};
+    std::atomic<uint64_t> values{0};            // channel values written to the coalescer
+    std::atomic<uint64_t> patches{0};           // multi-path PATCH requests sent
+    std::atomic<uint64_t> patch_failures{0};      // transient, the paths are retried
+    std::atomic<uint64_t> patch_rejects{0};       // 4xx, the paths are dropped
+    std::atomic<uint64_t> paths_rejected{0};
+    std::atomic<uint64_t> paths_out{0};         // paths carried by those PATCHes
+    std::atomic<uint64_t> bytes_out{0};         // PATCH body bytes
+    std::atomic<uint64_t> command_events{0};    // changes seen on the command stream
+    std::atomic<uint64_t> commands_out{0};      // command frames sent to boards
+    std::atomic<int> connections{0};            // open TCP connections
+};
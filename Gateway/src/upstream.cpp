@@ -0,0 +1,296 @@
+#include "upstream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <curl/curl.h>
+
+#include "json.h"
+
+static constexpr long BACKOFF_MAX_MS = 60000;
+
+upstream::upstream(upstream_config config, coalescer &source, gateway_stats &stats)
+    : config_(std::move(config)), source_(source), stats_(stats)
+{
+}
+
+upstream::~upstream()
+{
+    stop();
+}
+
+void upstream::start(command_sink sink)
+{
+    sink_ = std::move(sink);
+    writer_ = std::thread(&upstream::writer_loop, this);
+    if (!config_.db_url.empty() && !config_.commands_path.empty())
+        commands_ = std::thread(&upstream::command_loop, this);
+}
+
+void upstream::stop()
+{
+    stopping_ = true;
+    wake_.notify_all();
+    if (writer_.joinable())
+        writer_.join();
+    if (commands_.joinable())
+        commands_.join();
+}
+
+std::string upstream::url(const std::string &path, const char *query) const
+{
+    std::string out = config_.db_url + "/" + path + ".json";
+    char sep = '?';
+    if (query != nullptr) {
+        out += sep;
+        out += query;
+        sep = '&';
+    }
+    if (!config_.auth.empty()) {
+        out += sep;
+        out += "auth=" + config_.auth;
+    }
+    return out;
+}
+
+static size_t discard(char *, size_t size, size_t nmemb, void *)
+{
+    return size * nmemb;
+}
+
+void upstream::writer_loop()
+{
+    CURL *curl = curl_easy_init();
+    curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+    curl_easy_setopt(curl, CURLOPT_URL, url("", "print=silent").c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 15000L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    long backoff_ms = 0;
+    while (!stopping_) {
+        {
+            std::unique_lock<std::mutex> guard(wake_lock_);
+            wake_.wait_for(guard, std::chrono::milliseconds(config_.flush_ms + backoff_ms),
+                           [this] { return stopping_.load(); });
+        }
+
+        coalescer::batch batch = source_.take();
+        if (batch.empty())
+            continue;
+
+        // Split into PATCHes of at most max_paths, each one is all-or-nothing
+        std::vector<coalescer::batch::value_type *> entries;
+        entries.reserve(batch.size());
+        for (auto &entry : batch)
+            entries.push_back(&entry);
+
+        coalescer::batch failed;
+        for (size_t start = 0; start < entries.size(); start += config_.max_paths) {
+            size_t end = std::min(entries.size(), start + config_.max_paths);
+            std::string body = "{";
+            for (size_t i = start; i < end; i++) {
+                if (i > start)
+                    body += ',';
+                body += json_quote(entries[i]->first);
+                body += ':';
+                body += entries[i]->second;
+            }
+            body += '}';
+
+            bool ok = true;
+            bool retry = false;
+            if (!config_.db_url.empty()) {
+                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+                curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+                long status = 0;
+                CURLcode res = curl_easy_perform(curl);
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+                ok = res == CURLE_OK && status >= 200 && status < 300;
+                // Only the network, the server and rate limits are worth another try,
+                // any other 4xx is this body and would fail the same way forever
+                retry = res != CURLE_OK || status >= 500 || status == 429;
+                if (!ok)
+                    fprintf(stderr, "upstream: PATCH %s, %s, status %ld, %zu paths\n", retry ? "failed" : "rejected",
+                            curl_easy_strerror(res), status, end - start);
+            }
+
+            stats_.patches++;
+            if (ok) {
+                stats_.paths_out += end - start;
+                stats_.bytes_out += body.size();
+            } else if (retry) {
+                stats_.patch_failures++;
+                for (size_t i = start; i < end; i++)
+                    failed.emplace(std::move(entries[i]->first), std::move(entries[i]->second));
+            } else {
+                stats_.patch_rejects++;
+                stats_.paths_rejected += end - start;
+            }
+        }
+
+        if (failed.empty()) {
+            backoff_ms = 0;
+        } else {
+            source_.restore(std::move(failed));
+            backoff_ms = std::min(BACKOFF_MAX_MS, backoff_ms ? backoff_ms * 2 : 1000L);
+        }
+    }
+
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+}
+
+size_t upstream::on_stream_data(char *ptr, size_t size, size_t nmemb, void *user)
+{
+    auto *self = static_cast<upstream *>(user);
+    if (self->stopping_)
+        return 0;
+    self->stream_buf_.append(ptr, size * nmemb);
+
+    // Server-sent events: "event:" and "data:" lines, a blank line ends one
+    size_t pos;
+    while ((pos = self->stream_buf_.find('\n')) != std::string::npos) {
+        std::string line = self->stream_buf_.substr(0, pos);
+        self->stream_buf_.erase(0, pos + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.empty()) {
+            self->on_event(self->event_, self->data_);
+            self->event_.clear();
+            self->data_.clear();
+        } else if (line.compare(0, 6, "event:") == 0) {
+            self->event_ = line.substr(line.find_first_not_of(' ', 6));
+        } else if (line.compare(0, 5, "data:") == 0) {
+            size_t start = line.find_first_not_of(' ', 5);
+            self->data_ += start == std::string::npos ? "" : line.substr(start);
+        }
+    }
+    return size * nmemb;
+}
+
+int upstream::on_progress(void *user, long long, long long, long long, long long)
+{
+    return static_cast<upstream *>(user)->stopping_ ? 1 : 0;
+}
+
+void upstream::command_loop()
+{
+    long backoff_ms = 1000;
+
+    while (!stopping_) {
+        CURL *curl = curl_easy_init();
+        curl_slist *headers = curl_slist_append(nullptr, "Accept: text/event-stream");
+        std::string stream_url = url(config_.commands_path, nullptr);
+        curl_easy_setopt(curl, CURLOPT_URL, stream_url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, on_stream_data);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, on_progress);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        // Firebase sends keep-alive events every 30 s
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 90L);
+
+        stream_buf_.clear();
+        event_.clear();
+        data_.clear();
+        CURLcode res = curl_easy_perform(curl);
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
+
+        if (stopping_)
+            break;
+        fprintf(stderr, "upstream: command stream ended, %s, retry in %ld ms\n", curl_easy_strerror(res), backoff_ms);
+        std::unique_lock<std::mutex> guard(wake_lock_);
+        wake_.wait_for(guard, std::chrono::milliseconds(backoff_ms), [this] { return stopping_.load(); });
+        backoff_ms = std::min(BACKOFF_MAX_MS, backoff_ms * 2);
+    }
+}
+
+void upstream::on_event(const std::string &event, const std::string &data)
+{
+    if (event == "keep-alive" || event.empty())
+        return;
+    if (event == "cancel" || event == "auth_revoked") {
+        fprintf(stderr, "upstream: command stream %s\n", event.c_str());
+        return;
+    }
+    if (event != "put" && event != "patch")
+        return;
+
+    std::string path_raw, value;
+    if (!json_member(data, "path", path_raw) || !json_member(data, "data", value))
+        return;
+    stats_.command_events++;
+    apply_command(json_unquote(path_raw), value, event == "patch");
+}
+
+/* Fold one stream event into the per-device state, then push the devices it touched */
+void upstream::apply_command(const std::string &path, const std::string &raw, bool merge)
+{
+    // Split the event path below the commands path: "", "<device>" or "<device>/<field>"
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos)
+            slash = path.size();
+        if (slash > start)
+            parts.push_back(path.substr(start, slash - start));
+        start = slash + 1;
+    }
+
+    std::vector<std::pair<std::string, std::string>> members;
+    if (parts.empty()) {
+        // Whole tree (put) or several children (patch), keys may be "<device>/<field>"
+        if (!merge)
+            command_state_.clear();
+        if (raw != "null" && !json_members(raw, members))
+            return;
+        for (auto &member : members)
+            apply_command(member.first, member.second, false);
+        return;
+    }
+
+    const std::string &device = parts[0];
+    auto &state = command_state_[device];
+    if (parts.size() == 1) {
+        if (!merge)
+            state.clear();
+        if (raw != "null" && json_members(raw, members)) {
+            for (auto &member : members)
+                state[member.first] = member.second;
+        }
+    } else if (parts.size() == 2) {
+        if (raw == "null")
+            state.erase(parts[1]);
+        else
+            state[parts[1]] = raw;
+    } else {
+        fprintf(stderr, "upstream: ignoring nested command path %s\n", path.c_str());
+        return;
+    }
+    publish(device);
+}
+
+void upstream::publish(const std::string &device)
+{
+    std::string json = "{";
+    for (auto &field : command_state_[device]) {
+        if (json.size() > 1)
+            json += ',';
+        json += json_quote(field.first) + ":" + field.second;
+    }
+    json += '}';
+    if (sink_)
+        sink_(device, json);
+}
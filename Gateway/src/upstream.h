@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "coalescer.h"
+#include "stats.h"
+
+struct upstream_config {
+    std::string db_url;             // https://<project>-default-rtdb.firebaseio.com, empty for a dry run
+    std::string auth;               // database secret or ID token, optional
+    std::string commands_path;      // streamed, one child per device with its command state
+    int flush_ms = 1000;            // how long writes coalesce before a PATCH
+    size_t max_paths = 1000;        // paths per PATCH
+};
+
+// Firebase side of the gateway. A writer thread flushes the coalescer as
+// multi-path PATCHes over one kept-alive connection, a second thread follows
+// the command path as an event stream and hands changes to the command sink.
+class upstream {
+public:
+    using command_sink = std::function<void(const std::string &device, const std::string &json)>;
+
+    upstream(upstream_config config, coalescer &source, gateway_stats &stats);
+    ~upstream();
+
+    void start(command_sink sink);
+    void stop();
+
+private:
+    void writer_loop();
+    bool patch(const std::string &body);
+    void command_loop();
+    void on_event(const std::string &event, const std::string &data);
+    void apply_command(const std::string &path, const std::string &raw, bool merge);
+    void publish(const std::string &device);
+    std::string url(const std::string &path, const char *query) const;
+
+    static size_t on_stream_data(char *ptr, size_t size, size_t nmemb, void *user);
+    static int on_progress(void *user, long long, long long, long long, long long);
+
+    upstream_config config_;
+    coalescer &source_;
+    gateway_stats &stats_;
+    command_sink sink_;
+
+    std::atomic<bool> stopping_{false};
+    std::mutex wake_lock_;
+    std::condition_variable wake_;
+    std::thread writer_;
+    std::thread commands_;
+
+    // Event stream parser state
+    std::string stream_buf_;
+    std::string event_;
+    std::string data_;
+
+    // Command state per device, field -> raw JSON
+    std::unordered_map<std::string, std::map<std::string, std::string>> command_state_;
+};
@@ -0,0 +1,231 @@
+// Scripted load for the command queue: pushes bursts of button toggles to
+// command_queue/<device>, like a user clicking as fast as they can, then
+// waits for the board to drain the queue. Reports the push rate, how long
+// the board took and whether every field ended where the last command left it.
+//
+//   command_load --db https://<project>-default-rtdb.firebaseio.com --auth <secret>
+//                --device <id> --commands 200 --burst 20 --gap-ms 500
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <vector>
+#include <curl/curl.h>
+
+using steady = std::chrono::steady_clock;
+
+static const char *const FIELDS[] = { "button1", "button2", "button3" };
+static const int FIELD_COUNT = 3;
+
+struct options {
+    std::string db_url;
+    std::string auth;
+    std::string ns;
+    std::string device;
+    int commands = 100;
+    int burst = 10;         // commands pushed back to back
+    int gap_ms = 500;       // pause between bursts
+    int timeout_s = 120;    // for the drain
+};
+
+static size_t append_body(char *ptr, size_t size, size_t nmemb, void *user)
+{
+    static_cast<std::string *>(user)->append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+static std::string url(const options &opt, const std::string &path, const std::string &query)
+{
+    std::vector<std::string> params;
+    if (!query.empty())
+        params.push_back(query);
+    if (!opt.ns.empty())
+        params.push_back("ns=" + opt.ns);
+    if (!opt.auth.empty())
+        params.push_back("auth=" + opt.auth);
+
+    std::string out = opt.db_url + "/" + path + ".json";
+    for (size_t i = 0; i < params.size(); i++)
+        out += (i == 0 ? '?' : '&') + params[i];
+    return out;
+}
+
+/* One request on the shared handle, false on a transport error or a non-2xx status */
+static bool request(CURL *curl, const char *method, const std::string &target, const std::string *body,
+                    std::string &response)
+{
+    response.clear();
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, target.c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+    curl_slist *headers = nullptr;
+    if (body != nullptr) {
+        headers = curl_slist_append(nullptr, "Content-Type: application/json");
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(body->size()));
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_body);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 30000L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    long status = 0;
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_slist_free_all(headers);
+    if (res != CURLE_OK || status < 200 || status >= 300) {
+        fprintf(stderr, "command_load: %s %s failed, %s, status %ld\n", method, target.c_str(),
+                curl_easy_strerror(res), status);
+        return false;
+    }
+    return true;
+}
+
+static int64_t wall_ms()
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s --db URL --device ID [options]\n"
+            "  --db URL          database root, e.g. https://<project>-default-rtdb.firebaseio.com\n"
+            "  --auth TOKEN      database secret or ID token\n"
+            "  --ns NAME         emulator namespace, usually the project ID\n"
+            "  --device ID       board to command, its MAC as in fleet/\n"
+            "  --commands N      commands in total (default 100)\n"
+            "  --burst N         commands pushed back to back (default 10)\n"
+            "  --gap-ms N        pause between bursts (default 500)\n"
+            "  --timeout-s N     how long the board gets to drain the queue (default 120)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    static const option long_options[] = {
+        { "db", required_argument, nullptr, 'd' },
+        { "auth", required_argument, nullptr, 'a' },
+        { "ns", required_argument, nullptr, 'n' },
+        { "device", required_argument, nullptr, 'i' },
+        { "commands", required_argument, nullptr, 'c' },
+        { "burst", required_argument, nullptr, 'b' },
+        { "gap-ms", required_argument, nullptr, 'g' },
+        { "timeout-s", required_argument, nullptr, 't' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (c) {
+        case 'd': opt.db_url = optarg; break;
+        case 'a': opt.auth = optarg; break;
+        case 'n': opt.ns = optarg; break;
+        case 'i': opt.device = optarg; break;
+        case 'c': opt.commands = atoi(optarg); break;
+        case 'b': opt.burst = atoi(optarg); break;
+        case 'g': opt.gap_ms = atoi(optarg); break;
+        case 't': opt.timeout_s = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    while (!opt.db_url.empty() && opt.db_url.back() == '/')
+        opt.db_url.pop_back();
+    if (opt.db_url.empty() || opt.device.empty() || opt.commands <= 0 || opt.burst <= 0 || opt.gap_ms < 0 ||
+        opt.timeout_s <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    CURL *curl = curl_easy_init();
+    std::string response;
+    const std::string queue = "command_queue/" + opt.device;
+    const std::string marker_path = "commands/" + opt.device + "/command_queue";
+
+    // Round robin over the fields, each one toggling, so folding any two
+    // commands together shows up as a wrong final value
+    int last_value[FIELD_COUNT] = { -1, -1, -1 };
+    int pushed = 0;
+    double push_s = 0;
+    auto start = steady::now();
+    while (pushed < opt.commands) {
+        auto burst_start = steady::now();
+        for (int i = 0; i < opt.burst && pushed < opt.commands; i++, pushed++) {
+            int field = pushed % FIELD_COUNT;
+            int value = (pushed / FIELD_COUNT) % 2 == 0 ? 1 : 0;
+            std::string body = std::string("{\"field\":\"") + FIELDS[field] + "\",\"value\":" + std::to_string(value) +
+                               ",\"version\":{\".sv\":\"timestamp\"},\"seq\":" + std::to_string(pushed + 1) +
+                               ",\"sent_at\":" + std::to_string(wall_ms()) + "}";
+            if (!request(curl, "POST", url(opt, queue, ""), &body, response)) {
+                curl_easy_cleanup(curl);
+                curl_global_cleanup();
+                return 1;
+            }
+            last_value[field] = value;
+        }
+        // The board reads the queue when its version poll sees the marker move
+        std::string marker = "{\"version\":{\".sv\":\"timestamp\"}}";
+        if (!request(curl, "PUT", url(opt, marker_path, ""), &marker, response)) {
+            curl_easy_cleanup(curl);
+            curl_global_cleanup();
+            return 1;
+        }
+        push_s += std::chrono::duration<double>(steady::now() - burst_start).count();
+        if (pushed < opt.commands)
+            std::this_thread::sleep_for(std::chrono::milliseconds(opt.gap_ms));
+    }
+    double pushed_at = std::chrono::duration<double>(steady::now() - start).count();
+    printf("pushed %d commands in %.2f s, %.0f/s within bursts\n", pushed, pushed_at, pushed / push_s);
+
+    // The queue is drained when its node is gone
+    bool drained = false;
+    auto deadline = steady::now() + std::chrono::seconds(opt.timeout_s);
+    while (steady::now() < deadline) {
+        if (request(curl, "GET", url(opt, queue, "shallow=true"), nullptr, response) && response == "null") {
+            drained = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    double drained_at = std::chrono::duration<double>(steady::now() - start).count();
+    if (!drained) {
+        fprintf(stderr, "command_load: queue not drained after %d s\n", opt.timeout_s);
+        curl_easy_cleanup(curl);
+        curl_global_cleanup();
+        return 1;
+    }
+    printf("drained %.2f s after the first push, %.2f s after the last, %.1f commands/s overall\n", drained_at,
+           drained_at - pushed_at, pushed / drained_at);
+
+    // Each field is reported where the last command for it left it
+    int status = 0;
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (last_value[field] < 0)
+            continue;
+        std::string path = "devices/" + opt.device + "/reported/" + FIELDS[field] + "/value";
+        if (!request(curl, "GET", url(opt, path, ""), nullptr, response)) {
+            status = 1;
+            continue;
+        }
+        bool ok = atoi(response.c_str()) == last_value[field] && response != "null";
+        printf("%s: reported %s, expected %d%s\n", FIELDS[field], response.c_str(), last_value[field],
+               ok ? "" : " MISMATCH");
+        if (!ok)
+            status = 1;
+    }
+
+    curl_easy_cleanup(curl);
+    curl_global_cleanup();
+    return status;
+}
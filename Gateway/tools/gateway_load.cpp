@@ -0,0 +1,219 @@
+// Load generator for the edge gateway: simulates boards sending telemetry and
+// measures the gateway's CPU use, giving how many boards one core can serve.
+//
+//   edge_gateway --stats-s 0 &
+//   gateway_load --devices 2000 --rate 1 --duration 20 --pid $!
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gateway_frame.h"
+#include "telemetry_cbor.h"
+
+using steady = std::chrono::steady_clock;
+
+struct device {
+    int fd;
+    uint8_t id[GATEWAY_DEVICE_ID_LEN];
+    uint32_t sent;
+};
+
+/* utime + stime of a process in seconds, -1 if it can't be read */
+static double process_cpu_seconds(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == nullptr)
+        return -1;
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // Fields after the command name, which may hold spaces
+    const char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p == nullptr || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static int build_frame(uint8_t *frame, const device &dev, bool tcp)
+{
+    uint8_t *out = tcp ? frame + 2 : frame;
+    int len = gateway_frame_header(out, GATEWAY_MSG_TELEMETRY, dev.id);
+
+    // Alternate between the DHT and BH1750 samples a board sends
+    if (dev.sent % 2 == 0) {
+        telemetry_reading_t readings[] = {
+            { TELEMETRY_CH_TEMPERATURE, 2000 + static_cast<int32_t>(dev.sent % 100) * 10 },
+            { TELEMETRY_CH_HUMIDITY, 400 + static_cast<int32_t>(dev.sent % 200) },
+        };
+        len += telemetry_cbor_encode(out + len, GATEWAY_FRAME_MAX - len, -1, readings, 2);
+    } else {
+        telemetry_reading_t reading = { TELEMETRY_CH_LIGHT, static_cast<int32_t>(dev.sent % 1000) };
+        len += telemetry_cbor_encode(out + len, GATEWAY_FRAME_MAX - len, -1, &reading, 1);
+    }
+    if (tcp) {
+        frame[0] = len >> 8;
+        frame[1] = len & 0xff;
+        len += 2;
+    }
+    return len;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--host IP] [--port N] [--devices N] [--rate HZ] [--duration S] [--udp] [--pid GATEWAY_PID]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    std::string host = "127.0.0.1";
+    int port = GATEWAY_PORT;
+    int devices = 100;
+    double rate = 1.0;
+    int duration = 10;
+    bool udp = false;
+    int pid = 0;
+
+    static const option options[] = {
+        { "host", required_argument, nullptr, 'H' },
+        { "port", required_argument, nullptr, 'p' },
+        { "devices", required_argument, nullptr, 'n' },
+        { "rate", required_argument, nullptr, 'r' },
+        { "duration", required_argument, nullptr, 'd' },
+        { "udp", no_argument, nullptr, 'u' },
+        { "pid", required_argument, nullptr, 'P' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': devices = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'u': udp = true; break;
+        case 'P': pid = atoi(optarg); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (devices <= 0 || rate <= 0 || duration <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // One socket per board
+    rlimit files {};
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad host %s\n", host.c_str());
+        return 2;
+    }
+
+    std::vector<device> boards(devices);
+    for (int i = 0; i < devices; i++) {
+        device &dev = boards[i];
+        // Locally administered MACs 02:00:00:xx:xx:xx
+        uint8_t id[GATEWAY_DEVICE_ID_LEN] = { 0x02, 0, 0, static_cast<uint8_t>(i >> 16), static_cast<uint8_t>(i >> 8),
+                                              static_cast<uint8_t>(i) };
+        memcpy(dev.id, id, sizeof(id));
+        dev.sent = 0;
+        dev.fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+        if (dev.fd < 0 || connect(dev.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            fprintf(stderr, "board %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        if (!udp) {
+            int one = 1;
+            setsockopt(dev.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            uint8_t hello[2 + GATEWAY_HEADER_LEN];
+            int len = gateway_frame_header(hello + 2, GATEWAY_MSG_HELLO, dev.id);
+            hello[0] = 0;
+            hello[1] = len;
+            if (send(dev.fd, hello, len + 2, MSG_NOSIGNAL) < 0)
+                perror("hello");
+        }
+    }
+
+    double cpu_start = pid ? process_cpu_seconds(pid) : -1;
+    auto start = steady::now();
+    auto end = start + std::chrono::seconds(duration);
+    uint64_t sent = 0, failed = 0, commands_bytes = 0;
+    double per_second = devices * rate;
+    size_t next = 0;
+    auto next_drain = start;
+
+    while (steady::now() < end) {
+        double elapsed = std::chrono::duration<double>(steady::now() - start).count();
+        uint64_t due = static_cast<uint64_t>(elapsed * per_second);
+
+        // Boards take turns so each one sends at the given rate
+        while (sent + failed < due) {
+            device &dev = boards[next];
+            next = (next + 1) % boards.size();
+            uint8_t frame[GATEWAY_FRAME_MAX + 2];
+            int len = build_frame(frame, dev, !udp);
+            if (send(dev.fd, frame, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len)
+                sent++;
+            else
+                failed++;
+            dev.sent++;
+        }
+
+        // Read whatever commands came down so the gateway never blocks on us
+        if (!udp && steady::now() >= next_drain) {
+            uint8_t buf[4096];
+            for (device &dev : boards) {
+                ssize_t n;
+                while ((n = recv(dev.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                    commands_bytes += n;
+            }
+            next_drain = steady::now() + std::chrono::milliseconds(100);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    double wall = std::chrono::duration<double>(steady::now() - start).count();
+    // Let the gateway finish what is in its socket buffers
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    double cpu_end = pid ? process_cpu_seconds(pid) : -1;
+
+    printf("%s, %d boards at %.2f Hz: sent %llu frames (%llu failed) in %.1f s, %.0f frames/s\n",
+           udp ? "udp" : "tcp", devices, rate, (unsigned long long)sent, (unsigned long long)failed, wall, sent / wall);
+    if (cpu_start >= 0 && cpu_end >= 0) {
+        double load = (cpu_end - cpu_start) / (wall + 0.5);
+        printf("gateway cpu %.1f%% of one core, %.0f boards per core at this rate, %.0f frames/s per core\n",
+               100.0 * load, load > 0 ? devices / load : 0.0, load > 0 ? sent / wall / load : 0.0);
+    }
+    if (commands_bytes)
+        printf("received %llu bytes of commands\n", (unsigned long long)commands_bytes);
+
+    for (device &dev : boards)
+        close(dev.fd);
+    return 0;
+}
@@ -0,0 +1,264 @@
+// Compression ratio and encode cost of the Gorilla history blocks
+// (telemetry_gorilla.h) on a recorded sensor trace, per channel.
+//
+//   curl '<db>/history/<device>.json' > trace.json
+//   gorilla_bench --history trace.json
+//
+// Without --history it runs on a synthetic 1 Hz DHT/BH1750 trace.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <getopt.h>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "gateway_frame.h"
+#include "json.h"
+#include "telemetry_gorilla.h"
+#include "telemetry_schema.h"
+
+using steady = std::chrono::steady_clock;
+
+struct sample {
+    int64_t ts_ms;
+    float value;
+};
+
+using trace = std::map<int, std::vector<sample>>;
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int channel_id(const std::string &name)
+{
+    for (int ch = TELEMETRY_KEY_TS + 1; ch < TELEMETRY_CH_MAX; ch++)
+        if (name == telemetry_channel_name(ch))
+            return ch;
+    return -1;
+}
+
+/* history/<device> export: {"yyyymmddhh": {"<ms into the hour>": {"<channel>": value}}} */
+static bool load_history(const char *path, trace &out)
+{
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+
+    std::vector<std::pair<std::string, std::string>> buckets, offsets, channels;
+    if (!in || !json_members(text.str(), buckets))
+        return false;
+    for (auto &bucket : buckets) {
+        struct tm tm {};
+        if (bucket.first.size() != 10 ||
+            sscanf(bucket.first.c_str(), "%4d%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour) != 4)
+            continue;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        int64_t start_ms = static_cast<int64_t>(timegm(&tm)) * 1000;
+
+        offsets.clear();
+        if (!json_members(bucket.second, offsets))
+            continue;
+        for (auto &offset : offsets) {
+            channels.clear();
+            if (!json_members(offset.second, channels))
+                continue;
+            for (auto &channel : channels) {
+                int ch = channel_id(channel.first);
+                if (ch >= 0)
+                    out[ch].push_back({ start_ms + atoll(offset.first.c_str()), strtof(channel.second.c_str(), nullptr) });
+            }
+        }
+    }
+    // Offsets come back sorted as strings, put each channel in time order
+    for (auto &ch : out)
+        std::sort(ch.second.begin(), ch.second.end(),
+                  [](const sample &a, const sample &b) { return a.ts_ms < b.ts_ms; });
+    return !out.empty();
+}
+
+/* 1 Hz samples as the tasks take them: the period stretches by the sensor
+ * read time, DHT values have 0.1 resolution, lux is whole */
+static void synthesize(int hours, trace &out)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> dht_read(4, 30), bh_read(1, 3);
+    std::normal_distribution<float> step(0.0f, 0.03f);
+    std::normal_distribution<float> flicker(0.0f, 20.0f);
+    int64_t start = 1760000000000LL;
+    int64_t t_dht = start, t_bh = start + 137;
+    float temp = 22.0f, hum = 45.0f;
+
+    for (int i = 0; i < hours * 3600; i++) {
+        temp += step(rng);
+        hum += 2 * step(rng);
+        out[TELEMETRY_CH_TEMPERATURE].push_back({ t_dht, std::round(temp * 10) / 10 });
+        out[TELEMETRY_CH_HUMIDITY].push_back({ t_dht, std::round(hum * 10) / 10 });
+        t_dht += 1000 + dht_read(rng);
+
+        double day = 2 * M_PI * (t_bh - start) / 86400000.0;
+        double lux = std::max(0.0, 800 * std::sin(day)) + std::fabs(flicker(rng));
+        out[TELEMETRY_CH_LIGHT].push_back({ t_bh, static_cast<float>(std::round(lux)) });
+        t_bh += 1000 + bh_read(rng);
+    }
+}
+
+/* Bytes of one record in the JSON history PATCH, see sample_store_replay() */
+static size_t json_record_len(const sample &s, int ch)
+{
+    char record[64];
+    return snprintf(record, sizeof(record), ",\"%lld/%s\":%.6g", static_cast<long long>(s.ts_ms % 3600000),
+                    telemetry_channel_name(ch), s.value);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--history EXPORT.json | --hours N] [--block BYTES] [--rounds N]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *history = nullptr;
+    int hours = 24;
+    // A history frame: header, channel, u16 count, then the block
+    int block = GATEWAY_FRAME_MAX - GATEWAY_HEADER_LEN - 3;
+    int rounds = 20;
+
+    static const option options[] = {
+        { "history", required_argument, nullptr, 'h' },
+        { "hours", required_argument, nullptr, 'H' },
+        { "block", required_argument, nullptr, 'b' },
+        { "rounds", required_argument, nullptr, 'r' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+        case 'h': history = optarg; break;
+        case 'H': hours = atoi(optarg); break;
+        case 'b': block = atoi(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (hours <= 0 || block < 16 || rounds <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    trace samples;
+    if (history != nullptr) {
+        if (!load_history(history, samples)) {
+            fprintf(stderr, "no samples in %s\n", history);
+            return 1;
+        }
+    } else {
+        synthesize(hours, samples);
+    }
+
+    printf("%s, %d-byte blocks, raw = 12 bytes/sample (int64 ms + float32)\n",
+           history ? history : "synthetic trace", block);
+    printf("%-16s %8s %6s %9s %8s %7s %7s %9s %9s %9s\n", "channel", "samples", "blocks", "bytes", "bits/smp",
+           "vs raw", "vs json", "enc ns", "enc cyc", "dec ns");
+
+    std::vector<uint8_t> buf(block);
+    for (auto &entry : samples) {
+        int ch = entry.first;
+        const std::vector<sample> &series = entry.second;
+
+        // Split into blocks the way the gateway transport fills frames
+        std::vector<std::vector<uint8_t>> blocks;
+        std::vector<uint16_t> counts;
+        gorilla_encoder_t enc;
+        gorilla_encoder_init(&enc, buf.data(), buf.size());
+        for (const sample &s : series) {
+            if (!gorilla_encode(&enc, s.ts_ms, s.value)) {
+                blocks.emplace_back(buf.begin(), buf.begin() + gorilla_encoder_len(&enc));
+                counts.push_back(enc.count);
+                gorilla_encoder_init(&enc, buf.data(), buf.size());
+                gorilla_encode(&enc, s.ts_ms, s.value);
+            }
+        }
+        blocks.emplace_back(buf.begin(), buf.begin() + gorilla_encoder_len(&enc));
+        counts.push_back(enc.count);
+
+        size_t bytes = 0, json_bytes = 0;
+        for (auto &b : blocks)
+            bytes += b.size() + 3;
+        for (const sample &s : series)
+            json_bytes += json_record_len(s, ch);
+
+        // Everything must come back bit for bit
+        size_t n = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            gorilla_decoder_t dec;
+            gorilla_decoder_init(&dec, blocks[i].data(), blocks[i].size(), counts[i]);
+            int64_t ts;
+            float value;
+            while (gorilla_decode(&dec, &ts, &value)) {
+                if (ts != series[n].ts_ms || memcmp(&value, &series[n].value, sizeof(value)) != 0) {
+                    fprintf(stderr, "%s: sample %zu does not round-trip\n", telemetry_channel_name(ch), n);
+                    return 1;
+                }
+                n++;
+            }
+        }
+        if (n != series.size()) {
+            fprintf(stderr, "%s: decoded %zu of %zu samples\n", telemetry_channel_name(ch), n, series.size());
+            return 1;
+        }
+
+        // Timing over repeated runs, best round counts
+        double enc_ns = 1e18, dec_ns = 1e18, enc_cycles = 1e18;
+        for (int r = 0; r < rounds; r++) {
+            auto t0 = steady::now();
+            uint64_t c0 = cycles();
+            gorilla_encoder_init(&enc, buf.data(), buf.size());
+            for (const sample &s : series) {
+                if (!gorilla_encode(&enc, s.ts_ms, s.value)) {
+                    gorilla_encoder_init(&enc, buf.data(), buf.size());
+                    gorilla_encode(&enc, s.ts_ms, s.value);
+                }
+            }
+            uint64_t c1 = cycles();
+            auto t1 = steady::now();
+            enc_ns = std::min(enc_ns, std::chrono::duration<double, std::nano>(t1 - t0).count() / series.size());
+            enc_cycles = std::min(enc_cycles, static_cast<double>(c1 - c0) / series.size());
+
+            t0 = steady::now();
+            for (size_t i = 0; i < blocks.size(); i++) {
+                gorilla_decoder_t dec;
+                gorilla_decoder_init(&dec, blocks[i].data(), blocks[i].size(), counts[i]);
+                int64_t ts;
+                float value;
+                while (gorilla_decode(&dec, &ts, &value))
+                    ;
+            }
+            t1 = steady::now();
+            dec_ns = std::min(dec_ns, std::chrono::duration<double, std::nano>(t1 - t0).count() / series.size());
+        }
+
+        printf("%-16s %8zu %6zu %9zu %8.2f %6.1fx %6.1fx %9.1f %9.0f %9.1f\n", telemetry_channel_name(ch),
+               series.size(), blocks.size(), bytes, 8.0 * bytes / series.size(), 12.0 * series.size() / bytes,
+               static_cast<double>(json_bytes) / bytes, enc_ns, enc_cycles, dec_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,366 @@
+// Host build of the firmware's metrics registry (telemetry_metrics.h), with
+// a local scraper for the Prometheus text it serves.
+//
+//   metrics_host                       increment cost, then one exposition
+//   metrics_host --serve 9100 &        /metrics on a port, values moving
+//   metrics_host --scrape http://127.0.0.1:9100/metrics
+//   metrics_host --scrape http://esp-<id>.local/metrics
+//
+// --scrape checks the exposition the way a scraper reads it: every sample
+// belongs to a declared family, label sets parse, histogram buckets are
+// cumulative and +Inf equals _count. Exits 1 on the first problem.
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <curl/curl.h>
+
+#include "telemetry_metrics.h"
+
+using steady = std::chrono::steady_clock;
+
+// The same shapes as the board's, see board_metrics.c
+static metric_t requests[] = {
+    METRIC_COUNTER("http_requests_total", "Database requests by outcome", "outcome=\"ok\""),
+    METRIC_COUNTER("http_requests_total", "Database requests by outcome", "outcome=\"transport_error\""),
+};
+METRIC_HISTOGRAM_DEFINE(request_ms, "http_request_duration_milliseconds", "Database request time", nullptr,
+                        50, 100, 200, 500, 1000, 2000, 5000);
+static metric_t depth = METRIC_GAUGE("net_sched_queue_depth", "Requests waiting", "class=\"telemetry\"");
+static int32_t uptime_s()
+{
+    static const auto start = steady::now();
+    return static_cast<int32_t>(std::chrono::duration_cast<std::chrono::seconds>(steady::now() - start).count());
+}
+static metric_t uptime = METRIC_GAUGE_FN("uptime_seconds", "Time since start", nullptr, uptime_s);
+
+static int append_text(void *ctx, const char *text, size_t len)
+{
+    static_cast<std::string *>(ctx)->append(text, len);
+    return 0;
+}
+
+static std::string exposition()
+{
+    std::string out;
+    metrics_render(append_text, &out);
+    return out;
+}
+
+/* ns per call of op over n calls on each of threads threads, all at once */
+template <typename Op>
+static double bench(int threads, long n, Op op)
+{
+    std::vector<std::thread> workers;
+    auto start = steady::now();
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back([&]() {
+            for (long i = 0; i < n; i++)
+                op(i);
+        });
+    for (auto &w : workers)
+        w.join();
+    return std::chrono::duration<double, std::nano>(steady::now() - start).count() / n;
+}
+
+static void run_bench(long n)
+{
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    if (cores < 1)
+        cores = 1;
+    printf("%-28s %8s %12s\n", "operation", "threads", "ns per op");
+    for (int threads : { 1, cores }) {
+        printf("%-28s %8d %12.2f\n", "metric_inc", threads, bench(threads, n, [](long) { metric_inc(&requests[0]); }));
+        printf("%-28s %8d %12.2f\n", "metric_observe", threads,
+               bench(threads, n, [](long i) { metric_observe(&request_ms, static_cast<uint32_t>(i % 3000)); }));
+        if (cores == 1)
+            break;
+    }
+    std::string text = exposition();
+    auto start = steady::now();
+    for (int i = 0; i < 1000; i++)
+        text = exposition();
+    printf("%-28s %8d %12.0f (%zu bytes)\n\n", "metrics_render", 1,
+           std::chrono::duration<double, std::nano>(steady::now() - start).count() / 1000, text.size());
+    fputs(text.c_str(), stdout);
+}
+
+static int serve(int port, int duration_s)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        perror("metrics_host: listen");
+        return 1;
+    }
+    printf("serving http://127.0.0.1:%d/metrics for %d s\n", port, duration_s);
+    fflush(stdout);
+
+    // Something to watch move between scrapes
+    std::atomic<bool> stop{false};
+    std::thread load([&]() {
+        for (uint32_t i = 0; !stop; i++) {
+            metric_inc(&requests[i % 50 == 0 ? 1 : 0]);
+            metric_observe(&request_ms, 40 + (i * 7919) % 900);
+            metric_set(&depth, static_cast<int32_t>(i % 8));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    auto deadline = steady::now() + std::chrono::seconds(duration_s);
+    while (steady::now() < deadline) {
+        timeval tv = { 1, 0 };
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (select(fd + 1, &fds, nullptr, nullptr, &tv) <= 0)
+            continue;
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        // One request per connection, the request itself isn't looked at
+        char request[1024];
+        if (recv(client, request, sizeof(request), 0) > 0) {
+            std::string body = exposition();
+            std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                   std::to_string(body.size()) + "\r\n\r\n" + body;
+            send(client, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+        close(client);
+    }
+    stop = true;
+    load.join();
+    close(fd);
+    return 0;
+}
+
+static size_t append_body(char *ptr, size_t size, size_t nmemb, void *user)
+{
+    static_cast<std::string *>(user)->append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+static bool valid_name(const std::string &name)
+{
+    if (name.empty() || !(isalpha(name[0]) || name[0] == '_' || name[0] == ':'))
+        return false;
+    for (char c : name)
+        if (!(isalnum(c) || c == '_' || c == ':'))
+            return false;
+    return true;
+}
+
+/* name{k="v",...} value, the labels into a map */
+static bool parse_sample(const std::string &line, std::string &name, std::map<std::string, std::string> &labels,
+                         double &value)
+{
+    size_t i = 0;
+    while (i < line.size() && line[i] != '{' && line[i] != ' ')
+        i++;
+    name = line.substr(0, i);
+    labels.clear();
+    if (i < line.size() && line[i] == '{') {
+        i++;
+        while (i < line.size() && line[i] != '}') {
+            size_t eq = line.find("=\"", i);
+            if (eq == std::string::npos)
+                return false;
+            std::string key = line.substr(i, eq - i);
+            size_t end = eq + 2;
+            std::string val;
+            while (end < line.size() && line[end] != '"') {
+                if (line[end] == '\\' && end + 1 < line.size())
+                    end++;
+                val += line[end++];
+            }
+            if (end >= line.size() || !valid_name(key))
+                return false;
+            labels[key] = val;
+            i = end + 1;
+            if (i < line.size() && line[i] == ',')
+                i++;
+        }
+        if (i >= line.size())
+            return false;
+        i++;
+    }
+    if (i >= line.size() || line[i] != ' ')
+        return false;
+    std::string text = line.substr(i + 1);
+    char *end = nullptr;
+    value = strtod(text.c_str(), &end);
+    return valid_name(name) && end != text.c_str() && (*end == '\0' || *end == ' ');
+}
+
+static int scrape(const std::string &url)
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    CURL *curl = curl_easy_init();
+    std::string body;
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_body);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 10000L);
+    long status = 0;
+    auto start = steady::now();
+    CURLcode res = curl_easy_perform(curl);
+    double ms = std::chrono::duration<double, std::milli>(steady::now() - start).count();
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_cleanup(curl);
+    curl_global_cleanup();
+    if (res != CURLE_OK || status != 200) {
+        fprintf(stderr, "metrics_host: GET %s failed, %s, status %ld\n", url.c_str(), curl_easy_strerror(res), status);
+        return 1;
+    }
+
+    std::map<std::string, std::string> types;  // family -> type
+    // Per histogram series (name + labels without le): last cumulative count and +Inf
+    std::map<std::string, double> last_bucket, inf_bucket, counts;
+    int samples = 0, line_no = 0;
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t nl = body.find('\n', pos);
+        std::string line = body.substr(pos, nl == std::string::npos ? std::string::npos : nl - pos);
+        pos = nl == std::string::npos ? body.size() : nl + 1;
+        line_no++;
+        if (line.empty() || line.compare(0, 7, "# HELP ") == 0)
+            continue;
+        if (line.compare(0, 7, "# TYPE ") == 0) {
+            size_t sp = line.find(' ', 7);
+            if (sp == std::string::npos) {
+                fprintf(stderr, "line %d: bad TYPE: %s\n", line_no, line.c_str());
+                return 1;
+            }
+            types[line.substr(7, sp - 7)] = line.substr(sp + 1);
+            continue;
+        }
+        if (line[0] == '#')
+            continue;
+
+        std::string name;
+        std::map<std::string, std::string> labels;
+        double value;
+        if (!parse_sample(line, name, labels, value)) {
+            fprintf(stderr, "line %d: not a sample: %s\n", line_no, line.c_str());
+            return 1;
+        }
+        samples++;
+
+        // The family a sample belongs to, histogram series carry a suffix
+        std::string family = name, suffix;
+        for (const char *s : { "_bucket", "_sum", "_count" }) {
+            size_t n = strlen(s);
+            if (name.size() > n && name.compare(name.size() - n, n, s) == 0 &&
+                types.count(name.substr(0, name.size() - n)) && types[name.substr(0, name.size() - n)] == "histogram") {
+                family = name.substr(0, name.size() - n);
+                suffix = s;
+            }
+        }
+        if (!types.count(family)) {
+            fprintf(stderr, "line %d: %s has no TYPE\n", line_no, name.c_str());
+            return 1;
+        }
+        if (types[family] == "counter" && value < 0) {
+            fprintf(stderr, "line %d: negative counter %s\n", line_no, line.c_str());
+            return 1;
+        }
+        if (types[family] != "histogram")
+            continue;
+
+        std::string le = labels.count("le") ? labels["le"] : "";
+        labels.erase("le");
+        std::string series = family;
+        for (const auto &l : labels)
+            series += "," + l.first + "=" + l.second;
+        if (suffix == "_bucket") {
+            if (le.empty() || (last_bucket.count(series) && value < last_bucket[series])) {
+                fprintf(stderr, "line %d: buckets not cumulative: %s\n", line_no, line.c_str());
+                return 1;
+            }
+            last_bucket[series] = value;
+            if (le == "+Inf")
+                inf_bucket[series] = value;
+        } else if (suffix == "_count") {
+            counts[series] = value;
+        }
+    }
+    for (const auto &c : counts) {
+        if (!inf_bucket.count(c.first) || inf_bucket[c.first] != c.second) {
+            fprintf(stderr, "%s: +Inf bucket doesn't match _count\n", c.first.c_str());
+            return 1;
+        }
+    }
+    printf("%s: %zu bytes in %.1f ms, %zu families, %d samples, %zu histograms, valid\n", url.c_str(), body.size(), ms,
+           types.size(), samples, counts.size());
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --iterations N   increments per benchmark and thread (default 10000000)\n"
+            "  --serve PORT     serve /metrics on 127.0.0.1:PORT\n"
+            "  --duration-s N   how long to serve (default 60)\n"
+            "  --scrape URL     fetch and check an exposition, e.g. http://esp-<id>.local/metrics\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = 10000000;
+    int port = 0, duration_s = 60;
+    std::string scrape_url;
+    static const option options[] = {
+        { "iterations", required_argument, nullptr, 'i' },
+        { "serve", required_argument, nullptr, 's' },
+        { "duration-s", required_argument, nullptr, 'd' },
+        { "scrape", required_argument, nullptr, 'c' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+        case 'i': iterations = atol(optarg); break;
+        case 's': port = atoi(optarg); break;
+        case 'd': duration_s = atoi(optarg); break;
+        case 'c': scrape_url = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (iterations <= 0 || port < 0 || duration_s <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!scrape_url.empty())
+        return scrape(scrape_url);
+
+    for (auto &m : requests)
+        metrics_register(&m);
+    metrics_register(&request_ms);
+    metrics_register(&depth);
+    metrics_register(&uptime);
+    if (port > 0)
+        return serve(port, duration_s);
+    run_bench(iterations);
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Data access for the dashboard. Views subscribe to the nodes they show and
+// get child_added/child_changed deltas, never a whole subtree again. Every
+// delivered update is measured: bytes on the wire, snapshot bytes handed to
+// the view and time spent rendering it. Open the page with ?stats to see the
+// numbers, or call DataLayer.report() from the console.
+
+const DataLayer = (() => {
+  const stats = {
+    updates: 0,
+    snapshotBytes: 0,   // JSON size of the values delivered to views
+    renderMs: [],       // per update, last RENDER_SAMPLES kept
+  };
+  const RENDER_SAMPLES = 500;
+
+  // Wire bytes come from wire_stats.js, which has to load before the SDK.
+  // Loaded late, or with the SDK on long polling, it counts nothing.
+  const wireBytes = () => (typeof WireStats === 'undefined' ? 0 : WireStats.bytes());
+  const WIRE_CHECK_UPDATES = 5;
+  let wireChecked = false;
+  const checkWire = () => {
+    wireChecked = true;
+    if (wireBytes() === 0) {
+      console.warn('DataLayer: no database bytes counted after ' + stats.updates + ' updates. ' +
+        'Load wire_stats.js before the Firebase SDK scripts; wire numbers read 0 until then.');
+    }
+  };
+
+  const measure = (key, value, render) => {
+    const start = performance.now();
+    render(key, value);
+    const took = performance.now() - start;
+    stats.updates++;
+    stats.snapshotBytes += key.length + (value === null ? 4 : JSON.stringify(value).length);
+    stats.renderMs.push(took);
+    if (stats.renderMs.length > RENDER_SAMPLES) {
+      stats.renderMs.shift();
+    }
+    if (!wireChecked && stats.updates >= WIRE_CHECK_UPDATES) {
+      checkWire();
+    }
+    if (overlay) {
+      scheduleOverlay();
+    }
+  };
+
+  // A group of subscriptions dropped together, e.g. everything for one board
+  const scope = () => {
+    const offs = [];
+    return {
+      // render(key, value) per child as it appears, changes or goes (null)
+      children: (path, render) => {
+        const ref = firebase.database().ref(path);
+        const onChild = (snap) => measure(snap.key, snap.val(), render);
+        const onRemoved = (snap) => measure(snap.key, null, render);
+        ref.on('child_added', onChild);
+        ref.on('child_changed', onChild);
+        ref.on('child_removed', onRemoved);
+        offs.push(() => {
+          ref.off('child_added', onChild);
+          ref.off('child_changed', onChild);
+          ref.off('child_removed', onRemoved);
+        });
+      },
+      // render(key, value) for a single leaf node
+      value: (path, render) => {
+        const ref = firebase.database().ref(path);
+        const onValue = (snap) => measure(snap.key, snap.val(), render);
+        ref.on('value', onValue);
+        offs.push(() => ref.off('value', onValue));
+      },
+      off: () => {
+        offs.forEach((off) => off());
+        offs.length = 0;
+      },
+    };
+  };
+
+  const percentile = (values, p) => {
+    if (!values.length) {
+      return 0;
+    }
+    const sorted = [...values].sort((a, b) => a - b);
+    return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+  };
+
+  const summary = () => ({
+    updates: stats.updates,
+    wireBytes: wireBytes(),
+    wireBytesPerUpdate: stats.updates ? Math.round(wireBytes() / stats.updates) : 0,
+    snapshotBytesPerUpdate: stats.updates ? Math.round(stats.snapshotBytes / stats.updates) : 0,
+    renderP50Ms: +percentile(stats.renderMs, 0.5).toFixed(3),
+    renderP99Ms: +percentile(stats.renderMs, 0.99).toFixed(3),
+  });
+
+  const report = () => {
+    console.table(summary());
+    return summary();
+  };
+
+  const reset = () => {
+    stats.updates = 0;
+    if (typeof WireStats !== 'undefined') {
+      WireStats.reset();
+    }
+    stats.snapshotBytes = 0;
+    stats.renderMs = [];
+  };
+
+  // Optional on-page readout, refreshed at most once a frame
+  let overlay = null;
+  let overlayPending = false;
+  const scheduleOverlay = () => {
+    if (overlayPending) {
+      return;
+    }
+    overlayPending = true;
+    requestAnimationFrame(() => {
+      overlayPending = false;
+      const s = summary();
+      overlay.textContent = `updates ${s.updates} | wire ${s.wireBytes} B (${s.wireBytesPerUpdate}/update) | ` +
+        `snapshot ${s.snapshotBytesPerUpdate} B/update | render p50 ${s.renderP50Ms} ms, p99 ${s.renderP99Ms} ms`;
+    });
+  };
+  const showOverlay = () => {
+    overlay = document.createElement('div');
+    overlay.className = 'data-stats';
+    document.body.appendChild(overlay);
+    scheduleOverlay();
+  };
+  if (new URLSearchParams(location.search).has('stats')) {
+    if (document.readyState === 'loading') {
+      document.addEventListener('DOMContentLoaded', showOverlay);
+    } else {
+      showOverlay();
+    }
+  }
+
+  return { scope, report, reset, summary };
+})();
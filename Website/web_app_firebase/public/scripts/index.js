@@ -19,28 +19,145 @@ const btn2Off = document.getElementById('btn2Off');
 const btn3On = document.getElementById('btn3On');
 const btn3Off = document.getElementById('btn3Off');
 
-// Database path for GPIO states
-var dbPathOutput1 = 'button_state/button1';
-var dbPathOutput2 = 'button_state/button2';
-var dbPathOutput3 = 'button_state/button3';
-// var dbPathTemp = 'sensor_data/temperature';
-// var dbPathHum = 'sensor_data/humidity';
-// var dbPathPres = 'Light_data/light_intensity';
+// Board selection
+const deviceSelect = document.getElementById('device-select');
 
-// Database references
-var dbRefOutput1 = firebase.database().ref().child(dbPathOutput1);
-var dbRefOutput2 = firebase.database().ref().child(dbPathOutput2);
-var dbRefOutput3 = firebase.database().ref().child(dbPathOutput3);
+// Every board writes under devices/<id>, reads its buttons from commands/<id>
+// and registers in fleet/<id>. The buttons are a shadow: commands/<id> is the
+// desired state, devices/<id>/reported what the board has applied. Fields in
+// both are { value, version }, the version being the server time of the write.
+// Clicks don't overwrite the desired state, they are pushed to
+// command_queue/<id> and the board applies them in order, so quick toggles
+// all reach the pins. Boards on a push transport (gateway, MQTT) don't read
+// the queue, for them a click sets the desired state. Only the selected board's nodes on screen are
+// subscribed, as child deltas, so what a dashboard downloads doesn't grow with
+// the fleet or with what else the board writes.
+var deviceScope = null;
 
-// Firebase Realtime Database paths for sensors
-// var dbPathTemp = firebase.database().ref().child(dbPathTemp);
-// var dbPathHum  = firebase.database().ref().child(dbPathHum);
-// var dbPathPres = firebase.database().ref().child(dbPathPres);
-var dbRefTemp = firebase.database().ref('sensor_data/temperature');
-var dbRefHum  = firebase.database().ref('sensor_data/humidity');
-var dbRefPres = firebase.database().ref('Light_data/light_intensity');
+const stateElements = { button1: stateElement1, button2: stateElement2, button3: stateElement3 };
+const readingElements = {
+  temperature: [tempElement, '°C'],
+  humidity: [humElement, '%'],
+  light_intensity: [presElement, 'lux'],
+};
+
+// Per field, the desired and reported { value, version }
+let shadow = {};
+// Commands the board hasn't taken yet, push ID -> { field, value }
+let queued = new Map();
+
+// Shows the reported state, marked while the board hasn't caught up
+const renderShadow = (key) => {
+  const element = stateElements[key];
+  const field = shadow[key];
+  if (!element || !field) {
+    return;
+  }
+  const { desired, reported } = field;
+  const state = reported ? (reported.value == 1 ? "ON" : "OFF") : "?";
+  // Push IDs sort by time, the last queued command for the field wins
+  const waiting = [...queued.values()].filter((command) => command.field === key);
+  const target = waiting.length ? waiting[waiting.length - 1]
+    : desired && (!reported || reported.version < desired.version) ? desired : null;
+  const more = waiting.length > 1 ? ` (${waiting.length} queued)` : '';
+  element.innerText = target ? `${state} → ${target.value == 1 ? "ON" : "OFF"}${more}` : state;
+};
+
+const shadowHalf = (half) => (key, value) => {
+  shadow[key] = shadow[key] || {};
+  shadow[key][half] = value && typeof value === 'object' ? value : null;
+  renderShadow(key);
+};
+
+const queuedCommand = (key, value) => {
+  const field = (queued.get(key) || value || {}).field;
+  if (value) {
+    queued.set(key, value);
+  } else {
+    queued.delete(key);
+  }
+  if (field) {
+    shadow[field] = shadow[field] || {};
+    renderShadow(field);
+  }
+};
+
+const renderReading = (key, value) => {
+  const reading = readingElements[key];
+  if (reading) {
+    reading[0].innerText = value !== null ? `${parseFloat(value).toFixed(2)} ${reading[1]}` : 'N/A';
+  }
+};
+
+const watchDevice = (id) => {
+  // Drop the previous board's listeners
+  if (deviceScope) {
+    deviceScope.off();
+    deviceScope = null;
+  }
+  if (!id) {
+    return;
+  }
+  localStorage.setItem('device', id);
+
+  deviceScope = DataLayer.scope();
+  shadow = {};
+  queued = new Map();
+  deviceScope.children(`commands/${id}`, shadowHalf('desired'));
+  deviceScope.children(`devices/${id}/reported`, shadowHalf('reported'));
+  deviceScope.children(`command_queue/${id}`, queuedCommand);
+  deviceScope.children(`devices/${id}/sensor_data`, renderReading);
+  deviceScope.children(`devices/${id}/Light_data`, renderReading);
+  deviceScope.value(`devices/${id}/command_ack`, (key, ack) => CommandLatency.ack(ack));
+  CommandLatency.reset();
+
+  // Queue a command upon button click, stamped for the latency histogram
+  const transport = deviceSelect.selectedOptions[0] ? deviceSelect.selectedOptions[0].dataset.transport : 'rest';
+  const command = (button, value) => {
+    const write = { value, version: firebase.database.ServerValue.TIMESTAMP, ...CommandLatency.stamp() };
+    if (transport && transport !== 'rest') {
+      return firebase.database().ref(`commands/${id}/${button}`).set(write);
+    }
+    // The marker next to the desired fields is what the board's version poll
+    // sees, it reads the queue only when the marker moved
+    const key = firebase.database().ref(`command_queue/${id}`).push().key;
+    return firebase.database().ref().update({
+      [`command_queue/${id}/${key}`]: { field: button, ...write },
+      [`commands/${id}/command_queue/version`]: firebase.database.ServerValue.TIMESTAMP,
+    });
+  };
+  btn1On.onclick = () => command('button1', 1);
+  btn1Off.onclick = () => command('button1', 0);
+  btn2On.onclick = () => command('button2', 1);
+  btn2Off.onclick = () => command('button2', 0);
+  btn3On.onclick = () => command('button3', 1);
+  btn3Off.onclick = () => command('button3', 0);
+};
 
+// Fill the board list from the fleet index, read once rather than followed
+const loadFleet = () => {
+  return firebase.database().ref('fleet').orderByChild('last_seen').once('value').then(snap => {
+    deviceSelect.innerHTML = '';
+    snap.forEach(child => {
+      const entry = child.val() || {};
+      const seen = entry.last_seen ? new Date(entry.last_seen).toLocaleString() : 'never';
+      const option = document.createElement('option');
+      option.value = child.key;
+      option.dataset.transport = entry.transport || '';
+      option.text = `${child.key} (${entry.transport || '?'}, seen ${seen})`;
+      deviceSelect.prepend(option);  // most recently seen first
+    });
+    const saved = localStorage.getItem('device');
+    if (saved && deviceSelect.querySelector(`option[value="${saved}"]`)) {
+      deviceSelect.value = saved;
+    } else if (deviceSelect.options.length) {
+      deviceSelect.selectedIndex = 0;
+    }
+    watchDevice(deviceSelect.value);
+  });
+};
 
+deviceSelect.onchange = () => watchDevice(deviceSelect.value);
 
 // MANAGE LOGIN/LOGOUT UI
 const setupUI = (user) => {
@@ -55,79 +172,12 @@ const setupUI = (user) => {
     var uid = user.uid;
     console.log(uid);
 
-    //Update states depending on the database value
-    dbRefOutput1.on('value', snap => {
-        if(snap.val()==1) {
-            stateElement1.innerText="ON";
-        }
-        else{
-            stateElement1.innerText="OFF";
-        }
-    });
-    dbRefOutput2.on('value', snap => {
-        if(snap.val()==1) {
-            stateElement2.innerText="ON";
-        }
-        else{
-            stateElement2.innerText="OFF";
-        }
-    });
-    dbRefOutput3.on('value', snap => {
-        if(snap.val()==1) {
-            stateElement3.innerText="ON";
-        }
-        else{
-            stateElement3.innerText="OFF";
-        }
-    });
-
-    // Update database upon button click
-    btn1On.onclick = () => dbRefOutput1.set(1);
-    btn1Off.onclick = () => dbRefOutput1.set(0);
-    btn2On.onclick = () => dbRefOutput2.set(1);
-    btn2Off.onclick = () => dbRefOutput2.set(0);
-    btn3On.onclick = () => dbRefOutput3.set(1);
-    btn3Off.onclick = () => dbRefOutput3.set(0);
-
-    // Update sensor values from Firebase
-    dbRefTemp.on('value', snap => {
-        const tempData = snap.val();
-        console.log("Temperature data:", tempData); 
-        if (tempData !== null) {
-          // tempElement.innerText = `${tempData} °C`;
-          tempElement.innerText = `${parseFloat(tempData).toFixed(2)} °C`;
-        } else {
-          tempElement.innerText = 'N/A';
-          // console.error("Temperature data is null or undefined.");
-        }
-      });
-  
-      dbRefHum.on('value', snap => {
-        const humData = snap.val();
-        console.log("Humidity data:", humData); // Debugging
-        if (humData !== null) {
-          // humElement.innerText = `${humData} %`;
-          humElement.innerText = `${parseFloat(humData).toFixed(2)} %`;
-        } else {
-          humElement.innerText = 'N/A';
-          // console.error("Humidity data is null or undefined.");
-        }
-      });
-  
-      dbRefPres.on('value', snap => {
-        const presData = snap.val();
-        console.log("Pressure data:", presData); // Debugging
-        if (presData !== null) {
-          // presElement.innerText = `${presData} hPa`;
-          presElement.innerText = `${parseFloat(presData).toFixed(2)} lux`;
-        } else {
-          presElement.innerText = 'N/A';
-          // console.error("Pressure data is null or undefined.");
-        }
-      });
+    // Subscribe to the selected board
+    loadFleet();
   // if user is logged out
   } else {
     // toggle UI elements
+    watchDevice(null);
     loginElement.style.display = 'block';
     authBarElement.style.display = 'none';
     userDetailsElement.style.display = 'none';
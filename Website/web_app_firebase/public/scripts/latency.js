@@ -0,0 +1,127 @@
+// Command latency, from the button click to the board setting its GPIOs.
+// Every command is stamped with a seq and the browser's sent_at. The board
+// writes back devices/<id>/command_ack with its own applied_at. Each acked
+// command gives two numbers:
+//  - apply: applied_at - sent_at, one way, across the browser and board clocks
+//    (both NTP synced, good to a few tens of ms)
+//  - round trip: click to the ack showing up here, on the browser clock alone
+// The last WINDOW commands make the histogram. CommandLatency.report() prints
+// the same numbers to the console, for comparing transports.
+
+const CommandLatency = (() => {
+  const WINDOW = 100;
+  const LOST_AFTER_MS = 30000;
+  const BUCKETS_MS = [100, 200, 500, 1000, 2000, 5000, Infinity];
+
+  // Random start so two open dashboards don't reuse each other's seqs
+  let seq = Math.floor(Math.random() * 0x7fffffff);
+  const pending = new Map(); // seq -> { sentAt, clickMs }
+  let samples = [];          // { apply, roundTrip, transport }
+  let lost = 0;
+
+  const histogramElement = document.getElementById('latency-histogram');
+  const summaryElement = document.getElementById('latency-summary');
+
+  const percentile = (values, p) => {
+    if (!values.length) {
+      return null;
+    }
+    const sorted = [...values].sort((a, b) => a - b);
+    return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+  };
+
+  // Pending commands with no ack in time are counted as lost
+  const expire = () => {
+    const now = performance.now();
+    pending.forEach((entry, key) => {
+      if (now - entry.clickMs > LOST_AFTER_MS) {
+        pending.delete(key);
+        lost++;
+      }
+    });
+  };
+
+  // Fields to write along with a command
+  const stamp = () => {
+    expire();
+    seq = (seq + 1) % 0x100000000;
+    const sentAt = Date.now();
+    pending.set(seq, { sentAt, clickMs: performance.now() });
+    return { seq, sent_at: sentAt };
+  };
+
+  // A command_ack snapshot, acks of commands from elsewhere are ignored
+  const ack = (value) => {
+    const entry = value && pending.get(value.seq);
+    if (!entry || entry.sentAt !== value.sent_at || !Number.isFinite(value.applied_at)) {
+      return;
+    }
+    pending.delete(value.seq);
+    samples.push({
+      apply: value.applied_at - value.sent_at,
+      roundTrip: performance.now() - entry.clickMs,
+      transport: value.transport,
+    });
+    if (samples.length > WINDOW) {
+      samples.shift();
+    }
+    render();
+  };
+
+  const summary = () => {
+    const apply = samples.map((s) => s.apply);
+    const roundTrip = samples.map((s) => s.roundTrip);
+    return {
+      commands: samples.length,
+      lost,
+      transport: samples.length ? samples[samples.length - 1].transport : null,
+      applyP50Ms: percentile(apply, 0.5),
+      applyP90Ms: percentile(apply, 0.9),
+      applyP99Ms: percentile(apply, 0.99),
+      roundTripP50Ms: Math.round(percentile(roundTrip, 0.5)),
+      roundTripP99Ms: Math.round(percentile(roundTrip, 0.99)),
+    };
+  };
+
+  const render = () => {
+    if (!histogramElement || !summaryElement) {
+      return;
+    }
+    const counts = BUCKETS_MS.map(() => 0);
+    samples.forEach((s) => {
+      counts[BUCKETS_MS.findIndex((limit) => s.apply < limit)]++;
+    });
+    const most = Math.max(1, ...counts);
+    histogramElement.innerHTML = '';
+    BUCKETS_MS.forEach((limit, i) => {
+      const row = document.createElement('div');
+      row.className = 'latency-row';
+      const label = limit === Infinity ? `≥ ${BUCKETS_MS[i - 1]} ms` : `< ${limit} ms`;
+      row.innerHTML = `<span class="latency-label">${label}</span>` +
+        `<span class="latency-bar" style="width: ${(70 * counts[i]) / most}%"></span>` +
+        `<span class="latency-count">${counts[i]}</span>`;
+      histogramElement.appendChild(row);
+    });
+
+    const s = summary();
+    summaryElement.innerText = s.commands
+      ? `p50 ${s.applyP50Ms} ms, p90 ${s.applyP90Ms} ms, p99 ${s.applyP99Ms} ms over ${s.commands} commands ` +
+        `(round trip p50 ${s.roundTripP50Ms} ms, via ${s.transport}, ${lost} lost)`
+      : 'No commands acknowledged yet';
+  };
+
+  const report = () => {
+    console.table(summary());
+    return summary();
+  };
+
+  // New board, new numbers
+  const reset = () => {
+    pending.clear();
+    samples = [];
+    lost = 0;
+    render();
+  };
+
+  return { stamp, ack, summary, report, reset };
+})();
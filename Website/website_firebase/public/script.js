@@ -17,10 +17,12 @@ const firebaseConfig = {
 	var database = firebase.database();
 	var Led1Status;
   
-	// Fetch data from Firebase in real-time
-	database.ref().on("value", function (snap) {
-	  // Handle LED status
-	  Led1Status = snap.val().Led1Status;
+	// Only the two nodes on screen are followed, not the whole database
+	var scope = DataLayer.scope();
+
+	// Handle LED status
+	scope.value("Led1Status", function (key, value) {
+	  Led1Status = value;
 	  if (Led1Status == 1) {
 		document.getElementById("unact").style.display = "none";
 		document.getElementById("act").style.display = "block";
@@ -28,13 +30,15 @@ const firebaseConfig = {
 		document.getElementById("unact").style.display = "block";
 		document.getElementById("act").style.display = "none";
 	  }
-  
-	  // Display temperature and humidity from SENSOR node
-	  var sensorData = snap.val().SENSOR || {};
-	  var temperature = sensorData.temperature || "--";
-	  var humidity = sensorData.humidity || "--";
-	  document.getElementById("temperature").innerText = temperature + " °C";
-	  document.getElementById("humidity").innerText = humidity + " %";
+	});
+
+	// Display temperature and humidity from SENSOR node, one child at a time
+	scope.children("SENSOR", function (key, value) {
+	  if (key === "temperature") {
+		document.getElementById("temperature").innerText = (value || "--") + " °C";
+	  } else if (key === "humidity") {
+		document.getElementById("humidity").innerText = (value || "--") + " %";
+	  }
 	});
   
 	// Toggle LED status on button click
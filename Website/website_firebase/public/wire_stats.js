@@ -0,0 +1,28 @@
+// Bytes received by the database connection, read by DataLayer. The Firebase
+// SDK keeps the WebSocket constructor it finds when its script runs, so this
+// file loads before the SDK's <script> tags, not with the dashboard scripts.
+
+const WireStats = (() => {
+  let received = 0;
+
+  const NativeWebSocket = window.WebSocket;
+  window.WebSocket = function (url, protocols) {
+    const socket = protocols === undefined ? new NativeWebSocket(url) : new NativeWebSocket(url, protocols);
+    socket.addEventListener('message', (event) => {
+      received += typeof event.data === 'string' ? event.data.length : event.data.byteLength || event.data.size || 0;
+    });
+    return socket;
+  };
+  window.WebSocket.prototype = NativeWebSocket.prototype;
+  Object.assign(window.WebSocket, {
+    CONNECTING: NativeWebSocket.CONNECTING,
+    OPEN: NativeWebSocket.OPEN,
+    CLOSING: NativeWebSocket.CLOSING,
+    CLOSED: NativeWebSocket.CLOSED,
+  });
+
+  return {
+    bytes: () => received,
+    reset: () => { received = 0; },
+  };
+})();
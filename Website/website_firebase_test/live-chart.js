@@ -0,0 +1,204 @@
+// Live telemetry chart. Each series keeps its newest points in a fixed-size
+// ring, so an append never copies, sorts or rebuilds anything. Appends made
+// between two frames are drawn once, on the next animation frame. When the
+// view holds more than four points per pixel column, each column is drawn
+// from its first, min, max and last point, so a render costs the same
+// however many samples the series holds.
+
+class LiveSeries {
+  constructor(capacity) {
+    this.times = new Float64Array(capacity);
+    this.values = new Float64Array(capacity);
+    this.start = 0; // ring slot of the oldest point
+    this.length = 0;
+  }
+
+  slot(i) {
+    return (this.start + i) % this.times.length;
+  }
+
+  time(i) {
+    return this.times[this.slot(i)];
+  }
+
+  value(i) {
+    return this.values[this.slot(i)];
+  }
+
+  // First point at or after time t
+  lowerBound(t) {
+    let lo = 0;
+    let hi = this.length;
+    while (lo < hi) {
+      const mid = (lo + hi) >> 1;
+      if (this.time(mid) < t) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  // Points are expected in time order. A point at a time already held
+  // replaces that value, e.g. a rollup minute that gained samples. An older
+  // point at a new time is dropped. Returns whether anything changed.
+  append(t, v) {
+    if (this.length) {
+      const newest = this.slot(this.length - 1);
+      if (t < this.times[newest]) {
+        const i = this.lowerBound(t);
+        if (i < this.length && this.time(i) === t) {
+          this.values[this.slot(i)] = v;
+          return true;
+        }
+        return false;
+      }
+      if (t === this.times[newest]) {
+        this.values[newest] = v;
+        return true;
+      }
+    }
+    const slot = this.slot(this.length);
+    this.times[slot] = t;
+    this.values[slot] = v;
+    if (this.length < this.times.length) {
+      this.length++;
+    } else {
+      this.start = (this.start + 1) % this.times.length;
+    }
+    return true;
+  }
+
+  latest() {
+    return this.length ? { t: this.time(this.length - 1), v: this.value(this.length - 1) } : null;
+  }
+
+  // Chart points between from and to, at most four per pixel column. The
+  // point before the window is kept so the line enters it from the edge.
+  decimate(from, to, columns) {
+    let i = Math.max(0, this.lowerBound(from) - 1);
+    const end = this.lowerBound(to + 1);
+    const points = [];
+    if (end - i <= columns * 4) {
+      for (; i < end; i++) {
+        points.push({ x: this.time(i), y: this.value(i) });
+      }
+      return points;
+    }
+
+    const width = (to - from) / columns;
+    while (i < end) {
+      const column = Math.floor((this.time(i) - from) / width);
+      const columnEnd = from + (column + 1) * width;
+      const first = i;
+      let min = i;
+      let max = i;
+      for (i++; i < end && this.time(i) < columnEnd; i++) {
+        const v = this.value(i);
+        if (v < this.value(min)) min = i;
+        if (v > this.value(max)) max = i;
+      }
+      // In time order, so the line stays continuous between columns
+      const keep = [first, min, max, i - 1].sort((a, b) => a - b);
+      keep.forEach((k, n) => {
+        if (n === 0 || k !== keep[n - 1]) {
+          points.push({ x: this.time(k), y: this.value(k) });
+        }
+      });
+    }
+    return points;
+  }
+}
+
+class LiveChart {
+  // series: [{ label, color }], one ring of capacity points each. The view
+  // shows the last spanMs up to now.
+  constructor(canvas, { series, capacity, spanMs, onRender }) {
+    this.series = series.map(() => new LiveSeries(capacity));
+    this.spanMs = spanMs;
+    this.onRender = onRender;
+    this.frame = 0;
+    this.renderMs = 0;
+    this.destroyed = false;
+
+    this.chart = new Chart(canvas.getContext("2d"), {
+      type: "line",
+      data: {
+        datasets: series.map((s) => ({
+          label: s.label,
+          data: [],
+          borderColor: s.color,
+          borderWidth: 2,
+          pointRadius: 0,
+          spanGaps: true,
+        })),
+      },
+      options: {
+        animation: false,
+        parsing: false,
+        normalized: true,
+        scales: {
+          x: {
+            type: "linear",
+            title: { display: true, text: "Time" },
+            ticks: {
+              maxRotation: 0,
+              callback: (t) => this.formatTime(t),
+            },
+          },
+        },
+      },
+    });
+  }
+
+  formatTime(t) {
+    const date = new Date(t);
+    if (this.spanMs > 86400000) {
+      return date.toLocaleString([], { month: "short", day: "numeric", hour: "2-digit", minute: "2-digit" });
+    }
+    return date.toLocaleTimeString([], { hour: "2-digit", minute: "2-digit" });
+  }
+
+  append(series, t, v) {
+    if (this.series[series].append(t, v)) {
+      this.schedule();
+    }
+  }
+
+  latest(series) {
+    return this.series[series].latest();
+  }
+
+  // Draw on the next frame, however many appends come before it. Reads that
+  // land after the chart was closed are ignored.
+  schedule() {
+    if (!this.frame && !this.destroyed) {
+      this.frame = requestAnimationFrame(() => this.render());
+    }
+  }
+
+  render() {
+    const start = performance.now();
+    this.frame = 0;
+    const to = Date.now();
+    const from = to - this.spanMs;
+    const area = this.chart.chartArea;
+    const columns = Math.max(1, Math.round(area ? area.width : this.chart.width));
+
+    this.series.forEach((series, i) => {
+      this.chart.data.datasets[i].data = series.decimate(from, to, columns);
+    });
+    this.chart.options.scales.x.min = from;
+    this.chart.options.scales.x.max = to;
+    this.chart.update("none");
+    if (this.onRender) {
+      this.onRender(this);
+    }
+    this.renderMs = performance.now() - start;
+  }
+
+  destroy() {
+    cancelAnimationFrame(this.frame);
+    this.frame = 0;
+    this.destroyed = true;
+    this.chart.destroy();
+  }
+}